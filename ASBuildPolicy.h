@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+// Describes how the acceleration structure of a model is built and kept up to date.
+// The policy is chosen per model at load time (see LoadModelFromClass) and is mapped
+// to DXR build flags by the renderer
+enum class ASBuildPolicy : uint32_t {
+	Static = 0,		// Never changes after loading - fast trace + compaction
+	Hero,			// Close-up, high quality geometry - fast trace, skips the compaction copy
+	Deformable,		// Vertices change every frame - fast build, refitted in place
+	Streamed		// Loaded and unloaded at runtime - fast build, minimal memory
+};
+// What happens to the BLAS after its first build
+enum class ASUpdateStrategy : uint32_t {
+	None = 0,		// Built once
+	Refit			// Updated in place (ALLOW_UPDATE + PERFORM_UPDATE), scratch memory is kept alive
+};
+
+// How the geometry of a glTF model is split into BLASes
+enum class BlasGranularity : uint32_t {
+	Model = 0,		// One BLAS for the whole model, node transforms are baked into the geometry descriptors
+	Mesh			// One BLAS per unique mesh, one TLAS instance per node which references a mesh
+};
+
+inline ASUpdateStrategy GetASUpdateStrategy(ASBuildPolicy policy) {
+	return policy == ASBuildPolicy::Deformable ? ASUpdateStrategy::Refit : ASUpdateStrategy::None;
+}
+inline const char* GetASBuildPolicyName(ASBuildPolicy policy) {
+	switch (policy) {
+	case ASBuildPolicy::Static:
+		return "static";
+	case ASBuildPolicy::Hero:
+		return "hero";
+	case ASBuildPolicy::Deformable:
+		return "deformable";
+	case ASBuildPolicy::Streamed:
+		return "streamed";
+	}
+	return "unknown";
+}
+inline const char* GetBlasGranularityName(BlasGranularity granularity) {
+	return granularity == BlasGranularity::Mesh ? "mesh" : "model";
+}
@@ -0,0 +1,19 @@
+#include "Accumulation.h"
+
+namespace accum {
+	Frame Controller::Advance(const State& state) {
+		Frame frame;
+		frame.reset = m_forceReset || (m_hasState && state != m_state);
+		if (frame.reset || !m_hasState) {
+			if (frame.reset)
+				m_resetCount++;
+			m_state = state;
+			m_hasState = true;
+			m_forceReset = false;
+			m_sampleCount = 0;
+		}
+		frame.sampleIndex = m_sampleCount;
+		m_sampleCount++;
+		return frame;
+	}
+}
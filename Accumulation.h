@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+// Progressive accumulation of the path traced image. Every frame adds one sample per pixel to a
+// running average, which restarts once anything the image depends on changed: the camera, the
+// instances, the animation time or the render settings. No D3D dependencies
+namespace accum {
+	// What the image depends on, gathered anew every frame and compared bitwise with the last one
+	class State {
+	public:
+		void Clear() { m_bytes.clear(); }
+		template<typename T>
+		void Add(const T& value) {
+			const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+			m_bytes.insert(m_bytes.end(), bytes, bytes + sizeof(T));
+		}
+		bool operator==(const State& other) const { return m_bytes == other.m_bytes; }
+		bool operator!=(const State& other) const { return m_bytes != other.m_bytes; }
+	private:
+		std::vector<uint8_t> m_bytes;
+	};
+	struct Frame {
+		uint32_t sampleIndex = 0; // Samples in the average before this frame, 0 overwrites it
+		bool reset = false; // The state changed or Reset was called
+	};
+
+	class Controller {
+	public:
+		// Starts a frame, the average restarts when state differs from the one of the last frame
+		Frame Advance(const State& state);
+		// Restarts the average on the next Advance
+		void Reset() { m_forceReset = true; }
+		// Samples per pixel in the image once the frame of the last Advance is done
+		uint32_t GetSampleCount() const { return m_sampleCount; }
+		uint32_t GetResetCount() const { return m_resetCount; }
+	private:
+		State m_state;
+		bool m_hasState = false;
+		bool m_forceReset = false;
+		uint32_t m_sampleCount = 0;
+		uint32_t m_resetCount = 0;
+	};
+
+	// Running average after adding sample as the (sampleIndex + 1)th sample, as RayGen.hlsl blends it
+	template<typename T>
+	T Blend(const T& average, const T& sample, uint32_t sampleIndex) {
+		return sampleIndex == 0 ? sample : average + (sample - average) * (1.f / (sampleIndex + 1));
+	}
+}
@@ -0,0 +1,290 @@
+#include "Animation.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <glm/gtc/quaternion.hpp>
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define ANIM_SIMD 1
+#else
+#define ANIM_SIMD 0
+#endif
+
+namespace anim {
+	void Clip::Finalize() {
+		duration = 0.f;
+		for (auto& sampler : samplers) {
+			if (!sampler.times.empty())
+				duration = std::max(duration, sampler.times.back());
+		}
+		animatedNodes.clear();
+		for (auto& channel : channels) {
+			animatedNodes.push_back(channel.node);
+		}
+		std::sort(animatedNodes.begin(), animatedNodes.end());
+		animatedNodes.erase(std::unique(animatedNodes.begin(), animatedNodes.end()), animatedNodes.end());
+	}
+
+	// Keys around the given time and the normalized position between them, clamped at both ends
+	static void FindKeys(const std::vector<float>& times, float time, uint32_t& k0, uint32_t& k1, float& t, float& dt) {
+		t = 0.f;
+		dt = 0.f;
+		if (times.size() < 2 || time <= times.front()) {
+			k0 = k1 = 0;
+			return;
+		}
+		if (time >= times.back()) {
+			k0 = k1 = static_cast<uint32_t>(times.size() - 1);
+			return;
+		}
+		k1 = static_cast<uint32_t>(std::upper_bound(times.begin(), times.end(), time) - times.begin());
+		k0 = k1 - 1;
+		dt = times[k1] - times[k0];
+		t = dt > 0.f ? (time - times[k0]) / dt : 0.f;
+	}
+	static inline const glm::vec4& KeyValue(const Sampler& sampler, uint32_t key) {
+		return sampler.interpolation == Interpolation::CubicSpline ? sampler.values[3 * key + 1] : sampler.values[key];
+	}
+
+	glm::vec4 SampleReference(const Sampler& sampler, Path path, float time) {
+		if (sampler.times.empty())
+			return path == Path::Rotation ? glm::vec4(0.f, 0.f, 0.f, 1.f) : glm::vec4(0.f);
+		uint32_t k0, k1;
+		float t, dt;
+		FindKeys(sampler.times, time, k0, k1, t, dt);
+		const glm::vec4& v0 = KeyValue(sampler, k0);
+		const glm::vec4& v1 = KeyValue(sampler, k1);
+		if (k0 == k1 || sampler.interpolation == Interpolation::Step)
+			return v0;
+		if (sampler.interpolation == Interpolation::Linear) {
+			if (path == Path::Rotation) {
+				glm::quat q = glm::slerp(glm::quat(v0.w, v0.x, v0.y, v0.z), glm::quat(v1.w, v1.x, v1.y, v1.z), t);
+				q = glm::normalize(q);
+				return glm::vec4(q.x, q.y, q.z, q.w);
+			}
+			return glm::mix(v0, v1, t);
+		}
+		// Hermite spline, tangents are scaled by the key distance
+		float t2 = t * t;
+		float t3 = t2 * t;
+		glm::vec4 outTangent0 = sampler.values[3 * k0 + 2] * dt;
+		glm::vec4 inTangent1 = sampler.values[3 * k1 + 0] * dt;
+		glm::vec4 value = (2.f * t3 - 3.f * t2 + 1.f) * v0 + (t3 - 2.f * t2 + t) * outTangent0 +
+			(-2.f * t3 + 3.f * t2) * v1 + (t3 - t2) * inTangent1;
+		return path == Path::Rotation ? glm::normalize(value) : value;
+	}
+
+#if ANIM_SIMD
+	static inline __m128 Load(const glm::vec4& v) {
+		return _mm_loadu_ps(&v.x);
+	}
+	static inline glm::vec4 Store(__m128 v) {
+		glm::vec4 result;
+		_mm_storeu_ps(&result.x, v);
+		return result;
+	}
+	// Dot product broadcast to all lanes
+	static inline __m128 Dot4(__m128 a, __m128 b) {
+		__m128 m = _mm_mul_ps(a, b);
+		__m128 s = _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_add_ps(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 0, 3, 2)));
+	}
+	static inline __m128 Normalize4(__m128 v) {
+		return _mm_div_ps(v, _mm_sqrt_ps(Dot4(v, v)));
+	}
+#endif
+
+	glm::vec4 Sample(const Sampler& sampler, Path path, float time) {
+#if ANIM_SIMD
+		if (sampler.times.empty())
+			return path == Path::Rotation ? glm::vec4(0.f, 0.f, 0.f, 1.f) : glm::vec4(0.f);
+		uint32_t k0, k1;
+		float t, dt;
+		FindKeys(sampler.times, time, k0, k1, t, dt);
+		if (k0 == k1 || sampler.interpolation == Interpolation::Step)
+			return KeyValue(sampler, k0);
+		__m128 v0 = Load(KeyValue(sampler, k0));
+		__m128 v1 = Load(KeyValue(sampler, k1));
+		if (sampler.interpolation == Interpolation::Linear) {
+			if (path == Path::Rotation) {
+				// Slerp along the shortest path, nlerp when the quaternions are almost equal
+				float d = _mm_cvtss_f32(Dot4(v0, v1));
+				if (d < 0.f) {
+					v1 = _mm_sub_ps(_mm_setzero_ps(), v1);
+					d = -d;
+				}
+				float s0 = 1.f - t;
+				float s1 = t;
+				if (d < 0.9995f) {
+					float theta = std::acos(d);
+					float sinTheta = std::sin(theta);
+					s0 = std::sin((1.f - t) * theta) / sinTheta;
+					s1 = std::sin(t * theta) / sinTheta;
+				}
+				return Store(Normalize4(_mm_add_ps(_mm_mul_ps(v0, _mm_set1_ps(s0)), _mm_mul_ps(v1, _mm_set1_ps(s1)))));
+			}
+			return Store(_mm_add_ps(v0, _mm_mul_ps(_mm_sub_ps(v1, v0), _mm_set1_ps(t))));
+		}
+		float t2 = t * t;
+		float t3 = t2 * t;
+		__m128 outTangent0 = Load(sampler.values[3 * k0 + 2]);
+		__m128 inTangent1 = Load(sampler.values[3 * k1 + 0]);
+		__m128 value = _mm_mul_ps(v0, _mm_set1_ps(2.f * t3 - 3.f * t2 + 1.f));
+		value = _mm_add_ps(value, _mm_mul_ps(outTangent0, _mm_set1_ps((t3 - 2.f * t2 + t) * dt)));
+		value = _mm_add_ps(value, _mm_mul_ps(v1, _mm_set1_ps(-2.f * t3 + 3.f * t2)));
+		value = _mm_add_ps(value, _mm_mul_ps(inTangent1, _mm_set1_ps((t3 - t2) * dt)));
+		return Store(path == Path::Rotation ? Normalize4(value) : value);
+#else
+		return SampleReference(sampler, path, time);
+#endif
+	}
+
+	glm::mat4 ComposeTRS(const NodeTRS& trs) {
+		// T * R * S, written column by column
+		const glm::vec4& q = trs.rotation;
+		float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+		float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+		float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+		glm::mat4 result;
+#if ANIM_SIMD
+		_mm_storeu_ps(&result[0].x, _mm_mul_ps(_mm_setr_ps(1.f - 2.f * (yy + zz), 2.f * (xy + wz), 2.f * (xz - wy), 0.f), _mm_set1_ps(trs.scale.x)));
+		_mm_storeu_ps(&result[1].x, _mm_mul_ps(_mm_setr_ps(2.f * (xy - wz), 1.f - 2.f * (xx + zz), 2.f * (yz + wx), 0.f), _mm_set1_ps(trs.scale.y)));
+		_mm_storeu_ps(&result[2].x, _mm_mul_ps(_mm_setr_ps(2.f * (xz + wy), 2.f * (yz - wx), 1.f - 2.f * (xx + yy), 0.f), _mm_set1_ps(trs.scale.z)));
+#else
+		result[0] = glm::vec4(1.f - 2.f * (yy + zz), 2.f * (xy + wz), 2.f * (xz - wy), 0.f) * trs.scale.x;
+		result[1] = glm::vec4(2.f * (xy - wz), 1.f - 2.f * (xx + zz), 2.f * (yz + wx), 0.f) * trs.scale.y;
+		result[2] = glm::vec4(2.f * (xz + wy), 2.f * (yz - wx), 1.f - 2.f * (xx + yy), 0.f) * trs.scale.z;
+#endif
+		result[3] = glm::vec4(trs.translation.x, trs.translation.y, trs.translation.z, 1.f);
+		return result;
+	}
+
+	static inline void MultiplyMat4(const glm::mat4& a, const glm::mat4& b, glm::mat4& out) {
+#if ANIM_SIMD
+		__m128 a0 = _mm_loadu_ps(&a[0].x);
+		__m128 a1 = _mm_loadu_ps(&a[1].x);
+		__m128 a2 = _mm_loadu_ps(&a[2].x);
+		__m128 a3 = _mm_loadu_ps(&a[3].x);
+		for (int column = 0; column < 4; column++) {
+			__m128 bc = _mm_loadu_ps(&b[column].x);
+			__m128 r = _mm_mul_ps(a0, _mm_shuffle_ps(bc, bc, _MM_SHUFFLE(0, 0, 0, 0)));
+			r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(bc, bc, _MM_SHUFFLE(1, 1, 1, 1))));
+			r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(bc, bc, _MM_SHUFFLE(2, 2, 2, 2))));
+			r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(bc, bc, _MM_SHUFFLE(3, 3, 3, 3))));
+			_mm_storeu_ps(&out[column].x, r);
+		}
+#else
+		out = a * b;
+#endif
+	}
+
+	void Evaluate(Instance& instance) {
+		const Clip& clip = *instance.clip;
+		const skin::NodeHierarchy& hierarchy = *instance.hierarchy;
+		float time = instance.time;
+		if (clip.duration > 0.f) {
+			if (instance.loop) {
+				time = std::fmod(time, clip.duration);
+				if (time < 0.f)
+					time += clip.duration;
+			}
+			else {
+				time = std::min(time, clip.duration);
+			}
+		}
+		instance.pose = instance.restPose;
+		for (const Channel& channel : clip.channels) {
+			if (channel.node >= instance.pose.size())
+				continue;
+			glm::vec4 value = Sample(clip.samplers[channel.sampler], channel.path, time);
+			NodeTRS& trs = instance.pose[channel.node];
+			switch (channel.path) {
+			case Path::Translation:
+				trs.translation = value;
+				break;
+			case Path::Rotation:
+				trs.rotation = value;
+				break;
+			case Path::Scale:
+				trs.scale = value;
+				break;
+			}
+		}
+		// Nodes which are not animated keep their rest transform, which may be a matrix
+		instance.locals = hierarchy.localTransforms;
+		for (uint32_t node : clip.animatedNodes) {
+			if (node < instance.locals.size())
+				instance.locals[node] = ComposeTRS(instance.pose[node]);
+		}
+		instance.globals.resize(instance.locals.size());
+		for (int node : hierarchy.order) {
+			int parent = hierarchy.parents[node];
+			if (parent >= 0)
+				MultiplyMat4(instance.globals[parent], instance.locals[node], instance.globals[node]);
+			else
+				instance.globals[node] = instance.locals[node];
+		}
+	}
+	void EvaluateBatch(Instance* const* instances, size_t count, uint32_t threadCount) {
+		ParallelFor(static_cast<uint32_t>(count), 4, threadCount, [&](uint32_t first, uint32_t last, uint32_t) {
+			for (uint32_t i = first; i < last; i++) {
+				Evaluate(*instances[i]);
+			}
+		});
+	}
+
+	double BenchmarkAnimation(uint32_t nodeCount, uint32_t instanceCount, uint32_t keyCount, uint32_t frames, uint32_t threadCount) {
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<float> unit(-1.f, 1.f);
+		skin::NodeHierarchy hierarchy;
+		hierarchy.parents.resize(nodeCount);
+		hierarchy.localTransforms.assign(nodeCount, glm::mat4(1.f));
+		for (uint32_t i = 0; i < nodeCount; i++) {
+			hierarchy.parents[i] = i == 0 ? -1 : static_cast<int>(rng() % i);
+		}
+		hierarchy.Finalize();
+		// Every node gets animated T, R and S, cycling through the interpolation modes
+		Clip clip;
+		for (uint32_t node = 0; node < nodeCount; node++) {
+			for (uint32_t path = 0; path < 3; path++) {
+				Sampler sampler;
+				sampler.interpolation = static_cast<Interpolation>((node + path) % 3);
+				uint32_t valuesPerKey = sampler.interpolation == Interpolation::CubicSpline ? 3 : 1;
+				for (uint32_t k = 0; k < keyCount; k++) {
+					sampler.times.push_back(k / 30.f);
+					for (uint32_t v = 0; v < valuesPerKey; v++) {
+						glm::vec4 value(unit(rng), unit(rng), unit(rng), unit(rng));
+						if (static_cast<Path>(path) == Path::Rotation)
+							value = glm::normalize(value);
+						sampler.values.push_back(value);
+					}
+				}
+				clip.channels.push_back({ static_cast<uint32_t>(clip.samplers.size()), node, static_cast<Path>(path) });
+				clip.samplers.push_back(sampler);
+			}
+		}
+		clip.Finalize();
+		std::vector<Instance> instances(instanceCount);
+		std::vector<Instance*> instancePointers;
+		for (auto& instance : instances) {
+			instance.clip = &clip;
+			instance.hierarchy = &hierarchy;
+			instance.restPose.resize(nodeCount);
+			instance.time = (unit(rng) + 1.f) * clip.duration;
+			instancePointers.push_back(&instance);
+		}
+		// The first frame allocates the results
+		EvaluateBatch(instancePointers.data(), instancePointers.size(), threadCount);
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t frame = 0; frame < frames; frame++) {
+			for (auto& instance : instances) {
+				instance.time += 1.f / 60.f;
+			}
+			EvaluateBatch(instancePointers.data(), instancePointers.size(), threadCount);
+		}
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		return frames > 0 ? ms / frames : 0.0;
+	}
+}
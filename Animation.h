@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Skinning.h"
+// Playback of glTF node animations (translation, rotation and scale channels).
+// Sampling, TRS composition and the hierarchy walk use SSE where available, many
+// animated hierarchies are evaluated at once on worker threads. No D3D dependencies
+namespace anim {
+	enum class Interpolation : uint32_t {
+		Step = 0,
+		Linear,
+		CubicSpline
+	};
+	enum class Path : uint32_t {
+		Translation = 0,
+		Rotation,
+		Scale
+	};
+	struct Sampler {
+		std::vector<float> times;
+		// One value per key, three (in-tangent, value, out-tangent) for CubicSpline.
+		// Rotations are quaternions (x, y, z, w), translation and scale leave w unused
+		std::vector<glm::vec4> values;
+		Interpolation interpolation = Interpolation::Linear;
+	};
+	struct Channel {
+		uint32_t sampler = 0;
+		uint32_t node = 0;
+		Path path = Path::Translation;
+	};
+	struct Clip {
+		std::string name;
+		std::vector<Sampler> samplers;
+		std::vector<Channel> channels;
+		float duration = 0.f;
+		std::vector<uint32_t> animatedNodes; // Filled by Finalize
+		// Computes the duration and the list of animated nodes
+		void Finalize();
+	};
+	// Local transform of a node, rotation as quaternion (x, y, z, w)
+	struct NodeTRS {
+		glm::vec4 translation = glm::vec4(0.f);
+		glm::vec4 rotation = glm::vec4(0.f, 0.f, 0.f, 1.f);
+		glm::vec4 scale = glm::vec4(1.f);
+	};
+	// Plain glm implementation, the reference for Sample
+	glm::vec4 SampleReference(const Sampler& sampler, Path path, float time);
+	glm::vec4 Sample(const Sampler& sampler, Path path, float time);
+	glm::mat4 ComposeTRS(const NodeTRS& trs);
+
+	// An animated copy of a node hierarchy, the clip and the hierarchy are shared between instances
+	struct Instance {
+		const Clip* clip = nullptr;
+		const skin::NodeHierarchy* hierarchy = nullptr; // Rest pose local transforms and parents
+		std::vector<NodeTRS> restPose; // TRS of every node, only used for the animated ones
+		float time = 0.f;
+		bool loop = true;
+		// Results
+		std::vector<NodeTRS> pose;
+		std::vector<glm::mat4> locals;
+		std::vector<glm::mat4> globals;
+	};
+	void Evaluate(Instance& instance);
+	// Evaluates the instances on worker threads, threadCount = 0 uses all hardware threads
+	void EvaluateBatch(Instance* const* instances, size_t count, uint32_t threadCount = 0);
+
+	// Evaluates instanceCount synthetic hierarchies of nodeCount nodes with animated T, R and S,
+	// returns the average milliseconds per frame
+	double BenchmarkAnimation(uint32_t nodeCount, uint32_t instanceCount, uint32_t keyCount, uint32_t frames, uint32_t threadCount = 0);
+}
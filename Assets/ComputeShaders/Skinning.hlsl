@@ -0,0 +1,33 @@
+// Linear blend skinning of one glTF primitive, CPU reference in Skinning.cpp
+struct SkinningConstants
+{
+    uint vertexCount;
+    uint hasNormals;
+};
+ConstantBuffer<SkinningConstants> constants : register(b0);
+StructuredBuffer<float3> bindPositions : register(t0);
+StructuredBuffer<float3> bindNormals : register(t1);
+StructuredBuffer<uint4> joints : register(t2);
+StructuredBuffer<float4> weights : register(t3);
+StructuredBuffer<float4x4> jointMatrices : register(t4); // column major, like glm
+// Buffers the BLAS and the hit shaders read
+RWStructuredBuffer<float3> positions : register(u0);
+RWStructuredBuffer<float3> normals : register(u1);
+
+[numthreads(64, 1, 1)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+    uint v = DTid.x;
+    if (v >= constants.vertexCount)
+        return;
+    uint4 j = joints[v];
+    float4 w = weights[v];
+    float4x4 skinMatrix = w.x * jointMatrices[j.x] + w.y * jointMatrices[j.y] +
+        w.z * jointMatrices[j.z] + w.w * jointMatrices[j.w];
+    positions[v] = mul(skinMatrix, float4(bindPositions[v], 1.0)).xyz;
+    if (constants.hasNormals)
+    {
+        // No inverse transpose, joints are expected to scale uniformly
+        normals[v] = normalize(mul((float3x3) skinMatrix, bindNormals[v]));
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef ALPHA_TEST_HLSL
+#define ALPHA_TEST_HLSL
+#include "Common.hlsl"
+// Alpha test of glTF MASK materials, shared by the any-hit shaders of all ray types.
+// Returns true if the hit lies on a part of the triangle cut out by the base color alpha
+bool IsAlphaMasked(float2 bary)
+{
+	float3 barycentrics = float3(1.f - bary.x - bary.y, bary.x, bary.y);
+	uint vertId = 3 * PrimitiveIndex();
+	StructuredBuffer<uint> primIndexes = ResourceDescriptorHeap[heapIndexes[COMMON_RESOURCE_OFFSET + InstanceIndex()]];
+	uint primHeapIndex = primIndexes[GeometryIndex()];
+
+	StructuredBuffer<MaterialStruct> MaterialStructs = ResourceDescriptorHeap[primHeapIndex];
+	MaterialStruct material = MaterialStructs[0];
+	if (material.alphaMode != 1) {
+		return false;
+	}
+	float alpha = material.baseColor.a;
+	if (material.baseTextureIndex >= 0) {
+		StructuredBuffer<int> indices = ResourceDescriptorHeap[primHeapIndex + 3 + material.hasNormals + material.hasTangents + material.hasColors + material.hasTexcoords]; // + Material + Transform + Positions + Normals(optional) + Tangents(optional) + Colors(optional) + Texcoords(optional)
+		StructuredBuffer<float2> triTexcoord = ResourceDescriptorHeap[primHeapIndex + 3 + material.hasNormals +
+			material.hasTangents + material.hasColors + material.texCoordIdBase]; // + Material + Transform + Positions + Normals(optional) + Tangents(optional) + Colors(optional) + Texture coords for this prim texture
+		float2 uv = triTexcoord[indices[vertId + 0]] * barycentrics.x +
+			triTexcoord[indices[vertId + 1]] * barycentrics.y +
+			triTexcoord[indices[vertId + 2]] * barycentrics.z;
+		Texture2D baseColorTexture = ResourceDescriptorHeap[material.baseTextureIndex];
+		SamplerState baseColorSampler = SamplerDescriptorHeap[material.baseTextureSamplerIndex];
+		// Most detailed mip, so the cut out shape doesn't change with distance
+		alpha *= baseColorTexture.SampleLevel(baseColorSampler, uv, 0).a;
+	}
+	return alpha < material.alphaCutoff;
+}
+#endif // ALPHA_TEST_HLSL
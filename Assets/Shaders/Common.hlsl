@@ -1,3 +1,5 @@
+#ifndef COMMON_HLSL
+#define COMMON_HLSL
 #include "Random.hlsl"
 // Hit information, aka ray payload
 // This sample only carries a shading color and hit distance.
@@ -6,13 +8,31 @@
 // D3D12_RAYTRACING_SHADER_CONFIG pipeline subobjet.
 #define invPI 0.318309886183f
 #define PI 3.141592653589f
-#define MAX_RECURSION_DEPTH 10
+#define COMMON_RESOURCE_OFFSET 8 // RT output + TLAS + camera + frame index + accumulation + light triangles + light geometries + light instances
+// Instance masks, must match InstanceMask in GameObject.h
+#define INSTANCE_MASK_GEOMETRY 0x01 // regular scene geometry
+#define INSTANCE_MASK_LIGHT_PROXY 0x02 // emissive stand-ins for lights
+#define INSTANCE_MASK_ALL 0xFF
+// Rays which test occlusion must not be blocked by the lights themselves
+#define INSTANCE_MASK_SHADOW_RAY INSTANCE_MASK_GEOMETRY
+// The path tracer loops in RayGen, its closest hit only returns the surface: the albedo and the packed
+// shading normal, or the emitted radiance with HIT_FLAG_EMISSIVE, the light triangle and the instance
+#define HIT_FLAG_EMISSIVE 0x1
+#define ROULETTE_THRESHOLD 0.25f // render::kPathRouletteThreshold, paths with more throughput always survive Russian roulette
+#define HIT_INSTANCE_SHIFT 8 // Instance of emissive hits in the bits of flags above it
+#define NO_LIGHT 0xFFFFFFFF // lights::kNoLight
+// The debug modes only return a color, CreateRaytracingPipeline compiles their shaders with SURFACE_PAYLOAD 0
+#ifndef SURFACE_PAYLOAD
+#define SURFACE_PAYLOAD 1
+#endif
 struct HitInfo
 {
-  float4 colorAndDistance;
-  uint recursionDepth;
-  uint seed;
-  float2 __padding;
+  float4 colorAndDistance; // Negative distance on a miss
+  float2 cone; // Width at the ray origin and spread angle of the ray cone, picks the texture levels. render::kColorHitInfoSize in RenderModes.h
+#if SURFACE_PAYLOAD
+  uint normal; // PackNormal of the world space normal, or the light triangle of emissive hits. render::kHitInfoSize in RenderModes.h
+  uint flags;
+#endif
 };
 
 // Attributes output by the raytracing when hitting a surface,
@@ -61,11 +81,35 @@ struct MaterialStruct {
 };
 struct RenderModeStruct {
 	uint mode;
+	uint maxBounces; // Surfaces along a path, the last one only adds its emission
+	uint accumulatedSamples; // Path tracing samples in the accumulation buffer, 0 restarts the average
+	uint lightInstances; // Entries of the light instance table, 0 turns next event estimation off
+	uint rouletteDepth; // Surfaces before Russian roulette may end a path, maxBounces or more turns it off
+};
+// Next event estimation, lights::GpuTriangle and lights::GpuInstance in Lights.h. Light triangles are
+// in model space, the instance table moves them and picks the instance by power
+struct LightTriangle {
+	float3 p0;
+	float probability; // Alias table over the triangles of the model
+	float3 edge1;
+	uint alias;
+	float3 edge2;
+	float pdf; // Of picking the triangle among the ones of its model
+};
+struct LightInstance {
+	float4 rows[3]; // Object to world
+	uint firstTriangle;
+	uint triangleCount; // 0 if the instance is never picked
+	uint firstGeometry; // NO_LIGHT if hits on the instance report no light
+	float probability; // Alias table over the instances
+	uint alias;
+	float pdf; // Of picking the instance
+	uint2 padding;
 };
 //BINDLESS
 StructuredBuffer<uint> heapIndexes : register(t0, space1);
 ConstantBuffer<RenderModeStruct> renderMode : register(b0, space1);
-// For now render modes
+// For now render modes, Hit.hlsl is compiled into one closest hit shader per mode
 	// 0 - vertex colors
 	// 1 - vertex normals
 	// 2 - base color
@@ -77,4 +121,49 @@ ConstantBuffer<RenderModeStruct> renderMode : register(b0, space1);
 	// 8 - normal map 
 	// 9 - world space normals 
 	// 10 - emissive
-	// 11 - basecolor + shadows
\ No newline at end of file
+	// 11 - basecolor + shadows
+	// 12 - path tracing
+
+// Octahedral encoding, 16 bit per axis
+uint PackNormal(float3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	float2 e = n.z >= 0.f ? n.xy : (1.f - abs(n.yx)) * float2(n.x >= 0.f ? 1.f : -1.f, n.y >= 0.f ? 1.f : -1.f);
+	uint2 q = uint2(round(saturate(e * 0.5f + 0.5f) * 65535.f));
+	return q.x | (q.y << 16);
+}
+float3 UnpackNormal(uint packed)
+{
+	float2 e = float2(packed & 0xFFFF, packed >> 16) / 65535.f * 2.f - 1.f;
+	float3 n = float3(e, 1.f - abs(e.x) - abs(e.y));
+	if (n.z < 0.f)
+		n.xy = (1.f - abs(n.yx)) * float2(n.x >= 0.f ? 1.f : -1.f, n.y >= 0.f ? 1.f : -1.f);
+	return normalize(n);
+}
+// Cosine weighted, so brdf * cos / pdf of a diffuse surface is its albedo
+float3 GetDiffuseReflected(float3 normal, inout uint seed) {
+	float r = sqrt(rand(seed));
+	float phi = 2.f * PI * rand(seed);
+	float3 tangent = normalize(cross(abs(normal.x) > 0.5f ? float3(0.f, 1.f, 0.f) : float3(1.f, 0.f, 0.f), normal));
+	float3 bitangent = cross(normal, tangent);
+	return normalize(tangent * (r * cos(phi)) + bitangent * (r * sin(phi)) + normal * sqrt(max(0.f, 1.f - r * r)));
+}
+float PowerHeuristic(float pdf, float otherPdf) {
+	float sum = pdf * pdf + otherPdf * otherPdf;
+	return sum > 0.f ? pdf * pdf / sum : 0.f;
+}
+float3 LightTransformPoint(LightInstance instance, float3 p) {
+	return float3(dot(instance.rows[0], float4(p, 1.f)), dot(instance.rows[1], float4(p, 1.f)), dot(instance.rows[2], float4(p, 1.f)));
+}
+// World space normal of a light triangle, its length is twice the area
+float3 LightWorldCross(LightInstance instance, LightTriangle light) {
+	float3 edge1 = float3(dot(instance.rows[0].xyz, light.edge1), dot(instance.rows[1].xyz, light.edge1), dot(instance.rows[2].xyz, light.edge1));
+	float3 edge2 = float3(dot(instance.rows[0].xyz, light.edge2), dot(instance.rows[1].xyz, light.edge2), dot(instance.rows[2].xyz, light.edge2));
+	return cross(edge1, edge2);
+}
+// Area density of picking a point on the triangle, lights::PdfArea
+float LightPdfArea(LightInstance instance, LightTriangle light) {
+	float area = 0.5f * length(LightWorldCross(instance, light));
+	return area > 0.f ? instance.pdf * light.pdf / area : 0.f;
+}
+#endif // COMMON_HLSL
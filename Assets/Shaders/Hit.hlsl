@@ -1,25 +1,49 @@
 #include "Common.hlsl"
-#define COMMON_RESOURCE_OFFSET 4 // RT output + TLAS + camera
+#include "AlphaTest.hlsl"
+// Compiled once per render mode, CreateRaytracingPipeline defines RENDER_MODE and the name of the closest
+// hit shader. The mode is a compile time constant, so only the texture fetches it uses are left
+#ifndef RENDER_MODE
+#define RENDER_MODE 0
+#endif
+#ifndef CLOSEST_HIT
+#define CLOSEST_HIT ClosestHit
+#endif
+#define USES_BASE_COLOR (RENDER_MODE == 2 || RENDER_MODE == 11 || RENDER_MODE == 12)
+#define USES_METALLIC_ROUGHNESS (RENDER_MODE == 3 || RENDER_MODE == 4 || RENDER_MODE == 5 || RENDER_MODE == 7)
+#define USES_OCCLUSION (RENDER_MODE == 6 || RENDER_MODE == 7)
+#define USES_NORMAL_MAP (RENDER_MODE == 8)
+#define USES_EMISSIVE (RENDER_MODE == 10 || RENDER_MODE == 12)
 // Shading
 struct ShadowHitInfo
 {
 	bool isHit;
 };
-
-float3 GetDiffuseReflected(float3 normal,inout uint seed) {
-	float3 ray = normalize(float3(rand(seed), rand(seed), rand(seed)) * 2.f - 1.f) ;
-	if (dot(ray, normal) < 0.f) ray *= -1.f;
-	return ray;
+// texlod::TriangleLod in TextureLod.h, one per triangle and texcoord set in the view after the indexes
+struct TriangleLod
+{
+	float3 normal; // Object space, unit length
+	float base; // 0.5 * log2(uv area / area)
+};
+// Ray cone level of detail of a fetch, texlod::TextureLod on the CPU. coneWidth is the width of the cone at the hit,
+// logAreaScale log2 of how much the instance transform scales areas
+float TextureLod(Texture2D tex, TriangleLod triangle, float coneWidth, float logAreaScale)
+{
+	uint width, height, levels;
+	tex.GetDimensions(0, width, height, levels);
+	float cosine = abs(dot(triangle.normal, normalize(ObjectRayDirection())));
+	return triangle.base + 0.5f * log2(float(width) * float(height)) + log2(max(coneWidth, 1e-8f)) -
+		log2(max(cosine, 1e-3f)) - 0.5f * logAreaScale;
 }
+
 [shader("closesthit")] 
-void ClosestHit(inout HitInfo payload, Attributes attrib)
+void CLOSEST_HIT(inout HitInfo payload, Attributes attrib)
 {
 	float3 barycentrics =
 		float3(1.f - attrib.bary.x - attrib.bary.y, attrib.bary.x, attrib.bary.y);
 	// to get the first vertex index, we multiply the ID on 3
 	uint vertId = 3 * PrimitiveIndex();
 	// Get colors from vertex data
-	StructuredBuffer<uint> primIndexes = ResourceDescriptorHeap[heapIndexes[COMMON_RESOURCE_OFFSET + InstanceID()]];
+	StructuredBuffer<uint> primIndexes = ResourceDescriptorHeap[heapIndexes[COMMON_RESOURCE_OFFSET + InstanceIndex()]];
 	uint primHeapIndex = primIndexes[GeometryIndex()];
 
 	float3 hitColor = float3(1.f / 256.f, 1.f / 256.f, 1.f / 256.f) * float(primHeapIndex % 256);
@@ -35,9 +59,13 @@ void ClosestHit(inout HitInfo payload, Attributes attrib)
 	StructuredBuffer<float4> triColor = ResourceDescriptorHeap[primHeapIndex + 3 + material.hasNormals + material.hasTangents]; // + Material + Transform + Positions + Normals(optional) + Tangents(optional)
 
 	StructuredBuffer<int> indices = ResourceDescriptorHeap[primHeapIndex + 3 + material.hasNormals + material.hasTangents + material.hasColors + material.hasTexcoords]; // + Material + Positions + Normals(optional) + Tangents(optional) + Colors(optional) + Texcoords(optional)
-	float mip = RayTCurrent() / 5.f; // NEEDS TO BE REPLACED BY SOME FANCY SMART METHOD
+	StructuredBuffer<TriangleLod> triLods = ResourceDescriptorHeap[primHeapIndex + 4 + material.hasNormals + material.hasTangents + material.hasColors + material.hasTexcoords]; // + Material + Transform + Positions + Normals(optional) + Tangents(optional) + Colors(optional) + Texcoords(optional) + Indexes
+	uint triLod = PrimitiveIndex() * material.hasTexcoords; // Of texcoord set 0, the set of a texture follows
+	// The cone grows along the ray, whose direction isn't normalized for camera rays
+	float coneWidth = payload.cone.x + payload.cone.y * RayTCurrent() * length(WorldRayDirection());
+	float logAreaScale = 2.f / 3.f * log2(abs(determinant((float3x3)ObjectToWorld3x4())));
 	float4 baseColor = float4(0.f, 0.f, 0.f, 0.f);
-	if (material.baseTextureIndex >= 0) {
+	if (USES_BASE_COLOR && material.baseTextureIndex >= 0) {
 		Texture2D baseColorTexture = ResourceDescriptorHeap[material.baseTextureIndex];
 		SamplerState baseColorSampler = SamplerDescriptorHeap[material.baseTextureSamplerIndex];
 		StructuredBuffer<float2> triTexcoord = ResourceDescriptorHeap[primHeapIndex + 3 + material.hasNormals +
@@ -45,21 +73,11 @@ void ClosestHit(inout HitInfo payload, Attributes attrib)
 		float2 uv = triTexcoord[indices[vertId + 0]] * barycentrics.x +
 			triTexcoord[indices[vertId + 1]] * barycentrics.y +
 			triTexcoord[indices[vertId + 2]] * barycentrics.z;
-
-		//uint m, w, h, numLevels;
-		//baseColorTexture.GetDimensions(m, w, h, numLevels);
-
-		//float2 derivX = ddx(uv); 
-		//float2 derivY = ddy(uv);
-		////float mipLevel = float(log2(max(length(ddx(uv)), length(ddy(uv)))));
-		//float delta_max_sqr = max(dot(derivX, derivX), dot(derivY, derivY));
-		//float mip = 0.5 * log2(delta_max_sqr) * float(numLevels);
+		float mip = TextureLod(baseColorTexture, triLods[triLod + material.texCoordIdBase], coneWidth, logAreaScale);
 		baseColor = baseColorTexture.SampleLevel(baseColorSampler, uv, mip) * material.baseColor;
-
-
 	}
 	float2 metallicRoughness = float2(0.f, 0.f);
-	if (material.metallicRoughnessTextureIndex >= 0) {
+	if (USES_METALLIC_ROUGHNESS && material.metallicRoughnessTextureIndex >= 0) {
 		Texture2D metallicRoughnessTexture = ResourceDescriptorHeap[material.metallicRoughnessTextureIndex];
 		SamplerState metallicRoughnessSampler = SamplerDescriptorHeap[material.metallicRoughnessTextureSamplerIndex];
 		StructuredBuffer<float2> triTexcoord = ResourceDescriptorHeap[primHeapIndex + 3 + material.hasNormals +
@@ -67,12 +85,13 @@ void ClosestHit(inout HitInfo payload, Attributes attrib)
 		float2 uv = triTexcoord[indices[vertId + 0]] * barycentrics.x +
 			triTexcoord[indices[vertId + 1]] * barycentrics.y +
 			triTexcoord[indices[vertId + 2]] * barycentrics.z;
+		float mip = TextureLod(metallicRoughnessTexture, triLods[triLod + material.texCoordIdMR], coneWidth, logAreaScale);
 		metallicRoughness = metallicRoughnessTexture.SampleLevel(metallicRoughnessSampler, uv, mip).rg;
 		metallicRoughness.r *= material.metallicFactor;
 		metallicRoughness.g *= material.roughnessFactor;
 	}
 	float occlusion = 0.f;
-	if (material.occlusionTextureIndex >= 0) {
+	if (USES_OCCLUSION && material.occlusionTextureIndex >= 0) {
 		Texture2D occlusionTexture = ResourceDescriptorHeap[material.occlusionTextureIndex];
 		SamplerState occlusionTextureSampler = SamplerDescriptorHeap[material.occlusionTextureSamplerIndex];
 		StructuredBuffer<float2> triTexcoord = ResourceDescriptorHeap[primHeapIndex + 3 + material.hasNormals +
@@ -80,13 +99,14 @@ void ClosestHit(inout HitInfo payload, Attributes attrib)
 		float2 uv = triTexcoord[indices[vertId + 0]] * barycentrics.x +
 			triTexcoord[indices[vertId + 1]] * barycentrics.y +
 			triTexcoord[indices[vertId + 2]] * barycentrics.z;
+		float mip = TextureLod(occlusionTexture, triLods[triLod + material.texCoordIdOcclusion], coneWidth, logAreaScale);
 		occlusion = occlusionTexture.SampleLevel(occlusionTextureSampler, uv, mip).b; // if it is a separate texture will b work? it should, as it is usually 3 same values for RGB
 		// occludedColor = lerp(color, color * <sampled occlusion
 		// texture value>, <occlusion strength>) - from GLTF spec - we will need later for PBR 
 		//material.strengthOcclusion
 	}
 	float3 normal = float3(0.f, 0.f, 0.f);
-	if (material.normalTextureIndex >= 0) {
+	if (USES_NORMAL_MAP && material.normalTextureIndex >= 0) {
 		Texture2D normalTexture = ResourceDescriptorHeap[material.normalTextureIndex];
 		SamplerState normalTextureSamplerIndex = SamplerDescriptorHeap[material.normalTextureSamplerIndex];
 		StructuredBuffer<float2> triTexcoord = ResourceDescriptorHeap[primHeapIndex + 3 + material.hasNormals +
@@ -94,12 +114,13 @@ void ClosestHit(inout HitInfo payload, Attributes attrib)
 		float2 uv = triTexcoord[indices[vertId + 0]] * barycentrics.x +
 			triTexcoord[indices[vertId + 1]] * barycentrics.y +
 			triTexcoord[indices[vertId + 2]] * barycentrics.z;
+		float mip = TextureLod(normalTexture, triLods[triLod + material.texCoordIdNorm], coneWidth, logAreaScale);
 		normal = normalTexture.SampleLevel(normalTextureSamplerIndex, uv, mip);
 		// scaledNormal = normalize((normal * 2.0f - 1.0f) * float3(material.scaleNormal, material.scaleNormal, 1.0f))
 		// scaled - part of GLTF spec
 	}
 	float3 emissive = float3(0.f, 0.f, 0.f);
-	if (material.emissiveTextureIndex >= 0) {
+	if (USES_EMISSIVE && material.emissiveTextureIndex >= 0) {
 		Texture2D emissiveTexture = ResourceDescriptorHeap[material.emissiveTextureIndex];
 		SamplerState emissiveTextureSamplerIndex = SamplerDescriptorHeap[material.emissiveTextureSamplerIndex];
 		StructuredBuffer<float2> triTexcoord = ResourceDescriptorHeap[primHeapIndex + 3 + material.hasNormals +
@@ -107,43 +128,54 @@ void ClosestHit(inout HitInfo payload, Attributes attrib)
 		float2 uv = triTexcoord[indices[vertId + 0]] * barycentrics.x +
 			triTexcoord[indices[vertId + 1]] * barycentrics.y +
 			triTexcoord[indices[vertId + 2]] * barycentrics.z;
+		float mip = TextureLod(emissiveTexture, triLods[triLod + material.texCoordIdEmiss], coneWidth, logAreaScale);
 		emissive = emissiveTexture.SampleLevel(emissiveTextureSamplerIndex, uv, mip) * material.emisiveFactor;
 	}
 
-	if (renderMode.mode == 0) {
+#if RENDER_MODE == 0
+	{
 		// Vertex colors
 		hitColor = float3(float4(triColor[indices[vertId + 0]] * barycentrics.x +
 			triColor[indices[vertId + 1]] * barycentrics.y +
 			triColor[indices[vertId + 2]] * barycentrics.z).xyz);
 	}
-	if (renderMode.mode == 1) {
+#elif RENDER_MODE == 1
+	{
 		//// Model space normals
 		hitColor = (triNormal[indices[vertId + 0]] + 1.f) * 0.5 * barycentrics.x +
 			(triNormal[indices[vertId + 1]] + 1.f) * 0.5 * barycentrics.y +
 			(triNormal[indices[vertId + 2]] + 1.f) * 0.5 * barycentrics.z;
 	}
-	if (renderMode.mode == 2) {
+#elif RENDER_MODE == 2
+	{
 		hitColor = float3(baseColor.xyz);
 	}
-	if (renderMode.mode == 3) {
+#elif RENDER_MODE == 3
+	{
 		hitColor = float3(metallicRoughness.r, metallicRoughness.r, metallicRoughness.r);
 	}
-	if (renderMode.mode == 4) {
+#elif RENDER_MODE == 4
+	{
 		hitColor = float3(metallicRoughness.g, metallicRoughness.g, metallicRoughness.g);
 	}
-	if (renderMode.mode == 5) {
+#elif RENDER_MODE == 5
+	{
 		hitColor = float3(metallicRoughness.rg, 0.f);
 	}
-	if (renderMode.mode == 6) {
-		float3(occlusion, occlusion, occlusion);
+#elif RENDER_MODE == 6
+	{
+		hitColor = float3(occlusion, occlusion, occlusion);
 	}
-	if (renderMode.mode == 7) {
-		float3(metallicRoughness.r, metallicRoughness.g, occlusion);
+#elif RENDER_MODE == 7
+	{
+		hitColor = float3(metallicRoughness.r, metallicRoughness.g, occlusion);
 	}
-	if (renderMode.mode == 8) {
+#elif RENDER_MODE == 8
+	{
 		hitColor = normal;
 	}
-	if (renderMode.mode == 9) {
+#elif RENDER_MODE == 9
+	{
 		// World space normals
 		float3 vertN = triNormal[indices[vertId + 0]] * barycentrics.x +
 			triNormal[indices[vertId + 1]] * barycentrics.y +
@@ -153,10 +185,12 @@ void ClosestHit(inout HitInfo payload, Attributes attrib)
 		float3 transformedNormal = normalize(mul(modelSpaceN, (float3x3)ObjectToWorld3x4()));
 		hitColor = (transformedNormal + 1.f) * 0.5f;
 	}
-	if (renderMode.mode == 10) {
+#elif RENDER_MODE == 10
+	{
 		hitColor = emissive;
 	}
-	if (renderMode.mode == 11) {
+#elif RENDER_MODE == 11
+	{
 		float3 lightPos = float3(0, 2.5, 0);
 		// Find the world - space hit position 
 		float3 worldOriginLight = WorldRayOrigin() + RayTCurrent() * WorldRayDirection();
@@ -173,52 +207,46 @@ void ClosestHit(inout HitInfo payload, Attributes attrib)
 		ShadowHitInfo shadowPayload;
 		shadowPayload.isHit = false; // Trace the ray 
 		RaytracingAccelerationStructure sceneBVH = ResourceDescriptorHeap[heapIndexes[1]];
-		TraceRay(sceneBVH, RAY_FLAG_NONE, 0xFF, 1, 0, 1, ray, shadowPayload);
+		TraceRay(sceneBVH, RAY_FLAG_NONE, INSTANCE_MASK_SHADOW_RAY, 1, 0, 1, ray, shadowPayload);
 		float factor = shadowPayload.isHit ? 0.3 : 1.0;
 		hitColor = baseColor * factor;
 	}
-	if (renderMode.mode == 12) {
+#elif RENDER_MODE == 12
+	{
+		// The surface record for the loop in RayGen, which traces the bounces itself
+		payload.flags = 0;
 		if (length(emissive) > 0.f) {
 			hitColor = baseColor.xyz + emissive;
+			payload.flags = HIT_FLAG_EMISSIVE | (InstanceIndex() << HIT_INSTANCE_SHIFT);
+			// The light triangle, which RayGen needs for the MIS weight and to tell if a shadow ray reached its light
+			payload.normal = NO_LIGHT;
+			if (renderMode.lightInstances > 0) {
+				StructuredBuffer<uint> lightGeometries = ResourceDescriptorHeap[heapIndexes[6]];
+				StructuredBuffer<LightInstance> lightInstances = ResourceDescriptorHeap[heapIndexes[7]];
+				uint firstGeometry = lightInstances[InstanceIndex()].firstGeometry;
+				if (firstGeometry != NO_LIGHT && lightGeometries[firstGeometry + GeometryIndex()] != NO_LIGHT)
+					payload.normal = lightGeometries[firstGeometry + GeometryIndex()] + PrimitiveIndex();
+			}
 		}
 		else {
-			// Intersection
-			float3 rayHitPos = WorldRayOrigin() + RayTCurrent() * WorldRayDirection();
 			// World space normal
 			float3 vertN = triNormal[indices[vertId + 0]] * barycentrics.x +
 				triNormal[indices[vertId + 1]] * barycentrics.y +
 				triNormal[indices[vertId + 2]] * barycentrics.z;
 			float3 modelSpaceN = mul(vertN, (float3x3)transform);
-			float3x3 upperLeft3x3ObjectToWorld = (float3x3)ObjectToWorld3x4();
 			float3 transformedNormal = normalize(mul(modelSpaceN, (float3x3)ObjectToWorld3x4()));
-
-			// New Direction
-			float3 newDir = GetDiffuseReflected(transformedNormal, payload.seed);
-			// New Ray
-			RayDesc ray;
-			ray.Origin = rayHitPos;
-			ray.Direction = newDir;
-			ray.TMin = 0.01;
-			ray.TMax = 100000;
-			// Random Walk
-			HitInfo newPayload;
-			newPayload.colorAndDistance = float4(0, 0, 0, 0);
-			// Update Recursion Depth
-			newPayload.recursionDepth = payload.recursionDepth + 1;
-			if (newPayload.recursionDepth >= MAX_RECURSION_DEPTH - 1) {
-				newPayload.colorAndDistance = float4(0, 0, 0, 0);
-			}
-			else {
-				newPayload.seed = payload.seed;
-				RaytracingAccelerationStructure sceneBVH = ResourceDescriptorHeap[heapIndexes[1]];
-				TraceRay(sceneBVH, RAY_FLAG_NONE, 0xFF, 0, 0, 0, ray, newPayload);
-			}
-			// BRDF
-			float3 albedo = baseColor.xyz + emissive;
-			float3 brdf = albedo * invPI;
-			hitColor = brdf * 2.f * PI * dot(newDir, transformedNormal) * newPayload.colorAndDistance.xyz;
-
+			payload.normal = PackNormal(transformedNormal);
+			hitColor = baseColor.xyz;
 		}
 	}
+#endif
 	payload.colorAndDistance = float4(hitColor, RayTCurrent());
+}
+// Only invoked for non-opaque (alphaMode MASK) geometry, opaque geometry skips it in traversal
+[shader("anyhit")]
+void AlphaTestAnyHit(inout HitInfo payload, Attributes attrib)
+{
+	if (IsAlphaMasked(attrib.bary)) {
+		IgnoreHit();
+	}
 }
\ No newline at end of file
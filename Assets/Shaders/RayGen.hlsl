@@ -7,6 +7,126 @@ struct CamStruct {
 	float4x4 projectionInv;
 };
 
+#if SURFACE_PAYLOAD
+// Next event estimation: a shadow ray towards a point on a light picked by power, lights::SampleLight and
+// pt::SampleDirectLight on the CPU. It goes through the closest hit, which returns the emission of the point,
+// and only counts if it reaches the sampled triangle. Weighted against the bounces with the power heuristic.
+// cone is the ray cone of the path at the surface, for the level of the emissive texture
+float3 SampleDirectLight(RaytracingAccelerationStructure sceneBVH, float3 position, float3 normal, float3 albedo, float2 cone, inout uint seed) {
+	StructuredBuffer<LightTriangle> lightTriangles = ResourceDescriptorHeap[heapIndexes[5]];
+	StructuredBuffer<LightInstance> lightInstances = ResourceDescriptorHeap[heapIndexes[7]];
+	float u[6];
+	for (uint i = 0; i < 6; i++) {
+		u[i] = rand(seed);
+	}
+	// Instance, then triangle, then a uniform point on it
+	uint entry = min(uint(u[0] * renderMode.lightInstances), renderMode.lightInstances - 1);
+	uint instanceIndex = u[1] < lightInstances[entry].probability ? entry : lightInstances[entry].alias;
+	LightInstance instance = lightInstances[instanceIndex];
+	if (instance.triangleCount == 0)
+		return float3(0, 0, 0);
+	entry = instance.firstTriangle + min(uint(u[2] * instance.triangleCount), instance.triangleCount - 1);
+	uint lightIndex = instance.firstTriangle + (u[3] < lightTriangles[entry].probability ? entry - instance.firstTriangle : lightTriangles[entry].alias);
+	LightTriangle light = lightTriangles[lightIndex];
+	float su = sqrt(u[4]);
+	float3 lightPosition = LightTransformPoint(instance, light.p0 + (1.f - su) * light.edge1 + u[5] * su * light.edge2);
+	float3 lightCross = LightWorldCross(instance, light);
+	float pdfArea = LightPdfArea(instance, light);
+	if (pdfArea <= 0.f)
+		return float3(0, 0, 0);
+	float3 toLight = lightPosition - position;
+	float distance = length(toLight);
+	float3 direction = toLight / distance;
+	float cosSurface = dot(normal, direction);
+	float cosLight = abs(dot(normalize(lightCross), direction));
+	if (cosSurface <= 0.f || cosLight <= 0.f)
+		return float3(0, 0, 0);
+	RayDesc ray;
+	ray.Origin = position;
+	ray.Direction = direction;
+	ray.TMin = 0.01;
+	ray.TMax = distance * 1.01f;
+	HitInfo payload;
+	payload.colorAndDistance = float4(0, 0, 0, 0);
+	payload.normal = NO_LIGHT;
+	payload.flags = 0;
+	payload.cone = cone;
+	TraceRay(sceneBVH, RAY_FLAG_NONE, INSTANCE_MASK_ALL, 0, 0, 0, ray, payload);
+	// Anything but the sampled triangle in between occludes it
+	if (payload.colorAndDistance.w < 0.f || (payload.flags & HIT_FLAG_EMISSIVE) == 0 || payload.normal != lightIndex ||
+		(payload.flags >> HIT_INSTANCE_SHIFT) != instanceIndex)
+		return float3(0, 0, 0);
+	float lightPdf = pdfArea * distance * distance / cosLight;
+	float bsdfPdf = cosSurface * invPI;
+	return albedo * invPI * cosSurface * payload.colorAndDistance.rgb * (PowerHeuristic(lightPdf, bsdfPdf) / lightPdf);
+}
+
+// Render mode 12. The bounces are traced here instead of from the closest hit shader, so the path
+// length doesn't depend on the recursion depth of the pipeline. pt::TracePath in PathTracer.h is its CPU reference.
+// The ray cone grows along the whole path and keeps the spread of the camera, the lobe of a diffuse bounce
+// would blur every texture down to its coarsest level
+float3 TracePath(RaytracingAccelerationStructure sceneBVH, RayDesc ray, float spread, inout uint seed) {
+	StructuredBuffer<LightTriangle> lightTriangles = ResourceDescriptorHeap[heapIndexes[5]];
+	StructuredBuffer<LightInstance> lightInstances = ResourceDescriptorHeap[heapIndexes[7]];
+	float3 radiance = float3(0, 0, 0);
+	float3 throughput = float3(1, 1, 1);
+	float bsdfPdf = 0.f; // Of the last bounce, 0 for camera rays which no light sample can reach
+	float2 cone = float2(0.f, spread);
+	for (uint bounce = 0; bounce < renderMode.maxBounces; bounce++) {
+		HitInfo payload;
+		payload.colorAndDistance = float4(0, 0, 0, 0);
+		payload.normal = NO_LIGHT;
+		payload.flags = 0;
+		payload.cone = cone;
+		// Light proxies stay visible, bounces which hit them are weighted against the light samples
+		TraceRay(sceneBVH, RAY_FLAG_NONE, INSTANCE_MASK_ALL, 0, 0, 0, ray, payload);
+		if (payload.colorAndDistance.w < 0.f) {
+			radiance += throughput * payload.colorAndDistance.rgb;
+			break;
+		}
+		if ((payload.flags & HIT_FLAG_EMISSIVE) != 0) {
+			float weight = 1.f;
+			if (renderMode.lightInstances > 0 && bsdfPdf > 0.f && payload.normal != NO_LIGHT) {
+				LightInstance instance = lightInstances[payload.flags >> HIT_INSTANCE_SHIFT];
+				LightTriangle light = lightTriangles[payload.normal];
+				float cosLight = abs(dot(normalize(LightWorldCross(instance, light)), ray.Direction));
+				float distance = payload.colorAndDistance.w;
+				float lightPdf = cosLight > 0.f ? LightPdfArea(instance, light) * distance * distance / cosLight : 0.f;
+				weight = PowerHeuristic(bsdfPdf, lightPdf);
+			}
+			radiance += throughput * payload.colorAndDistance.rgb * weight;
+			break;
+		}
+		// The last surface only adds its emission
+		if (bounce + 1 >= renderMode.maxBounces)
+			break;
+		float3 normal = UnpackNormal(payload.normal);
+		float3 position = ray.Origin + payload.colorAndDistance.w * ray.Direction;
+		float3 albedo = payload.colorAndDistance.rgb;
+		// The distance is in lengths of the direction, which camera rays don't normalize
+		cone.x += cone.y * payload.colorAndDistance.w * length(ray.Direction);
+		if (renderMode.lightInstances > 0)
+			radiance += throughput * SampleDirectLight(sceneBVH, position, normal, albedo, cone, seed);
+		float3 newDir = GetDiffuseReflected(normal, seed);
+		// Diffuse BRDF with cosine weighted directions
+		throughput *= albedo;
+		bsdfPdf = dot(newDir, normal) * invPI;
+		// Russian roulette, dim paths end early and the survivors carry their weight
+		if (bounce + 1 >= renderMode.rouletteDepth) {
+			float survival = min(1.f, max(throughput.r, max(throughput.g, throughput.b)) / ROULETTE_THRESHOLD);
+			if (rand(seed) >= survival)
+				break;
+			throughput /= survival;
+		}
+		ray.Origin = position;
+		ray.Direction = newDir;
+		ray.TMin = 0.01;
+		ray.TMax = 100000;
+	}
+	return radiance;
+}
+#endif
+
 [shader("raygeneration")] 
 void RayGen() {
 	// Initialize the ray payload (data that is retrieved ffrom a single ray)
@@ -33,16 +153,33 @@ void RayGen() {
 	ray.Direction = mul(camBuffer.viewInv, float4(target.xyz, 0));
 	ray.TMin = 0;
 	ray.TMax = 100000;
+	// Angle to the ray through the center of the pixel below, the spread of the ray cones. texlod::SpreadAngle on the CPU
+	float4 belowTarget = mul(camBuffer.projectionInv, float4(d.x, -(d.y + 2.f / dims.y), 1, 1));
+	float3 below = mul(camBuffer.viewInv, float4(belowTarget.xyz, 0)).xyz;
+	float spread = atan2(length(cross(ray.Direction, below)), dot(ray.Direction, below));
+	payload.cone = float2(0.f, spread);
 
 	// Seeding
 	StructuredBuffer<uint> frameIndexBuffer = ResourceDescriptorHeap[heapIndexes[3]];
-	uint frameIndex = frameIndexBuffer[0]; // can be used for more random pos
+	uint frameIndex = frameIndexBuffer[0];
 	uint2 dimentions = DispatchRaysDimensions().xy;
 	uint pixelID = dimentions.x * DispatchRaysIndex().y + DispatchRaysIndex().x;
-	uint seed = GetWangHashSeed(pixelID * 3 + 1);
-	payload.seed = seed;
+	// A new sequence every frame, so the accumulated samples are independent. pt::PixelSeed on the CPU
+	uint seed = GetWangHashSeed(pixelID * 3 + 1 + frameIndex * 0x9E3779B9);
+#if SURFACE_PAYLOAD
+	if (renderMode.mode == 12) {
+		// Running average of the frames since the last reset, accum::Blend on the CPU
+		RWTexture2D<float4> gAccumulation = ResourceDescriptorHeap[heapIndexes[4]];
+		float3 radiance = TracePath(sceneBVH, ray, spread, seed);
+		if (renderMode.accumulatedSamples > 0)
+			radiance = lerp(gAccumulation[launchIndex].rgb, radiance, 1.f / (renderMode.accumulatedSamples + 1));
+		gAccumulation[launchIndex] = float4(radiance, 1.f);
+		gOutput[launchIndex] = float4(radiance, 1.f);
+		return;
+	}
+#endif
 	// Trace the ray description
-	TraceRay(sceneBVH,RAY_FLAG_NONE,0xFF, 0, 0, 0, ray, payload);
+	TraceRay(sceneBVH,RAY_FLAG_NONE,INSTANCE_MASK_ALL, 0, 0, 0, ray, payload);
 	// We output the data from the ray's payload
 	gOutput[launchIndex] = float4(payload.colorAndDistance.rgb, 1.f);
 }
@@ -1,18 +1,23 @@
+#include "AlphaTest.hlsl"
 struct ShadowHitInfo
 {
 	bool isHit;
 };
-struct Attributes
-{
-	float2 uv;
-};
 [shader("closesthit")]
 void ShadowClosestHit(inout ShadowHitInfo hit, Attributes bary)
 {
 	hit.isHit = true;
 }
+// Lets shadow rays pass through the cut out parts of alpha masked geometry
+[shader("anyhit")]
+void ShadowAnyHit(inout ShadowHitInfo hit, Attributes bary)
+{
+	if (IsAlphaMasked(bary.bary)) {
+		IgnoreHit();
+	}
+}
 [shader("miss")]
 void ShadowMiss(inout ShadowHitInfo hit : SV_RayPayload)
 {
 	hit.isHit = false;
-}
\ No newline at end of file
+}
@@ -0,0 +1,406 @@
+#include "Bvh.h"
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+namespace bvh {
+	void Mesh::GetTriangleBounds(std::vector<Aabb>& bounds) const {
+		bounds.resize(triangles.size());
+		for (size_t i = 0; i < triangles.size(); i++) {
+			Aabb b;
+			b.Grow(positions[triangles[i].x]);
+			b.Grow(positions[triangles[i].y]);
+			b.Grow(positions[triangles[i].z]);
+			bounds[i] = b;
+		}
+	}
+
+	static Node MakeNode(const Aabb& bounds, uint32_t child, uint32_t count) {
+		Node node;
+		node.boundsMin = bounds.min;
+		node.boundsMax = bounds.max;
+		node.child = child;
+		node.count = count;
+		return node;
+	}
+
+	void BuildBinned(const std::vector<Aabb>& primitiveBounds, const BuildSettings& settings, Bvh& bvh) {
+		uint32_t primitiveCount = static_cast<uint32_t>(primitiveBounds.size());
+		bvh.nodes.clear();
+		bvh.primitives.resize(primitiveCount);
+		std::iota(bvh.primitives.begin(), bvh.primitives.end(), 0u);
+		if (primitiveCount == 0)
+			return;
+		std::vector<glm::vec3> centers(primitiveCount);
+		Aabb rootBounds;
+		for (uint32_t i = 0; i < primitiveCount; i++) {
+			centers[i] = primitiveBounds[i].Center();
+			rootBounds.Grow(primitiveBounds[i]);
+		}
+		bvh.nodes.reserve(2 * primitiveCount);
+		bvh.nodes.push_back(MakeNode(rootBounds, 0, primitiveCount));
+		uint32_t binCount = glm::clamp(settings.binCount, 2u, 256u);
+		std::vector<Aabb> binBounds(binCount);
+		std::vector<uint32_t> binCounts(binCount);
+		std::vector<float> rightAreas(binCount);
+		std::vector<uint32_t> stack = { 0 };
+		while (!stack.empty()) {
+			uint32_t nodeIndex = stack.back();
+			stack.pop_back();
+			uint32_t first = bvh.nodes[nodeIndex].child;
+			uint32_t count = bvh.nodes[nodeIndex].count;
+			if (count <= 1)
+				continue;
+			float area = bvh.nodes[nodeIndex].Bounds().Area();
+			Aabb centerBounds;
+			for (uint32_t i = first; i < first + count; i++) {
+				centerBounds.Grow(centers[bvh.primitives[i]]);
+			}
+			// Cheapest split over the bins of every axis
+			float bestCost = (std::numeric_limits<float>::max)();
+			int bestAxis = -1;
+			uint32_t bestBin = 0;
+			glm::vec3 extent = centerBounds.max - centerBounds.min;
+			for (int axis = 0; axis < 3; axis++) {
+				if (extent[axis] <= 0.f)
+					continue;
+				float scale = binCount / extent[axis];
+				std::fill(binBounds.begin(), binBounds.end(), Aabb());
+				std::fill(binCounts.begin(), binCounts.end(), 0u);
+				for (uint32_t i = first; i < first + count; i++) {
+					uint32_t primitive = bvh.primitives[i];
+					uint32_t bin = (std::min)(binCount - 1, static_cast<uint32_t>((centers[primitive][axis] - centerBounds.min[axis]) * scale));
+					binBounds[bin].Grow(primitiveBounds[primitive]);
+					binCounts[bin]++;
+				}
+				Aabb right;
+				for (uint32_t bin = binCount - 1; bin > 0; bin--) {
+					right.Grow(binBounds[bin]);
+					rightAreas[bin] = right.Area();
+				}
+				Aabb left;
+				uint32_t leftCount = 0;
+				for (uint32_t bin = 0; bin + 1 < binCount; bin++) {
+					left.Grow(binBounds[bin]);
+					leftCount += binCounts[bin];
+					uint32_t rightCount = count - leftCount;
+					if (leftCount == 0 || rightCount == 0)
+						continue;
+					float cost = settings.traversalCost + settings.intersectionCost * (left.Area() * leftCount + rightAreas[bin + 1] * rightCount) / area;
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestBin = bin + 1;
+					}
+				}
+			}
+			float leafCost = settings.intersectionCost * count;
+			if (count <= settings.maxLeafSize && (bestAxis < 0 || bestCost >= leafCost))
+				continue;
+			uint32_t* begin = &bvh.primitives[first];
+			uint32_t* middle;
+			if (bestAxis >= 0) {
+				float scale = binCount / extent[bestAxis];
+				middle = std::partition(begin, begin + count, [&](uint32_t primitive) {
+					return (std::min)(binCount - 1, static_cast<uint32_t>((centers[primitive][bestAxis] - centerBounds.min[bestAxis]) * scale)) < bestBin;
+				});
+			}
+			else {
+				// All centers coincide, split the list in half
+				middle = begin + count / 2;
+			}
+			uint32_t leftCount = static_cast<uint32_t>(middle - begin);
+			Aabb leftBounds, rightBounds;
+			for (uint32_t i = first; i < first + count; i++) {
+				(i < first + leftCount ? leftBounds : rightBounds).Grow(primitiveBounds[bvh.primitives[i]]);
+			}
+			uint32_t leftIndex = static_cast<uint32_t>(bvh.nodes.size());
+			bvh.nodes.push_back(MakeNode(leftBounds, first, leftCount));
+			bvh.nodes.push_back(MakeNode(rightBounds, first + leftCount, count - leftCount));
+			bvh.nodes[nodeIndex].child = leftIndex;
+			bvh.nodes[nodeIndex].count = 0;
+			stack.push_back(leftIndex);
+			stack.push_back(leftIndex + 1);
+		}
+	}
+
+	// Copies the nodes reachable from the root, breadth first so siblings stay next to each other
+	static void CompactNodes(Bvh& bvh) {
+		std::vector<Node> nodes;
+		nodes.reserve(bvh.nodes.size());
+		nodes.push_back(bvh.nodes[0]);
+		for (size_t i = 0; i < nodes.size(); i++) {
+			if (nodes[i].IsLeaf())
+				continue;
+			uint32_t child = nodes[i].child;
+			nodes[i].child = static_cast<uint32_t>(nodes.size());
+			nodes.push_back(bvh.nodes[child]);
+			nodes.push_back(bvh.nodes[child + 1]);
+		}
+		bvh.nodes.swap(nodes);
+	}
+
+	void CollapseLeaves(Bvh& bvh, const BuildSettings& settings) {
+		if (bvh.nodes.empty())
+			return;
+		// Children always come after their parent, so a reverse sweep visits them first
+		size_t nodeCount = bvh.nodes.size();
+		std::vector<uint32_t> firsts(nodeCount), counts(nodeCount);
+		std::vector<float> costs(nodeCount);
+		bool collapsed = false;
+		for (size_t i = nodeCount; i-- > 0;) {
+			Node& node = bvh.nodes[i];
+			float area = node.Bounds().Area();
+			if (node.IsLeaf()) {
+				firsts[i] = node.child;
+				counts[i] = node.count;
+				costs[i] = settings.intersectionCost * area * node.count;
+				continue;
+			}
+			uint32_t left = node.child;
+			firsts[i] = (std::min)(firsts[left], firsts[left + 1]);
+			counts[i] = counts[left] + counts[left + 1];
+			costs[i] = settings.traversalCost * area + costs[left] + costs[left + 1];
+			float leafCost = settings.intersectionCost * area * counts[i];
+			if (counts[i] <= settings.maxLeafSize && leafCost <= costs[i]) {
+				node.child = firsts[i];
+				node.count = counts[i];
+				costs[i] = leafCost;
+				collapsed = true;
+			}
+		}
+		if (collapsed)
+			CompactNodes(bvh);
+	}
+
+	void Refit(Bvh& bvh, const std::vector<Aabb>& primitiveBounds) {
+		for (size_t i = bvh.nodes.size(); i-- > 0;) {
+			Node& node = bvh.nodes[i];
+			Aabb bounds;
+			if (node.IsLeaf()) {
+				for (uint32_t k = node.child; k < node.child + node.count; k++) {
+					bounds.Grow(primitiveBounds[bvh.primitives[k]]);
+				}
+			}
+			else {
+				bounds = bvh.nodes[node.child].Bounds();
+				bounds.Grow(bvh.nodes[node.child + 1].Bounds());
+			}
+			node.boundsMin = bounds.min;
+			node.boundsMax = bounds.max;
+		}
+	}
+
+	float SahCost(const Bvh& bvh, const BuildSettings& settings) {
+		if (bvh.nodes.empty())
+			return 0.f;
+		double cost = 0.0;
+		std::vector<uint32_t> stack = { 0 };
+		while (!stack.empty()) {
+			const Node& node = bvh.nodes[stack.back()];
+			stack.pop_back();
+			double area = node.Bounds().Area();
+			if (node.IsLeaf()) {
+				cost += settings.intersectionCost * area * node.count;
+			}
+			else {
+				cost += settings.traversalCost * area;
+				stack.push_back(node.child);
+				stack.push_back(node.child + 1);
+			}
+		}
+		double rootArea = bvh.nodes[0].Bounds().Area();
+		return rootArea > 0.0 ? static_cast<float>(cost / rootArea) : 0.f;
+	}
+
+	uint32_t Depth(const Bvh& bvh) {
+		if (bvh.nodes.empty())
+			return 0;
+		uint32_t depth = 0;
+		std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0, 1 } };
+		while (!stack.empty()) {
+			auto entry = stack.back();
+			stack.pop_back();
+			depth = (std::max)(depth, entry.second);
+			const Node& node = bvh.nodes[entry.first];
+			if (!node.IsLeaf()) {
+				stack.push_back({ node.child, entry.second + 1 });
+				stack.push_back({ node.child + 1, entry.second + 1 });
+			}
+		}
+		return depth;
+	}
+
+	static bool Contains(const Node& node, const Aabb& bounds) {
+		const float epsilon = 1e-4f * (1.f + glm::length(node.boundsMax - node.boundsMin));
+		return glm::all(glm::lessThanEqual(node.boundsMin - epsilon, bounds.min)) && glm::all(glm::greaterThanEqual(node.boundsMax + epsilon, bounds.max));
+	}
+	bool Validate(const Bvh& bvh, const std::vector<Aabb>& primitiveBounds, std::string* error) {
+		auto fail = [&](const std::string& message) {
+			if (error)
+				*error = message;
+			return false;
+		};
+		if (bvh.nodes.empty())
+			return primitiveBounds.empty() ? true : fail("no nodes");
+		std::vector<bool> referenced(primitiveBounds.size(), false);
+		std::vector<uint32_t> stack = { 0 };
+		size_t visited = 0;
+		while (!stack.empty()) {
+			uint32_t index = stack.back();
+			stack.pop_back();
+			if (++visited > bvh.nodes.size())
+				return fail("cycle in the node links");
+			const Node& node = bvh.nodes[index];
+			if (node.IsLeaf()) {
+				if (size_t(node.child) + node.count > bvh.primitives.size())
+					return fail("leaf " + std::to_string(index) + " out of range");
+				for (uint32_t i = node.child; i < node.child + node.count; i++) {
+					uint32_t primitive = bvh.primitives[i];
+					if (primitive >= primitiveBounds.size())
+						return fail("invalid primitive in leaf " + std::to_string(index));
+					referenced[primitive] = true;
+					// Spatial splits only reference a part of the primitive, the leaf still has to overlap it
+					const Aabb& b = primitiveBounds[primitive];
+					if (glm::any(glm::lessThan(node.boundsMax, b.min - 1e-4f)) || glm::any(glm::greaterThan(node.boundsMin, b.max + 1e-4f)))
+						return fail("leaf " + std::to_string(index) + " doesn't overlap primitive " + std::to_string(primitive));
+				}
+				continue;
+			}
+			if (size_t(node.child) + 1 >= bvh.nodes.size())
+				return fail("child of node " + std::to_string(index) + " out of range");
+			for (uint32_t child = node.child; child <= node.child + 1; child++) {
+				if (!Contains(node, bvh.nodes[child].Bounds()))
+					return fail("node " + std::to_string(index) + " doesn't contain child " + std::to_string(child));
+				stack.push_back(child);
+			}
+		}
+		for (size_t i = 0; i < referenced.size(); i++) {
+			if (!referenced[i])
+				return fail("primitive " + std::to_string(i) + " is not referenced");
+		}
+		return true;
+	}
+
+	bool IntersectTriangle(const Ray& ray, const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, float tMax, float& t, float& u, float& v) {
+		glm::vec3 e1 = p1 - p0;
+		glm::vec3 e2 = p2 - p0;
+		glm::vec3 p = glm::cross(ray.direction, e2);
+		float determinant = glm::dot(e1, p);
+		if (std::abs(determinant) < 1e-12f)
+			return false;
+		float inverse = 1.f / determinant;
+		glm::vec3 s = ray.origin - p0;
+		float b1 = glm::dot(s, p) * inverse;
+		if (b1 < 0.f || b1 > 1.f)
+			return false;
+		glm::vec3 q = glm::cross(s, e1);
+		float b2 = glm::dot(ray.direction, q) * inverse;
+		if (b2 < 0.f || b1 + b2 > 1.f)
+			return false;
+		float distance = glm::dot(e2, q) * inverse;
+		if (distance <= ray.tMin || distance >= tMax)
+			return false;
+		t = distance;
+		u = b1;
+		v = b2;
+		return true;
+	}
+
+	// Front to back with the entry distances on the stack, so subtrees behind the closest hit are skipped
+	template <bool AnyHit>
+	static bool Traverse(const Bvh& bvh, const Mesh& mesh, const Ray& ray, Hit& hit) {
+		hit = Hit();
+		hit.t = ray.tMax;
+		if (bvh.nodes.empty())
+			return false;
+		glm::vec3 inverseDirection = InverseDirection(ray.direction);
+		auto intersectBounds = [&](const Node& node, float& tEntry) {
+			glm::vec3 t0 = (node.boundsMin - ray.origin) * inverseDirection;
+			glm::vec3 t1 = (node.boundsMax - ray.origin) * inverseDirection;
+			glm::vec3 tNear = glm::min(t0, t1);
+			glm::vec3 tFar = glm::max(t0, t1);
+			tEntry = (std::max)((std::max)(tNear.x, tNear.y), (std::max)(tNear.z, ray.tMin));
+			float tExit = (std::min)((std::min)(tFar.x, tFar.y), (std::min)(tFar.z, hit.t));
+			return tEntry <= tExit;
+		};
+		struct Entry {
+			uint32_t node;
+			float t;
+		};
+		Entry stack[256];
+		uint32_t size = 0;
+		float tRoot;
+		if (intersectBounds(bvh.nodes[0], tRoot))
+			stack[size++] = { 0, tRoot };
+		while (size > 0) {
+			Entry entry = stack[--size];
+			if (entry.t >= hit.t)
+				continue;
+			const Node& node = bvh.nodes[entry.node];
+			if (node.IsLeaf()) {
+				for (uint32_t i = node.child; i < node.child + node.count; i++) {
+					uint32_t primitive = bvh.primitives[i];
+					const glm::uvec3& triangle = mesh.triangles[primitive];
+					if (IntersectTriangle(ray, mesh.positions[triangle.x], mesh.positions[triangle.y], mesh.positions[triangle.z], hit.t, hit.t, hit.u, hit.v)) {
+						hit.primitive = primitive;
+						if (AnyHit)
+							return true;
+					}
+				}
+				continue;
+			}
+			float tLeft, tRight;
+			bool left = intersectBounds(bvh.nodes[node.child], tLeft);
+			bool right = intersectBounds(bvh.nodes[node.child + 1], tRight);
+			if (left && right) {
+				bool leftFirst = tLeft <= tRight;
+				stack[size++] = leftFirst ? Entry{ node.child + 1, tRight } : Entry{ node.child, tLeft };
+				stack[size++] = leftFirst ? Entry{ node.child, tLeft } : Entry{ node.child + 1, tRight };
+			}
+			else if (left) {
+				stack[size++] = { node.child, tLeft };
+			}
+			else if (right) {
+				stack[size++] = { node.child + 1, tRight };
+			}
+		}
+		return hit.primitive != ~0u;
+	}
+	bool Intersect(const Bvh& bvh, const Mesh& mesh, const Ray& ray, Hit& hit) {
+		return Traverse<false>(bvh, mesh, ray, hit);
+	}
+	bool Occluded(const Bvh& bvh, const Mesh& mesh, const Ray& ray) {
+		Hit hit;
+		return Traverse<true>(bvh, mesh, ray, hit);
+	}
+
+	void MakeRandomTriangles(uint32_t count, float extent, float size, Mesh& mesh, uint32_t seed) {
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<float> unit(-1.f, 1.f);
+		mesh.positions.resize(3 * size_t(count));
+		mesh.triangles.resize(count);
+		for (uint32_t i = 0; i < count; i++) {
+			glm::vec3 center = glm::vec3(unit(rng), unit(rng), unit(rng)) * extent;
+			for (uint32_t k = 0; k < 3; k++) {
+				mesh.positions[3 * i + k] = center + glm::vec3(unit(rng), unit(rng), unit(rng)) * size;
+			}
+			mesh.triangles[i] = glm::uvec3(3 * i, 3 * i + 1, 3 * i + 2);
+		}
+	}
+
+	void MakeRandomRays(const Aabb& bounds, uint32_t count, std::vector<Ray>& rays, uint32_t seed) {
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<float> unit(0.f, 1.f);
+		rays.resize(count);
+		glm::vec3 extent = bounds.max - bounds.min;
+		for (uint32_t i = 0; i < count; i++) {
+			Ray& ray = rays[i];
+			ray.origin = bounds.min + extent * (0.1f + 0.8f * glm::vec3(unit(rng), unit(rng), unit(rng)));
+			float z = 2.f * unit(rng) - 1.f;
+			float phi = 6.2831853f * unit(rng);
+			float r = std::sqrt((std::max)(0.f, 1.f - z * z));
+			ray.direction = glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+		}
+	}
+}
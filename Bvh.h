@@ -0,0 +1,97 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+// CPU bounding volume hierarchies over triangles (or any primitives given by their bounds).
+// All builders emit the same binary layout, so SAH cost and traversal can be compared between them.
+// No D3D dependencies
+namespace bvh {
+	struct Aabb {
+		glm::vec3 min = glm::vec3((std::numeric_limits<float>::max)());
+		glm::vec3 max = glm::vec3(-(std::numeric_limits<float>::max)());
+		void Grow(const glm::vec3& p) { min = glm::min(min, p); max = glm::max(max, p); }
+		void Grow(const Aabb& b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+		bool Empty() const { return min.x > max.x; }
+		glm::vec3 Center() const { return 0.5f * (min + max); }
+		float Area() const {
+			if (Empty())
+				return 0.f;
+			glm::vec3 e = max - min;
+			return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+		}
+	};
+	// 32 bytes. Inner nodes have count = 0 and their children at child and child + 1,
+	// leaves reference primitives [child, child + count) of Bvh::primitives
+	struct Node {
+		glm::vec3 boundsMin;
+		uint32_t child;
+		glm::vec3 boundsMax;
+		uint32_t count;
+		bool IsLeaf() const { return count > 0; }
+		Aabb Bounds() const { Aabb b; b.min = boundsMin; b.max = boundsMax; return b; }
+	};
+	struct Bvh {
+		std::vector<Node> nodes; // Root first
+		std::vector<uint32_t> primitives; // Primitive indexes referenced by the leaves
+	};
+	// Triangle soup in world space, as loaded from a glTF scene
+	struct Mesh {
+		std::vector<glm::vec3> positions;
+		std::vector<glm::uvec3> triangles;
+		void GetTriangleBounds(std::vector<Aabb>& bounds) const;
+	};
+	struct Ray {
+		glm::vec3 origin;
+		float tMin = 0.f;
+		glm::vec3 direction;
+		float tMax = (std::numeric_limits<float>::max)();
+	};
+	struct Hit {
+		float t = (std::numeric_limits<float>::max)();
+		float u = 0.f; // Barycentrics of the second and third vertex
+		float v = 0.f;
+		uint32_t primitive = ~0u;
+	};
+
+	struct BuildSettings {
+		uint32_t binCount = 16;
+		uint32_t maxLeafSize = 4;
+		float traversalCost = 1.f; // SAH cost of an inner node relative to one primitive test
+		float intersectionCost = 1.f;
+	};
+	// Top down SAH builder, splits are found with binCount bins along every axis
+	void BuildBinned(const std::vector<Aabb>& primitiveBounds, const BuildSettings& settings, Bvh& bvh);
+	// Turns subtrees of at most maxLeafSize primitives into leaves where that lowers the SAH cost.
+	// Needs the primitives of every subtree next to each other, which all builders guarantee
+	void CollapseLeaves(Bvh& bvh, const BuildSettings& settings);
+	// Recomputes the node bounds bottom up for moved primitives, the topology is kept
+	void Refit(Bvh& bvh, const std::vector<Aabb>& primitiveBounds);
+	// Expected cost of a random ray, normalized by the root area
+	float SahCost(const Bvh& bvh, const BuildSettings& settings);
+	uint32_t Depth(const Bvh& bvh);
+	// Checks the child links, that every node contains its children and primitives and that every primitive is referenced
+	bool Validate(const Bvh& bvh, const std::vector<Aabb>& primitiveBounds, std::string* error = nullptr);
+
+	// 1 / direction with zero components replaced by a tiny value, so slab tests never compute 0 * inf
+	inline glm::vec3 InverseDirection(const glm::vec3& direction) {
+		glm::vec3 d;
+		for (int i = 0; i < 3; i++) {
+			d[i] = std::abs(direction[i]) > 1e-20f ? direction[i] : (direction[i] < 0.f ? -1e-20f : 1e-20f);
+		}
+		return 1.f / d;
+	}
+	// Moller-Trumbore, t is only written for hits in (tMin, tMax)
+	bool IntersectTriangle(const Ray& ray, const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, float tMax, float& t, float& u, float& v);
+	// Closest hit of the ray with the triangles of mesh referenced by the BVH, hit is reset first
+	bool Intersect(const Bvh& bvh, const Mesh& mesh, const Ray& ray, Hit& hit);
+	// Any hit, for shadow rays
+	bool Occluded(const Bvh& bvh, const Mesh& mesh, const Ray& ray);
+
+	// count random triangles of about size in a cube of extent, for build benchmarks without assets
+	void MakeRandomTriangles(uint32_t count, float extent, float size, Mesh& mesh, uint32_t seed = 1234);
+	// count rays from random points inside the inner 80% of bounds in random directions
+	void MakeRandomRays(const Aabb& bounds, uint32_t count, std::vector<Ray>& rays, uint32_t seed = 1234);
+}
@@ -25,11 +25,14 @@
 #define ROUND_UP(v, powerOf2Alignment) (((v) + (powerOf2Alignment)-1) & ~((powerOf2Alignment)-1))
 #endif
 #include <glm/gtx/transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "ParallelFor.h"
 #include <iostream>
 #include <locale>
 #include <codecvt>
 #include "stb_image/stb_image.h"
-#define MAX_RECURSION_DEPTH 10
+#include <chrono>
+#include <fstream>
 D3D12HelloTriangle::D3D12HelloTriangle(UINT width, UINT height, std::wstring name) :
 	DXSample(width, height, name),
 	m_frameIndex(0),
@@ -63,16 +66,21 @@ void D3D12HelloTriangle::OnInit()
 
 	//-----COMPUTE INIT------
 	CreateMipMapPSO();
+	CreateSkinningPSO();
 	//----------------------
 	// Camera
 	nv_helpers_dx12::CameraManip.setWindowSize(GetWidth(), GetHeight());
 	nv_helpers_dx12::CameraManip.setLookat(glm::vec3(1.5f, 1.5f, 1.5f), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
-	CreateCameraBuffer();
-	CreateFrameIndexBuffer();
+	CreateFrameConstants();
+	CreateLightDescriptors();
 	//--------------------------------------------------------------------
+	// Generated levels of detail, 1 only keeps the loaded geometry
+	m_LodChainSettings.levelCount = m_lodLevelCount;
 
 	MakeTestScene();
 
+	if (m_runBenchmarks)
+		RunBenchmarks();
 }
 // --------------ROOT SIGNATURES----------------------------
 // Create #RTX RAYGEN Root Signature (empty, as we use bindless)
@@ -94,8 +102,8 @@ ComPtr<ID3D12RootSignature> D3D12HelloTriangle::CreateGlobalSignature() {
 	nv_helpers_dx12::RootSignatureGenerator rsc;
 	// List of all heap indexes
 	rsc.AddRootParameter(D3D12_ROOT_PARAMETER_TYPE_SRV, 0, 1);
-	// Render mode
-	rsc.AddRootParameter(D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS, 0, 1);
+	// Render mode, a root constant buffer in the frame constants
+	rsc.AddRootParameter(D3D12_ROOT_PARAMETER_TYPE_CBV, 0, 1);
 	return rsc.Generate(m_device.Get(), false);
 }
 
@@ -106,96 +114,133 @@ ComPtr<ID3D12RootSignature> D3D12HelloTriangle::CreateMipMapSignature() {
 	
 	return rsc.Generate(m_device.Get(), false);
 }
+ComPtr<ID3D12RootSignature> D3D12HelloTriangle::CreateSkinningSignature() {
+	nv_helpers_dx12::RootSignatureGenerator rsc;
+	// Vertex count + normals flag
+	rsc.AddRootParameter(D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS, 0, 0, D3D12_SHADER_VISIBILITY_ALL, 2);
+	// Bind positions, bind normals, joints, weights, joint matrices
+	for (UINT i = 0; i < 5; i++) {
+		rsc.AddRootParameter(D3D12_ROOT_PARAMETER_TYPE_SRV, i);
+	}
+	// Skinned positions and normals
+	rsc.AddRootParameter(D3D12_ROOT_PARAMETER_TYPE_UAV, 0);
+	rsc.AddRootParameter(D3D12_ROOT_PARAMETER_TYPE_UAV, 1);
+	return rsc.Generate(m_device.Get(), false);
+}
 
 // ----------------------------------------------------
 // ---------CREATE RAYTRACING PIPELINE (similar to PSO in rasterization)------
 void D3D12HelloTriangle::CreateRaytracingPipeline()
 {
 	m_globalSignature = CreateGlobalSignature();
-	nv_helpers_dx12::RayTracingPipelineGenerator pipeline(m_device.Get(), m_globalSignature.Get());
-
-	
 
-	
 	// The pipeline contains the DXIL code of all the shaders potentially executed
 	// during the raytracing process. This section compiles the HLSL code into a
 	// set of DXIL libraries. We chose to separate the code in several libraries
 	// by semantic (ray generation, hit, miss) for clarity. Any code layout can be
 	// used.
-	m_rayGenLibrary = nv_helpers_dx12::CompileShaderLibrary(L"Assets/Shaders/RayGen.hlsl", L"lib_6_6");
-	m_missLibrary = nv_helpers_dx12::CompileShaderLibrary(L"Assets/Shaders/Miss.hlsl", L"lib_6_6");
-	m_hitLibrary = nv_helpers_dx12::CompileShaderLibrary(L"Assets/Shaders/Hit.hlsl", L"lib_6_6");
-
+	// The shaders of a pipeline agree on the payload, the modes which only return a color get a smaller one
+	for (uint32_t surfacePayload = 0; surfacePayload < 2; surfacePayload++) {
+		std::vector<DxcDefine> defines = { { L"SURFACE_PAYLOAD", surfacePayload ? L"1" : L"0" } };
+		m_rayGenLibraries[surfacePayload] = nv_helpers_dx12::CompileShaderLibrary(L"Assets/Shaders/RayGen.hlsl", L"lib_6_6", defines);
+		m_missLibraries[surfacePayload] = nv_helpers_dx12::CompileShaderLibrary(L"Assets/Shaders/Miss.hlsl", L"lib_6_6", defines);
+	}
+	// One closest hit permutation per render mode, so a mode only pays for its own texture fetches and rays
+	auto compileStart = std::chrono::high_resolution_clock::now();
+	m_hitLibraries.clear();
+	m_modeHitGroups.clear();
+	for (uint32_t mode = 0; mode < m_numRenderModes; mode++) {
+		std::wstring modeValue = std::to_wstring(mode);
+		std::wstring closestHit = L"ClosestHit" + modeValue;
+		std::vector<DxcDefine> defines = { { L"RENDER_MODE", modeValue.c_str() }, { L"CLOSEST_HIT", closestHit.c_str() },
+			{ L"SURFACE_PAYLOAD", render::kModes[mode].maxPayloadSize == render::kHitInfoSize ? L"1" : L"0" } };
+		m_hitLibraries.push_back(nv_helpers_dx12::CompileShaderLibrary(L"Assets/Shaders/Hit.hlsl", L"lib_6_6", defines));
+		m_modeHitGroups.push_back(L"HitGroup" + modeValue);
+	}
+	double compileMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - compileStart).count();
 	// SHADING-----------------------
 	m_shadowLibrary = nv_helpers_dx12::CompileShaderLibrary(L"Assets/Shaders/ShadowRay.hlsl", L"lib_6_6");
-	pipeline.AddLibrary(m_shadowLibrary.Get(), { L"ShadowClosestHit" });
-	pipeline.AddLibrary(m_shadowLibrary.Get(), { L"ShadowMiss" });
 	m_shadowSignature = CreateMissSignature();
 	//------------------------------
-	// In a way similar to DLLs, each library is associated with a number of
-	// exported symbols. This
-	// has to be done explicitly in the lines below. Note that a single library
-	// can contain an arbitrary number of symbols, whose semantic is given in HLSL
-	// using the [shader("xxx")] syntax
-	pipeline.AddLibrary(m_rayGenLibrary.Get(), { L"RayGen" });
-	pipeline.AddLibrary(m_missLibrary.Get(), { L"Miss" });
-	pipeline.AddLibrary(m_hitLibrary.Get(), { L"ClosestHit"});//, L"ShadedClosestHit"
-
 	// To be used, each DX12 shader needs a root signature defining which
 	// parameters and buffers will be accessed.
 	m_rayGenSignature = CreateRayGenSignature();
 	m_missSignature = CreateMissSignature();
 	m_hitSignature = CreateHitSignature();
-
-
-	// Hit group for the triangles, with a shader simply interpolating vertex
-	// colors
-	pipeline.AddHitGroup(L"HitGroup", L"ClosestHit");
-	//pipeline.AddHitGroup(L"ShadedHitGroup", L"ShadedClosestHit");
-	pipeline.AddHitGroup(L"ShadowHitGroup", L"ShadowClosestHit");
-	// The following section associates the root signature to each shader. Note
- // that we can explicitly show that some shaders share the same root signature
- // (eg. Miss and ShadowMiss). Note that the hit shaders are now only referred
- // to as hit groups, meaning that the underlying intersection, any-hit and
- // closest-hit shaders share the same root signature.
-	pipeline.AddRootSignatureAssociation(m_rayGenSignature.Get(), { L"RayGen" });
-	pipeline.AddRootSignatureAssociation(m_shadowSignature.Get(),
-		{ L"ShadowHitGroup" });
-	pipeline.AddRootSignatureAssociation(m_missSignature.Get(),
-		{ L"Miss", L"ShadowMiss" });
-	pipeline.AddRootSignatureAssociation(m_hitSignature.Get(),
-		{ L"HitGroup"});//, L"ShadedHitGroup" 
-
-
-
-	// The payload size defines the maximum size of the data carried by the rays,
-	// ie. the the data
-	// exchanged between shaders, such as the HitInfo structure in the HLSL code.
-	// It is important to keep this value as low as possible as a too high value
-	// would result in unnecessary memory consumption and cache trashing.
-	pipeline.SetMaxPayloadSize(8 * sizeof(float)); // RGB + distance
-
-	// Upon hitting a surface, DXR can provide several attributes to the hit. In
-	// our sample we just use the barycentric coordinates defined by the weights
-	// u,v of the last two vertices of the triangle. The actual barycentrics can
-	// be obtained using float3 barycentrics = float3(1.f-u-v, u, v);
-	pipeline.SetMaxAttributeSize(2 * sizeof(float)); // barycentric coordinates
-
-	// The raytracing process can shoot rays from existing hit points, resulting
-	// in nested TraceRay calls. Our sample code traces only primary rays, which
-	// then requires a trace depth of 1. Note that this recursion depth should be
-	// kept to a minimum for best performance. Path tracing algorithms can be
-	// easily flattened into a simple loop in the ray generation.
-	pipeline.SetMaxRecursionDepth(MAX_RECURSION_DEPTH);
-
-	// Compile the pipeline for execution on the GPU
-	m_rtStateObject = pipeline.Generate();
-
-	// Cast the state object into a properties object, allowing to later access
-	// the shader pointers by name
-	ThrowIfFailed(
-		m_rtStateObject->QueryInterface(IID_PPV_ARGS(&m_rtStateObjectProps)));
-
+	printf("Compiled %u closest hit permutations in %.1f ms (%.1f ms each)\n", m_numRenderModes, compileMs, compileMs / m_numRenderModes);
+
+	// One state object per distinct recursion depth and payload size in render::kModes
+	std::vector<render::PipelineDesc> pipelines = render::GroupModes(render::kModes, render::kModeCount, m_modePipelines);
+	m_rtStateObjects.clear();
+	m_rtStateObjectProps.clear();
+	for (const render::PipelineDesc& desc : pipelines) {
+		nv_helpers_dx12::RayTracingPipelineGenerator pipeline(m_device.Get(), m_globalSignature.Get());
+		// In a way similar to DLLs, each library is associated with a number of
+		// exported symbols. This
+		// has to be done explicitly in the lines below. Note that a single library
+		// can contain an arbitrary number of symbols, whose semantic is given in HLSL
+		// using the [shader("xxx")] syntax
+		pipeline.AddLibrary(m_shadowLibrary.Get(), { L"ShadowClosestHit", L"ShadowAnyHit" });
+		pipeline.AddLibrary(m_shadowLibrary.Get(), { L"ShadowMiss" });
+		uint32_t surfacePayload = desc.maxPayloadSize == render::kHitInfoSize ? 1 : 0;
+		pipeline.AddLibrary(m_rayGenLibraries[surfacePayload].Get(), { L"RayGen" });
+		pipeline.AddLibrary(m_missLibraries[surfacePayload].Get(), { L"Miss" });
+		// Every permutation contains the any-hit shader, the first one of the pipeline exports it
+		std::vector<std::wstring> hitGroups;
+		for (uint32_t mode : desc.modes) {
+			std::wstring closestHit = L"ClosestHit" + std::to_wstring(mode);
+			if (hitGroups.empty())
+				pipeline.AddLibrary(m_hitLibraries[mode].Get(), { closestHit, L"AlphaTestAnyHit" });
+			else
+				pipeline.AddLibrary(m_hitLibraries[mode].Get(), { closestHit });
+			// Any-hit shaders only run for non-opaque (alpha masked) geometry
+			pipeline.AddHitGroup(m_modeHitGroups[mode], closestHit, L"AlphaTestAnyHit");
+			hitGroups.push_back(m_modeHitGroups[mode]);
+		}
+		// The shader tables of every mode reference the shadow hit group, whether the mode traces shadow rays or not
+		pipeline.AddHitGroup(L"ShadowHitGroup", L"ShadowClosestHit", L"ShadowAnyHit");
+		// The following section associates the root signature to each shader. Note
+		// that we can explicitly show that some shaders share the same root signature
+		// (eg. Miss and ShadowMiss). Note that the hit shaders are now only referred
+		// to as hit groups, meaning that the underlying intersection, any-hit and
+		// closest-hit shaders share the same root signature.
+		pipeline.AddRootSignatureAssociation(m_rayGenSignature.Get(), { L"RayGen" });
+		pipeline.AddRootSignatureAssociation(m_shadowSignature.Get(), { L"ShadowHitGroup" });
+		pipeline.AddRootSignatureAssociation(m_missSignature.Get(), { L"Miss", L"ShadowMiss" });
+		pipeline.AddRootSignatureAssociation(m_hitSignature.Get(), hitGroups);
+
+		// The payload size defines the maximum size of the data carried by the rays,
+		// ie. the the data
+		// exchanged between shaders, such as the HitInfo structure in the HLSL code.
+		// It is important to keep this value as low as possible as a too high value
+		// would result in unnecessary memory consumption and cache trashing.
+		pipeline.SetMaxPayloadSize(desc.maxPayloadSize);
+
+		// Upon hitting a surface, DXR can provide several attributes to the hit. In
+		// our sample we just use the barycentric coordinates defined by the weights
+		// u,v of the last two vertices of the triangle. The actual barycentrics can
+		// be obtained using float3 barycentrics = float3(1.f-u-v, u, v);
+		pipeline.SetMaxAttributeSize(2 * sizeof(float)); // barycentric coordinates
+
+		// The raytracing process can shoot rays from existing hit points, resulting
+		// in nested TraceRay calls. The driver sizes the stack for the deepest
+		// nesting, so every pipeline only asks for the depth of its own modes.
+		pipeline.SetMaxRecursionDepth(desc.maxRecursionDepth);
+
+		// Compile the pipeline for execution on the GPU
+		auto pipelineStart = std::chrono::high_resolution_clock::now();
+		ComPtr<ID3D12StateObject> stateObject = pipeline.Generate();
+		double pipelineMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - pipelineStart).count();
+
+		// Cast the state object into a properties object, allowing to later access
+		// the shader pointers by name
+		ComPtr<ID3D12StateObjectProperties> stateObjectProps;
+		ThrowIfFailed(stateObject->QueryInterface(IID_PPV_ARGS(&stateObjectProps)));
+		printf("Pipeline %zu: %zu modes, recursion depth %u, payload %u bytes, stack %llu bytes, created in %.1f ms\n",
+			m_rtStateObjects.size(), desc.modes.size(), desc.maxRecursionDepth, desc.maxPayloadSize, stateObjectProps->GetPipelineStackSize(), pipelineMs);
+		m_rtStateObjects.push_back(stateObject);
+		m_rtStateObjectProps.push_back(stateObjectProps);
+	}
 }
 // ----------Other PSOs-----------------------------------
 void D3D12HelloTriangle::CreateMipMapPSO() {
@@ -206,12 +251,24 @@ void D3D12HelloTriangle::CreateMipMapPSO() {
 	psoDesc.CS = { computeShader->GetBufferPointer(), computeShader->GetBufferSize() };
 	m_device->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(&m_MipMapPSO));
 }
+void D3D12HelloTriangle::CreateSkinningPSO() {
+	D3D12_COMPUTE_PIPELINE_STATE_DESC psoDesc = {};
+	m_SkinningRootSignature = CreateSkinningSignature();
+	psoDesc.pRootSignature = m_SkinningRootSignature.Get();
+	IDxcBlob* computeShader = nv_helpers_dx12::CompileShaderLibrary(L"Assets/ComputeShaders/Skinning.hlsl", L"cs_6_6");
+	psoDesc.CS = { computeShader->GetBufferPointer(), computeShader->GetBufferSize() };
+	m_device->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(&m_SkinningPSO));
+}
 // --------- RT Output - buffer from which we copy data to the Render Target ----
 void D3D12HelloTriangle::CreateRaytracingOutputBuffer() {
 	m_outputResource = nv_helpers_dx12::CreateTextureBuffer(m_device.Get(), GetWidth(), GetHeight(), 1, DXGI_FORMAT_R8G8B8A8_UNORM, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE, nv_helpers_dx12::kDefaultHeapProps);
 	// RTX output
 	m_RTOutputHeapIndex = nv_helpers_dx12::CreateBufferView(m_device.Get(), m_outputResource.Get(), m_outputResource->GetGPUVirtualAddress(),
 			m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::UAV);
+	// Only written by the ray generation shader, it never leaves the UAV state
+	m_accumulationResource = nv_helpers_dx12::CreateTextureBuffer(m_device.Get(), GetWidth(), GetHeight(), 1, DXGI_FORMAT_R32G32B32A32_FLOAT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nv_helpers_dx12::kDefaultHeapProps);
+	m_AccumulationHeapIndex = nv_helpers_dx12::CreateBufferView(m_device.Get(), m_accumulationResource.Get(), m_accumulationResource->GetGPUVirtualAddress(),
+			m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::UAV);
 }
 // --------- Create CBV SRV UAV heap
 void D3D12HelloTriangle::CreatHeaps() { 
@@ -224,27 +281,42 @@ void D3D12HelloTriangle::CreatHeaps() {
 // --------- For a particular scene recreate an SBT - shader + resource bindings for each BLAS
 void D3D12HelloTriangle::ReCreateShaderBindingTable(Scene* scene) {
 	
-	m_sbtHelper.Reset();
-	// MAKE THESE SHADER DATA RETRIEVED FROM SCENE
-	m_sbtHelper.AddRayGenerationProgram(L"RayGen", {  });
-	m_sbtHelper.AddMissProgram(L"Miss", {});
-	m_sbtHelper.AddMissProgram(L"ShadowMiss", {});
-
-	for (int i = 0; i < scene->m_sceneObjects.size(); i++) {
-		for (auto& hitGroup : scene->m_sceneObjects[i].m_model->m_hitGroups) {
-			std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
-			const std::wstring hitName = converter.from_bytes(hitGroup);
-			m_sbtHelper.AddHitGroup(hitName, {});
+	// One table per render mode, they only differ in the permutation behind "HitGroup". The layout is the same,
+	// so switching modes only switches the table
+	m_sbtStorage.resize(m_numRenderModes);
+	std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+	for (uint32_t mode = 0; mode < m_numRenderModes; mode++) {
+		m_sbtHelper.Reset();
+		// MAKE THESE SHADER DATA RETRIEVED FROM SCENE
+		m_sbtHelper.AddRayGenerationProgram(L"RayGen", {  });
+		m_sbtHelper.AddMissProgram(L"Miss", {});
+		m_sbtHelper.AddMissProgram(L"ShadowMiss", {});
+
+		// One set of records per hit group list, whatever the number of TLAS instances using it
+		for (auto& hitGroups : m_HitGroupSets) {
+			for (auto& hitName : hitGroups) {
+				m_sbtHelper.AddHitGroup(hitName == "HitGroup" ? m_modeHitGroups[mode] : converter.from_bytes(hitName), {});
+			}
 		}
+		uint32_t sbtSize = m_sbtHelper.ComputeSBTSize();
+		m_sbtStorage[mode] = nv_helpers_dx12::CreateBuffer(
+			m_device.Get(), sbtSize, D3D12_RESOURCE_FLAG_NONE,
+			D3D12_RESOURCE_STATE_GENERIC_READ, nv_helpers_dx12::kUploadHeapProps);
+		if (!m_sbtStorage[mode]) {
+			throw std::logic_error("Could not allocate the shader binding table");
+		}
+		m_sbtHelper.Generate(m_sbtStorage[mode].Get(), m_rtStateObjectProps[m_modePipelines[mode]].Get());
 	}
-	uint32_t sbtSize = m_sbtHelper.ComputeSBTSize();
-	m_sbtStorage = nv_helpers_dx12::CreateBuffer(
-		m_device.Get(), sbtSize, D3D12_RESOURCE_FLAG_NONE,
-		D3D12_RESOURCE_STATE_GENERIC_READ, nv_helpers_dx12::kUploadHeapProps);
-	if (!m_sbtStorage) {
-		throw std::logic_error("Could not allocate the shader binding table");
+}
+UINT D3D12HelloTriangle::GetHitGroupOffset(const std::vector<std::string>& hitGroups) {
+	UINT offset = 0;
+	for (auto& set : m_HitGroupSets) {
+		if (set == hitGroups)
+			return offset;
+		offset += static_cast<UINT>(set.size());
 	}
-	m_sbtHelper.Generate(m_sbtStorage.Get(), m_rtStateObjectProps.Get());
+	m_HitGroupSets.push_back(hitGroups);
+	return offset;
 }
 // Load the rendering pipeline dependencies.
 void D3D12HelloTriangle::LoadPipeline()
@@ -298,10 +370,13 @@ void D3D12HelloTriangle::LoadPipeline()
 	queueDesc.Type = D3D12_COMMAND_LIST_TYPE_DIRECT;
 
 	ThrowIfFailed(m_device->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&m_commandQueue)));
+	// Model data goes through a copy queue of its own
+	m_Uploads.Init(m_device.Get());
 
-	// Describe and create the swap chain.
+	// Describe and create the swap chain. Every frame in flight renders into its own back buffer
+	m_framesInFlight = (std::max)(2u, (std::min)(m_framesInFlight, FrameCount));
 	DXGI_SWAP_CHAIN_DESC1 swapChainDesc = {};
-	swapChainDesc.BufferCount = FrameCount;
+	swapChainDesc.BufferCount = m_framesInFlight;
 	swapChainDesc.Width = m_width;
 	swapChainDesc.Height = m_height;
 	swapChainDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
@@ -342,7 +417,7 @@ void D3D12HelloTriangle::LoadPipeline()
 		CD3DX12_CPU_DESCRIPTOR_HANDLE rtvHandle(m_rtvHeap->GetCPUDescriptorHandleForHeapStart());
 
 		// Create a RTV for each frame.
-		for (UINT n = 0; n < FrameCount; n++)
+		for (UINT n = 0; n < m_framesInFlight; n++)
 		{
 			ThrowIfFailed(m_swapChain->GetBuffer(n, IID_PPV_ARGS(&m_renderTargets[n])));
 			m_device->CreateRenderTargetView(m_renderTargets[n].Get(), nullptr, rtvHandle);
@@ -351,6 +426,11 @@ void D3D12HelloTriangle::LoadPipeline()
 	}
 
 	ThrowIfFailed(m_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&m_commandAllocator)));
+	// A frame can only reset its allocator once the GPU finished the previous frame of the slot
+	for (UINT n = 0; n < m_framesInFlight; n++)
+	{
+		ThrowIfFailed(m_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&m_frameAllocators[n])));
+	}
 	// Create the command list.
 	ThrowIfFailed(m_device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, m_commandAllocator.Get(), nullptr, IID_PPV_ARGS(&m_commandList)));
 	// Create synchronization objects and wait until assets have been uploaded to the GPU.
@@ -369,6 +449,9 @@ void D3D12HelloTriangle::LoadPipeline()
 // Sets the scene to the proper one after the button callback
 void D3D12HelloTriangle::SwitchScenes() {
 	if (m_currentScene != m_requestedScene) {
+		// Loading replaces resources the frames in flight still use
+		WaitForGpu();
+		ThrowIfFailed(m_commandAllocator->Reset());
 		ThrowIfFailed(m_commandList->Reset(m_commandAllocator.Get(), nullptr));
 		m_currentScene = m_requestedScene;
 
@@ -380,7 +463,7 @@ void D3D12HelloTriangle::SwitchScenes() {
 			MakeTestScene1();
 			break;
 		}
-		WaitForPreviousFrame();
+		WaitForGpu();
 	}
 }
 // Update frame-based values.
@@ -389,16 +472,23 @@ void D3D12HelloTriangle::OnUpdate()
 	// Switches the active scene if this is required
 	SwitchScenes();
 
+	// The GPU is done with the previous frame of this slot
+	m_FrameConstants.BeginFrame(m_frameIndex);
 	UpdateCameraBuffer();
 	UpdateFrameIndexBuffer();
 	// ANIMATE 
-	m_time++;
-	std::get<1>(m_instances[0]) = XMMatrixScaling(0.5003f, 0.5003f, 0.5003f) * XMMatrixRotationAxis({ 0.f, 1.f, 0.f }, static_cast<float>(m_time) / 50.0f) * XMMatrixTranslation(1.f, 0.0f * cosf(m_time / 20.f), -1.f);
-	//std::get<1>(m_instances[1]) = XMMatrixScaling(0.04f, 0.04f, 0.04f) * XMMatrixRotationAxis({ 0.f, 0.f, 1.f }, static_cast<float>(m_time) / 50.0f) * XMMatrixTranslation(0.f, 0.1f * cosf(m_time / 20.f), 1.f);
-	std::get<1>(m_instances[2]) = XMMatrixScaling(0.15f, 0.15f, 0.15f) * XMMatrixRotationAxis({ 0.f, -1.f, 0.f }, static_cast<float>(m_time) / 50.0f) * XMMatrixTranslation(-1.f, 0.1f * cosf(m_time / 20.f) + 0.5f, 0.f);
-	/*
-	std::get<1>(m_instances[3]) = XMMatrixScaling(0.003f, 0.00001f, 0.003f) * XMMatrixTranslation(0.f, - 1.f, 0.f);
-	std::get<1>(m_instances[4]) = XMMatrixScaling(0.0006f, 0.0006f, 0.0006f);*/
+	if (!m_pauseAnimation)
+		m_time++;
+	// glTF animations, the skinning pass reads the evaluated pose
+	UpdateAnimations();
+	UpdateSkinning();
+	// Levels of detail follow the final instance transforms
+	UpdateLods();
+	UpdateLights();
+	UpdateHeapIndexBuffer();
+	UpdateAccumulation();
+	if (m_cpuRayQueries)
+		UpdateCpuScene();
 }
 
 // Render the scene.
@@ -413,15 +503,15 @@ void D3D12HelloTriangle::OnRender()
 	// Present the frame.
 	ThrowIfFailed(m_swapChain->Present(1, 0));
 
-	WaitForPreviousFrame();
-	
+	MoveToNextFrame();
 }
 
 void D3D12HelloTriangle::OnDestroy()
 {
 	// Ensure that the GPU is no longer referencing resources that are about to be
 	// cleaned up by the destructor.
-	WaitForPreviousFrame();
+	WaitForGpu();
+	m_Uploads.WaitIdle();
 
 	CloseHandle(m_fenceEvent);
 }
@@ -433,23 +523,34 @@ void D3D12HelloTriangle::OnKeyUp(UINT8 key)
 		m_requestedScene += 1;
 		m_requestedScene = m_requestedScene % 2;
 	}
+	// Every mode has a prebuilt shader table, PopulateCommandList picks the one of m_renderMode
 	if (key == VK_LEFT) {
-		m_renderMode -= 1;
-		if (m_renderMode < 0)
-			m_renderMode = m_numRenderModes - 1;
+		m_renderMode = (m_renderMode + m_numRenderModes - 1) % m_numRenderModes;
 	}
 	if (key == VK_RIGHT) {
 		m_renderMode += 1;
 		if (m_renderMode >= m_numRenderModes)
 			m_renderMode = 0;
 	}
-
+	if (key == VK_LEFT || key == VK_RIGHT) {
+		const char* name = render::kModes[m_renderMode].name;
+		printf("Render mode %u: %s\n", m_renderMode, name);
+		SetCustomWindowText(std::wstring(name, name + strlen(name)).c_str());
+	}
+	if (key == 'P') {
+		m_pauseAnimation = !m_pauseAnimation;
+		printf("Animation %s\n", m_pauseAnimation ? "paused" : "resumed");
+	}
+	if (key == 'N') {
+		m_nextEventEstimation = !m_nextEventEstimation;
+		printf("Next event estimation %s\n", m_nextEventEstimation ? "on" : "off");
+	}
 }
 void D3D12HelloTriangle::PopulateCommandList()
 {
-	
-	ThrowIfFailed(m_commandAllocator->Reset());
-	ThrowIfFailed(m_commandList->Reset(m_commandAllocator.Get(), nullptr));
+	// MoveToNextFrame waited for the GPU to finish the previous frame of this slot
+	ThrowIfFailed(m_frameAllocators[m_frameIndex]->Reset());
+	ThrowIfFailed(m_commandList->Reset(m_frameAllocators[m_frameIndex].Get(), nullptr));
 	//m_commandList->RSSetViewports(1, &m_viewport);
 	//m_commandList->RSSetScissorRects(1, &m_scissorRect);
 	m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_renderTargets[m_frameIndex].Get(), D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET));
@@ -461,6 +562,7 @@ void D3D12HelloTriangle::PopulateCommandList()
 	
 	//------------------------- #RTX PREPARE FRAME AND RENDER---------------------------------------------
 	
+	RecordSkinning(); // Deform skinned meshes and refit their BLASes before the TLAS update
 	CreateTopLevelAS(m_instances, true); // Update TLAS for Animations
 	
 	std::vector<ID3D12DescriptorHeap*> heaps = { m_CbvSrvUavHeap.Get(), m_SamplerHeap.Get()};
@@ -475,19 +577,20 @@ void D3D12HelloTriangle::PopulateCommandList()
 	D3D12_DISPATCH_RAYS_DESC desc = {};
 	
 	// All rayGen shaders first
+	D3D12_GPU_VIRTUAL_ADDRESS sbtAddress = m_sbtStorage[m_renderMode]->GetGPUVirtualAddress();
 	uint32_t rayGenerationSectionSizeInBytes = m_sbtHelper.GetRayGenSectionSize();
-	desc.RayGenerationShaderRecord.StartAddress = m_sbtStorage->GetGPUVirtualAddress();
+	desc.RayGenerationShaderRecord.StartAddress = sbtAddress;
 	desc.RayGenerationShaderRecord.SizeInBytes = rayGenerationSectionSizeInBytes;
 	
 	// All miss shaedrs - second
 	uint32_t missSectionSizeInBytes = m_sbtHelper.GetMissSectionSize();
-	desc.MissShaderTable.StartAddress = m_sbtStorage->GetGPUVirtualAddress() + rayGenerationSectionSizeInBytes;
+	desc.MissShaderTable.StartAddress = sbtAddress + rayGenerationSectionSizeInBytes;
 	desc.MissShaderTable.SizeInBytes = missSectionSizeInBytes;
 	desc.MissShaderTable.StrideInBytes = m_sbtHelper.GetMissEntrySize();
 	
 	// All hit groups - third
 	uint32_t hitGroupsSectionSize = m_sbtHelper.GetHitGroupSectionSize();
-	desc.HitGroupTable.StartAddress = m_sbtStorage->GetGPUVirtualAddress() + rayGenerationSectionSizeInBytes + missSectionSizeInBytes;
+	desc.HitGroupTable.StartAddress = sbtAddress + rayGenerationSectionSizeInBytes + missSectionSizeInBytes;
 	desc.HitGroupTable.SizeInBytes = hitGroupsSectionSize;
 	desc.HitGroupTable.StrideInBytes = m_sbtHelper.GetHitGroupEntrySize();
 	// Window size to dispatch primary rays
@@ -495,11 +598,20 @@ void D3D12HelloTriangle::PopulateCommandList()
 	desc.Height = GetHeight();
 	desc.Depth = 1;
 	// Bind the raytracing pipeline
-	m_commandList->SetPipelineState1(m_rtStateObject.Get());
+	m_commandList->SetPipelineState1(m_rtStateObjects[m_modePipelines[m_renderMode]].Get());
 
 	// Heap indexes for Bindless rendering
-	m_commandList->SetComputeRootShaderResourceView(0, m_HeapIndexBuffer.Get()->GetGPUVirtualAddress());
-	m_commandList->SetComputeRoot32BitConstant(1, m_renderMode, 0);
+	m_commandList->SetComputeRootShaderResourceView(0, m_HeapIndexBuffers[m_frameIndex]->GetGPUVirtualAddress());
+	FrameConstants::Constant<RenderConstants> renderConstants = m_FrameConstants.Allocate<RenderConstants>();
+	renderConstants.cpu->renderMode = m_renderMode;
+	renderConstants.cpu->maxBounces = m_pathMaxBounces;
+	renderConstants.cpu->accumulatedSamples = m_AccumulationFrame.sampleIndex;
+	renderConstants.cpu->lightInstances = m_LightInstanceCount;
+	renderConstants.cpu->rouletteDepth = m_pathRouletteDepth;
+	m_commandList->SetComputeRootConstantBufferView(1, renderConstants.gpu);
+	// The accumulation of the last frame has to be written before this one reads it
+	CD3DX12_RESOURCE_BARRIER accumulationBarrier = CD3DX12_RESOURCE_BARRIER::UAV(m_accumulationResource.Get());
+	m_commandList->ResourceBarrier(1, &accumulationBarrier);
 	// ----------DRAWING ------------------------------------------
 	// Dispatch the rays and write to the raytracing output
 	m_commandList->DispatchRays(&desc);
@@ -518,81 +630,251 @@ void D3D12HelloTriangle::PopulateCommandList()
 	ThrowIfFailed(m_commandList->Close());
 }
 
-void D3D12HelloTriangle::WaitForPreviousFrame()
+void D3D12HelloTriangle::MoveToNextFrame()
 {
-	// WAITING FOR THE FRAME TO COMPLETE BEFORE CONTINUING IS NOT BEST PRACTICE.
-	// This is code implemented as such for simplicity. The D3D12HelloFrameBuffering
-	// sample illustrates how to use fences for efficient resource usage and to
-	// maximize GPU utilization.
-
-	// Signal and increment the fence value.
-	const UINT64 fence = m_fenceValue;
-	ThrowIfFailed(m_commandQueue->Signal(m_fence.Get(), fence));
+	// Signal and remember the fence value of the submitted frame.
 	m_fenceValue++;
+	ThrowIfFailed(m_commandQueue->Signal(m_fence.Get(), m_fenceValue));
+	m_frameFenceValues[m_frameIndex] = m_fenceValue;
 
-	// Wait until the previous frame is finished.
-	if (m_fence->GetCompletedValue() < fence)
+	// Only wait if the GPU is still busy with the last frame recorded into the next slot,
+	// with more than one frame in flight the CPU records while the GPU renders.
+	m_frameIndex = m_swapChain->GetCurrentBackBufferIndex();
+	auto start = std::chrono::high_resolution_clock::now();
+	if (m_fence->GetCompletedValue() < m_frameFenceValues[m_frameIndex])
 	{
-		ThrowIfFailed(m_fence->SetEventOnCompletion(fence, m_fenceEvent));
+		ThrowIfFailed(m_fence->SetEventOnCompletion(m_frameFenceValues[m_frameIndex], m_fenceEvent));
 		WaitForSingleObject(m_fenceEvent, INFINITE);
 	}
-
-	m_frameIndex = m_swapChain->GetCurrentBackBufferIndex();
+	m_cpuWaitMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	if (++m_cpuWaitFrames == 300) {
+		printf("Frames in flight: %u, CPU waited %.3f ms/frame for the GPU\n", m_framesInFlight, m_cpuWaitMs / m_cpuWaitFrames);
+		m_cpuWaitMs = 0.0;
+		m_cpuWaitFrames = 0;
+	}
+}
+void D3D12HelloTriangle::WaitForGpu()
+{
+	m_fenceValue++;
+	ThrowIfFailed(m_commandQueue->Signal(m_fence.Get(), m_fenceValue));
+	ThrowIfFailed(m_fence->SetEventOnCompletion(m_fenceValue, m_fenceEvent));
+	WaitForSingleObject(m_fenceEvent, INFINITE);
 }
 D3D12HelloTriangle::AccelerationStructureBuffers
 D3D12HelloTriangle::CreateBottomLevelAS(std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>> vVertexBuffers,
 										std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>> vIndexBuffers,
-										std::vector<ComPtr<ID3D12Resource>> vTransformBuffers) {
+										std::vector<ComPtr<ID3D12Resource>> vTransformBuffers, std::vector<bool> vOpaque, ASBuildPolicy policy, BlasRecord* record) {
 
 	nv_helpers_dx12::BottomLevelASGenerator bottomLevelAS; 
+	UINT64 opaqueTriangles = 0;
+	UINT64 nonOpaqueTriangles = 0;
 	// Adding all vertex buffers and not transforming their position for now
 	for (size_t i = 0; i < vVertexBuffers.size(); i++) {
+		// Non-opaque geometry invokes the any-hit shaders (alpha test), opaque geometry never does
+		bool isOpaque = i < vOpaque.size() ? vOpaque[i] : true;
+		UINT64 triangles = (i < vIndexBuffers.size() && vIndexBuffers[i].second > 0 ? vIndexBuffers[i].second : vVertexBuffers[i].second) / 3;
+		(isOpaque ? opaqueTriangles : nonOpaqueTriangles) += triangles;
 		if (vTransformBuffers.size() > 0) {
 			if (i < vIndexBuffers.size() && vIndexBuffers[i].second > 0)
-				bottomLevelAS.AddVertexBuffer(vVertexBuffers[i].first.Get(), 0, vVertexBuffers[i].second, sizeof(Vertex), vIndexBuffers[i].first.Get(), 0, vIndexBuffers[i].second, vTransformBuffers[i].Get(), 0, true);
+				bottomLevelAS.AddVertexBuffer(vVertexBuffers[i].first.Get(), 0, vVertexBuffers[i].second, sizeof(Vertex), vIndexBuffers[i].first.Get(), 0, vIndexBuffers[i].second, vTransformBuffers[i].Get(), 0, isOpaque);
 			else
-				bottomLevelAS.AddVertexBuffer(vVertexBuffers[i].first.Get(), 0, vVertexBuffers[i].second, sizeof(Vertex), 0, 0, 0, vTransformBuffers[i].Get(), 0, true);
+				bottomLevelAS.AddVertexBuffer(vVertexBuffers[i].first.Get(), 0, vVertexBuffers[i].second, sizeof(Vertex), 0, 0, 0, vTransformBuffers[i].Get(), 0, isOpaque);
 		}
 		else {
 			if (i < vIndexBuffers.size() && vIndexBuffers[i].second > 0)
-				bottomLevelAS.AddVertexBuffer(vVertexBuffers[i].first.Get(), 0, vVertexBuffers[i].second, sizeof(Vertex), vIndexBuffers[i].first.Get(), 0, vIndexBuffers[i].second, nullptr, 0, true);
+				bottomLevelAS.AddVertexBuffer(vVertexBuffers[i].first.Get(), 0, vVertexBuffers[i].second, sizeof(Vertex), vIndexBuffers[i].first.Get(), 0, vIndexBuffers[i].second, nullptr, 0, isOpaque);
 			else
-				bottomLevelAS.AddVertexBuffer(vVertexBuffers[i].first.Get(), 0, vVertexBuffers[i].second, sizeof(Vertex), 0, 0, 0);
+				bottomLevelAS.AddVertexBuffer(vVertexBuffers[i].first.Get(), 0, vVertexBuffers[i].second, sizeof(Vertex), nullptr, 0, isOpaque);
 
 		}
 	}
 	UINT64 scratchSizeInBytes = 0; 
 	UINT64 resultSizeInBytes = 0; 
-	bottomLevelAS.ComputeASBufferSizes(m_device.Get(), false, &scratchSizeInBytes, &resultSizeInBytes); 
+	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags = GetASBuildFlags(policy);
+	bottomLevelAS.ComputeASBufferSizes(m_device.Get(), buildFlags, &scratchSizeInBytes, &resultSizeInBytes); 
 	AccelerationStructureBuffers buffers; 
 	buffers.pScratch = nv_helpers_dx12::CreateBuffer( m_device.Get(), scratchSizeInBytes, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps); 
 	buffers.pResult = nv_helpers_dx12::CreateBuffer( m_device.Get(), resultSizeInBytes, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, nv_helpers_dx12::kDefaultHeapProps); 
-	bottomLevelAS.Generate(m_commandList.Get(), buffers.pScratch.Get(), buffers.pResult.Get(), false, nullptr); 
+
+	// The compacted size and the timestamps go to the query slot of the build, they are read back by the flush
+	const bool compact = (buildFlags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION) != 0;
+	UINT slot = static_cast<UINT>(m_PendingBlases.size());
+	if (slot / kBlasQueriesPerChunk >= m_BlasQueryChunks.size()) {
+		BlasQueryChunk chunk;
+		chunk.compactedSizes = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(UINT64) * kBlasQueriesPerChunk, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nv_helpers_dx12::kDefaultHeapProps);
+		D3D12_QUERY_HEAP_DESC queryHeapDesc = {};
+		queryHeapDesc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+		queryHeapDesc.Count = 2 * kBlasQueriesPerChunk;
+		ThrowIfFailed(m_device->CreateQueryHeap(&queryHeapDesc, IID_PPV_ARGS(&chunk.timestamps)));
+		chunk.readback = nv_helpers_dx12::CreateBuffer(m_device.Get(), 3 * sizeof(UINT64) * kBlasQueriesPerChunk, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COPY_DEST, nv_helpers_dx12::kReadbackHeapProps);
+		m_BlasQueryChunks.push_back(chunk);
+	}
+	BlasQueryChunk& chunk = m_BlasQueryChunks[slot / kBlasQueriesPerChunk];
+	UINT chunkSlot = slot % kBlasQueriesPerChunk;
+	// The build reads the uploaded geometry, the direct queue waits for the copies on the GPU
+	m_Uploads.MakeVisible(m_commandQueue.Get(), m_commandList.Get());
+	m_commandList->EndQuery(chunk.timestamps.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 2 * chunkSlot);
+	bottomLevelAS.Generate(m_commandList.Get(), buffers.pScratch.Get(), buffers.pResult.Get(), false, nullptr,
+		compact ? chunk.compactedSizes->GetGPUVirtualAddress() + sizeof(UINT64) * chunkSlot : 0);
+	m_commandList->EndQuery(chunk.timestamps.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 2 * chunkSlot + 1);
+
+	BlasRecord localRecord;
+	if (!record)
+		record = &localRecord;
+	record->policy = policy;
+	record->buildFlags = buildFlags;
+	record->buffers = buffers;
+	record->generator = bottomLevelAS;
+	record->resultSizeInBytes = resultSizeInBytes;
+	record->opaqueTriangles = opaqueTriangles;
+	record->nonOpaqueTriangles = nonOpaqueTriangles;
+	m_BlasRecords.push_back(*record);
+	m_PendingBlases.push_back(m_BlasRecords.size() - 1);
 	return buffers;
 }
-// tuple of bottom level AS,  matrix of the instance and number of hit groups
-void D3D12HelloTriangle::CreateTopLevelAS(const std::vector<std::tuple<ComPtr<ID3D12Resource>, DirectX::XMMATRIX, UINT>>& instances, bool updateOnly) {
+void D3D12HelloTriangle::FlushBottomLevelAS(Model* model) {
+	if (m_PendingBlases.empty() && m_PendingMipHeaps.empty())
+		return;
+	UINT pendingCount = static_cast<UINT>(m_PendingBlases.size());
+	for (UINT first = 0; first < pendingCount; first += kBlasQueriesPerChunk) {
+		BlasQueryChunk& chunk = m_BlasQueryChunks[first / kBlasQueriesPerChunk];
+		UINT count = (std::min)(pendingCount - first, UINT(kBlasQueriesPerChunk));
+		CD3DX12_RESOURCE_BARRIER transition = CD3DX12_RESOURCE_BARRIER::Transition(chunk.compactedSizes.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE);
+		m_commandList->ResourceBarrier(1, &transition);
+		m_commandList->CopyBufferRegion(chunk.readback.Get(), 0, chunk.compactedSizes.Get(), 0, sizeof(UINT64) * count);
+		transition = CD3DX12_RESOURCE_BARRIER::Transition(chunk.compactedSizes.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+		m_commandList->ResourceBarrier(1, &transition);
+		m_commandList->ResolveQueryData(chunk.timestamps.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 0, 2 * count, chunk.readback.Get(), sizeof(UINT64) * kBlasQueriesPerChunk);
+	}
+	// All builds of the batch and the mip generation recorded with them in one submit
+	ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
+	ThrowIfFailed(m_commandList->Close());
+	m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
+	WaitForGpu();
+	ThrowIfFailed(m_commandList->Reset(m_commandAllocator.Get(), nullptr));
+	m_PendingMipHeaps.clear();
+
+	UINT64 frequency = 1;
+	ThrowIfFailed(m_commandQueue->GetTimestampFrequency(&frequency));
+	// The originals stay alive until the copies are done
+	std::vector<std::pair<size_t, ComPtr<ID3D12Resource>>> compacted;
+	for (UINT first = 0; first < pendingCount; first += kBlasQueriesPerChunk) {
+		BlasQueryChunk& chunk = m_BlasQueryChunks[first / kBlasQueriesPerChunk];
+		UINT count = (std::min)(pendingCount - first, UINT(kBlasQueriesPerChunk));
+		UINT64* pQueries;
+		CD3DX12_RANGE readRange(0, 3 * sizeof(UINT64) * kBlasQueriesPerChunk);
+		ThrowIfFailed(chunk.readback->Map(0, &readRange, reinterpret_cast<void**>(&pQueries)));
+		const UINT64* pTimestamps = pQueries + kBlasQueriesPerChunk;
+		for (UINT i = 0; i < count; i++) {
+			BlasRecord& record = m_BlasRecords[m_PendingBlases[first + i]];
+			record.buildTimeMs = 1000.0 * (pTimestamps[2 * i + 1] - pTimestamps[2 * i]) / frequency;
+			// Scratch memory is only needed again if the BLAS gets refitted
+			if (GetASUpdateStrategy(record.policy) != ASUpdateStrategy::Refit)
+				record.buffers.pScratch.Reset();
+			if ((record.buildFlags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION) == 0)
+				continue;
+			// Copy into a buffer of the exact size and drop the original one
+			record.compactedSizeInBytes = ROUND_UP(pQueries[i], D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
+			ComPtr<ID3D12Resource> compactedResult = nv_helpers_dx12::CreateBuffer(m_device.Get(), record.compactedSizeInBytes, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, nv_helpers_dx12::kDefaultHeapProps);
+			m_commandList->CopyRaytracingAccelerationStructure(compactedResult->GetGPUVirtualAddress(), record.buffers.pResult->GetGPUVirtualAddress(),
+				D3D12_RAYTRACING_ACCELERATION_STRUCTURE_COPY_MODE_COMPACT);
+			compacted.push_back({ m_PendingBlases[first + i], compactedResult });
+		}
+		CD3DX12_RANGE writeRange(0, 0);
+		chunk.readback->Unmap(0, &writeRange);
+	}
+	m_PendingBlases.clear();
+	if (compacted.empty())
+		return;
+	// All compactions in a second submit
+	ThrowIfFailed(m_commandList->Close());
+	m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
+	WaitForGpu();
+	ThrowIfFailed(m_commandList->Reset(m_commandAllocator.Get(), nullptr));
+	std::unordered_map<uint64_t, uint64_t> remap;
+	for (auto& entry : compacted) {
+		BlasRecord& record = m_BlasRecords[entry.first];
+		remap[reinterpret_cast<uint64_t>(record.buffers.pResult.Get())] = reinterpret_cast<uint64_t>(entry.second.Get());
+		record.buffers.pResult = entry.second;
+	}
+	if (!model)
+		return;
+	auto remapBlas = [&remap](uint64_t& blasPointer) {
+		auto it = remap.find(blasPointer);
+		if (it != remap.end())
+			blasPointer = it->second;
+	};
+	remapBlas(model->m_BlasPointer);
+	for (auto& level : model->m_lods) {
+		remapBlas(level.blasPointer);
+	}
+	for (auto& nodeInstance : model->m_nodeInstances) {
+		remapBlas(nodeInstance.blasPointer);
+	}
+}
+D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS D3D12HelloTriangle::GetASBuildFlags(ASBuildPolicy policy) {
+	switch (policy) {
+	case ASBuildPolicy::Static:
+		return D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE | D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION;
+	case ASBuildPolicy::Hero:
+		return D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+	case ASBuildPolicy::Deformable:
+		return D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD | D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE;
+	case ASBuildPolicy::Streamed:
+		return D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD | D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_MINIMIZE_MEMORY;
+	}
+	return D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
+}
+void D3D12HelloTriangle::ReportAccelerationStructures() {
+	UINT64 totalSize = 0;
+	double totalTime = 0.0;
+	UINT64 totalOpaque = 0;
+	UINT64 totalNonOpaque = 0;
+	printf("---------------- BLAS report ----------------\n");
+	for (auto& record : m_BlasRecords) {
+		UINT64 size = record.compactedSizeInBytes > 0 ? record.compactedSizeInBytes : record.resultSizeInBytes;
+		printf("%-40s policy: %-10s flags: 0x%02x size: %10.1f KB (prebuild %10.1f KB) build: %8.2f ms triangles: %llu opaque / %llu non-opaque\n",
+			record.modelName.c_str(), GetASBuildPolicyName(record.policy), static_cast<UINT>(record.buildFlags),
+			size / 1024.0, record.resultSizeInBytes / 1024.0, record.buildTimeMs, record.opaqueTriangles, record.nonOpaqueTriangles);
+		totalSize += size;
+		totalTime += record.buildTimeMs;
+		totalOpaque += record.opaqueTriangles;
+		totalNonOpaque += record.nonOpaqueTriangles;
+		if (record.ommStats.MicroTriangles() > 0) {
+			printf("%-40s opacity micromap: %llu micro-triangles, %.1f%% resolved without any-hit, baked in %.2f ms\n", "",
+				record.ommStats.MicroTriangles(), 100.0 * record.ommStats.ResolvedFraction(), record.ommStats.bakeTimeMs);
+		}
+	}
+	printf("%zu BLASes, %.1f KB, %.2f ms, %llu opaque / %llu non-opaque triangles\n", m_BlasRecords.size(), totalSize / 1024.0, totalTime, totalOpaque, totalNonOpaque);
+}
+// bottom level AS, matrix of the instance, number of hit groups, mask, flags and user ID
+void D3D12HelloTriangle::CreateTopLevelAS(const std::vector<SceneInstance>& instances, bool updateOnly) {
 	if (!updateOnly)
 	{
 		// Gather all the instances into the builder helper 
 		for (size_t i = 0; i < instances.size(); i++)
 		{
-			m_topLevelASGenerator.AddInstance(std::get<0>(instances[i]).Get(), std::get<1>(instances[i]), static_cast<UINT>(i),
+			// Shaders find the instance data with InstanceIndex(), InstanceID() is left to gameplay
+			m_topLevelASGenerator.AddInstance(instances[i].blas.Get(), instances[i].transform, instances[i].userID,
 				// Hit group id refers to the order in which we added Hit Groups to SBT
-				static_cast<UINT>(std::get<2>(instances[i]) * i)); //2 is for 2 shaders - hit and shadow hit
+				instances[i].hitGroupOffset,
+				instances[i].instanceMask, instances[i].flags);
 		}
 		UINT64 scratchSize, resultSize, instanceDescsSize;
-		m_topLevelASGenerator.ComputeASBufferSizes(m_device.Get(), true, &scratchSize, &resultSize, &instanceDescsSize);
+		m_topLevelASGenerator.ComputeASBufferSizes(m_device.Get(), m_TlasBuildFlags, &scratchSize, &resultSize, &instanceDescsSize);
 		m_topLevelASBuffers.pScratch = nv_helpers_dx12::CreateBuffer(m_device.Get(), scratchSize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
 		m_topLevelASBuffers.pResult = nv_helpers_dx12::CreateBuffer(m_device.Get(), resultSize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, nv_helpers_dx12::kDefaultHeapProps);
-		m_topLevelASBuffers.pInstanceDesc = nv_helpers_dx12::CreateBuffer(m_device.Get(), instanceDescsSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, nv_helpers_dx12::kUploadHeapProps);
+		for (UINT n = 0; n < m_framesInFlight; n++) {
+			m_TlasInstanceDescs[n] = nv_helpers_dx12::CreateBuffer(m_device.Get(), instanceDescsSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, nv_helpers_dx12::kUploadHeapProps);
+		}
 		
 	}
 	// After all the buffers are allocated, or if only an update is required, we 
 		// can build the acceleration structure. Note that in the case of the update 
 		// we also pass the existing AS as the 'previous' AS, so that it can be 
 		// refitted in place.
-	m_topLevelASGenerator.Generate(m_commandList.Get(), m_topLevelASBuffers.pScratch.Get(), m_topLevelASBuffers.pResult.Get(), m_topLevelASBuffers.pInstanceDesc.Get());
+	m_topLevelASGenerator.Generate(m_commandList.Get(), m_topLevelASBuffers.pScratch.Get(), m_topLevelASBuffers.pResult.Get(), m_TlasInstanceDescs[m_frameIndex].Get(),
+		updateOnly, updateOnly ? m_topLevelASBuffers.pResult.Get() : nullptr);
 	
 }
 void D3D12HelloTriangle::ReCreateAccelerationStructures() {
@@ -620,23 +902,44 @@ void D3D12HelloTriangle::ReCreateAccelerationStructures() {
 	ThrowIfFailed(m_commandList->Reset(m_commandAllocator.Get(), nullptr));
 }
 // Camera----REWRITE FOR A PROPER CAM--------------------------------------------------------------
-void D3D12HelloTriangle::CreateCameraBuffer() {
-	uint32_t nbMatrix = 4; // view, perspective, viewInv, perspectiveInv 
-	m_cameraBufferSize = nbMatrix * sizeof(XMMATRIX); // discuss, how we can work with GLM instead of DXMath
-	// Create the constant buffer for all matrices 
-	m_cameraBuffer = nv_helpers_dx12::CreateBuffer( m_device.Get(), m_cameraBufferSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, nv_helpers_dx12::kUploadHeapProps); 
-	// Create a descriptor heap that will be used by the rasterization shaders 
-	//m_constHeap = nv_helpers_dx12::CreateDescriptorHeap( m_device.Get(), 1, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, true); //In our case REMOVE 
-	// Describe and create the constant buffer view. 
-	D3D12_CONSTANT_BUFFER_VIEW_DESC cbvDesc = {}; 
-	cbvDesc.BufferLocation = m_cameraBuffer->GetGPUVirtualAddress(); 
-	cbvDesc.SizeInBytes = m_cameraBufferSize; 
-	
-	m_camHeapIndex = nv_helpers_dx12::CreateBufferView(m_device.Get(), m_cameraBuffer.Get(), m_cameraBuffer->GetGPUVirtualAddress(),
-		m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::CBV);
+void D3D12HelloTriangle::CreateFrameConstants() {
+	m_FrameConstants.Init(m_device.Get(), kFrameConstantsSliceSize, m_framesInFlight);
+	// The shaders find the camera and the frame index by heap index, so every slot keeps its own descriptors.
+	// OnUpdate writes them before the slot records its frame
+	UINT descriptorSize = m_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+	for (UINT n = 0; n < m_framesInFlight; n++) {
+		m_camHeapIndices[n] = m_CbvSrvUavIndex++;
+		m_FrameHeapIndices[n] = m_CbvSrvUavIndex++;
+		m_CbvSrvUavHandle.ptr += 2 * descriptorSize;
+	}
+}
+void D3D12HelloTriangle::CreateLightDescriptors() {
+	UINT descriptorSize = m_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+	m_LightTrianglesHeapIndex = m_CbvSrvUavIndex++;
+	m_LightGeometriesHeapIndex = m_CbvSrvUavIndex++;
+	m_CbvSrvUavHandle.ptr += 2 * descriptorSize;
+	for (UINT n = 0; n < m_framesInFlight; n++) {
+		m_LightInstancesHeapIndices[n] = m_CbvSrvUavIndex++;
+		m_CbvSrvUavHandle.ptr += descriptorSize;
+	}
+}
+void D3D12HelloTriangle::UpdateLights() {
+	if (!m_MappedLightInstances[m_frameIndex])
+		return;
+	// Lower levels of detail have other triangles, skinned instances never had a light list
+	m_LightTransforms.resize(m_instances.size());
+	std::vector<lights::InstanceLights> instances = m_InstanceLights;
+	for (size_t i = 0; i < m_instances.size(); i++) {
+		memcpy(glm::value_ptr(m_LightTransforms[i]), &m_instances[i].transform, sizeof(glm::mat4));
+		if (m_instances[i].lod != 0 || !m_nextEventEstimation)
+			instances[i].mesh = nullptr;
+	}
+	double power = lights::BuildInstanceTable(instances, m_LightTransforms, m_LightInstanceTable);
+	memcpy(m_MappedLightInstances[m_frameIndex], m_LightInstanceTable.data(), sizeof(lights::GpuInstance) * m_LightInstanceTable.size());
+	m_LightInstanceCount = power > 0.0 ? static_cast<uint32_t>(m_LightInstanceTable.size()) : 0;
 }
 void D3D12HelloTriangle::UpdateCameraBuffer() {
-	std::vector<XMMATRIX> matrices(4);
+	XMMATRIX matrices[4]; // view, perspective, viewInv, perspectiveInv
 
 	// Initialize the view matrix, ideally this should be based on user
 	// interactions The lookat and perspective matrices used for rasterization are
@@ -656,18 +959,53 @@ void D3D12HelloTriangle::UpdateCameraBuffer() {
 	matrices[2] = XMMatrixInverse(&det, matrices[0]);
 	matrices[3] = XMMatrixInverse(&det, matrices[1]);
 
-	// Copy the matrix contents
-	uint8_t* pData;
-	ThrowIfFailed(m_cameraBuffer->Map(0, nullptr, (void**)&pData));
-	memcpy(pData, matrices.data(), m_cameraBufferSize);
-	m_cameraBuffer->Unmap(0, nullptr);
+	// Upload heaps are write combined, the matrices are only written there
+	FrameConstants::Constant<XMMATRIX> camera = m_FrameConstants.Allocate<XMMATRIX>(4);
+	memcpy(camera.cpu, matrices, sizeof(matrices));
+	CD3DX12_CPU_DESCRIPTOR_HANDLE handle(m_CbvSrvUavHeap->GetCPUDescriptorHandleForHeapStart(), m_camHeapIndices[m_frameIndex],
+		m_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV));
+	m_FrameConstants.CreateConstantBufferView(camera, handle);
 }
 void D3D12HelloTriangle::UpdateFrameIndexBuffer() {
 	m_FrameNumber++;
-	uint8_t* pData;
-	ThrowIfFailed(m_FrameIndexBuffer->Map(0, nullptr, (void**)&pData));
-	memcpy(pData, &m_FrameNumber, sizeof(uint32_t));
-	m_FrameIndexBuffer->Unmap(0, nullptr);
+	FrameConstants::Constant<uint32_t> frameNumber = m_FrameConstants.Allocate<uint32_t>();
+	*frameNumber.cpu = m_FrameNumber;
+	CD3DX12_CPU_DESCRIPTOR_HANDLE handle(m_CbvSrvUavHeap->GetCPUDescriptorHandleForHeapStart(), m_FrameHeapIndices[m_frameIndex],
+		m_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV));
+	m_FrameConstants.CreateStructuredBufferView(frameNumber, 1, handle);
+}
+void D3D12HelloTriangle::UpdateAccumulation() {
+	// Everything the path traced image depends on, after the animations and level of detail switches
+	m_AccumulationState.Clear();
+	m_AccumulationState.Add(nv_helpers_dx12::CameraManip.getMatrix());
+	m_AccumulationState.Add(m_renderMode);
+	m_AccumulationState.Add(m_pathMaxBounces);
+	m_AccumulationState.Add(m_nextEventEstimation);
+	m_AccumulationState.Add(m_pathRouletteDepth);
+	m_AccumulationState.Add(m_currentScene);
+	for (const SceneInstance& instance : m_instances) {
+		m_AccumulationState.Add(instance.transform);
+		m_AccumulationState.Add(instance.blas.Get());
+		m_AccumulationState.Add(instance.instanceMask);
+	}
+	// Skinned poses follow the animation time
+	for (const AnimatedModel& animated : m_AnimatedModels) {
+		m_AccumulationState.Add(animated.instance.time);
+	}
+	m_AccumulationFrame = m_Accumulation.Advance(m_AccumulationState);
+	if (m_renderMode == render::kPathTracingMode && (m_AccumulationFrame.reset || m_Accumulation.GetSampleCount() % 16 == 0)) {
+		std::wstring text = L"path tracing, " + std::to_wstring(m_Accumulation.GetSampleCount()) + L" spp";
+		SetCustomWindowText(text.c_str());
+	}
+}
+void D3D12HelloTriangle::UpdateHeapIndexBuffer() {
+	if (!m_MappedHeapIndices[m_frameIndex])
+		return;
+	// Common indexes: output, TLAS, camera, frame index, accumulation, light triangles, light geometries, light instances
+	m_AllHeapIndices[2] = m_camHeapIndices[m_frameIndex];
+	m_AllHeapIndices[3] = m_FrameHeapIndices[m_frameIndex];
+	m_AllHeapIndices[7] = m_LightInstancesHeapIndices[m_frameIndex];
+	memcpy(m_MappedHeapIndices[m_frameIndex], m_AllHeapIndices.data(), sizeof(uint32_t) * m_AllHeapIndices.size());
 }
 //--------------------------------------------------------------------------------------------------
 void D3D12HelloTriangle::OnButtonDown(UINT32 lParam) {
@@ -692,6 +1030,388 @@ void D3D12HelloTriangle::OnMouseMove(UINT8 wParam, UINT32 lParam) {
 	CameraManip.mouseMove(-GET_X_LPARAM(lParam), -GET_Y_LPARAM(lParam), inputs);
 }
  // -------------Loads GLTF from file, launches recursion and stores BLAS
+ // Local transform of a glTF node, either its matrix or T * R * S
+ static glm::mat4 GetGLTFNodeTransform(const tinygltf::Node& node) {
+	 if (node.matrix.size() == 16) {
+		 glm::mat4 matrix;
+		 for (int i = 0; i < 16; i++) {
+			 glm::value_ptr(matrix)[i] = static_cast<float>(node.matrix[i]);
+		 }
+		 return matrix;
+	 }
+	 glm::mat4 translation(1.f);
+	 glm::mat4 rotation(1.f);
+	 glm::mat4 scale(1.f);
+	 if (node.translation.size() == 3)
+		 translation = glm::translate(glm::vec3(node.translation[0], node.translation[1], node.translation[2]));
+	 if (node.rotation.size() == 4)
+		 rotation = glm::mat4_cast(glm::normalize(glm::quat(float(node.rotation[3]), float(node.rotation[0]), float(node.rotation[1]), float(node.rotation[2]))));
+	 if (node.scale.size() == 3)
+		 scale = glm::scale(glm::vec3(node.scale[0], node.scale[1], node.scale[2]));
+	 return translation * rotation * scale;
+ }
+ // Reads up to 4 components of every element of an accessor, normalized integers are mapped to [0, 1] or [-1, 1]
+ static void ReadGLTFAccessorVec4(const tinygltf::Model& model, const tinygltf::Accessor& accessor, std::vector<glm::vec4>& out) {
+	 const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
+	 const unsigned char* data = &model.buffers[bufferView.buffer].data[bufferView.byteOffset + accessor.byteOffset];
+	 int stride = accessor.ByteStride(bufferView);
+	 int components = glm::min(4, tinygltf::GetNumComponentsInType(accessor.type));
+	 out.assign(accessor.count, glm::vec4(0.f));
+	 for (size_t i = 0; i < accessor.count; i++) {
+		 const unsigned char* element = data + i * stride;
+		 for (int c = 0; c < components; c++) {
+			 switch (accessor.componentType) {
+			 case TINYGLTF_COMPONENT_TYPE_FLOAT:
+				 out[i][c] = reinterpret_cast<const float*>(element)[c];
+				 break;
+			 case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+				 out[i][c] = accessor.normalized ? element[c] / 255.f : element[c];
+				 break;
+			 case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+				 out[i][c] = accessor.normalized ? reinterpret_cast<const uint16_t*>(element)[c] / 65535.f : reinterpret_cast<const uint16_t*>(element)[c];
+				 break;
+			 case TINYGLTF_COMPONENT_TYPE_BYTE:
+				 out[i][c] = accessor.normalized ? glm::max(reinterpret_cast<const int8_t*>(element)[c] / 127.f, -1.f) : reinterpret_cast<const int8_t*>(element)[c];
+				 break;
+			 case TINYGLTF_COMPONENT_TYPE_SHORT:
+				 out[i][c] = accessor.normalized ? glm::max(reinterpret_cast<const int16_t*>(element)[c] / 32767.f, -1.f) : reinterpret_cast<const int16_t*>(element)[c];
+				 break;
+			 }
+		 }
+	 }
+ }
+ // Parents and rest pose local transforms of all nodes
+ static void BuildGLTFNodeHierarchy(const tinygltf::Model& model, skin::NodeHierarchy& hierarchy) {
+	 hierarchy.parents.assign(model.nodes.size(), -1);
+	 hierarchy.localTransforms.clear();
+	 for (size_t i = 0; i < model.nodes.size(); i++) {
+		 hierarchy.localTransforms.push_back(GetGLTFNodeTransform(model.nodes[i]));
+		 for (int child : model.nodes[i].children) {
+			 hierarchy.parents[child] = static_cast<int>(i);
+		 }
+	 }
+	 hierarchy.Finalize();
+ }
+ // Nodes of the default scene which reference a mesh, in the order BuildModelRecursive visits them
+ static void CollectGLTFMeshNodes(const tinygltf::Model& model, std::vector<int>& meshNodes) {
+	 auto& scene = model.scenes[model.defaultScene];
+	 std::vector<int> stack(scene.nodes.rbegin(), scene.nodes.rend());
+	 while (!stack.empty()) {
+		 int node = stack.back();
+		 stack.pop_back();
+		 if (model.nodes[node].mesh >= 0)
+			 meshNodes.push_back(node);
+		 stack.insert(stack.end(), model.nodes[node].children.rbegin(), model.nodes[node].children.rend());
+	 }
+ }
+ // Model space bounding sphere around the POSITION bounds of every mesh node of the default scene
+ static glm::vec4 ComputeGLTFBoundingSphere(const tinygltf::Model& model, const skin::NodeHierarchy& hierarchy) {
+	 std::vector<glm::mat4> globals;
+	 hierarchy.ComputeGlobalTransforms(globals);
+	 std::vector<int> meshNodes;
+	 CollectGLTFMeshNodes(model, meshNodes);
+	 glm::vec3 boundsMin((std::numeric_limits<float>::max)());
+	 glm::vec3 boundsMax(-(std::numeric_limits<float>::max)());
+	 for (int node : meshNodes) {
+		 for (auto& prim : model.meshes[model.nodes[node].mesh].primitives) {
+			 auto position = prim.attributes.find("POSITION");
+			 if (position == prim.attributes.end())
+				 continue;
+			 // glTF requires min and max for positions
+			 const tinygltf::Accessor& accessor = model.accessors[position->second];
+			 if (accessor.minValues.size() < 3 || accessor.maxValues.size() < 3)
+				 continue;
+			 for (int corner = 0; corner < 8; corner++) {
+				 glm::vec4 p((corner & 1) ? accessor.maxValues[0] : accessor.minValues[0], (corner & 2) ? accessor.maxValues[1] : accessor.minValues[1],
+					 (corner & 4) ? accessor.maxValues[2] : accessor.minValues[2], 1.0);
+				 glm::vec3 world(globals[node] * p);
+				 boundsMin = glm::min(boundsMin, world);
+				 boundsMax = glm::max(boundsMax, world);
+			 }
+		 }
+	 }
+	 if (boundsMin.x > boundsMax.x)
+		 return glm::vec4(0.f);
+	 return glm::vec4(0.5f * (boundsMin + boundsMax), 0.5f * glm::length(boundsMax - boundsMin));
+ }
+ // Indices of a primitive widened to 32 bit
+ static void ReadGLTFIndices(const tinygltf::Model& model, const tinygltf::Accessor& indexAccessor, std::vector<UINT>& indexData) {
+	 const tinygltf::BufferView& indexBufferView = model.bufferViews[indexAccessor.bufferView];
+	 const unsigned char* data = &model.buffers[indexBufferView.buffer].data[indexBufferView.byteOffset + indexAccessor.byteOffset];
+	 indexData.resize(indexAccessor.count);
+	 for (size_t i = 0; i < indexAccessor.count; i++) {
+		 switch (indexAccessor.componentType) {
+		 case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+			 indexData[i] = data[i];
+			 break;
+		 case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+			 indexData[i] = reinterpret_cast<const UINT16*>(data)[i];
+			 break;
+		 case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+			 indexData[i] = reinterpret_cast<const UINT32*>(data)[i];
+			 break;
+		 }
+	 }
+ }
+ // TRANSLATION, ROTATION and SCALE accessors of an EXT_mesh_gpu_instancing node
+ static void ReadGLTFInstancingAttributes(const tinygltf::Model& model, const tinygltf::Value& extension, instancing::InstanceAttributes& attributes) {
+	 const char* names[3] = { "TRANSLATION", "ROTATION", "SCALE" };
+	 std::vector<glm::vec4>* values[3] = { &attributes.translations, &attributes.rotations, &attributes.scales };
+	 attributes.count = 0;
+	 if (!extension.Has("attributes"))
+		 return;
+	 const tinygltf::Value& accessors = extension.Get("attributes");
+	 for (int i = 0; i < 3; i++) {
+		 if (!accessors.Has(names[i]))
+			 continue;
+		 const tinygltf::Accessor& accessor = model.accessors[accessors.Get(names[i]).GetNumberAsInt()];
+		 ReadGLTFAccessorVec4(model, accessor, *values[i]);
+		 attributes.count = static_cast<uint32_t>(accessor.count);
+	 }
+ }
+ // What the path tracing closest hit reads of a glTF material, the factors as FillInfoPBR fills them
+ static pt::Material ReadGLTFPathTracingMaterial(const tinygltf::Model& model, const tinygltf::Material& materialGLTF) {
+	 pt::Material material;
+	 const std::vector<double>& baseColorFactor = materialGLTF.pbrMetallicRoughness.baseColorFactor;
+	 material.baseColor = glm::vec4(float(baseColorFactor[0]), float(baseColorFactor[1]), float(baseColorFactor[2]), float(baseColorFactor[3]));
+	 if (materialGLTF.pbrMetallicRoughness.baseColorTexture.index >= 0)
+		 material.baseTexture = model.textures[materialGLTF.pbrMetallicRoughness.baseColorTexture.index].source;
+	 double emissiveStrength = 1.0;
+	 auto extension = materialGLTF.extensions.find("KHR_materials_emissive_strength");
+	 if (extension != materialGLTF.extensions.end() && extension->second.IsObject())
+		 emissiveStrength = extension->second.Get("emissiveStrength").GetNumberAsDouble();
+	 material.emissive = glm::vec3(float(materialGLTF.emissiveFactor[0] * emissiveStrength), float(materialGLTF.emissiveFactor[1] * emissiveStrength),
+		 float(materialGLTF.emissiveFactor[2] * emissiveStrength));
+	 if (materialGLTF.emissiveTexture.index >= 0)
+		 material.emissiveTexture = model.textures[materialGLTF.emissiveTexture.index].source;
+	 return material;
+ }
+ // Model space light triangles of a primitive, in its index order, nothing if the primitive doesn't emit.
+ // The emission is estimated from the emissive texture like the CPU path tracer samples it
+ static void ReadGLTFLightTriangles(const tinygltf::Model& model, const tinygltf::Primitive& prim, const XMMATRIX& modelSpaceTrans, std::vector<lights::Triangle>& triangles) {
+	 triangles.clear();
+	 if (prim.material < 0 || prim.indices < 0 || (prim.mode != -1 && prim.mode != TINYGLTF_MODE_TRIANGLES))
+		 return;
+	 const tinygltf::Material& materialGLTF = model.materials[prim.material];
+	 pt::Material material = ReadGLTFPathTracingMaterial(model, materialGLTF);
+	 if (material.emissiveTexture < 0 || lights::Luminance(material.emissive) <= 0.f)
+		 return;
+	 auto texcoord = prim.attributes.find("TEXCOORD_" + std::to_string(materialGLTF.emissiveTexture.texCoord));
+	 if (texcoord == prim.attributes.end())
+		 return;
+	 // Only the emissive texture, 8 bit like the path tracer reference reads it
+	 std::vector<pt::Texture> textures(model.images.size());
+	 const tinygltf::Image& image = model.images[material.emissiveTexture];
+	 if (image.bits == 8) {
+		 textures[material.emissiveTexture].pixels = image.image;
+		 textures[material.emissiveTexture].width = image.width;
+		 textures[material.emissiveTexture].height = image.height;
+		 textures[material.emissiveTexture].components = image.component;
+	 }
+	 std::vector<glm::vec4> positions;
+	 std::vector<glm::vec4> texcoords;
+	 std::vector<UINT> indexData;
+	 ReadGLTFAccessorVec4(model, model.accessors[prim.attributes.at("POSITION")], positions);
+	 ReadGLTFAccessorVec4(model, model.accessors[texcoord->second], texcoords);
+	 ReadGLTFIndices(model, model.accessors[prim.indices], indexData);
+	 // The node transform is baked into the BLAS like into the light triangles
+	 glm::mat4 transform;
+	 memcpy(glm::value_ptr(transform), &modelSpaceTrans, sizeof(transform));
+	 for (size_t i = 0; i + 2 < indexData.size(); i += 3) {
+		 lights::Triangle triangle;
+		 glm::vec3* corners[3] = { &triangle.p0, &triangle.p1, &triangle.p2 };
+		 for (int corner = 0; corner < 3; corner++) {
+			 *corners[corner] = glm::vec3(transform * glm::vec4(glm::vec3(positions[indexData[i + corner]]), 1.f));
+		 }
+		 triangle.emission = pt::EstimateEmission(material, textures, glm::vec2(texcoords[indexData[i]]), glm::vec2(texcoords[indexData[i + 1]]), glm::vec2(texcoords[indexData[i + 2]]));
+		 triangles.push_back(triangle);
+	 }
+ }
+ // Key in m_ModelLights of the lights of a mesh, for models with a BLAS per mesh
+ static std::string GetMeshLightsName(const std::string& model, int mesh) {
+	 return model + " [mesh " + std::to_string(mesh) + "]";
+ }
+ // The first count texcoord sets of a primitive, TEXCOORD_0 to TEXCOORD_<count - 1>
+ static void ReadGLTFTexcoordSets(const tinygltf::Model& model, const tinygltf::Primitive& prim, uint32_t count, std::vector<std::vector<glm::vec2>>& sets) {
+	 sets.assign(count, std::vector<glm::vec2>());
+	 std::vector<glm::vec4> values;
+	 for (uint32_t i = 0; i < count; i++) {
+		 ReadGLTFAccessorVec4(model, model.accessors[prim.attributes.at("TEXCOORD_" + std::to_string(i))], values);
+		 for (const glm::vec4& value : values) {
+			 sets[i].push_back(glm::vec2(value));
+		 }
+	 }
+ }
+ // World space triangles of every mesh node of the default scene, for the CPU BVH builders.
+ // surfaces gets their shading data for the CPU path tracer
+ static bool LoadGLTFMesh(const std::string& name, bvh::Mesh& mesh, pt::Surfaces* surfaces = nullptr) {
+	 tinygltf::TinyGLTF context;
+	 tinygltf::Model model;
+	 std::string error;
+	 std::string warning;
+	 if (!context.LoadASCIIFromFile(&model, &error, &warning, name))
+		 return false;
+	 skin::NodeHierarchy hierarchy;
+	 BuildGLTFNodeHierarchy(model, hierarchy);
+	 std::vector<glm::mat4> globals;
+	 hierarchy.ComputeGlobalTransforms(globals);
+	 std::vector<int> meshNodes;
+	 CollectGLTFMeshNodes(model, meshNodes);
+	 mesh.positions.clear();
+	 mesh.triangles.clear();
+	 if (surfaces)
+		 *surfaces = pt::Surfaces();
+	 std::vector<glm::vec4> positions;
+	 std::vector<glm::vec4> attributeValues; // Of the path tracing attributes
+	 std::vector<UINT> indexData;
+	 for (int node : meshNodes) {
+		 for (auto& prim : model.meshes[model.nodes[node].mesh].primitives) {
+			 auto position = prim.attributes.find("POSITION");
+			 if (position == prim.attributes.end() || (prim.mode != -1 && prim.mode != TINYGLTF_MODE_TRIANGLES))
+				 continue;
+			 ReadGLTFAccessorVec4(model, model.accessors[position->second], positions);
+			 if (prim.indices >= 0) {
+				 ReadGLTFIndices(model, model.accessors[prim.indices], indexData);
+			 }
+			 else {
+				 indexData.resize(positions.size());
+				 for (size_t i = 0; i < indexData.size(); i++) {
+					 indexData[i] = static_cast<UINT>(i);
+				 }
+			 }
+			 uint32_t firstVertex = static_cast<uint32_t>(mesh.positions.size());
+			 for (const glm::vec4& p : positions) {
+				 mesh.positions.push_back(glm::vec3(globals[node] * glm::vec4(glm::vec3(p), 1.f)));
+			 }
+			 for (size_t i = 0; i + 2 < indexData.size(); i += 3) {
+				 mesh.triangles.push_back(glm::uvec3(indexData[i], indexData[i + 1], indexData[i + 2]) + firstVertex);
+			 }
+			 if (!surfaces)
+				 continue;
+			 // Normals get the node transform like the GPU does, missing attributes read as zero
+			 glm::mat3 normalTransform(globals[node]);
+			 auto readAttribute = [&](const char* attribute) {
+				 auto accessor = prim.attributes.find(attribute);
+				 if (accessor != prim.attributes.end())
+					 ReadGLTFAccessorVec4(model, model.accessors[accessor->second], attributeValues);
+				 else
+					 attributeValues.assign(positions.size(), glm::vec4(0.f));
+			 };
+			 readAttribute("NORMAL");
+			 for (const glm::vec4& normal : attributeValues) {
+				 surfaces->normals.push_back(normalTransform * glm::vec3(normal));
+			 }
+			 readAttribute("TEXCOORD_0");
+			 for (const glm::vec4& texcoord : attributeValues) {
+				 surfaces->texcoords.push_back(glm::vec2(texcoord));
+			 }
+			 // Primitives without a material get the default one after the glTF materials
+			 uint32_t material = prim.material >= 0 ? static_cast<uint32_t>(prim.material) : static_cast<uint32_t>(model.materials.size());
+			 surfaces->triangleMaterials.resize(mesh.triangles.size(), material);
+		 }
+	 }
+	 if (surfaces) {
+		 surfaces->materials.clear();
+		 for (const tinygltf::Material& material : model.materials) {
+			 surfaces->materials.push_back(ReadGLTFPathTracingMaterial(model, material));
+		 }
+		 surfaces->materials.push_back(pt::Material());
+		 surfaces->textures.resize(model.images.size());
+		 for (size_t i = 0; i < model.images.size(); i++) {
+			 // Only 8 bit images, the others sample as white
+			 const tinygltf::Image& image = model.images[i];
+			 if (image.bits != 8)
+				 continue;
+			 surfaces->textures[i].pixels = image.image;
+			 surfaces->textures[i].width = image.width;
+			 surfaces->textures[i].height = image.height;
+			 surfaces->textures[i].components = image.component;
+		 }
+	 }
+	 return true;
+ }
+ // Builds the scene with every CPU builder and prints build time and quality
+ static void CompareBvhBuilders(const std::string& name, const bvh::Mesh& mesh) {
+	 std::vector<bvh::Aabb> bounds;
+	 mesh.GetTriangleBounds(bounds);
+	 bvh::BuildSettings settings;
+	 printf("%s (%zu triangles)\n", name.c_str(), bounds.size());
+	 auto print = [&](const char* builder, const bvh::Bvh& tree, double ms) {
+		 printf("  %-14s build %9.2f ms (%6.2f Mtris/s), SAH cost %8.2f, %8zu nodes, depth %u%s\n", builder, ms, ms > 0.0 ? bounds.size() / (ms * 1000.0) : 0.0,
+			 bvh::SahCost(tree, settings), tree.nodes.size(), bvh::Depth(tree), bvh::Validate(tree, bounds) ? "" : ", INVALID");
+	 };
+	 bvh::Bvh tree;
+	 auto start = std::chrono::high_resolution_clock::now();
+	 bvh::BuildBinned(bounds, settings, tree);
+	 bvh::CollapseLeaves(tree, settings);
+	 print("binned SAH", tree, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+	 bvh::SbvhSettings sbvhSettings;
+	 bvh::SbvhStats sbvhStats;
+	 start = std::chrono::high_resolution_clock::now();
+	 bvh::BuildSbvh(mesh, sbvhSettings, tree, &sbvhStats);
+	 bvh::CollapseLeaves(tree, settings);
+	 print("SBVH", tree, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+	 printf("  SBVH references: %u (+%.1f%%, cap +%.0f%%), %u spatial splits at overlap threshold %g\n", sbvhStats.references,
+		 bounds.empty() ? 0.0 : 100.0 * (sbvhStats.references - bounds.size()) / bounds.size(), 100.0 * sbvhSettings.maxReferenceGrowth, sbvhStats.spatialSplits, sbvhSettings.overlapThreshold);
+	 bvh::LbvhSettings lbvhSettings;
+	 bvh::LbvhTimings timings;
+	 lbvhSettings.treeletSize = 0;
+	 bvh::BuildLbvh(bounds, lbvhSettings, tree, &timings);
+	 print("LBVH", tree, timings.totalMs);
+	 lbvhSettings = bvh::LbvhSettings();
+	 bvh::BuildLbvh(bounds, lbvhSettings, tree, &timings);
+	 print("LBVH+treelets", tree, timings.totalMs);
+	 printf("  LBVH phases: Morton %.2f ms, sort %.2f ms, hierarchy %.2f ms, treelets %.2f ms\n", timings.mortonMs, timings.sortMs, timings.hierarchyMs, timings.treeletMs);
+ }
+ // Closest hit rays per second through the binned and spatial split BVHs and their wide collapses, on all threads
+ static void CompareBvhTraversal(const bvh::Mesh& mesh, uint32_t rayCount) {
+	 std::vector<bvh::Aabb> bounds;
+	 mesh.GetTriangleBounds(bounds);
+	 bvh::Aabb sceneBounds;
+	 for (const bvh::Aabb& b : bounds) {
+		 sceneBounds.Grow(b);
+	 }
+	 bvh::BuildSettings settings;
+	 bvh::Bvh binary;
+	 bvh::BuildBinned(bounds, settings, binary);
+	 bvh::CollapseLeaves(binary, settings);
+	 bvh::Bvh4 wide4;
+	 bvh::Bvh8 wide8;
+	 bvh::CollapseToWide(binary, wide4);
+	 bvh::CollapseToWide(binary, wide8);
+	 bvh::Bvh spatial;
+	 bvh::Bvh8 spatial8;
+	 bvh::BuildSbvh(mesh, bvh::SbvhSettings(), spatial);
+	 bvh::CollapseLeaves(spatial, settings);
+	 bvh::CollapseToWide(spatial, spatial8);
+	 std::vector<bvh::Ray> rays;
+	 bvh::MakeRandomRays(sceneBounds, rayCount, rays);
+	 std::vector<uint32_t> reference(rayCount), primitives(rayCount);
+	 auto trace = [&](const char* layout, size_t nodeCount, std::vector<uint32_t>& results, auto intersect) {
+		 auto start = std::chrono::high_resolution_clock::now();
+		 ParallelFor(rayCount, 1024, 0, [&](uint32_t first, uint32_t last, uint32_t) {
+			 bvh::Hit hit;
+			 for (uint32_t i = first; i < last; i++) {
+				 intersect(rays[i], hit);
+				 results[i] = hit.primitive;
+			 }
+		 });
+		 double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		 uint32_t mismatches = 0;
+		 for (uint32_t i = 0; i < rayCount; i++) {
+			 mismatches += results[i] != reference[i] ? 1 : 0;
+		 }
+		 printf("  %-21s %8zu nodes, %7.2f Mrays/s%s\n", layout, nodeCount, rayCount / (ms * 1000.0),
+			 mismatches > 0 ? (", " + std::to_string(mismatches) + " hits differ from the binary BVH").c_str() : "");
+	 };
+	 trace("binary", binary.nodes.size(), reference, [&](const bvh::Ray& ray, bvh::Hit& hit) { bvh::Intersect(binary, mesh, ray, hit); });
+	 std::string layout4 = std::string("4 wide (") + bvh::GetWideKernelName(4) + ")";
+	 trace(layout4.c_str(), wide4.nodes.size(), primitives, [&](const bvh::Ray& ray, bvh::Hit& hit) { bvh::Intersect(wide4, mesh, ray, hit); });
+	 std::string layout8 = std::string("8 wide (") + bvh::GetWideKernelName(8) + ")";
+	 trace(layout8.c_str(), wide8.nodes.size(), primitives, [&](const bvh::Ray& ray, bvh::Hit& hit) { bvh::Intersect(wide8, mesh, ray, hit); });
+	 trace("SBVH binary", spatial.nodes.size(), primitives, [&](const bvh::Ray& ray, bvh::Hit& hit) { bvh::Intersect(spatial, mesh, ray, hit); });
+	 trace(("SBVH " + layout8).c_str(), spatial8.nodes.size(), primitives, [&](const bvh::Ray& ray, bvh::Hit& hit) { bvh::Intersect(spatial8, mesh, ray, hit); });
+ }
  void D3D12HelloTriangle::LoadModelRecursive(const std::string& name, Model* model)
  {
 	 tinygltf::TinyGLTF context;
@@ -714,14 +1434,18 @@ void D3D12HelloTriangle::OnMouseMove(UINT8 wParam, UINT32 lParam) {
 	 std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>> modelVertexAndNum;
 	 std::vector <std::pair<ComPtr<ID3D12Resource>, uint32_t>> modelIndexAndNum;
 	 std::vector <ComPtr<ID3D12Resource >> transforms;
+	 std::vector<bool> opaqueGeometry;
+	 omm::BakeStats ommStats;
+	 SkinnedModel skinnedModel;
 	 std::vector<uint32_t> primitiveIndexes = { 0 };
 	 std::vector<uint32_t> imageIndexes;
+	 m_LodPrimitives.clear();
 
 	 // The first data for the model - its primitive indexes buffer
 	  // Update Primitive Buffer according to the new data
 	 ComPtr<ID3D12Resource> primBuffer;
 	 primBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(uint32_t) * primitiveIndexes.size(), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
-	 nv_helpers_dx12::CopyToDirectResource(m_device.Get(), m_commandList.Get(), primBuffer.Get(), &primitiveIndexes[0], sizeof(uint32_t) * primitiveIndexes.size());
+	 m_Uploads.UploadBuffer(primBuffer.Get(), &primitiveIndexes[0], sizeof(uint32_t) * primitiveIndexes.size());
 	
 	 // -------------Primitive Heap Upload------------------------
 	 model->m_heapPointer = nv_helpers_dx12::CreateBufferView(m_device.Get(), primBuffer.Get(),primBuffer->GetGPUVirtualAddress(),
@@ -731,50 +1455,240 @@ void D3D12HelloTriangle::OnMouseMove(UINT8 wParam, UINT32 lParam) {
 	 // ---------------Load Images To Heap--------------------
 	 LoadImageData(m_TestModel, imageIndexes);
 	
+	 // ---------------Node hierarchy---------------------------
+	 // Shared by skinning, animation and per mesh instances
+	 skin::NodeHierarchy hierarchy;
+	 BuildGLTFNodeHierarchy(m_TestModel, hierarchy);
+	 model->m_boundingSphere = ComputeGLTFBoundingSphere(m_TestModel, hierarchy);
+	 // ---------------GPU instancing--------------------------
+	 // Instances of a node share the mesh BLAS, so they need one BLAS per mesh
+	 for (auto& node : m_TestModel.nodes) {
+		 if (node.mesh >= 0 && node.extensions.count("EXT_mesh_gpu_instancing") > 0 && model->m_blasGranularity != BlasGranularity::Mesh) {
+			 printf("%s uses EXT_mesh_gpu_instancing, using one BLAS per mesh\n", name.c_str());
+			 model->m_blasGranularity = BlasGranularity::Mesh;
+		 }
+	 }
+	 // ---------------Skinning--------------------------------
+	 // The node hierarchy drives the joints, every primitive of a skinned mesh gets deformed by the skinning pass
+	 if (!m_TestModel.skins.empty()) {
+		 skinnedModel.modelName = name;
+		 skinnedModel.hierarchy = hierarchy;
+		 // Skinned BLASes are refitted every time the pose changes
+		 if (model->m_buildPolicy != ASBuildPolicy::Deformable) {
+			 printf("%s is skinned, using the deformable build policy instead of %s\n", name.c_str(), GetASBuildPolicyName(model->m_buildPolicy));
+			 model->m_buildPolicy = ASBuildPolicy::Deformable;
+		 }
+		 // Joint matrices are relative to the mesh node whose transform is baked into the model BLAS
+		 if (model->m_blasGranularity != BlasGranularity::Model) {
+			 printf("%s is skinned, using one BLAS for the whole model\n", name.c_str());
+			 model->m_blasGranularity = BlasGranularity::Model;
+		 }
+	 }
+	 if (model->m_blasGranularity == BlasGranularity::Mesh) {
+		 BuildMeshAccelerationStructures(m_TestModel, model, name, hierarchy, imageIndexes);
+		 LoadAnimations(m_TestModel, name, hierarchy, -1);
+		 return;
+	 }
 	 // ---------------Upload model data to GPU
 	 auto& scene = m_TestModel.scenes[m_TestModel.defaultScene];
+	 m_LightGeometries.clear();
 	 for (size_t i = 0; i < scene.nodes.size(); i++) {
-		 BuildModelRecursive(m_TestModel, model, scene.nodes[i], XMMatrixIdentity(), transforms, modelVertexAndNum, modelIndexAndNum, primitiveIndexes, imageIndexes);
+		 BuildModelRecursive(m_TestModel, model, scene.nodes[i], XMMatrixIdentity(), transforms, modelVertexAndNum, modelIndexAndNum, opaqueGeometry, ommStats, skinnedModel, primitiveIndexes, imageIndexes,
+			 model->m_buildPolicy == ASBuildPolicy::Deformable ? nullptr : &m_LodPrimitives);
 	 }
 	 
 	 // --------Update Primitive Buffer according to the new data
 	 ComPtr<ID3D12Resource> newPrimBuffer;
 	 newPrimBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(uint32_t) * primitiveIndexes.size(), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
-	 nv_helpers_dx12::CopyToDirectResource(m_device.Get(), m_commandList.Get(), newPrimBuffer.Get(), &primitiveIndexes[0], sizeof(uint32_t) * primitiveIndexes.size());
+	 m_Uploads.UploadBuffer(newPrimBuffer.Get(), &primitiveIndexes[0], sizeof(uint32_t) * primitiveIndexes.size());
 
 	 
 	 // ---------------Heap Data Update------------------------
 	 nv_helpers_dx12::ChangeSRVResourceLoaction(m_device.Get(), newPrimBuffer.Get(), m_CbvSrvUavHeap.Get(), model->m_heapPointer, sizeof(uint32_t));
-	 
-	 ThrowIfFailed(m_commandList->Close());
-	 ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
-	 m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
-	 m_fenceValue++;
-	 m_commandQueue->Signal(m_fence.Get(), m_fenceValue);
-	 m_fence->SetEventOnCompletion(m_fenceValue, m_fenceEvent);
-	 WaitForSingleObject(m_fenceEvent, INFINITE);
-	 ThrowIfFailed(m_commandList->Reset(m_commandAllocator.Get(), nullptr));
 
-	 AccelerationStructureBuffers AS = CreateBottomLevelAS(modelVertexAndNum, modelIndexAndNum, transforms);
-	 ComPtr<ID3D12Resource> m_modelBLASBuffer = AS.pResult;
-	 model->m_BlasPointer = reinterpret_cast<UINT64>(m_modelBLASBuffer.Get());
+	 // The BLAS build makes the uploads recorded above visible
+	 BlasRecord record;
+	 record.modelName = name;
+	 record.ommStats = ommStats;
+	 AccelerationStructureBuffers AS = CreateBottomLevelAS(modelVertexAndNum, modelIndexAndNum, transforms, opaqueGeometry, model->m_buildPolicy, &record);
+	 if (!skinnedModel.primitives.empty()) {
+		 skinnedModel.blasRecord = m_BlasRecords.size() - 1;
+		 // Refitting reads all the BLAS inputs again
+		 for (size_t i = 0; i < modelVertexAndNum.size(); i++) {
+			 skinnedModel.blasInputs.push_back(modelVertexAndNum[i].first);
+			 skinnedModel.blasInputs.push_back(modelIndexAndNum[i].first);
+			 skinnedModel.blasInputs.push_back(transforms[i]);
+		 }
+		 skinnedModel.jointMatrices.resize(skinnedModel.skins.size());
+		 // The skinning pass of a frame reads the matrices of its frame slot while the next frame writes its own
+		 for (auto& modelSkin : skinnedModel.skins) {
+			 for (UINT n = 0; n < FrameCount; n++) {
+				 ComPtr<ID3D12Resource> jointMatrixBuffer;
+				 jointMatrixBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(glm::mat4) * glm::max<size_t>(1, modelSkin.jointNodes.size()), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, nv_helpers_dx12::kUploadHeapProps);
+				 glm::mat4* mapped;
+				 CD3DX12_RANGE readRange(0, 0);
+				 ThrowIfFailed(jointMatrixBuffer->Map(0, &readRange, reinterpret_cast<void**>(&mapped)));
+				 skinnedModel.jointMatrixBuffers.push_back(jointMatrixBuffer);
+				 skinnedModel.mappedJointMatrices.push_back(mapped);
+			 }
+		 }
+		 m_SkinnedModels.push_back(skinnedModel);
+	 }
+	 LoadAnimations(m_TestModel, name, hierarchy, skinnedModel.primitives.empty() ? -1 : static_cast<int>(m_SkinnedModels.size() - 1));
+	 // Deformed triangles move away from the light list, the bounces still find them
+	 lights::MeshLights meshLights;
+	 if (model->m_buildPolicy != ASBuildPolicy::Deformable && lights::BuildMeshLights(m_LightGeometries, meshLights)) {
+		 printf("%s has %zu emissive triangles\n", name.c_str(), meshLights.triangles.size());
+		 m_ModelLights[name] = std::move(meshLights);
+	 }
+	 model->m_BlasPointer = reinterpret_cast<UINT64>(AS.pResult.Get());
+	 model->m_lods.push_back({ model->m_BlasPointer, model->m_heapPointer, record.opaqueTriangles + record.nonOpaqueTriangles });
  }
 
 
+ void D3D12HelloTriangle::BuildMeshAccelerationStructures(tinygltf::Model& model, Model* modelData, const std::string& name, const skin::NodeHierarchy& hierarchy, std::vector<uint32_t>& imageHeapIds) {
+	 std::vector<glm::mat4> globals;
+	 hierarchy.ComputeGlobalTransforms(globals);
+	 std::vector<int> meshNodes;
+	 CollectGLTFMeshNodes(model, meshNodes);
+	 // BLAS and primitive indexes heap pointer of every mesh, built when the first node references it
+	 std::vector<std::pair<UINT64, uint32_t>> meshBlases(model.meshes.size(), { 0, 0 });
+	 std::vector<uint64_t> meshTriangles(model.meshes.size(), 0);
+	 size_t blasCount = 0;
+	 for (int node : meshNodes) {
+		 int mesh = model.nodes[node].mesh;
+		 if (meshBlases[mesh].first == 0) {
+			 std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>> meshVertexAndNum;
+			 std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>> meshIndexAndNum;
+			 std::vector<ComPtr<ID3D12Resource>> transforms;
+			 std::vector<bool> opaqueGeometry;
+			 omm::BakeStats ommStats;
+			 SkinnedModel noSkinning;
+			 std::vector<uint32_t> primitiveIndexes;
+			 m_LightGeometries.clear();
+			 // Identity transform and no skin, the node transform goes into the TLAS instance instead
+			 BuildMeshPrimitives(model, mesh, XMMatrixIdentity(), -1, transforms, meshVertexAndNum, meshIndexAndNum, opaqueGeometry, ommStats, noSkinning, primitiveIndexes, imageHeapIds, nullptr);
+
+			 ComPtr<ID3D12Resource> primBuffer;
+			 primBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(uint32_t) * primitiveIndexes.size(), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+			 m_Uploads.UploadBuffer(primBuffer.Get(), &primitiveIndexes[0], sizeof(uint32_t) * primitiveIndexes.size());
+			 meshBlases[mesh].second = nv_helpers_dx12::CreateBufferView(m_device.Get(), primBuffer.Get(), primBuffer->GetGPUVirtualAddress(),
+				 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(uint32_t));
+
+			 // The BLAS build makes the uploads recorded above visible
+			 BlasRecord record;
+			 record.modelName = name + " [" + (model.meshes[mesh].name.empty() ? std::to_string(mesh) : model.meshes[mesh].name) + "]";
+			 record.ommStats = ommStats;
+			 AccelerationStructureBuffers AS = CreateBottomLevelAS(meshVertexAndNum, meshIndexAndNum, transforms, opaqueGeometry, modelData->m_buildPolicy, &record);
+			 meshBlases[mesh].first = reinterpret_cast<UINT64>(AS.pResult.Get());
+			 meshTriangles[mesh] = record.opaqueTriangles + record.nonOpaqueTriangles;
+			 blasCount++;
+			 // Every node and instance of the mesh shares its light triangles
+			 lights::MeshLights meshLights;
+			 if (modelData->m_buildPolicy != ASBuildPolicy::Deformable && lights::BuildMeshLights(m_LightGeometries, meshLights)) {
+				 printf("%s has %zu emissive triangles\n", record.modelName.c_str(), meshLights.triangles.size());
+				 m_ModelLights[GetMeshLightsName(name, mesh)] = std::move(meshLights);
+			 }
+		 }
+		 auto extension = model.nodes[node].extensions.find("EXT_mesh_gpu_instancing");
+		 if (extension == model.nodes[node].extensions.end()) {
+			 modelData->m_nodeInstances.push_back({ meshBlases[mesh].first, meshBlases[mesh].second, node, mesh, globals[node], glm::mat4(1.f), meshTriangles[mesh] });
+			 continue;
+		 }
+		 // Every instance becomes a TLAS instance of the mesh BLAS
+		 instancing::InstanceAttributes attributes;
+		 ReadGLTFInstancingAttributes(model, extension->second, attributes);
+		 std::vector<glm::mat4> transforms(attributes.count);
+		 instancing::ComposeInstanceTransformsParallel(attributes, globals[node], transforms.data());
+		 // Animation moves the node, the instance transforms below it are kept
+		 std::vector<glm::mat4> instanceTransforms(model.animations.empty() ? 0 : attributes.count);
+		 if (!instanceTransforms.empty())
+			 instancing::ComposeInstanceTransformsParallel(attributes, glm::mat4(1.f), instanceTransforms.data());
+		 for (uint32_t i = 0; i < attributes.count; i++) {
+			 modelData->m_nodeInstances.push_back({ meshBlases[mesh].first, meshBlases[mesh].second, node, mesh, transforms[i],
+				 instanceTransforms.empty() ? glm::mat4(1.f) : instanceTransforms[i], meshTriangles[mesh] });
+		 }
+	 }
+	 modelData->m_BlasPointer = modelData->m_nodeInstances.empty() ? 0 : modelData->m_nodeInstances[0].blasPointer;
+	 printf("%s: %zu TLAS instances of %zu mesh BLASes\n", name.c_str(), modelData->m_nodeInstances.size(), blasCount);
+ }
+ void D3D12HelloTriangle::LoadAnimations(const tinygltf::Model& model, const std::string& name, const skin::NodeHierarchy& hierarchy, int skinnedModel) {
+	 if (model.animations.empty())
+		 return;
+	 AnimatedModel animatedModel;
+	 animatedModel.modelName = name;
+	 animatedModel.hierarchy = hierarchy;
+	 for (auto& gltfAnimation : model.animations) {
+		 anim::Clip clip;
+		 clip.name = gltfAnimation.name;
+		 for (auto& gltfSampler : gltfAnimation.samplers) {
+			 anim::Sampler sampler;
+			 if (gltfSampler.interpolation == "STEP")
+				 sampler.interpolation = anim::Interpolation::Step;
+			 else if (gltfSampler.interpolation == "CUBICSPLINE")
+				 sampler.interpolation = anim::Interpolation::CubicSpline;
+			 std::vector<glm::vec4> times;
+			 ReadGLTFAccessorVec4(model, model.accessors[gltfSampler.input], times);
+			 for (auto& time : times) {
+				 sampler.times.push_back(time.x);
+			 }
+			 ReadGLTFAccessorVec4(model, model.accessors[gltfSampler.output], sampler.values);
+			 size_t valuesPerKey = sampler.interpolation == anim::Interpolation::CubicSpline ? 3 : 1;
+			 sampler.values.resize(sampler.times.size() * valuesPerKey);
+			 clip.samplers.push_back(sampler);
+		 }
+		 for (auto& gltfChannel : gltfAnimation.channels) {
+			 anim::Channel channel;
+			 // Morph target weights are not supported
+			 if (gltfChannel.target_path == "translation")
+				 channel.path = anim::Path::Translation;
+			 else if (gltfChannel.target_path == "rotation")
+				 channel.path = anim::Path::Rotation;
+			 else if (gltfChannel.target_path == "scale")
+				 channel.path = anim::Path::Scale;
+			 else
+				 continue;
+			 if (gltfChannel.target_node < 0 || gltfChannel.sampler < 0)
+				 continue;
+			 channel.sampler = static_cast<uint32_t>(gltfChannel.sampler);
+			 channel.node = static_cast<uint32_t>(gltfChannel.target_node);
+			 clip.channels.push_back(channel);
+		 }
+		 clip.Finalize();
+		 animatedModel.clips.push_back(clip);
+	 }
+	 // Animated nodes are TRS by the spec, channels override single components of the rest pose
+	 animatedModel.instance.restPose.resize(model.nodes.size());
+	 for (size_t i = 0; i < model.nodes.size(); i++) {
+		 auto& node = model.nodes[i];
+		 anim::NodeTRS& trs = animatedModel.instance.restPose[i];
+		 if (node.translation.size() == 3)
+			 trs.translation = glm::vec4(node.translation[0], node.translation[1], node.translation[2], 0.f);
+		 if (node.rotation.size() == 4)
+			 trs.rotation = glm::vec4(node.rotation[0], node.rotation[1], node.rotation[2], node.rotation[3]);
+		 if (node.scale.size() == 3)
+			 trs.scale = glm::vec4(node.scale[0], node.scale[1], node.scale[2], 0.f);
+	 }
+	 auto& scene = model.scenes[model.defaultScene];
+	 if (scene.nodes.size() == 1) {
+		 animatedModel.rootNode = scene.nodes[0];
+		 animatedModel.inverseRestRootGlobal = glm::inverse(hierarchy.localTransforms[animatedModel.rootNode]);
+	 }
+	 animatedModel.skinnedModel = skinnedModel;
+	 printf("%s: %zu animations, playing \"%s\" (%.2f s)\n", name.c_str(), animatedModel.clips.size(),
+		 animatedModel.clips[0].name.c_str(), animatedModel.clips[0].duration);
+	 m_AnimatedModels.push_back(animatedModel);
+ }
  void D3D12HelloTriangle::BuildModelRecursive(tinygltf::Model& model, Model* modelData, uint64_t nodeIndex, XMMATRIX parentMat, std::vector <ComPtr<ID3D12Resource >>& transforms,
 	 std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>& modelVertexAndNum, std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>& modelIndexAndNum, 
-	 std::vector<uint32_t>& primitiveIndexes, std::vector<uint32_t>& imageHeapIds) {
+	 std::vector<bool>& opaqueGeometry, omm::BakeStats& ommStats, SkinnedModel& skinnedModel, std::vector<uint32_t>& primitiveIndexes, std::vector<uint32_t>& imageHeapIds,
+	 std::vector<LodPrimitive>* lodPrimitives) {
 	 HRESULT hr = S_OK;
 	 // get the needed node
 	 auto& glTFNode = model.nodes[nodeIndex];
 	 XMMATRIX modelSpaceTrans = parentMat;
-	 bool hasMesh = glTFNode.mesh >= 0;
-	 ComPtr<ID3D12Resource> transBuffer;
 	 // Build Matrix
 	 {
-		 // Build a constant buffer for node transform matrix
-		 transBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(XMMATRIX), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
-
 		 // if GLTF node has a pre-specified matrix, use it
 		 if (glTFNode.matrix.size() == 16) {
 			 // transform GLTF vector with 16 values to GLM mat4
@@ -800,221 +1714,306 @@ void D3D12HelloTriangle::OnMouseMove(UINT8 wParam, UINT32 lParam) {
 			 }
 			 modelSpaceTrans = scMat * rotMat * trMat * parentMat;
 		 }
-		 nv_helpers_dx12::CopyToDirectResource(m_device.Get(), m_commandList.Get(), transBuffer.Get(), &modelSpaceTrans, sizeof(XMMATRIX));
 		 
 	 }
 	 // Build Primitive data
-	 {
-		 if (hasMesh) {
-			 auto& mesh = model.meshes[glTFNode.mesh];
-			 for (auto& prim : mesh.primitives) {
-
-				 transforms.push_back(transBuffer);
-
-				 ComPtr<ID3D12Resource> newVBuffer;
-				 modelVertexAndNum.push_back({ newVBuffer, 0 });
-
-				 ComPtr<ID3D12Resource> newIBuffer;
-				 modelIndexAndNum.push_back({ newIBuffer, 0 });
-
-				 const tinygltf::Accessor& vertexAccessor = model.accessors[prim.attributes.at("POSITION")];
-				 const tinygltf::Accessor& indexAccessor = model.accessors[prim.indices];
-
-				 const tinygltf::BufferView& vertexBufferView = model.bufferViews[vertexAccessor.bufferView];
-				 const tinygltf::BufferView& indexBufferView = model.bufferViews[indexAccessor.bufferView];
+	 if (glTFNode.mesh >= 0)
+		 BuildMeshPrimitives(model, glTFNode.mesh, modelSpaceTrans, static_cast<int>(nodeIndex), transforms, modelVertexAndNum, modelIndexAndNum, opaqueGeometry, ommStats, skinnedModel, primitiveIndexes, imageHeapIds, lodPrimitives);
 
-
-				 UINT vertexDataSize = vertexAccessor.count * vertexAccessor.ByteStride(vertexBufferView);
-				 UINT indexDataSize = indexAccessor.count * sizeof(UINT);
-
-				 const float* vertexData = reinterpret_cast<const float*>(&model.buffers[vertexBufferView.buffer].data[vertexBufferView.byteOffset + vertexAccessor.byteOffset]);
-
-				 std::vector<UINT> indexData;
-				 switch (indexAccessor.componentType) {
-					 case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-					 {
-						 const UINT8* indexLoadData8 = reinterpret_cast<const UINT8*>(&model.buffers[indexBufferView.buffer].data[indexBufferView.byteOffset + indexAccessor.byteOffset]);
-						 for (int i = 0; i < indexAccessor.count; i++) {
-							 UINT id = indexLoadData8[i];
-							 indexData.push_back(id);
-						 }
-					 }
-					 break;
-					 case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-					 {
-						 const UINT16* indexLoadData16 = reinterpret_cast<const UINT16*>(&model.buffers[indexBufferView.buffer].data[indexBufferView.byteOffset + indexAccessor.byteOffset]);
-						 for (int i = 0; i < indexAccessor.count; i++) {
-							 UINT id = indexLoadData16[i];
-							 indexData.push_back(id);
-						 }
-					 }
-					 break;
-					 case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-					 {
-						 const UINT32* indexLoadData32 = reinterpret_cast<UINT32*>(&model.buffers[indexBufferView.buffer].data[indexBufferView.byteOffset + indexAccessor.byteOffset]);
-						 for (int i = 0; i < indexAccessor.count; i++) {
-							 UINT id = indexLoadData32[i];
-							 indexData.push_back(id);
-						 }
-					 }
-					 break;
-				 }
-				 modelVertexAndNum.back().second = vertexAccessor.count;
-				 modelIndexAndNum.back().second = indexAccessor.count;
-
-				 modelVertexAndNum.back().first = nv_helpers_dx12::CreateBuffer(m_device.Get(), vertexDataSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
-				 nv_helpers_dx12::CopyToDirectResource(m_device.Get(), m_commandList.Get(), modelVertexAndNum.back().first.Get(), vertexData, vertexDataSize);
-				 modelIndexAndNum.back().first = nv_helpers_dx12::CreateBuffer(m_device.Get(), indexDataSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
-				 nv_helpers_dx12::CopyToDirectResource(m_device.Get(), m_commandList.Get(), modelIndexAndNum.back().first.Get(), &indexData[0], indexDataSize);
-				 
-				
-				 /*
-				 -------Primitive in heap---------
-				 Material
-				 Transform
-				 Positions
-				 Normals  (optional)
-				 Tangents (optional)
-				 Colors   (optional)
-				 TexCoords (optional)
-				 Indexes
-				 */
-				
-				 //
-				 MaterialStruct primMat;
-				 // Fill in and Upload material data
-				 {
-					 // Check which model data we have
-					 {
-						 // -----------------Normals --------------------------
-						 if (prim.attributes.find("NORMAL") != prim.attributes.end())
-							 primMat.hasNormals = 1;
-						 else
-							 primMat.hasNormals = 0;
-						 // -----------------Tangents --------------------------
-						 if (prim.attributes.find("TANGENT") != prim.attributes.end())
-							 primMat.hasTangents = 1;
-						 else
-							 primMat.hasTangents = 0;
-						 // -----------------Colors --------------------------
-						 if (prim.attributes.find("COLOR_0") != prim.attributes.end())
-							 primMat.hasColors = 1;
-						 else
-							 primMat.hasColors = 0;
-						 // -----------------Texcoords --------------------------
-						 // we will cover a wide range of texture coords
-						 primMat.hasTexcoords = 0;
-						 for (int i = 0; i < 10; i++) {
-							 std::string name = "TEXCOORD_" + std::to_string(i);
-							 if (prim.attributes.find(name.c_str()) != prim.attributes.end())
-								 primMat.hasTexcoords += 1;
-						 }
-					 }
-					 FillInfoPBR(model, prim, &primMat, imageHeapIds);
-					 //----------------Create material Buffer + Push to Heap-----------------------
-					 {
-						 ComPtr<ID3D12Resource> newMatBuffer;
-						 newMatBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(MaterialStruct), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
-						 nv_helpers_dx12::CopyToDirectResource(m_device.Get(), m_commandList.Get(), newMatBuffer.Get(), &primMat, sizeof(MaterialStruct));
-
-						 // ---------------Heap Upload------------------------
-						 // WE START PRIMITIVE DATA IN A HEAP FROM MATERIAL OF THE FIRST PRIMITIVE
-						 primitiveIndexes.push_back(
-							 nv_helpers_dx12::CreateBufferView(m_device.Get(), newMatBuffer.Get(), newMatBuffer->GetGPUVirtualAddress(),
-								 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(MaterialStruct)));
+	 // continue with node's children (we pass paren's model matrix to get the correct transform for children)
+	 for (size_t i = 0; i < glTFNode.children.size(); i++) {
+		 BuildModelRecursive(model, modelData, glTFNode.children[i], modelSpaceTrans, transforms, modelVertexAndNum, modelIndexAndNum, opaqueGeometry, ommStats, skinnedModel, primitiveIndexes, imageHeapIds, lodPrimitives);
+	 }
+ }
+ void D3D12HelloTriangle::BuildMeshPrimitives(tinygltf::Model& model, int meshIndex, XMMATRIX transform, int skinNode, std::vector<ComPtr<ID3D12Resource>>& transforms,
+	 std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>& modelVertexAndNum, std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>& modelIndexAndNum,
+	 std::vector<bool>& opaqueGeometry, omm::BakeStats& ommStats, SkinnedModel& skinnedModel, std::vector<uint32_t>& primitiveIndexes, std::vector<uint32_t>& imageHeapIds,
+	 std::vector<LodPrimitive>* lodPrimitives) {
+	 int skinIndex = skinNode >= 0 ? model.nodes[skinNode].skin : -1;
+	 // Build a constant buffer for the transform matrix
+	 ComPtr<ID3D12Resource> transBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(XMMATRIX), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+	 m_Uploads.UploadBuffer(transBuffer.Get(), &transform, sizeof(XMMATRIX));
+	 auto& mesh = model.meshes[meshIndex];
+	 for (auto& prim : mesh.primitives) {
+
+		 transforms.push_back(transBuffer);
+
+		 ComPtr<ID3D12Resource> newVBuffer;
+		 modelVertexAndNum.push_back({ newVBuffer, 0 });
+
+		 ComPtr<ID3D12Resource> newIBuffer;
+		 modelIndexAndNum.push_back({ newIBuffer, 0 });
+
+		 const tinygltf::Accessor& vertexAccessor = model.accessors[prim.attributes.at("POSITION")];
+		 const tinygltf::Accessor& indexAccessor = model.accessors[prim.indices];
+
+		 const tinygltf::BufferView& vertexBufferView = model.bufferViews[vertexAccessor.bufferView];
+
+
+		 UINT vertexDataSize = vertexAccessor.count * vertexAccessor.ByteStride(vertexBufferView);
+		 UINT indexDataSize = indexAccessor.count * sizeof(UINT);
+
+		 const float* vertexData = reinterpret_cast<const float*>(&model.buffers[vertexBufferView.buffer].data[vertexBufferView.byteOffset + vertexAccessor.byteOffset]);
+
+		 std::vector<UINT> indexData;
+		 ReadGLTFIndices(model, indexAccessor, indexData);
+		 modelVertexAndNum.back().second = vertexAccessor.count;
+		 modelIndexAndNum.back().second = indexAccessor.count;
+
+		 // Skinned primitives keep a copy of the bind pose, the skinning pass writes into the buffers the BLAS is built from
+		 bool skinned = skinIndex >= 0 && prim.attributes.find("JOINTS_0") != prim.attributes.end() && prim.attributes.find("WEIGHTS_0") != prim.attributes.end();
+		 SkinnedPrimitive skinnedPrim;
+		 std::vector<glm::vec3> bindPositions;
+		 if (skinned) {
+			 // The skinning pass reads and writes packed float3s
+			 int vertexStride = vertexAccessor.ByteStride(vertexBufferView);
+			 bindPositions.resize(vertexAccessor.count);
+			 for (size_t i = 0; i < vertexAccessor.count; i++) {
+				 memcpy(&bindPositions[i], reinterpret_cast<const unsigned char*>(vertexData) + i * vertexStride, sizeof(glm::vec3));
+			 }
+			 vertexData = &bindPositions[0].x;
+			 vertexDataSize = static_cast<UINT>(sizeof(glm::vec3) * bindPositions.size());
+		 }
+		 D3D12_RESOURCE_FLAGS vertexFlags = skinned ? D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS : D3D12_RESOURCE_FLAG_NONE;
+
+		 modelVertexAndNum.back().first = nv_helpers_dx12::CreateBuffer(m_device.Get(), vertexDataSize, vertexFlags, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+		 m_Uploads.UploadBuffer(modelVertexAndNum.back().first.Get(), vertexData, vertexDataSize);
+		 if (skinned) {
+			 skinnedPrim.vertexCount = static_cast<UINT>(vertexAccessor.count);
+			 skinnedPrim.positions = modelVertexAndNum.back().first;
+			 skinnedPrim.bindPositions = nv_helpers_dx12::CreateBuffer(m_device.Get(), vertexDataSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+			 m_Uploads.UploadBuffer(skinnedPrim.bindPositions.Get(), vertexData, vertexDataSize);
+			 // JOINTS_0 and WEIGHTS_0 can be stored as bytes, shorts or floats, the skinning pass wants uint4 and float4
+			 std::vector<glm::vec4> jointData;
+			 std::vector<glm::vec4> weightData;
+			 ReadGLTFAccessorVec4(model, model.accessors[prim.attributes.at("JOINTS_0")], jointData);
+			 ReadGLTFAccessorVec4(model, model.accessors[prim.attributes.at("WEIGHTS_0")], weightData);
+			 std::vector<glm::uvec4> jointIndices(jointData.begin(), jointData.end());
+			 skinnedPrim.joints = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(glm::uvec4) * jointIndices.size(), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+			 m_Uploads.UploadBuffer(skinnedPrim.joints.Get(), jointIndices.data(), sizeof(glm::uvec4) * jointIndices.size());
+			 skinnedPrim.weights = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(glm::vec4) * weightData.size(), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+			 m_Uploads.UploadBuffer(skinnedPrim.weights.Get(), weightData.data(), sizeof(glm::vec4) * weightData.size());
+
+			 // One skin entry per glTF skin and mesh node, the joint matrices are relative to the mesh node
+			 skinnedPrim.skin = static_cast<UINT>(skinnedModel.skins.size());
+			 for (size_t i = 0; i < skinnedModel.skins.size(); i++) {
+				 if (skinnedModel.skinSources[i] == skinIndex && skinnedModel.skins[i].meshNode == skinNode)
+					 skinnedPrim.skin = static_cast<UINT>(i);
+			 }
+			 if (skinnedPrim.skin == skinnedModel.skins.size()) {
+				 const tinygltf::Skin& skinGLTF = model.skins[skinIndex];
+				 skin::Skin newSkin;
+				 newSkin.jointNodes = skinGLTF.joints;
+				 newSkin.meshNode = skinNode;
+				 if (skinGLTF.inverseBindMatrices >= 0) {
+					 const tinygltf::Accessor& ibmAccessor = model.accessors[skinGLTF.inverseBindMatrices];
+					 const tinygltf::BufferView& ibmBufferView = model.bufferViews[ibmAccessor.bufferView];
+					 int ibmStride = ibmAccessor.ByteStride(ibmBufferView);
+					 const unsigned char* ibmData = &model.buffers[ibmBufferView.buffer].data[ibmBufferView.byteOffset + ibmAccessor.byteOffset];
+					 newSkin.inverseBindMatrices.resize(ibmAccessor.count);
+					 for (size_t i = 0; i < ibmAccessor.count; i++) {
+						 memcpy(&newSkin.inverseBindMatrices[i], ibmData + i * ibmStride, sizeof(glm::mat4));
 					 }
 				 }
-				 // Upload Transform to Heap
-				 nv_helpers_dx12::CreateBufferView(m_device.Get(), transBuffer.Get(), transBuffer->GetGPUVirtualAddress(),
-					 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(XMMATRIX));
-				 // Upload Positions to Heap
-				 nv_helpers_dx12::CreateBufferView(m_device.Get(), modelVertexAndNum.back().first.Get(), modelVertexAndNum.back().first->GetGPUVirtualAddress(),
-					 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(XMFLOAT3));
-				 // Fill in and Upload to Heap arbitrary Vertex data
-				 {
-					 // -----------------Normals --------------------------
-					 if (primMat.hasNormals == 1) {
-						 ComPtr<ID3D12Resource> newNormalBuffer;
-						 const tinygltf::Accessor& normalAccessor = model.accessors[prim.attributes.at("NORMAL")];
-						 const tinygltf::BufferView& normalBufferView = model.bufferViews[normalAccessor.bufferView];
-						 UINT normalDataSize = normalAccessor.count * normalAccessor.ByteStride(normalBufferView);
-						 const float* normalData = reinterpret_cast<const float*>(&model.buffers[normalBufferView.buffer].data[normalBufferView.byteOffset + normalAccessor.byteOffset]);
-
-						 newNormalBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), normalDataSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
-						 nv_helpers_dx12::CopyToDirectResource(m_device.Get(), m_commandList.Get(), newNormalBuffer.Get(), normalData, normalDataSize);
-
-						 // --------Upload to Heap-----------
-						 nv_helpers_dx12::CreateBufferView(m_device.Get(), newNormalBuffer.Get(), newNormalBuffer->GetGPUVirtualAddress(),
-							 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(XMFLOAT3));
-					 }
-					 //------------------------------------------------------
-
-					 // -----------------Tangents --------------------------
-					 if (primMat.hasTangents == 1) {
-						 ComPtr<ID3D12Resource> newTangentBuffer;
-						 const tinygltf::Accessor& tangentAccessor = model.accessors[prim.attributes.at("TANGENT")];
-						 const tinygltf::BufferView& tangentBufferView = model.bufferViews[tangentAccessor.bufferView];
-						 UINT tangentDataSize = tangentAccessor.count * tangentAccessor.ByteStride(tangentBufferView);
-						 const float* tangentData = reinterpret_cast<const float*>(&model.buffers[tangentBufferView.buffer].data[tangentBufferView.byteOffset + tangentAccessor.byteOffset]);
-
-						 newTangentBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), tangentDataSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
-						 nv_helpers_dx12::CopyToDirectResource(m_device.Get(), m_commandList.Get(), newTangentBuffer.Get(), tangentData, tangentDataSize);
-						 
-						 // --------Upload to Heap-----------
-						 nv_helpers_dx12::CreateBufferView(m_device.Get(), newTangentBuffer.Get(), newTangentBuffer->GetGPUVirtualAddress(),
-							 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(XMFLOAT4));
-					 }
-					 //------------------------------------------------------
-
-					 // -----------------Colors --------------------------
-					 if (primMat.hasColors == 1) {
-						 ComPtr<ID3D12Resource> newColorBuffer;
-						 const tinygltf::Accessor& colorAccessor = model.accessors[prim.attributes.at("COLOR_0")];
-						 const tinygltf::BufferView& colorBufferView = model.bufferViews[colorAccessor.bufferView];
-						 UINT colorDataSize = colorAccessor.count * colorAccessor.ByteStride(colorBufferView);
-						 const float* colorData = reinterpret_cast<const float*>(&model.buffers[colorBufferView.buffer].data[colorBufferView.byteOffset + colorAccessor.byteOffset]);
-
-						 newColorBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), colorDataSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
-						 nv_helpers_dx12::CopyToDirectResource(m_device.Get(), m_commandList.Get(), newColorBuffer.Get(), colorData, colorDataSize);
-						 // --------Upload to Heap-----------
-						 nv_helpers_dx12::CreateBufferView(m_device.Get(), newColorBuffer.Get(), newColorBuffer->GetGPUVirtualAddress(),
-							 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(XMFLOAT4));
-					 }
-					 //------------------------------------------------------
-
-					 // -----------------Texcoords --------------------------
-					 for (int i = 0; i < primMat.hasTexcoords; i++) {
-						 ComPtr<ID3D12Resource> newTexcoordBuffer;
-						 std::string name = "TEXCOORD_" + std::to_string(i);
-						 const tinygltf::Accessor& texcoordAccessor = model.accessors[prim.attributes.at(name.c_str())];
-						 const tinygltf::BufferView& texcoordBufferView = model.bufferViews[texcoordAccessor.bufferView];
-						 UINT texcoordDataSize = texcoordAccessor.count * texcoordAccessor.ByteStride(texcoordBufferView);
-						 const float* texcoordData = reinterpret_cast<const float*>(&model.buffers[texcoordBufferView.buffer].data[texcoordBufferView.byteOffset + texcoordAccessor.byteOffset]);
-
-						 newTexcoordBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), texcoordDataSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
-						 nv_helpers_dx12::CopyToDirectResource(m_device.Get(), m_commandList.Get(), newTexcoordBuffer.Get(), texcoordData, texcoordDataSize);
-						 
-						 // --------Upload to Heap-----------
-						 nv_helpers_dx12::CreateBufferView(m_device.Get(), newTexcoordBuffer.Get(), newTexcoordBuffer->GetGPUVirtualAddress(),
-							 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(XMFLOAT2));
-					 }
-					 //------------------------------------------------------
+				 skinnedModel.skins.push_back(newSkin);
+				 skinnedModel.skinSources.push_back(skinIndex);
+			 }
+		 }
+		 modelIndexAndNum.back().first = nv_helpers_dx12::CreateBuffer(m_device.Get(), indexDataSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+		 m_Uploads.UploadBuffer(modelIndexAndNum.back().first.Get(), &indexData[0], indexDataSize);
+		 
+		
+		 /*
+		 -------Primitive in heap---------
+		 Material
+		 Transform
+		 Positions
+		 Normals  (optional)
+		 Tangents (optional)
+		 Colors   (optional)
+		 TexCoords (optional)
+		 Indexes
+		 Triangle lods
+		 */
+		
+		 // Buffers of the views above the indexes, generated levels of detail view them again
+		 std::vector<std::pair<ComPtr<ID3D12Resource>, UINT>> primViews;
+		 MaterialStruct primMat;
+		 // Fill in and Upload material data
+		 {
+			 // Check which model data we have
+			 {
+				 // -----------------Normals --------------------------
+				 if (prim.attributes.find("NORMAL") != prim.attributes.end())
+					 primMat.hasNormals = 1;
+				 else
+					 primMat.hasNormals = 0;
+				 // -----------------Tangents --------------------------
+				 if (prim.attributes.find("TANGENT") != prim.attributes.end())
+					 primMat.hasTangents = 1;
+				 else
+					 primMat.hasTangents = 0;
+				 // -----------------Colors --------------------------
+				 if (prim.attributes.find("COLOR_0") != prim.attributes.end())
+					 primMat.hasColors = 1;
+				 else
+					 primMat.hasColors = 0;
+				 // -----------------Texcoords --------------------------
+				 // we will cover a wide range of texture coords
+				 primMat.hasTexcoords = 0;
+				 for (int i = 0; i < 10; i++) {
+					 std::string name = "TEXCOORD_" + std::to_string(i);
+					 if (prim.attributes.find(name.c_str()) != prim.attributes.end())
+						 primMat.hasTexcoords += 1;
 				 }
-				 //----------------Indices
-				 nv_helpers_dx12::CreateBufferView(m_device.Get(), modelIndexAndNum.back().first.Get(), modelIndexAndNum.back().first->GetGPUVirtualAddress(),
-					 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(UINT));
+			 }
+			 FillInfoPBR(model, prim, &primMat, imageHeapIds);
+			 // One light geometry per BLAS geometry, empty unless the primitive emits
+			 m_LightGeometries.emplace_back();
+			 ReadGLTFLightTriangles(model, prim, transform, m_LightGeometries.back());
+			 // Only MASK materials need the any-hit alpha test, BLEND is still traced as opaque
+			 opaqueGeometry.push_back(primMat.alphaMode != 1);
+			 if (primMat.alphaMode == 1)
+				 ommStats += BakeOpacityMicromap(model, prim, primMat, indexData);
+			 //----------------Create material Buffer + Push to Heap-----------------------
+			 {
+				 ComPtr<ID3D12Resource> newMatBuffer;
+				 newMatBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(MaterialStruct), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+				 m_Uploads.UploadBuffer(newMatBuffer.Get(), &primMat, sizeof(MaterialStruct));
+
+				 // ---------------Heap Upload------------------------
+				 // WE START PRIMITIVE DATA IN A HEAP FROM MATERIAL OF THE FIRST PRIMITIVE
+				 primitiveIndexes.push_back(
+					 nv_helpers_dx12::CreateBufferView(m_device.Get(), newMatBuffer.Get(), newMatBuffer->GetGPUVirtualAddress(),
+						 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(MaterialStruct)));
+				 primViews.push_back({ newMatBuffer, sizeof(MaterialStruct) });
 			 }
 		 }
+		 // Upload Transform to Heap
+		 nv_helpers_dx12::CreateBufferView(m_device.Get(), transBuffer.Get(), transBuffer->GetGPUVirtualAddress(),
+			 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(XMMATRIX));
+		 primViews.push_back({ transBuffer, sizeof(XMMATRIX) });
+		 // Upload Positions to Heap
+		 nv_helpers_dx12::CreateBufferView(m_device.Get(), modelVertexAndNum.back().first.Get(), modelVertexAndNum.back().first->GetGPUVirtualAddress(),
+			 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(XMFLOAT3));
+		 primViews.push_back({ modelVertexAndNum.back().first, sizeof(XMFLOAT3) });
+		 // Fill in and Upload to Heap arbitrary Vertex data
+		 {
+			 // -----------------Normals --------------------------
+			 if (primMat.hasNormals == 1) {
+				 ComPtr<ID3D12Resource> newNormalBuffer;
+				 const tinygltf::Accessor& normalAccessor = model.accessors[prim.attributes.at("NORMAL")];
+				 const tinygltf::BufferView& normalBufferView = model.bufferViews[normalAccessor.bufferView];
+				 UINT normalDataSize = normalAccessor.count * normalAccessor.ByteStride(normalBufferView);
+				 const float* normalData = reinterpret_cast<const float*>(&model.buffers[normalBufferView.buffer].data[normalBufferView.byteOffset + normalAccessor.byteOffset]);
+
+				 newNormalBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), normalDataSize, vertexFlags, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+				 m_Uploads.UploadBuffer(newNormalBuffer.Get(), normalData, normalDataSize);
+				 if (skinned) {
+					 skinnedPrim.normals = newNormalBuffer;
+					 skinnedPrim.bindNormals = nv_helpers_dx12::CreateBuffer(m_device.Get(), normalDataSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+					 m_Uploads.UploadBuffer(skinnedPrim.bindNormals.Get(), normalData, normalDataSize);
+				 }
 
-	 }
-
-	 // continue with node's children (we pass paren's model matrix to get the correct transform for children)
-	 for (size_t i = 0; i < glTFNode.children.size(); i++) {
-		 BuildModelRecursive(model, modelData, glTFNode.children[i], modelSpaceTrans, transforms, modelVertexAndNum, modelIndexAndNum, primitiveIndexes, imageHeapIds);
+				 // --------Upload to Heap-----------
+				 nv_helpers_dx12::CreateBufferView(m_device.Get(), newNormalBuffer.Get(), newNormalBuffer->GetGPUVirtualAddress(),
+					 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(XMFLOAT3));
+				 primViews.push_back({ newNormalBuffer, sizeof(XMFLOAT3) });
+			 }
+			 //------------------------------------------------------
+
+			 // -----------------Tangents --------------------------
+			 if (primMat.hasTangents == 1) {
+				 ComPtr<ID3D12Resource> newTangentBuffer;
+				 const tinygltf::Accessor& tangentAccessor = model.accessors[prim.attributes.at("TANGENT")];
+				 const tinygltf::BufferView& tangentBufferView = model.bufferViews[tangentAccessor.bufferView];
+				 UINT tangentDataSize = tangentAccessor.count * tangentAccessor.ByteStride(tangentBufferView);
+				 const float* tangentData = reinterpret_cast<const float*>(&model.buffers[tangentBufferView.buffer].data[tangentBufferView.byteOffset + tangentAccessor.byteOffset]);
+
+				 newTangentBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), tangentDataSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+				 m_Uploads.UploadBuffer(newTangentBuffer.Get(), tangentData, tangentDataSize);
+				 
+				 // --------Upload to Heap-----------
+				 nv_helpers_dx12::CreateBufferView(m_device.Get(), newTangentBuffer.Get(), newTangentBuffer->GetGPUVirtualAddress(),
+					 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(XMFLOAT4));
+				 primViews.push_back({ newTangentBuffer, sizeof(XMFLOAT4) });
+			 }
+			 //------------------------------------------------------
+
+			 // -----------------Colors --------------------------
+			 if (primMat.hasColors == 1) {
+				 ComPtr<ID3D12Resource> newColorBuffer;
+				 const tinygltf::Accessor& colorAccessor = model.accessors[prim.attributes.at("COLOR_0")];
+				 const tinygltf::BufferView& colorBufferView = model.bufferViews[colorAccessor.bufferView];
+				 UINT colorDataSize = colorAccessor.count * colorAccessor.ByteStride(colorBufferView);
+				 const float* colorData = reinterpret_cast<const float*>(&model.buffers[colorBufferView.buffer].data[colorBufferView.byteOffset + colorAccessor.byteOffset]);
+
+				 newColorBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), colorDataSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+				 m_Uploads.UploadBuffer(newColorBuffer.Get(), colorData, colorDataSize);
+				 // --------Upload to Heap-----------
+				 nv_helpers_dx12::CreateBufferView(m_device.Get(), newColorBuffer.Get(), newColorBuffer->GetGPUVirtualAddress(),
+					 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(XMFLOAT4));
+				 primViews.push_back({ newColorBuffer, sizeof(XMFLOAT4) });
+			 }
+			 //------------------------------------------------------
+
+			 // -----------------Texcoords --------------------------
+			 for (int i = 0; i < primMat.hasTexcoords; i++) {
+				 ComPtr<ID3D12Resource> newTexcoordBuffer;
+				 std::string name = "TEXCOORD_" + std::to_string(i);
+				 const tinygltf::Accessor& texcoordAccessor = model.accessors[prim.attributes.at(name.c_str())];
+				 const tinygltf::BufferView& texcoordBufferView = model.bufferViews[texcoordAccessor.bufferView];
+				 UINT texcoordDataSize = texcoordAccessor.count * texcoordAccessor.ByteStride(texcoordBufferView);
+				 const float* texcoordData = reinterpret_cast<const float*>(&model.buffers[texcoordBufferView.buffer].data[texcoordBufferView.byteOffset + texcoordAccessor.byteOffset]);
+
+				 newTexcoordBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), texcoordDataSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+				 m_Uploads.UploadBuffer(newTexcoordBuffer.Get(), texcoordData, texcoordDataSize);
+				 
+				 // --------Upload to Heap-----------
+				 nv_helpers_dx12::CreateBufferView(m_device.Get(), newTexcoordBuffer.Get(), newTexcoordBuffer->GetGPUVirtualAddress(),
+					 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(XMFLOAT2));
+				 primViews.push_back({ newTexcoordBuffer, sizeof(XMFLOAT2) });
+			 }
+			 //------------------------------------------------------
+		 }
+		 //----------------Indices
+		 nv_helpers_dx12::CreateBufferView(m_device.Get(), modelIndexAndNum.back().first.Get(), modelIndexAndNum.back().first->GetGPUVirtualAddress(),
+			 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(UINT));
+		 //----------------Triangle lods
+		 // Skinned positions were already packed into the bind pose, vertexData points at them
+		 std::vector<glm::vec3> positions = bindPositions;
+		 if (!skinned) {
+			 int vertexStride = vertexAccessor.ByteStride(vertexBufferView);
+			 positions.resize(vertexAccessor.count);
+			 for (size_t i = 0; i < vertexAccessor.count; i++) {
+				 memcpy(&positions[i], reinterpret_cast<const unsigned char*>(vertexData) + i * vertexStride, sizeof(glm::vec3));
+			 }
+		 }
+		 glm::mat4 modelTransform;
+		 memcpy(glm::value_ptr(modelTransform), &transform, sizeof(modelTransform));
+		 std::vector<std::vector<glm::vec2>> texcoords;
+		 ReadGLTFTexcoordSets(model, prim, primMat.hasTexcoords, texcoords);
+		 CreateTriangleLodView(positions, modelTransform, indexData, texcoords);
+		 if (skinned)
+			 skinnedModel.primitives.push_back(skinnedPrim);
+		 // The simplifier only reads positions and indexes, the levels keep all other streams
+		 if (lodPrimitives) {
+			 LodPrimitive lodPrim;
+			 lodPrim.positions = positions;
+			 lodPrim.modelTransform = modelTransform;
+			 lodPrim.texcoords = texcoords;
+			 lodPrim.indices = indexData;
+			 lodPrim.vertexBuffer = modelVertexAndNum.back();
+			 lodPrim.transform = transBuffer;
+			 lodPrim.opaque = opaqueGeometry.back();
+			 lodPrim.views = primViews;
+			 lodPrimitives->push_back(lodPrim);
+		 }
 	 }
  }
  
  void D3D12HelloTriangle::LoadImageData(tinygltf::Model& model, std::vector<uint32_t>& imageHeapIds) {
+	 std::vector<ComPtr<ID3D12Resource>> textures;
 	 for (auto& image : model.images) {
 		 ComPtr<ID3D12Resource> texture;
 		 // check format - we later should be able to know if it is SRBB or not, idk how
@@ -1064,55 +2063,51 @@ void D3D12HelloTriangle::OnMouseMove(UINT8 wParam, UINT32 lParam) {
 		 uint16_t mipsNum = glm::max(1, int(log2(glm::max(image.width, image.height))));
 		 texture = nv_helpers_dx12::CreateTextureBuffer(m_device.Get(), image.width, image.height, mipsNum, format, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
 
-		 // questionable if I need an upload buffer here
-		 // COPY TEXTURE BUFFER
-		 {
-			 // create a footprint  for the texture to know its properties
-			 D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint;
-			 UINT rowCount;
-			 UINT64 rowSize;
-			 UINT64 size;
-			 m_device->GetCopyableFootprints(&texture->GetDesc(), 0, 1, 0,
-				 &footprint, &rowCount, &rowSize, &size);
-			 ComPtr<ID3D12Resource> textureUploader;
-			 textureUploader = nv_helpers_dx12::CreateBuffer(m_device.Get(), size, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, nv_helpers_dx12::kUploadHeapProps);
-			 UINT8* pTextureDataBegin;
-			 CD3DX12_RANGE readRange(0, 0);
-			 ThrowIfFailed(textureUploader->Map(0, &readRange, reinterpret_cast<void**>(&pTextureDataBegin)));
-
-			 int properRowPitch = rowSize;
-			 if (properRowPitch <= 256)
-				 properRowPitch = 256;
-			 else if (properRowPitch % 256 != 0)
-				 properRowPitch = properRowPitch + (256 - properRowPitch % 256);
-
-			 for (UINT i = 0; i != rowCount; ++i) {
-				 memcpy(static_cast<uint8_t*>(pTextureDataBegin) + properRowPitch * i,
-					 &image.image[0] + image.width * image.component * i,
-					 image.width * image.component);
-			 }
-			 D3D12_TEXTURE_COPY_LOCATION dstCopyLocation = {};
-			 dstCopyLocation.pResource = texture.Get();
-			 dstCopyLocation.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
-			 dstCopyLocation.SubresourceIndex = 0;
-
-			 D3D12_TEXTURE_COPY_LOCATION srcCopyLocation = {};
-			 srcCopyLocation.pResource = textureUploader.Get();
-			 srcCopyLocation.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
-			 srcCopyLocation.PlacedFootprint = footprint;
-
-			 CD3DX12_RESOURCE_BARRIER transition = CD3DX12_RESOURCE_BARRIER::Transition(texture.Get(), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST);
-			 m_commandList->ResourceBarrier(1, &transition);
-
-			 m_commandList->CopyTextureRegion(&dstCopyLocation, 0, 0, 0,
-				 &srcCopyLocation, nullptr);
-			 textureUploader->Unmap(0, nullptr);
-		 }
+		 // Recorded on the copy queue, the staging memory lives until the copy is done
+		 m_Uploads.UploadTexture(texture.Get(), &image.image[0], image.width * image.component * image.bits / 8);
 		 imageHeapIds.push_back(nv_helpers_dx12::CreateBufferView(m_device.Get(), texture.Get(), NULL,
 			 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::TEXTURE));
-		 
-		 GenerateMips(texture);
+		 textures.push_back(texture);
 	 }
+	 if (textures.empty())
+		 return;
+	 // One GPU wait on the copy queue, the mips are submitted with the BLAS builds of the model
+	 m_Uploads.MakeVisible(m_commandQueue.Get(), m_commandList.Get());
+	 for (auto& texture : textures) {
+		 m_PendingMipHeaps.push_back(GenerateMips(texture));
+	 }
+ }
+ omm::BakeStats D3D12HelloTriangle::BakeOpacityMicromap(tinygltf::Model& model, tinygltf::Primitive& prim, const MaterialStruct& material, const std::vector<UINT>& indexData) {
+	 // Only the base color alpha is known on the CPU, without a texture every micro-triangle has the same state
+	 const tinygltf::Material& materialGLTF = model.materials[prim.material];
+	 int textureIndexGLTF = materialGLTF.pbrMetallicRoughness.baseColorTexture.index;
+	 std::string texcoordName = "TEXCOORD_" + std::to_string(material.texCoordIdBase);
+	 if (textureIndexGLTF < 0 || prim.attributes.find(texcoordName) == prim.attributes.end())
+		 return omm::BakeStats();
+	 const tinygltf::Image& image = model.images[model.textures[textureIndexGLTF].source];
+	 const tinygltf::Accessor& texcoordAccessor = model.accessors[prim.attributes.at(texcoordName)];
+	 if (image.bits != 8 || texcoordAccessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT)
+		 return omm::BakeStats();
+	 // Texcoords may be interleaved, the baker wants them packed
+	 const tinygltf::BufferView& texcoordBufferView = model.bufferViews[texcoordAccessor.bufferView];
+	 int texcoordStride = texcoordAccessor.ByteStride(texcoordBufferView);
+	 const unsigned char* texcoordData = &model.buffers[texcoordBufferView.buffer].data[texcoordBufferView.byteOffset + texcoordAccessor.byteOffset];
+	 std::vector<glm::vec2> texcoords(texcoordAccessor.count);
+	 for (size_t i = 0; i < texcoordAccessor.count; i++) {
+		 memcpy(&texcoords[i], texcoordData + i * texcoordStride, sizeof(glm::vec2));
+	 }
+	 omm::BakeInput input;
+	 input.texcoords = texcoords.data();
+	 input.indices = indexData.data();
+	 input.triangleCount = static_cast<uint32_t>(indexData.size() / 3);
+	 input.texture.pixels = image.image.data();
+	 input.texture.width = image.width;
+	 input.texture.height = image.height;
+	 input.texture.components = image.component;
+	 input.alphaFactor = material.baseColor.w;
+	 input.alphaCutoff = material.alphaCutoff;
+	 input.subdivisionLevel = m_OmmSubdivisionLevel;
+	 return omm::Bake(input).stats;
  }
  void D3D12HelloTriangle::FillInfoPBR(tinygltf::Model& model, tinygltf::Primitive& prim, MaterialStruct* material, std::vector<uint32_t>& imageHeapIds) {
 
@@ -1250,12 +2245,17 @@ void D3D12HelloTriangle::OnMouseMove(UINT8 wParam, UINT32 lParam) {
 	 
  }
  // Move to model.cpp?
- Model* D3D12HelloTriangle::LoadModelFromClass(ResourceManager* resManager, const std::string& name, std::vector<std::string>& hitGroups)
+ Model* D3D12HelloTriangle::LoadModelFromClass(ResourceManager* resManager, const std::string& name, std::vector<std::string>& hitGroups, ASBuildPolicy policy, BlasGranularity granularity)
  {
 	 Model model;
 	 model.m_name = name;
+	 model.m_buildPolicy = policy;
+	 model.m_blasGranularity = granularity;
 	 if (resManager->GetModel(name) == nullptr) {
 		LoadModelRecursive(model.m_name, &model);
+		LoadModelLods(&model);
+		// One submit for all BLASes of the model and its levels, one for their compaction
+		FlushBottomLevelAS(&model);
 		 for (auto& hitGroup : hitGroups) {
 			 model.m_hitGroups.push_back(hitGroup);
 		 }
@@ -1265,10 +2265,137 @@ void D3D12HelloTriangle::OnMouseMove(UINT8 wParam, UINT32 lParam) {
 	// DO WE WANT THIS? WHEN WILL WE USE THIS?
 	return resManager->GetModel(name);
  }
+ void D3D12HelloTriangle::LoadModelLods(Model* model)
+ {
+	 // Primitives of the model collected by LoadModelRecursive, loading the authored levels replaces them
+	 std::vector<LodPrimitive> primitives;
+	 primitives.swap(m_LodPrimitives);
+	 // Deformable BLASes are refitted from the full detail geometry only
+	 if (model->m_lods.empty() || model->m_buildPolicy == ASBuildPolicy::Deformable)
+		 return;
+	 size_t extension = model->m_name.rfind('.');
+	 std::string stem = model->m_name.substr(0, extension);
+	 std::string suffix = extension == std::string::npos ? "" : model->m_name.substr(extension);
+	 for (uint32_t level = 1;; level++) {
+		 std::string lodName = stem + "_lod" + std::to_string(level) + suffix;
+		 if (!std::ifstream(lodName).good())
+			 break;
+		 Model lodModel;
+		 lodModel.m_name = lodName;
+		 lodModel.m_buildPolicy = model->m_buildPolicy;
+		 LoadModelRecursive(lodName, &lodModel);
+		 if (lodModel.m_lods.size() != 1) {
+			 printf("%s can't be used as level of detail of %s\n", lodName.c_str(), model->m_name.c_str());
+			 break;
+		 }
+		 model->m_lods.push_back(lodModel.m_lods[0]);
+	 }
+	 m_LodPrimitives.clear();
+	 // Authored levels take precedence over generated ones
+	 if (model->m_lods.size() == 1)
+		 GenerateLods(model, primitives);
+	 if (model->m_lods.size() > 1) {
+		 printf("%s: %zu levels of detail,", model->m_name.c_str(), model->m_lods.size());
+		 for (auto& level : model->m_lods) {
+			 printf(" %llu", level.triangles);
+		 }
+		 printf(" triangles\n");
+	 }
+ }
+ void D3D12HelloTriangle::GenerateLods(Model* model, const std::vector<LodPrimitive>& primitives)
+ {
+	 if (primitives.empty() || m_LodChainSettings.levelCount < 2)
+		 return;
+	 std::vector<simplify::MeshInput> meshes(primitives.size());
+	 for (size_t i = 0; i < primitives.size(); i++) {
+		 meshes[i].positions = reinterpret_cast<const uint8_t*>(primitives[i].positions.data());
+		 meshes[i].positionStride = sizeof(glm::vec3);
+		 meshes[i].vertexCount = static_cast<uint32_t>(primitives[i].positions.size());
+		 meshes[i].indices = primitives[i].indices.data();
+		 meshes[i].indexCount = static_cast<uint32_t>(primitives[i].indices.size());
+	 }
+	 std::vector<std::vector<simplify::Level>> chains;
+	 auto start = std::chrono::high_resolution_clock::now();
+	 simplify::BuildLodChains(meshes, m_LodChainSettings, chains);
+	 std::chrono::duration<double, std::milli> simplifyTime = std::chrono::high_resolution_clock::now() - start;
+	 size_t levelCount = 1;
+	 for (auto& chain : chains) {
+		 levelCount = (std::max)(levelCount, chain.size() + 1);
+	 }
+	 printf("%s: simplified %zu primitives in %.2f ms\n", model->m_name.c_str(), primitives.size(), simplifyTime.count());
+	 for (size_t level = 1; level < levelCount; level++) {
+		 std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>> vertexAndNum;
+		 std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>> indexAndNum;
+		 std::vector<ComPtr<ID3D12Resource>> transforms;
+		 std::vector<bool> opaqueGeometry;
+		 std::vector<uint32_t> primitiveIndexes;
+		 float error = 0.f;
+		 double timeMs = 0.0;
+		 for (size_t i = 0; i < primitives.size(); i++) {
+			 const LodPrimitive& prim = primitives[i];
+			 // Primitives whose chain ended early stay at their coarsest level
+			 const std::vector<uint32_t>* indices = &prim.indices;
+			 if (!chains[i].empty()) {
+				 const simplify::Level& primLevel = chains[i][(std::min)(level, chains[i].size()) - 1];
+				 indices = &primLevel.indices;
+				 error = (std::max)(error, primLevel.error);
+				 if (level <= chains[i].size())
+					 timeMs += primLevel.timeMs;
+			 }
+			 // The index buffer sits beside the original streams, which the level views again
+			 UINT indexDataSize = static_cast<UINT>(indices->size() * sizeof(UINT));
+			 ComPtr<ID3D12Resource> indexBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), indexDataSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+			 m_Uploads.UploadBuffer(indexBuffer.Get(), indices->data(), indexDataSize);
+			 vertexAndNum.push_back(prim.vertexBuffer);
+			 indexAndNum.push_back({ indexBuffer, static_cast<uint32_t>(indices->size()) });
+			 transforms.push_back(prim.transform);
+			 opaqueGeometry.push_back(prim.opaque);
+			 // Same heap layout as BuildMeshPrimitives, starting with the material
+			 for (size_t view = 0; view < prim.views.size(); view++) {
+				 uint32_t heapIndex = nv_helpers_dx12::CreateBufferView(m_device.Get(), prim.views[view].first.Get(), prim.views[view].first->GetGPUVirtualAddress(),
+					 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, prim.views[view].second);
+				 if (view == 0)
+					 primitiveIndexes.push_back(heapIndex);
+			 }
+			 nv_helpers_dx12::CreateBufferView(m_device.Get(), indexBuffer.Get(), indexBuffer->GetGPUVirtualAddress(),
+				 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(UINT));
+			 CreateTriangleLodView(prim.positions, prim.modelTransform, *indices, prim.texcoords);
+		 }
+		 ComPtr<ID3D12Resource> primBuffer;
+		 primBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(uint32_t) * primitiveIndexes.size(), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+		 m_Uploads.UploadBuffer(primBuffer.Get(), &primitiveIndexes[0], sizeof(uint32_t) * primitiveIndexes.size());
+		 uint32_t heapPointer = nv_helpers_dx12::CreateBufferView(m_device.Get(), primBuffer.Get(), primBuffer->GetGPUVirtualAddress(),
+			 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(uint32_t));
+
+		 // The BLAS build makes the uploads recorded above visible
+		 BlasRecord record;
+		 record.modelName = model->m_name + " [LOD " + std::to_string(level) + "]";
+		 AccelerationStructureBuffers AS = CreateBottomLevelAS(vertexAndNum, indexAndNum, transforms, opaqueGeometry, model->m_buildPolicy, &record);
+		 uint64_t triangles = record.opaqueTriangles + record.nonOpaqueTriangles;
+		 model->m_lods.push_back({ reinterpret_cast<UINT64>(AS.pResult.Get()), heapPointer, triangles });
+		 printf("%s LOD %zu: %llu triangles (%.1f%%), error %.4f, %.2f ms\n", model->m_name.c_str(), level, triangles,
+			 100.0 * triangles / (std::max)(uint64_t(1), model->m_lods[0].triangles), error, timeMs);
+	 }
+ }
+ void D3D12HelloTriangle::CreateTriangleLodView(const std::vector<glm::vec3>& positions, const glm::mat4& transform, const std::vector<uint32_t>& indices,
+	 const std::vector<std::vector<glm::vec2>>& texcoords)
+ {
+	 std::vector<texlod::TriangleLod> lods;
+	 texlod::BuildTriangleLods(positions, transform, indices, texcoords, lods);
+	 // Primitives without texcoords fetch no texture, the view still needs a buffer
+	 if (lods.empty())
+		 lods.emplace_back();
+	 UINT lodDataSize = static_cast<UINT>(lods.size() * sizeof(texlod::TriangleLod));
+	 ComPtr<ID3D12Resource> lodBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), lodDataSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+	 m_Uploads.UploadBuffer(lodBuffer.Get(), lods.data(), lodDataSize);
+	 nv_helpers_dx12::CreateBufferView(m_device.Get(), lodBuffer.Get(), lodBuffer->GetGPUVirtualAddress(),
+		 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(texlod::TriangleLod));
+ }
  // Move to scene.cpp?
  void D3D12HelloTriangle::UploadScene(Scene* scene)
  {
 	 // Sync with model data uploading
+	 m_Uploads.MakeVisible(m_commandQueue.Get(), m_commandList.Get());
 	 m_commandList->Close();
 	 ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
 	 m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
@@ -1279,33 +2406,127 @@ void D3D12HelloTriangle::OnMouseMove(UINT8 wParam, UINT32 lParam) {
 	 ThrowIfFailed(m_commandList->Reset(m_commandAllocator.Get(), nullptr));
 	 // Clear
 	 m_instances.clear();
+	 m_HitGroupSets.clear();
 	 m_AllHeapIndices.clear();
 	 m_topLevelASGenerator.ClearInstances();
 
+	 // Deformable and streamed content changes often, so the TLAS then favours build speed over trace speed
+	 m_TlasBuildFlags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE | D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+	 for (int i = 0; i < scene->m_sceneObjects.size(); i++) {
+		 ASBuildPolicy policy = scene->m_sceneObjects[i].m_model->m_buildPolicy;
+		 if (policy == ASBuildPolicy::Deformable || policy == ASBuildPolicy::Streamed) {
+			 m_TlasBuildFlags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE | D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD;
+			 break;
+		 }
+	 }
 	 // -----------------------------------
 	 // FILL in Model Data
+	 std::vector<std::string> instanceLightNames; // Key in m_ModelLights of every instance
 	 for (int i = 0; i < scene->m_sceneObjects.size(); i++) {
 
 		 ComPtr<ID3D12Resource> BlasResource = reinterpret_cast<ID3D12Resource*>(scene->m_sceneObjects[i].m_model->m_BlasPointer);
-		 m_instances.push_back({ BlasResource, GlmToXM_mat4(scene->m_sceneObjects[i].m_transform), scene->m_sceneObjects[i].m_model->m_hitGroups.size() });
+		 GameObject& object = scene->m_sceneObjects[i];
+		 int animation = -1;
+		 for (size_t a = 0; a < m_AnimatedModels.size(); a++) {
+			 if (m_AnimatedModels[a].modelName == object.m_model->m_name)
+				 animation = static_cast<int>(a);
+		 }
+		 // Models with a BLAS per mesh get one instance per node
+		 if (!object.m_model->m_nodeInstances.empty()) {
+			 for (auto& nodeInstance : object.m_model->m_nodeInstances) {
+				 ComPtr<ID3D12Resource> meshBlas = reinterpret_cast<ID3D12Resource*>(nodeInstance.blasPointer);
+				 m_instances.push_back({ meshBlas, GlmToXM_mat4(object.m_transform * nodeInstance.transform), GetHitGroupOffset(object.m_model->m_hitGroups),
+					 object.m_instanceMask, static_cast<D3D12_RAYTRACING_INSTANCE_FLAGS>(object.m_instanceFlags), object.m_userID, nodeInstance.heapPointer, nodeInstance.node, animation, object.m_transform, nodeInstance.instanceTransform });
+				 m_instances.back().triangles = nodeInstance.triangles;
+				 instanceLightNames.push_back(GetMeshLightsName(object.m_model->m_name, nodeInstance.mesh));
+			 }
+			 continue;
+		 }
+		 m_instances.push_back({ BlasResource, GlmToXM_mat4(object.m_transform), GetHitGroupOffset(object.m_model->m_hitGroups),
+			 object.m_instanceMask, static_cast<D3D12_RAYTRACING_INSTANCE_FLAGS>(object.m_instanceFlags), object.m_userID,
+			 object.m_model->m_heapPointer, -1, animation, object.m_transform });
+		 // Starts at full detail, UpdateLods switches the level every frame
+		 m_instances.back().model = object.m_model;
+		 m_instances.back().triangles = object.m_model->m_lods.empty() ? 0 : object.m_model->m_lods[0].triangles;
+		 instanceLightNames.push_back(object.m_model->m_name);
 	 }
 	 // Update TLAS
 	 ReCreateAccelerationStructures();
 	 // Update SBT
 	 ReCreateShaderBindingTable(scene);
 
+	 // ---------Light list of next event estimation
+	 // Instances of a whole model or of a mesh share its triangles, the geometries of the BLAS index into them
+	 std::vector<lights::GpuTriangle> lightTriangles;
+	 std::vector<uint32_t> lightGeometries;
+	 std::unordered_map<std::string, lights::InstanceLights> placedLights;
+	 m_InstanceLights.assign(m_instances.size(), lights::InstanceLights());
+	 for (size_t i = 0; i < m_instances.size(); i++) {
+		 const std::string& name = instanceLightNames[i];
+		 auto meshLights = m_ModelLights.find(name);
+		 if (meshLights == m_ModelLights.end())
+			 continue;
+		 auto placed = placedLights.find(name);
+		 if (placed == placedLights.end()) {
+			 lights::InstanceLights entry;
+			 entry.mesh = &meshLights->second;
+			 entry.firstTriangle = static_cast<uint32_t>(lightTriangles.size());
+			 entry.firstGeometry = static_cast<uint32_t>(lightGeometries.size());
+			 for (uint32_t first : meshLights->second.geometries) {
+				 lightGeometries.push_back(first == lights::kNoLight ? first : first + entry.firstTriangle);
+			 }
+			 lightTriangles.insert(lightTriangles.end(), meshLights->second.triangles.begin(), meshLights->second.triangles.end());
+			 placed = placedLights.emplace(name, entry).first;
+		 }
+		 m_InstanceLights[i] = placed->second;
+	 }
+	 // Scenes without lights still get buffers to point the descriptors at
+	 size_t lightTriangleCount = lightTriangles.size();
+	 lightTriangles.resize((std::max)(size_t(1), lightTriangles.size()));
+	 lightGeometries.resize((std::max)(size_t(1), lightGeometries.size()), lights::kNoLight);
+	 m_LightTriangleBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(lights::GpuTriangle) * lightTriangles.size(), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+	 m_Uploads.UploadBuffer(m_LightTriangleBuffer.Get(), lightTriangles.data(), sizeof(lights::GpuTriangle) * lightTriangles.size());
+	 nv_helpers_dx12::ChangeSRVResourceLoaction(m_device.Get(), m_LightTriangleBuffer.Get(), m_CbvSrvUavHeap.Get(), m_LightTrianglesHeapIndex, sizeof(lights::GpuTriangle));
+	 m_LightGeometryBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(uint32_t) * lightGeometries.size(), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+	 m_Uploads.UploadBuffer(m_LightGeometryBuffer.Get(), lightGeometries.data(), sizeof(uint32_t) * lightGeometries.size());
+	 nv_helpers_dx12::ChangeSRVResourceLoaction(m_device.Get(), m_LightGeometryBuffer.Get(), m_CbvSrvUavHeap.Get(), m_LightGeometriesHeapIndex, sizeof(uint32_t));
+	 m_Uploads.MakeVisible(m_commandQueue.Get(), m_commandList.Get());
+	 // The instance table of a slot is rewritten before recording its frame like the heap indexes
+	 CD3DX12_RANGE lightReadRange(0, 0);
+	 for (UINT n = 0; n < m_framesInFlight; n++) {
+		 if (m_MappedLightInstances[n])
+			 m_LightInstanceBuffers[n]->Unmap(0, nullptr);
+		 m_LightInstanceBuffers[n] = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(lights::GpuInstance) * (std::max)(size_t(1), m_instances.size()), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, nv_helpers_dx12::kUploadHeapProps);
+		 ThrowIfFailed(m_LightInstanceBuffers[n]->Map(0, &lightReadRange, reinterpret_cast<void**>(&m_MappedLightInstances[n])));
+		 nv_helpers_dx12::ChangeSRVResourceLoaction(m_device.Get(), m_LightInstanceBuffers[n].Get(), m_CbvSrvUavHeap.Get(), m_LightInstancesHeapIndices[n], sizeof(lights::GpuInstance));
+	 }
+	 UpdateLights();
+	 printf("Light list: %zu emissive triangles of %zu models and meshes, %u instances\n", lightTriangleCount, placedLights.size(), m_LightInstanceCount);
+
 	 // Fill in indexes, used for any set of models
 	 m_AllHeapIndices.push_back(m_RTOutputHeapIndex);
 	 m_AllHeapIndices.push_back(m_TlasHeapIndex);
-	 m_AllHeapIndices.push_back(m_camHeapIndex);
-	 m_AllHeapIndices.push_back(m_FrameHeapIndex);
-	 // Fill in model indexes
-	 for (int i = 0; i < scene->m_sceneObjects.size(); i++) {
-		 m_AllHeapIndices.push_back(scene->m_sceneObjects[i].m_model->m_heapPointer);
+	 // Camera and frame index of the frame slot, UpdateHeapIndexBuffer swaps them for every slot
+	 m_AllHeapIndices.push_back(m_camHeapIndices[m_frameIndex]);
+	 m_AllHeapIndices.push_back(m_FrameHeapIndices[m_frameIndex]);
+	 m_AllHeapIndices.push_back(m_AccumulationHeapIndex);
+	 m_AllHeapIndices.push_back(m_LightTrianglesHeapIndex);
+	 m_AllHeapIndices.push_back(m_LightGeometriesHeapIndex);
+	 m_AllHeapIndices.push_back(m_LightInstancesHeapIndices[m_frameIndex]);
+	 // Fill in model indexes, one per TLAS instance
+	 for (auto& instance : m_instances) {
+		 m_AllHeapIndices.push_back(instance.primitiveHeapIndex);
+	 }
+	 // Upload HEAP INDEXES buffers to gpu. They stay mapped, the level of detail of an instance changes its primitive indexes.
+	 // The GPU may still read the copy of another frame slot, so each slot is only written before recording its own frame
+	 CD3DX12_RANGE readRange(0, 0);
+	 for (UINT n = 0; n < m_framesInFlight; n++) {
+		 if (m_MappedHeapIndices[n])
+			 m_HeapIndexBuffers[n]->Unmap(0, nullptr);
+		 m_HeapIndexBuffers[n] = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(uint32_t) * m_AllHeapIndices.size(), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, nv_helpers_dx12::kUploadHeapProps);
+		 ThrowIfFailed(m_HeapIndexBuffers[n]->Map(0, &readRange, reinterpret_cast<void**>(&m_MappedHeapIndices[n])));
 	 }
-	 // Upload HEAP INDEXES buffer to gpu
-	 m_HeapIndexBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(uint32_t) * m_AllHeapIndices.size(), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
-	 nv_helpers_dx12::CopyToDirectResource(m_device.Get(), m_commandList.Get(), m_HeapIndexBuffer.Get(), m_AllHeapIndices.data(), sizeof(uint32_t) * m_AllHeapIndices.size());
+	 UpdateHeapIndexBuffer();
 
 	 // Close cmd list
 	 ThrowIfFailed(m_commandList->Close()); 
@@ -1314,6 +2535,13 @@ void D3D12HelloTriangle::OnMouseMove(UINT8 wParam, UINT32 lParam) {
 	 m_commandQueue->Signal(m_fence.Get(), m_fenceValue);
 	 m_fence->SetEventOnCompletion(m_fenceValue, m_fenceEvent);
 	 WaitForSingleObject(m_fenceEvent, INFINITE);
+
+	 const upload::Stats& uploads = m_Uploads.GetStats();
+	 printf("Uploads: %llu copies, %.1f MB in %llu copy queue submissions, %llu waits for staging memory\n",
+		 uploads.uploads, uploads.bytes / (1024.0 * 1024.0), uploads.submissions, uploads.ringWaits);
+	 ReportAccelerationStructures();
+	 if (m_cpuRayQueries)
+		 BuildCpuScene(scene);
  }
  // Move this to helper?
  XMMATRIX D3D12HelloTriangle::GlmToXM_mat4(glm::mat4 gmat) {
@@ -1474,10 +2702,10 @@ void D3D12HelloTriangle::OnMouseMove(UINT8 wParam, UINT32 lParam) {
  }
 
 
- void D3D12HelloTriangle::GenerateMips(ComPtr<ID3D12Resource> texture) {
+ ComPtr<ID3D12DescriptorHeap> D3D12HelloTriangle::GenerateMips(ComPtr<ID3D12Resource> texture) {
 	
-	 // Transition of the whole texture
-	 CD3DX12_RESOURCE_BARRIER transition = CD3DX12_RESOURCE_BARRIER::Transition(texture.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	 // Transition of the whole texture, the copy queue leaves it in the COMMON state
+	 CD3DX12_RESOURCE_BARRIER transition = CD3DX12_RESOURCE_BARRIER::Transition(texture.Get(), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 	 m_commandList->ResourceBarrier(1, &transition);
 
 	 // Create a heap to hold UAVs for each mip map
@@ -1529,6 +2757,647 @@ void D3D12HelloTriangle::OnMouseMove(UINT8 wParam, UINT32 lParam) {
 	 transition = CD3DX12_RESOURCE_BARRIER::Transition(texture.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_GENERIC_READ, texture.Get()->GetDesc().MipLevels - 1);
 	 m_commandList->ResourceBarrier(1, &transition);
 
+	 return pUavHeap;
+ }
+ void D3D12HelloTriangle::UpdateAnimations() {
+	 auto now = std::chrono::high_resolution_clock::now();
+	 float dt = m_lastAnimationTime.time_since_epoch().count() == 0 || m_pauseAnimation ? 0.f : std::chrono::duration<float>(now - m_lastAnimationTime).count();
+	 m_lastAnimationTime = now;
+	 if (m_AnimatedModels.empty())
+		 return;
+	 std::vector<anim::Instance*> instances;
+	 for (auto& animated : m_AnimatedModels) {
+		 // Loading models can move the vectors, so the pointers are refreshed every frame
+		 animated.instance.clip = &animated.clips[animated.activeClip];
+		 animated.instance.hierarchy = &animated.hierarchy;
+		 animated.instance.time += dt;
+		 instances.push_back(&animated.instance);
+	 }
+	 anim::EvaluateBatch(instances.data(), instances.size());
+	 // The skinning pass picks up the new pose
+	 for (auto& animated : m_AnimatedModels) {
+		 if (animated.skinnedModel >= 0)
+			 m_SkinnedModels[animated.skinnedModel].hierarchy.localTransforms = animated.instance.locals;
+	 }
+	 // Per node instances follow their node, whole model instances the root motion.
+	 // The TLAS is updated in PopulateCommandList
+	 for (auto& instance : m_instances) {
+		 if (instance.animation < 0)
+			 continue;
+		 const AnimatedModel& animated = m_AnimatedModels[instance.animation];
+		 if (instance.node >= 0)
+			 instance.transform = GlmToXM_mat4(instance.objectTransform * animated.instance.globals[instance.node] * instance.instanceTransform);
+		 else if (animated.rootNode >= 0)
+			 instance.transform = GlmToXM_mat4(instance.objectTransform * animated.instance.globals[animated.rootNode] * animated.inverseRestRootGlobal);
+	 }
+ }
+ void D3D12HelloTriangle::UpdateSkinning() {
+	 std::vector<glm::mat4> globals;
+	 for (auto& skinned : m_SkinnedModels) {
+		 skinned.hierarchy.ComputeGlobalTransforms(globals);
+		 // Skins are independent of each other
+		 std::vector<std::vector<glm::mat4>> jointMatrices(skinned.skins.size());
+		 std::vector<uint8_t> changed(skinned.skins.size(), 0);
+		 ParallelFor(static_cast<uint32_t>(skinned.skins.size()), 1, 0, [&](uint32_t first, uint32_t last, uint32_t) {
+			 for (uint32_t i = first; i < last; i++) {
+				 jointMatrices[i].resize(skinned.skins[i].jointNodes.size());
+				 skin::ComputeJointMatrices(skinned.skins[i], globals, jointMatrices[i].data());
+				 changed[i] = jointMatrices[i] != skinned.jointMatrices[i];
+			 }
+		 });
+		 for (uint8_t skinChanged : changed) {
+			 if (skinChanged)
+				 skinned.dirty = true;
+		 }
+		 if (!skinned.dirty)
+			 continue;
+		 // The skinning pass reads every skin of the model from the slot of this frame, which holds the matrices
+		 // of an older frame or none at all, so the unchanged skins are written too
+		 for (size_t i = 0; i < skinned.skins.size(); i++) {
+			 memcpy(skinned.mappedJointMatrices[i * FrameCount + m_frameIndex], jointMatrices[i].data(), sizeof(glm::mat4) * jointMatrices[i].size());
+			 skinned.jointMatrices[i] = std::move(jointMatrices[i]);
+		 }
+	 }
+ }
+ void D3D12HelloTriangle::RecordSkinning() {
+	 bool anyDirty = false;
+	 for (auto& skinned : m_SkinnedModels) {
+		 anyDirty |= skinned.dirty;
+	 }
+	 if (!anyDirty)
+		 return;
+	 m_commandList->SetComputeRootSignature(m_SkinningRootSignature.Get());
+	 m_commandList->SetPipelineState(m_SkinningPSO.Get());
+	 for (auto& skinned : m_SkinnedModels) {
+		 if (!skinned.dirty)
+			 continue;
+		 // Vertex buffers stay in GENERIC_READ for the BLAS and the hit shaders, except during the skinning pass
+		 std::vector<CD3DX12_RESOURCE_BARRIER> toUAV;
+		 std::vector<CD3DX12_RESOURCE_BARRIER> toRead;
+		 for (auto& prim : skinned.primitives) {
+			 toUAV.push_back(CD3DX12_RESOURCE_BARRIER::Transition(prim.positions.Get(), D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+			 toRead.push_back(CD3DX12_RESOURCE_BARRIER::Transition(prim.positions.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_GENERIC_READ));
+			 if (prim.normals) {
+				 toUAV.push_back(CD3DX12_RESOURCE_BARRIER::Transition(prim.normals.Get(), D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+				 toRead.push_back(CD3DX12_RESOURCE_BARRIER::Transition(prim.normals.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_GENERIC_READ));
+			 }
+		 }
+		 m_commandList->ResourceBarrier(static_cast<UINT>(toUAV.size()), toUAV.data());
+		 for (auto& prim : skinned.primitives) {
+			 UINT constants[2] = { prim.vertexCount, prim.normals ? 1u : 0u };
+			 m_commandList->SetComputeRoot32BitConstants(0, 2, constants, 0);
+			 // Primitives without normals bind the positions in their place, the shader doesn't touch them
+			 ID3D12Resource* bindNormals = prim.bindNormals ? prim.bindNormals.Get() : prim.bindPositions.Get();
+			 ID3D12Resource* normals = prim.normals ? prim.normals.Get() : prim.positions.Get();
+			 m_commandList->SetComputeRootShaderResourceView(1, prim.bindPositions->GetGPUVirtualAddress());
+			 m_commandList->SetComputeRootShaderResourceView(2, bindNormals->GetGPUVirtualAddress());
+			 m_commandList->SetComputeRootShaderResourceView(3, prim.joints->GetGPUVirtualAddress());
+			 m_commandList->SetComputeRootShaderResourceView(4, prim.weights->GetGPUVirtualAddress());
+			 m_commandList->SetComputeRootShaderResourceView(5, skinned.jointMatrixBuffers[prim.skin * FrameCount + m_frameIndex]->GetGPUVirtualAddress());
+			 m_commandList->SetComputeRootUnorderedAccessView(6, prim.positions->GetGPUVirtualAddress());
+			 m_commandList->SetComputeRootUnorderedAccessView(7, normals->GetGPUVirtualAddress());
+			 m_commandList->Dispatch((prim.vertexCount + 63) / 64, 1, 1);
+		 }
+		 m_commandList->ResourceBarrier(static_cast<UINT>(toRead.size()), toRead.data());
+		 // Refit in place, the BLAS was built with ALLOW_UPDATE (deformable policy) and kept its scratch buffer
+		 BlasRecord& record = m_BlasRecords[skinned.blasRecord];
+		 record.generator.Generate(m_commandList.Get(), record.buffers.pScratch.Get(), record.buffers.pResult.Get(), true, record.buffers.pResult.Get());
+		 skinned.dirty = false;
+	 }
+ }
+ void D3D12HelloTriangle::UpdateLods() {
+	 if (m_instances.empty())
+		 return;
+	 lod::Settings settings;
+	 settings.verticalFov = glm::radians(45.f); // Same as UpdateCameraBuffer
+	 settings.viewportHeight = static_cast<float>(GetHeight());
+	 settings.triangleBudget = m_lodTriangleBudget;
+	 m_LodCandidates.resize(m_instances.size());
+	 m_LodLevelTriangles.clear();
+	 for (size_t i = 0; i < m_instances.size(); i++) {
+		 SceneInstance& instance = m_instances[i];
+		 lod::Candidate& candidate = m_LodCandidates[i];
+		 candidate.firstLevel = static_cast<uint32_t>(m_LodLevelTriangles.size());
+		 // Instances without levels still count towards the budget
+		 if (instance.model == nullptr || instance.model->m_lods.size() < 2) {
+			 candidate.levelCount = 1;
+			 m_LodLevelTriangles.push_back(instance.triangles);
+			 continue;
+		 }
+		 glm::mat4 transform;
+		 memcpy(glm::value_ptr(transform), &instance.transform, sizeof(glm::mat4));
+		 lod::TransformBoundingSphere(transform, instance.model->m_boundingSphere, candidate.center, candidate.radius);
+		 candidate.levelCount = static_cast<uint32_t>(instance.model->m_lods.size());
+		 for (auto& level : instance.model->m_lods) {
+			 m_LodLevelTriangles.push_back(level.triangles);
+		 }
+	 }
+	 lod::SelectLods(m_LodCandidates, m_LodLevelTriangles, lod::GetEyePosition(nv_helpers_dx12::CameraManip.getMatrix()), settings, m_LodResult);
+
+	 uint32_t switches = 0;
+	 for (size_t i = 0; i < m_instances.size(); i++) {
+		 SceneInstance& instance = m_instances[i];
+		 uint32_t level = m_LodResult.levels[i];
+		 if (m_LodCandidates[i].levelCount == 1 || level == instance.lod)
+			 continue;
+		 const ModelLod& modelLod = instance.model->m_lods[level];
+		 instance.blas = reinterpret_cast<ID3D12Resource*>(modelLod.blasPointer);
+		 instance.primitiveHeapIndex = modelLod.heapPointer;
+		 instance.lod = level;
+		 instance.triangles = modelLod.triangles;
+		 // Picked up by the TLAS update of this frame
+		 m_topLevelASGenerator.SetInstanceBottomLevelAS(static_cast<UINT>(i), instance.blas.Get());
+		 m_AllHeapIndices[kCommonHeapIndexCount + i] = modelLod.heapPointer;
+		 switches++;
+	 }
+	 m_LodUnreportedSwitches += switches;
+	 auto now = std::chrono::high_resolution_clock::now();
+	 if (m_LodUnreportedSwitches > 0 && now - m_LodLastReport >= std::chrono::seconds(1)) {
+		 printf("LOD: %llu of %llu triangles traced (%.1f%%), %u switches, %u levels dropped for the budget%s\n", m_LodResult.triangles, m_LodResult.fullDetailTriangles,
+			 m_LodResult.fullDetailTriangles > 0 ? 100.0 * m_LodResult.triangles / m_LodResult.fullDetailTriangles : 100.0, m_LodUnreportedSwitches, m_LodResult.budgetCoarsenings,
+			 m_LodResult.withinBudget ? "" : ", over budget");
+		 m_LodLastReport = now;
+		 m_LodUnreportedSwitches = 0;
+	 }
+ }
+ void D3D12HelloTriangle::BuildCpuScene(Scene* scene) {
+	 auto start = std::chrono::high_resolution_clock::now();
+	 m_CpuInstances.clear();
+	 m_CpuInstanceSources.clear();
+	 size_t firstInstance = 0;
+	 for (GameObject& object : scene->m_sceneObjects) {
+		 const std::string& name = object.m_model->m_name;
+		 if (m_CpuBlases.find(name) == m_CpuBlases.end()) {
+			 bvh::Mesh mesh;
+			 if (!LoadGLTFMesh(name, mesh))
+				 printf("Couldn't load %s for the CPU ray queries\n", name.c_str());
+			 bvh::BuildBlas(std::move(mesh), bvh::BuildSettings(), m_CpuBlases[name]);
+		 }
+		 bvh::Instance instance;
+		 instance.blas = &m_CpuBlases[name];
+		 instance.transform = object.m_transform;
+		 instance.mask = object.m_instanceMask;
+		 instance.userID = object.m_userID;
+		 m_CpuInstances.push_back(instance);
+		 // Same order as UploadScene, models with a BLAS per mesh have one TLAS instance per node
+		 m_CpuInstanceSources.push_back(firstInstance);
+		 firstInstance += object.m_model->m_nodeInstances.empty() ? 1 : object.m_model->m_nodeInstances.size();
+	 }
+	 m_CpuTlas.Build(m_CpuInstances);
+	 printf("CPU acceleration structures: %zu instances, %zu BLASes, %.2f ms\n", m_CpuInstances.size(), m_CpuBlases.size(),
+		 std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+ }
+ void D3D12HelloTriangle::UpdateCpuScene() {
+	 for (size_t i = 0; i < m_CpuInstances.size(); i++) {
+		 const SceneInstance& source = m_instances[m_CpuInstanceSources[i]];
+		 // Whole model instances carry the final transform, per node instances add the node on top of the object
+		 if (source.node < 0)
+			 memcpy(glm::value_ptr(m_CpuInstances[i].transform), &source.transform, sizeof(glm::mat4));
+		 else
+			 m_CpuInstances[i].transform = source.objectTransform;
+	 }
+	 m_CpuTlas.Update(m_CpuInstances);
+ }
+ bvh::RayBatchTiming D3D12HelloTriangle::CastRays(const std::vector<bvh::Ray>& rays, std::vector<bvh::InstanceHit>& hits, uint32_t mask) const {
+	 bvh::RayBatchSettings settings;
+	 settings.mask = mask;
+	 return bvh::IntersectRays(m_CpuTlas, rays, hits, settings);
+ }
+ bvh::RayBatchTiming D3D12HelloTriangle::TestOcclusion(const std::vector<bvh::Ray>& rays, std::vector<uint8_t>& occluded, uint32_t mask) const {
+	 bvh::RayBatchSettings settings;
+	 settings.mask = mask;
+	 return bvh::OccludedRays(m_CpuTlas, rays, occluded, settings);
+ }
+ void D3D12HelloTriangle::RunBenchmarks() {
+	 // UploadScene leaves the command list closed, the GPU benchmarks record into it
+	 ThrowIfFailed(m_commandList->Reset(m_commandAllocator.Get(), nullptr));
+	 printf("---------------- CPU benchmarks ----------------\n");
+	 const uint32_t skinnedVertices = 1 << 20;
+	 printf("Skinning (%u vertices, 64 joints): %.0f vertices/ms, single thread %.0f vertices/ms\n", skinnedVertices,
+		 skin::BenchmarkSkinning(skinnedVertices, 64, 10), skin::BenchmarkSkinning(skinnedVertices, 64, 10, 1));
+	 // 10k animated nodes: 100 hierarchies of 100 nodes, every node with T, R and S channels of 32 keys
+	 printf("Animation (100 x 100 nodes): %.3f ms/frame, single thread %.3f ms/frame\n",
+		 anim::BenchmarkAnimation(100, 100, 32, 100), anim::BenchmarkAnimation(100, 100, 32, 100, 1));
+	 printf("LOD selection (10000 instances, 4 levels, budget): %.3f ms/frame\n", lod::BenchmarkLodSelection(10000, 4, 100));
+	 std::vector<simplify::Level> sphereChain;
+	 double simplifyMs = simplify::BenchmarkSimplification(100000, 16, m_LodChainSettings, sphereChain);
+	 printf("Simplification (16 spheres of 100000 triangles): %.1f ms, single thread %.1f ms\n", simplifyMs,
+		 simplify::BenchmarkSimplification(100000, 16, m_LodChainSettings, sphereChain, 1));
+	 for (size_t level = 0; level < sphereChain.size(); level++) {
+		 printf("  LOD %zu: %zu triangles, error %.5f, %.2f ms\n", level + 1, sphereChain[level].indices.size() / 3, sphereChain[level].error, sphereChain[level].timeMs);
+	 }
+	 printf("---------------- CPU BVH builders ----------------\n");
+	 bvh::Mesh bvhMesh;
+	 for (const char* scene : { "Assets/Sponza/Sponza.gltf", "Assets/city/scene.gltf" }) {
+		 if (LoadGLTFMesh(scene, bvhMesh)) {
+			 CompareBvhBuilders(scene, bvhMesh);
+			 CompareBvhTraversal(bvhMesh, 1 << 20);
+		 }
+		 else
+			 printf("Couldn't load %s for the BVH comparison\n", scene);
+	 }
+	 bvh::MakeRandomTriangles(1 << 22, 100.f, 0.5f, bvhMesh);
+	 CompareBvhBuilders("Random triangles", bvhMesh);
+	 CompareBvhTraversal(bvhMesh, 1 << 20);
+	 printf("---------------- CPU two level acceleration structure ----------------\n");
+	 bvh::Mesh helmetMesh;
+	 if (LoadGLTFMesh("Assets/Helmet/DamagedHelmet.gltf", helmetMesh)) {
+		 bvh::Blas helmet;
+		 bvh::BuildBlas(std::move(helmetMesh), bvh::BuildSettings(), helmet);
+		 bvh::TlasBenchmark tlas;
+		 bvh::BenchmarkTlas(helmet, 10000, 1 << 20, tlas);
+		 printf("10000 helmet instances: TLAS build %.2f ms, refit of all instances %.2f ms%s\n", tlas.buildMs, tlas.refitMs, tlas.refitRebuilt ? " (rebuilt)" : "");
+		 printf("  closest hit %.2f Mrays/s, any hit %.2f Mrays/s, %u of %u rays hit\n", tlas.closestHitRaysPerSecond * 1e-6, tlas.anyHitRaysPerSecond * 1e-6,
+			 tlas.closestHits, 1u << 20);
+	 }
+	 printf("---------------- Batched CPU ray queries ----------------\n");
+	 bvh::Mesh sponzaMesh;
+	 if (LoadGLTFMesh("Assets/Sponza/Sponza.gltf", sponzaMesh)) {
+		 bvh::Blas sponza;
+		 bvh::BuildBlas(std::move(sponzaMesh), bvh::BuildSettings(), sponza);
+		 std::vector<bvh::Instance> instances(1);
+		 instances[0].blas = &sponza;
+		 bvh::Tlas tlas;
+		 tlas.Build(instances);
+		 // Line of sight checks, a quarter of the scene diagonal long
+		 std::vector<bvh::Ray> rays;
+		 bvh::MakeRandomRays(sponza.bounds, 1000000, rays);
+		 float length = 0.25f * glm::length(sponza.bounds.max - sponza.bounds.min);
+		 for (bvh::Ray& ray : rays) {
+			 ray.tMax = length;
+		 }
+		 std::vector<uint8_t> occluded;
+		 auto print = [&](const char* label, const bvh::RayBatchSettings& settings) {
+			 bvh::RayBatchTiming timing = bvh::OccludedRays(tlas, rays, occluded, settings);
+			 uint32_t occludedCount = 0;
+			 for (uint8_t o : occluded) {
+				 occludedCount += o;
+			 }
+			 printf("%-24s %7.2f ms (sort %.2f ms), %6.2f Mrays/s, %u threads, %u occluded\n", label, timing.totalMs, timing.sortMs,
+				 timing.RaysPerSecond() * 1e-6, timing.threadCount, occludedCount);
+		 };
+		 printf("Sponza, 1M random occlusion rays\n");
+		 bvh::RayBatchSettings settings;
+		 print("sorted streams", settings);
+		 settings.sortRays = false;
+		 print("submission order", settings);
+		 settings.sortRays = true;
+		 settings.threadCount = 1;
+		 print("sorted, single thread", settings);
+	 }
+	 else
+		 printf("Couldn't load Assets/Sponza/Sponza.gltf for the ray query benchmark\n");
+	 printf("---------------- Per frame constants ----------------\n");
+	 {
+		 // 100k camera updates, a Map and Unmap per update as before against allocations from the mapped ring
+		 const uint32_t updateCount = 100000;
+		 XMMATRIX matrices[4] = { XMMatrixIdentity(), XMMatrixIdentity(), XMMatrixIdentity(), XMMatrixIdentity() };
+		 ComPtr<ID3D12Resource> buffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(matrices), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, nv_helpers_dx12::kUploadHeapProps);
+		 auto start = std::chrono::high_resolution_clock::now();
+		 for (uint32_t i = 0; i < updateCount; i++) {
+			 uint8_t* pData;
+			 ThrowIfFailed(buffer->Map(0, nullptr, (void**)&pData));
+			 memcpy(pData, matrices, sizeof(matrices));
+			 buffer->Unmap(0, nullptr);
+		 }
+		 double mapMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		 FrameConstants constants;
+		 constants.Init(m_device.Get(), kFrameConstantsSliceSize, FrameCount);
+		 const uint32_t perSlice = static_cast<uint32_t>(kFrameConstantsSliceSize / sizeof(matrices));
+		 start = std::chrono::high_resolution_clock::now();
+		 for (uint32_t i = 0; i < updateCount; i++) {
+			 if (i % perSlice == 0)
+				 constants.BeginFrame(i / perSlice);
+			 memcpy(constants.Allocate<XMMATRIX>(4).cpu, matrices, sizeof(matrices));
+		 }
+		 double ringMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		 printf("%u camera updates: Map/Unmap %.2f ms (%.1f ns each), ring %.2f ms (%.1f ns each)\n", updateCount,
+			 mapMs, mapMs * 1e6 / updateCount, ringMs, ringMs * 1e6 / updateCount);
+	 }
+	 printf("---------------- Upload scheduling ----------------\n");
+	 {
+		 // Fake copy queue finishing one submission every 4 uploads, so small rings have to wait
+		 auto print = [](const char* label, const upload::Settings& settings) {
+			 upload::SchedulingBenchmark result;
+			 upload::BenchmarkScheduling(1000000, 1 << 20, 4, settings, result);
+			 printf("%-24s %8llu submissions, %7llu ring waits, %5.1f ns/upload\n", label,
+				 result.stats.submissions, result.stats.ringWaits, result.nsPerUpload);
+		 };
+		 printf("1M uploads up to 1 MB\n");
+		 upload::Settings settings;
+		 print("64 MB ring, 16 MB batch", settings);
+		 settings.batchSize = 1ull << 20;
+		 print("64 MB ring, 1 MB batch", settings);
+		 settings.ringSize = 8ull << 20;
+		 settings.batchSize = 4ull << 20;
+		 print("8 MB ring, 4 MB batch", settings);
+	 }
+	 printf("---------------- CPU path tracing reference ----------------\n");
+	 {
+		 PathTracingReference reference;
+		 BuildPathTracingReference(&m_myScene, 4, reference);
+		 ComparePathTracingEstimators(reference);
+		 printf("---------------- Next event estimation ----------------\n");
+		 CompareNextEventEstimation(reference);
+		 printf("---------------- Russian roulette ----------------\n");
+		 CompareRussianRoulette(reference);
+		 printf("---------------- Ray cone texture level of detail ----------------\n");
+		 // At the resolution of the window, which the levels depend on
+		 BuildPathTracingReference(&m_myScene, 1, reference);
+		 CompareTextureLod(reference);
+		 printf("---------------- Progressive accumulation ----------------\n");
+		 BuildPathTracingReference(&m_myScene, 8, reference);
+		 TestProgressiveAccumulation(reference);
+	 }
+	 printf("---------------- BLAS per model vs per mesh ----------------\n");
+	 CompareBlasGranularity("Assets/cars2/scene.gltf");
+	 CompareBlasGranularity("Assets/city/scene.gltf");
+	 printf("---------------- GPU instancing stress test ----------------\n");
+	 StressTestGpuInstancing(1000000);
+	 ThrowIfFailed(m_commandList->Close());
+ }
+ void D3D12HelloTriangle::CompareBlasGranularity(const std::string& name) {
+	 tinygltf::TinyGLTF context;
+	 tinygltf::Model model;
+	 std::string error;
+	 std::string warning;
+	 if (!context.LoadASCIIFromFile(&model, &error, &warning, name)) {
+		 printf("Couldn't load %s for the BLAS comparison\n", name.c_str());
+		 return;
+	 }
+	 skin::NodeHierarchy hierarchy;
+	 BuildGLTFNodeHierarchy(model, hierarchy);
+	 std::vector<glm::mat4> globals;
+	 hierarchy.ComputeGlobalTransforms(globals);
+	 std::vector<int> meshNodes;
+	 CollectGLTFMeshNodes(model, meshNodes);
+	 // Positions and indices are uploaded once per primitive and shared by both builds
+	 std::vector<std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>> meshVertices(model.meshes.size());
+	 std::vector<std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>> meshIndices(model.meshes.size());
+	 for (int node : meshNodes) {
+		 int mesh = model.nodes[node].mesh;
+		 if (!meshVertices[mesh].empty())
+			 continue;
+		 for (auto& prim : model.meshes[mesh].primitives) {
+			 const tinygltf::Accessor& vertexAccessor = model.accessors[prim.attributes.at("POSITION")];
+			 const tinygltf::BufferView& vertexBufferView = model.bufferViews[vertexAccessor.bufferView];
+			 UINT vertexDataSize = static_cast<UINT>(vertexAccessor.count * vertexAccessor.ByteStride(vertexBufferView));
+			 ComPtr<ID3D12Resource> vertexBuffer;
+			 vertexBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), vertexDataSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+			 m_Uploads.UploadBuffer(vertexBuffer.Get(),
+				 &model.buffers[vertexBufferView.buffer].data[vertexBufferView.byteOffset + vertexAccessor.byteOffset], vertexDataSize);
+			 meshVertices[mesh].push_back({ vertexBuffer, static_cast<uint32_t>(vertexAccessor.count) });
+			 ComPtr<ID3D12Resource> indexBuffer;
+			 std::vector<UINT> indexData;
+			 if (prim.indices >= 0) {
+				 ReadGLTFIndices(model, model.accessors[prim.indices], indexData);
+				 indexBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(UINT) * indexData.size(), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+				 m_Uploads.UploadBuffer(indexBuffer.Get(), indexData.data(), sizeof(UINT) * indexData.size());
+			 }
+			 meshIndices[mesh].push_back({ indexBuffer, static_cast<uint32_t>(indexData.size()) });
+		 }
+	 }
+	 // One BLAS for the whole model, every node references its mesh again with its transform baked in
+	 std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>> modelVertexAndNum;
+	 std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>> modelIndexAndNum;
+	 std::vector<ComPtr<ID3D12Resource>> transforms;
+	 for (int node : meshNodes) {
+		 int mesh = model.nodes[node].mesh;
+		 ComPtr<ID3D12Resource> transBuffer;
+		 transBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(XMMATRIX), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+		 XMMATRIX transform = GlmToXM_mat4(globals[node]);
+		 m_Uploads.UploadBuffer(transBuffer.Get(), &transform, sizeof(XMMATRIX));
+		 for (size_t i = 0; i < meshVertices[mesh].size(); i++) {
+			 modelVertexAndNum.push_back(meshVertices[mesh][i]);
+			 modelIndexAndNum.push_back(meshIndices[mesh][i]);
+			 transforms.push_back(transBuffer);
+		 }
+	 }
+	 // The comparison builds are only kept until they are measured
+	 size_t modelRecordIndex = m_BlasRecords.size();
+	 CreateBottomLevelAS(modelVertexAndNum, modelIndexAndNum, transforms, {}, ASBuildPolicy::Static);
+	 // One BLAS per mesh, the nodes become TLAS instances
+	 for (size_t mesh = 0; mesh < meshVertices.size(); mesh++) {
+		 if (!meshVertices[mesh].empty())
+			 CreateBottomLevelAS(meshVertices[mesh], meshIndices[mesh], {}, {}, ASBuildPolicy::Static);
+	 }
+	 FlushBottomLevelAS();
+	 BlasRecord modelRecord = m_BlasRecords[modelRecordIndex];
+	 size_t meshBlasCount = m_BlasRecords.size() - modelRecordIndex - 1;
+	 UINT64 meshSize = 0;
+	 UINT64 meshPrebuildSize = 0;
+	 double meshBuildTimeMs = 0.0;
+	 for (size_t i = modelRecordIndex + 1; i < m_BlasRecords.size(); i++) {
+		 const BlasRecord& meshRecord = m_BlasRecords[i];
+		 meshSize += meshRecord.compactedSizeInBytes > 0 ? meshRecord.compactedSizeInBytes : meshRecord.resultSizeInBytes;
+		 meshPrebuildSize += meshRecord.resultSizeInBytes;
+		 meshBuildTimeMs += meshRecord.buildTimeMs;
+	 }
+	 m_BlasRecords.erase(m_BlasRecords.begin() + modelRecordIndex, m_BlasRecords.end());
+	 UINT64 modelSize = modelRecord.compactedSizeInBytes > 0 ? modelRecord.compactedSizeInBytes : modelRecord.resultSizeInBytes;
+	 printf("%s (%zu mesh nodes, %zu meshes)\n", name.c_str(), meshNodes.size(), meshBlasCount);
+	 printf("  per model:      1 BLAS   %10.1f KB (prebuild %10.1f KB) build %8.2f ms, 1 TLAS instance\n",
+		 modelSize / 1024.0, modelRecord.resultSizeInBytes / 1024.0, modelRecord.buildTimeMs);
+	 printf("  per mesh:  %6zu BLASes %10.1f KB (prebuild %10.1f KB) build %8.2f ms, %zu TLAS instances\n",
+		 meshBlasCount, meshSize / 1024.0, meshPrebuildSize / 1024.0, meshBuildTimeMs, meshNodes.size());
+ }
+ void D3D12HelloTriangle::BuildPathTracingReference(Scene* scene, uint32_t resolutionDivisor, PathTracingReference& reference) {
+	 std::vector<bvh::Instance> instances;
+	 reference.scene.surfaces.clear();
+	 for (GameObject& object : scene->m_sceneObjects) {
+		 const std::string& name = object.m_model->m_name;
+		 if (reference.blases.find(name) == reference.blases.end()) {
+			 bvh::Mesh mesh;
+			 if (!LoadGLTFMesh(name, mesh, &reference.surfaces[name]))
+				 printf("Couldn't load %s for the path tracing reference\n", name.c_str());
+			 bvh::BuildBlas(std::move(mesh), bvh::BuildSettings(), reference.blases[name]);
+		 }
+		 bvh::Instance instance;
+		 instance.blas = &reference.blases[name];
+		 instance.transform = object.m_transform;
+		 instance.mask = object.m_instanceMask;
+		 instance.userID = object.m_userID;
+		 instances.push_back(instance);
+		 reference.scene.surfaces.push_back(&reference.surfaces[name]);
+	 }
+	 reference.tlas.Build(instances);
+	 reference.scene.tlas = &reference.tlas;
+	 pt::BuildSceneLights(reference.scene);
+	 // The matrices of UpdateCameraBuffer
+	 reference.camera.viewInv = glm::inverse(nv_helpers_dx12::CameraManip.getMatrix());
+	 XMMATRIX projectionInv = XMMatrixInverse(nullptr, XMMatrixPerspectiveFovRH(45.0f * XM_PI / 180.0f, m_aspectRatio, 0.1f, 1000.0f));
+	 memcpy(glm::value_ptr(reference.camera.projectionInv), &projectionInv, sizeof(glm::mat4));
+	 reference.camera.width = (std::max)(1u, GetWidth() / resolutionDivisor);
+	 reference.camera.height = (std::max)(1u, GetHeight() / resolutionDivisor);
+ }
+ void D3D12HelloTriangle::ComparePathTracingEstimators(const PathTracingReference& reference) {
+	 pt::Settings settings;
+	 settings.maxBounces = m_pathMaxBounces;
+	 settings.rouletteDepth = m_pathRouletteDepth;
+	 settings.samplesPerPixel = 16;
+	 pt::EstimatorComparison comparison = pt::CompareEstimators(reference.scene, reference.camera, settings);
+	 printf("%ux%u, %u spp, %u bounces: loop %.5f (%.1f ms), recursive %.5f (%.1f ms), difference %+.3f%%, per pixel RMS %.6f\n",
+		 reference.camera.width, reference.camera.height, settings.samplesPerPixel, settings.maxBounces, comparison.loopMean, comparison.loopMs,
+		 comparison.recursiveMean, comparison.recursiveMs, 100.0 * comparison.RelativeDifference(), comparison.rmsDifference);
+ }
+ void D3D12HelloTriangle::CompareNextEventEstimation(const PathTracingReference& reference) {
+	 const pt::SceneLights& sceneLights = reference.scene.lights;
+	 printf("%zu emissive triangles in %zu meshes, power %.3f\n", sceneLights.triangles.size(), sceneLights.meshes.size(), sceneLights.power);
+	 if (sceneLights.power <= 0.0) {
+		 printf("  no lights, nothing to compare\n");
+		 return;
+	 }
+	 // The alias table has to pick the instances in proportion to their power
+	 const uint32_t instanceCount = static_cast<uint32_t>(sceneLights.instances.size());
+	 std::vector<lights::AliasEntry> table(instanceCount);
+	 for (uint32_t i = 0; i < instanceCount; i++) {
+		 table[i].probability = sceneLights.instances[i].probability;
+		 table[i].alias = sceneLights.instances[i].alias;
+	 }
+	 const uint32_t draws = 1 << 22;
+	 std::vector<uint32_t> histogram(instanceCount, 0);
+	 uint32_t seed = 1;
+	 for (uint32_t i = 0; i < draws; i++) {
+		 float u0 = pt::Rand(seed);
+		 float u1 = pt::Rand(seed);
+		 histogram[lights::SampleAlias(table.data(), instanceCount, u0, u1)]++;
+	 }
+	 double maxError = 0.0;
+	 for (uint32_t i = 0; i < instanceCount; i++) {
+		 maxError = (std::max)(maxError, std::abs(double(histogram[i]) / draws - sceneLights.instances[i].pdf));
+	 }
+	 printf("  instance alias table, %u draws: max probability error %.6f\n", draws, maxError);
+	 // Error against a converged render from samples the others don't draw, per sample count
+	 pt::Settings settings;
+	 settings.maxBounces = m_pathMaxBounces;
+	 settings.rouletteDepth = m_pathRouletteDepth;
+	 settings.samplesPerPixel = 256;
+	 settings.firstSample = 1u << 20;
+	 std::vector<glm::vec3> converged;
+	 double convergedMs = pt::Render(reference.scene, reference.camera, settings, pt::Estimator::Loop, converged);
+	 printf("  %ux%u, converged image %u spp in %.1f ms, mean %.5f\n", reference.camera.width, reference.camera.height, settings.samplesPerPixel,
+		 convergedMs, pt::MeanRadiance(converged));
+	 settings.firstSample = 0;
+	 std::vector<glm::vec3> image;
+	 for (uint32_t spp = 1; spp <= 64; spp *= 4) {
+		 settings.samplesPerPixel = spp;
+		 settings.nextEventEstimation = false;
+		 double bounceMs = pt::Render(reference.scene, reference.camera, settings, pt::Estimator::Loop, image);
+		 double bounceRmse = pt::Rmse(image, converged);
+		 settings.nextEventEstimation = true;
+		 double nextEventMs = pt::Render(reference.scene, reference.camera, settings, pt::Estimator::Loop, image);
+		 double nextEventRmse = pt::Rmse(image, converged);
+		 printf("  %2u spp: bounces RMSE %.5f (%.1f ms), next event estimation RMSE %.5f (%.1f ms)\n", spp, bounceRmse, bounceMs, nextEventRmse, nextEventMs);
+	 }
+ }
+ void D3D12HelloTriangle::CompareRussianRoulette(const PathTracingReference& reference) {
+	 pt::Settings settings;
+	 settings.maxBounces = m_pathMaxBounces;
+	 settings.samplesPerPixel = 16;
+	 settings.nextEventEstimation = m_nextEventEstimation;
+	 printf("%ux%u, %u spp, %u bounces, next event estimation %s\n", reference.camera.width, reference.camera.height, settings.samplesPerPixel,
+		 settings.maxBounces, settings.nextEventEstimation ? "on" : "off");
+	 // Without roulette first, the efficiency of the others is relative to it
+	 settings.rouletteDepth = settings.maxBounces;
+	 pt::Efficiency full = pt::MeasureEfficiency(reference.scene, reference.camera, settings);
+	 printf("  %-18s mean %.5f, variance %.6f, %7.2f ms/spp, variance x time %.6f\n", "no roulette", full.mean, full.variance, full.msPerSample,
+		 full.variance * full.msPerSample);
+	 for (uint32_t depth : { 1u, 2u, 3u, 5u }) {
+		 settings.rouletteDepth = depth;
+		 pt::Efficiency roulette = pt::MeasureEfficiency(reference.scene, reference.camera, settings);
+		 std::string label = "roulette from " + std::to_string(depth);
+		 printf("  %-18s mean %.5f, variance %.6f, %7.2f ms/spp, variance x time %.6f, efficiency x%.2f%s\n", label.c_str(), roulette.mean, roulette.variance,
+			 roulette.msPerSample, roulette.variance * roulette.msPerSample, full.Value() > 0.0 ? roulette.Value() / full.Value() : 0.0,
+			 depth == m_pathRouletteDepth ? " (current)" : "");
+	 }
+ }
+ void D3D12HelloTriangle::CompareTextureLod(const PathTracingReference& reference) {
+	 texlod::CacheSettings cache;
+	 for (uint32_t lineCount : { 256u, 1024u }) {
+		 cache.lineCount = lineCount;
+		 pt::TextureLodReport report = pt::AnalyzeTextureLod(reference.scene, reference.camera, cache);
+		 printf("%ux%u, %u base color fetches, %u KB %u-way cache of %ux%u texel lines\n", reference.camera.width, reference.camera.height, report.fetches,
+			 lineCount * cache.blockSize * cache.blockSize * 4 / 1024, cache.ways, cache.blockSize, cache.blockSize);
+		 printf("  %-10s mean level %5.2f, error %5.2f, hit rate %5.1f%%, %.3f misses per fetch\n", "ray cone", report.coneLod, report.coneError,
+			 100.0 * report.coneCache.HitRate(), report.coneCache.MissesPerFetch());
+		 printf("  %-10s mean level %5.2f, error %5.2f, hit rate %5.1f%%, %.3f misses per fetch\n", "t / 5", report.distanceLod, report.distanceError,
+			 100.0 * report.distanceCache.HitRate(), report.distanceCache.MissesPerFetch());
+		 printf("  %-10s mean level %5.2f, %u fetches\n", "reference", report.referenceLod, report.referenceFetches);
+		 printf("  %-10s hit rate %5.1f%%, %.3f misses per fetch\n", "mip 0", 100.0 * report.finestCache.HitRate(), report.finestCache.MissesPerFetch());
+	 }
+ }
+ void D3D12HelloTriangle::TestProgressiveAccumulation(PathTracingReference& reference) {
+	 // Converged image from samples the accumulation doesn't draw
+	 pt::Settings settings;
+	 settings.maxBounces = m_pathMaxBounces;
+	 settings.rouletteDepth = m_pathRouletteDepth;
+	 settings.samplesPerPixel = 256;
+	 settings.firstSample = 1u << 20;
+	 std::vector<glm::vec3> converged;
+	 double convergedMs = pt::Render(reference.scene, reference.camera, settings, pt::Estimator::Loop, converged);
+	 printf("%ux%u, converged image %u spp in %.1f ms\n", reference.camera.width, reference.camera.height, settings.samplesPerPixel, convergedMs);
+	 accum::Controller controller;
+	 accum::State state;
+	 std::vector<glm::vec3> average(converged.size());
+	 std::vector<glm::vec3> frameImage;
+	 settings.samplesPerPixel = 1;
+	 for (uint32_t frame = 0; frame < 64; frame++) {
+		 state.Clear();
+		 state.Add(reference.camera.viewInv);
+		 accum::Frame accumulationFrame = controller.Advance(state);
+		 // The GPU seeds with the frame index
+		 settings.firstSample = frame;
+		 pt::Render(reference.scene, reference.camera, settings, pt::Estimator::Loop, frameImage);
+		 for (size_t i = 0; i < average.size(); i++) {
+			 average[i] = accum::Blend(average[i], frameImage[i], accumulationFrame.sampleIndex);
+		 }
+		 uint32_t spp = controller.GetSampleCount();
+		 if ((spp & (spp - 1)) == 0)
+			 printf("  %2u spp: RMSE %.5f\n", spp, pt::Rmse(average, converged));
+	 }
+	 // A moved camera restarts the average
+	 reference.camera.viewInv = glm::translate(glm::vec3(0.01f, 0.f, 0.f)) * reference.camera.viewInv;
+	 state.Clear();
+	 state.Add(reference.camera.viewInv);
+	 accum::Frame moved = controller.Advance(state);
+	 printf("  camera moved: %s, %u spp, %u resets\n", moved.reset && moved.sampleIndex == 0 ? "restarted" : "NOT RESTARTED",
+		 controller.GetSampleCount(), controller.GetResetCount());
+ }
+ void D3D12HelloTriangle::StressTestGpuInstancing(uint32_t instanceCount) {
+	 Model* cube = LoadModelFromClass(&m_resourceManager, "Assets/Cube/Cube.gltf", std::vector<std::string>{ "HitGroup", "ShadowHitGroup" });
+	 instancing::InstanceAttributes attributes = instancing::MakeRandomInstances(instanceCount, 1000.f);
+	 std::vector<glm::mat4> transforms(instanceCount);
+	 // Decoding: SIMD on worker threads, SIMD on one thread and the scalar reference
+	 auto start = std::chrono::high_resolution_clock::now();
+	 instancing::ComposeInstanceTransformsParallel(attributes, glm::mat4(1.f), transforms.data());
+	 double decodeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	 start = std::chrono::high_resolution_clock::now();
+	 instancing::ComposeInstanceTransforms(attributes, glm::mat4(1.f), transforms.data(), 0, instanceCount);
+	 double decodeSingleMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	 start = std::chrono::high_resolution_clock::now();
+	 instancing::ComposeInstanceTransformsReference(attributes, glm::mat4(1.f), transforms.data(), 0, instanceCount);
+	 double decodeScalarMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	 // A separate TLAS, so the scene TLAS stays untouched
+	 nv_helpers_dx12::TopLevelASGenerator generator;
+	 ID3D12Resource* blas = reinterpret_cast<ID3D12Resource*>(cube->m_BlasPointer);
+	 start = std::chrono::high_resolution_clock::now();
+	 // The generator keeps references to the transforms until Generate
+	 std::vector<XMMATRIX> instanceTransforms(instanceCount);
+	 for (uint32_t i = 0; i < instanceCount; i++) {
+		 instanceTransforms[i] = GlmToXM_mat4(transforms[i]);
+		 generator.AddInstance(blas, instanceTransforms[i], 0, 0, INSTANCE_MASK_GEOMETRY, D3D12_RAYTRACING_INSTANCE_FLAG_NONE);
+	 }
+	 double addMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	 UINT64 scratchSize, resultSize, instanceDescsSize;
+	 generator.ComputeASBufferSizes(m_device.Get(), D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE, &scratchSize, &resultSize, &instanceDescsSize);
+	 AccelerationStructureBuffers buffers;
+	 buffers.pScratch = nv_helpers_dx12::CreateBuffer(m_device.Get(), scratchSize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kDefaultHeapProps);
+	 buffers.pResult = nv_helpers_dx12::CreateBuffer(m_device.Get(), resultSize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, nv_helpers_dx12::kDefaultHeapProps);
+	 buffers.pInstanceDesc = nv_helpers_dx12::CreateBuffer(m_device.Get(), instanceDescsSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, nv_helpers_dx12::kUploadHeapProps);
+	 // Generate writes the instance descriptors on the CPU, the build time covers that and the GPU build
+	 start = std::chrono::high_resolution_clock::now();
+	 generator.Generate(m_commandList.Get(), buffers.pScratch.Get(), buffers.pResult.Get(), buffers.pInstanceDesc.Get());
 	 ThrowIfFailed(m_commandList->Close());
 	 ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
 	 m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
@@ -1537,19 +3406,12 @@ void D3D12HelloTriangle::OnMouseMove(UINT8 wParam, UINT32 lParam) {
 	 m_fence->SetEventOnCompletion(m_fenceValue, m_fenceEvent);
 	 WaitForSingleObject(m_fenceEvent, INFINITE);
 	 ThrowIfFailed(m_commandList->Reset(m_commandAllocator.Get(), nullptr));
-	
-	 pUavHeap.Reset();
-	 mipUAVs.clear();
-	 
- }
- void D3D12HelloTriangle::CreateFrameIndexBuffer()
- {
-
-	 
-	 m_FrameIndexBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), sizeof(uint32_t), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COMMON, nv_helpers_dx12::kUploadHeapProps);
-	 m_FrameHeapIndex = nv_helpers_dx12::CreateBufferView(m_device.Get(), m_FrameIndexBuffer.Get(), m_FrameIndexBuffer->GetGPUVirtualAddress(),
-			 m_CbvSrvUavHandle, m_CbvSrvUavIndex, nv_helpers_dx12::SRV_BUFFER, sizeof(uint32_t));
+	 double buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 
+	 printf("%u cube instances: decode %.2f ms (single thread %.2f ms, scalar %.2f ms), AddInstance %.2f ms, TLAS build %.2f ms\n",
+		 instanceCount, decodeMs, decodeSingleMs, decodeScalarMs, addMs, buildMs);
+	 printf("TLAS %.1f MB, scratch %.1f MB, instance descriptors %.1f MB\n",
+		 resultSize / (1024.0 * 1024.0), scratchSize / (1024.0 * 1024.0), instanceDescsSize / (1024.0 * 1024.0));
  }
  // Gameplay code simulation------------------------------
  void D3D12HelloTriangle::MakeTestScene()
@@ -1559,11 +3421,13 @@ void D3D12HelloTriangle::OnMouseMove(UINT8 wParam, UINT32 lParam) {
 	// a.m_model = LoadModelFromClass(&m_resourceManager, "Assets/cars2/scene.gltf", std::vector<std::string>{ "HitGroup", "ShadowHitGroup" });
 	 b.m_model = LoadModelFromClass(&m_resourceManager, "Assets/Sponza/Sponza.gltf", std::vector<std::string>{ "HitGroup", "ShadowHitGroup" });
 	c.m_model = LoadModelFromClass(&m_resourceManager, "Assets/EmissiveSphere/scene.gltf", std::vector<std::string>{ "HitGroup", "ShadowHitGroup" });
-	 a.m_model = LoadModelFromClass(&m_resourceManager, "Assets/Helmet/DamagedHelmet.gltf", std::vector<std::string>{ "HitGroup", "ShadowHitGroup" });
+	 a.m_model = LoadModelFromClass(&m_resourceManager, "Assets/Helmet/DamagedHelmet.gltf", std::vector<std::string>{ "HitGroup", "ShadowHitGroup" }, ASBuildPolicy::Hero);
 
 	 a.m_transform = glm::scale(glm::vec3(1.f));
 	 b.m_transform = glm::scale(glm::vec3(0.4f)) * glm::translate(glm::vec3(0.f, 0.f, 0.f));
 	 c.m_transform = glm::scale(glm::vec3(0.5f)) * glm::translate(glm::vec3(1.f, 0.f, 0.f));
+	 c.m_instanceMask = INSTANCE_MASK_LIGHT_PROXY;
+	 c.m_instanceFlags = INSTANCE_FLAG_FORCE_OPAQUE;
 
 	 m_myScene.m_sceneObjects.clear();
 	 m_myScene.AddGameObject(a);
@@ -1575,6 +3439,9 @@ void D3D12HelloTriangle::OnMouseMove(UINT8 wParam, UINT32 lParam) {
 		 n.m_model = LoadModelFromClass(&m_resourceManager, "Assets/EmissiveSphere/scene.gltf", std::vector<std::string>{ "HitGroup", "ShadowHitGroup" });
 		
 		 n.m_transform = glm::scale(glm::vec3(randf() + 0.1f)) * glm::translate(glm::vec3(randf() * 10.f - 5.f, randf() * 10.f - 5.f, randf() * 10.f - 5.f));
+		 n.m_instanceMask = INSTANCE_MASK_LIGHT_PROXY;
+		 n.m_instanceFlags = INSTANCE_FLAG_FORCE_OPAQUE;
+		 n.m_userID = i;
 		 m_myScene.AddGameObject(n);
 	 }
 	 UploadScene(&m_myScene);
@@ -1584,7 +3451,7 @@ void D3D12HelloTriangle::OnMouseMove(UINT8 wParam, UINT32 lParam) {
 	 GameObject a, b, c, d;
 	 Model am, bm, cm, dm;
 
-	 a.m_model = LoadModelFromClass(&m_resourceManager, "Assets/car/scene.gltf", std::vector<std::string>{ "HitGroup", "ShadowHitGroup" });
+	 a.m_model = LoadModelFromClass(&m_resourceManager, "Assets/car/scene.gltf", std::vector<std::string>{ "HitGroup", "ShadowHitGroup" }, ASBuildPolicy::Hero);
 	 b.m_model = LoadModelFromClass(&m_resourceManager, "Assets/Cube/Cube.gltf", std::vector<std::string>{ "HitGroup", "ShadowHitGroup" });
 	 c.m_model = LoadModelFromClass(&m_resourceManager, "Assets/cars2/scene.gltf", std::vector<std::string>{ "HitGroup", "ShadowHitGroup" });
 	 d.m_model = LoadModelFromClass(&m_resourceManager, "Assets/Sponza/Sponza.gltf", std::vector<std::string>{ "HitGroup", "ShadowHitGroup" });
@@ -16,10 +16,28 @@
 #include <dxcapi.h>
 #include <vector>
 #include "nv_helpers_dx12/TopLevelASGenerator.h"
+#include "nv_helpers_dx12/BottomLevelASGenerator.h"
 #include "nv_helpers_dx12/ShaderBindingTableGenerator.h"
 #include "tiny_gltf/tiny_gltf.h"
 #include "Scene.h"
 #include "ResourceManagerImprov.h"
+#include "OpacityMicromap.h"
+#include "Skinning.h"
+#include "Animation.h"
+#include "GpuInstancing.h"
+#include "LodSelector.h"
+#include "Simplify.h"
+#include "Lbvh.h"
+#include "Sbvh.h"
+#include "TwoLevelBvh.h"
+#include "RayQuery.h"
+#include "UploadQueue.h"
+#include "FrameConstants.h"
+#include "RenderModes.h"
+#include "PathTracer.h"
+#include "TextureLod.h"
+#include "Accumulation.h"
+#include <chrono>
 // -----------------
 using namespace DirectX;
 
@@ -42,8 +60,13 @@ public:
 	// Will need to be public to call from Model.cpp and Scene.cpp
 	void LoadModelRecursive(const std::string& name, Model* model);
 	void UploadScene(Scene* scene);
+	// Batched world space ray queries against the CPU scene (-cpurays), hit instances index the game
+	// objects. Both return the timing of the batch
+	bvh::RayBatchTiming CastRays(const std::vector<bvh::Ray>& rays, std::vector<bvh::InstanceHit>& hits, uint32_t mask = 0xFF) const;
+	bvh::RayBatchTiming TestOcclusion(const std::vector<bvh::Ray>& rays, std::vector<uint8_t>& occluded, uint32_t mask = 0xFF) const;
 private:
-	Model* LoadModelFromClass(ResourceManager* resManager, const std::string& name, std::vector<std::string>& hitGroups);
+	Model* LoadModelFromClass(ResourceManager* resManager, const std::string& name, std::vector<std::string>& hitGroups, ASBuildPolicy policy = ASBuildPolicy::Static,
+		BlasGranularity granularity = BlasGranularity::Model);
 
 	// ------REMOVE - GAMEPLAY CALL SIMULATION------
 	void MakeTestScene();
@@ -56,7 +79,8 @@ private:
 
 	void SwitchScenes();
 	// ------------------------------------------
-	static const UINT FrameCount = 2;
+	// Most frames in flight, m_framesInFlight of them are used. The back buffer index picks the frame slot
+	static const UINT FrameCount = 3;
 	struct Normal
 	{
 		XMFLOAT3 dir;
@@ -106,23 +130,23 @@ private:
 
 	};
 	void FillInfoPBR(tinygltf::Model& model, tinygltf::Primitive& prim, MaterialStruct* material, std::vector<uint32_t>& imageHeapIds);
+	// Bakes the opacity micromap of an alpha masked primitive on the CPU, the states are not uploaded yet
+	omm::BakeStats BakeOpacityMicromap(tinygltf::Model& model, tinygltf::Primitive& prim, const MaterialStruct& material, const std::vector<UINT>& indexData);
+	UINT m_OmmSubdivisionLevel = 4; // 4^level micro-triangles per triangle
 	void LoadImageData(tinygltf::Model& model, std::vector<uint32_t>& imageHeapIds);
 	uint32_t m_renderMode = 0;
-	uint32_t m_numRenderModes = 13;
-	// For now render modes
-	// 0 - vertex colors
-	// 1 - vertex normals
-	// 2 - base color
-	// 3 - metallic 
-	// 4 - roughness
-	// 5 - metallic roughness
-	// 6 - occlusion
-	// 7 - orm
-	// 8 - normal map 
-	// 9 - world space normals 
-	// 10 - emissive
-	// 11 - basecolor + shadows
-	// 12 - path Tracing
+	uint32_t m_numRenderModes = render::kModeCount;
+	// b0 in space 1 of the global root signature
+	struct RenderConstants {
+		uint32_t renderMode;
+		uint32_t maxBounces;
+		uint32_t accumulatedSamples;
+		uint32_t lightInstances; // 0 turns next event estimation off
+		uint32_t rouletteDepth; // m_pathRouletteDepth, -roulettedepth on the command line
+	};
+	uint32_t m_pathMaxBounces = render::kPathMaxBounces;
+	bool m_nextEventEstimation = true; // N, the path tracer samples the emissive triangles besides bouncing into them
+	// The render modes are listed in RenderModes.h
 	//----------------------------
 	// Pipeline objects.
 	CD3DX12_VIEWPORT m_viewport;
@@ -131,8 +155,11 @@ private:
 	ComPtr<ID3D12GraphicsCommandList4> m_commandList;
 	ComPtr<ID3D12Device5> m_device; // We need Device 5 for raytracing #RTX
 	ComPtr<ID3D12Resource> m_renderTargets[FrameCount];
-	ComPtr<ID3D12CommandAllocator> m_commandAllocator;
+	ComPtr<ID3D12CommandAllocator> m_commandAllocator; // Loading and other work the CPU waits for
+	ComPtr<ID3D12CommandAllocator> m_frameAllocators[FrameCount];
 	ComPtr<ID3D12CommandQueue> m_commandQueue;
+	// Copy queue for model data, made visible to m_commandQueue by a GPU side wait
+	UploadQueue m_Uploads;
 	ComPtr<ID3D12DescriptorHeap> m_rtvHeap;
 	UINT m_rtvDescriptorSize;
 
@@ -140,11 +167,18 @@ private:
 	UINT m_frameIndex;
 	HANDLE m_fenceEvent;
 	ComPtr<ID3D12Fence> m_fence;
-	UINT64 m_fenceValue;
+	UINT64 m_fenceValue; // Last signalled value
+	UINT64 m_frameFenceValues[FrameCount] = {}; // Reached when the GPU finished the last frame of the slot
+	// Time the CPU spent waiting for a free frame slot since the last report
+	double m_cpuWaitMs = 0.0;
+	uint32_t m_cpuWaitFrames = 0;
 
 	void LoadPipeline();
 	void PopulateCommandList();
-	void WaitForPreviousFrame();
+	// Signals the end of the submitted frame, then waits until the GPU is done with the next frame slot
+	void MoveToNextFrame();
+	// Waits until the GPU finished all submitted work
+	void WaitForGpu();
 
 	// We need to know if we can run RTX #RTX
 	void CheckRaytracingSupport();
@@ -157,19 +191,157 @@ private:
 		ComPtr<ID3D12Resource> pResult; // Where the AS is 
 		ComPtr<ID3D12Resource> pInstanceDesc; // Hold the matrices of the instances
 	};
-	std::vector<std::tuple<ComPtr<ID3D12Resource>, DirectX::XMMATRIX, UINT>> m_instances; // Stores BLASes  with the corresponding transforms and number of Hit groups
+	// TLAS instance of a game object
+	struct SceneInstance
+	{
+		ComPtr<ID3D12Resource> blas;
+		DirectX::XMMATRIX transform;
+		UINT hitGroupOffset; // First hit group record of the model in the SBT, InstanceContributionToHitGroupIndex
+		UINT instanceMask; // InstanceMask bits
+		D3D12_RAYTRACING_INSTANCE_FLAGS flags;
+		UINT userID; // Exposed to shaders as InstanceID()
+		UINT primitiveHeapIndex = 0; // Primitive indexes buffer, shaders find it through InstanceIndex()
+		int node = -1; // glTF node of a per mesh instance, -1 if the BLAS holds the whole model
+		int animation = -1; // Index in m_AnimatedModels, -1 if the model is not animated
+		glm::mat4 objectTransform = glm::mat4(1.f); // Game object transform, the animation is applied on top of it
+		glm::mat4 instanceTransform = glm::mat4(1.f); // EXT_mesh_gpu_instancing transform below the node
+		Model* model = nullptr; // Model whose levels of detail the instance switches between, nullptr for per mesh instances
+		uint32_t lod = 0; // Level of the current BLAS
+		uint64_t triangles = 0; // Triangles of the current BLAS
+	};
+	std::vector<SceneInstance> m_instances; // Stores BLASes  with the corresponding transforms and number of Hit groups
+
+	// Per model BLAS data, kept alive for the lifetime of the model and used for reporting
+	struct BlasRecord
+	{
+		std::string modelName;
+		ASBuildPolicy policy = ASBuildPolicy::Static;
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
+		AccelerationStructureBuffers buffers; // Scratch is only kept for BLASes which are refitted
+		nv_helpers_dx12::BottomLevelASGenerator generator; // Geometry descriptors, needed to refit
+		UINT64 resultSizeInBytes = 0; // Size reported by the prebuild info
+		UINT64 compactedSizeInBytes = 0; // 0 if the BLAS was not compacted
+		double buildTimeMs = 0.0; // GPU time between the timestamps around the build
+		UINT64 opaqueTriangles = 0;
+		UINT64 nonOpaqueTriangles = 0; // Alpha tested in the any-hit shaders
+		omm::BakeStats ommStats; // Opacity micromaps of the non-opaque triangles
+	};
+	std::vector<BlasRecord> m_BlasRecords;
+	// Compacted sizes and build timestamps of kBlasQueriesPerChunk builds, reused by every flush
+	struct BlasQueryChunk
+	{
+		ComPtr<ID3D12Resource> compactedSizes; // Written by the builds
+		ComPtr<ID3D12QueryHeap> timestamps; // Before and after every build
+		ComPtr<ID3D12Resource> readback; // The sizes, then the timestamps
+	};
+	static const UINT kBlasQueriesPerChunk = 256;
+	std::vector<BlasQueryChunk> m_BlasQueryChunks;
+	std::vector<size_t> m_PendingBlases; // Records built since the last flush, the i-th one uses query slot i
+	std::vector<ComPtr<ID3D12DescriptorHeap>> m_PendingMipHeaps; // UAVs of the mip generation recorded since the last flush
+	// Primitive of a skinned mesh. The compute pass writes the deformed vertices into the
+	// position and normal buffers which the BLAS and the hit shaders read
+	struct SkinnedPrimitive
+	{
+		ComPtr<ID3D12Resource> bindPositions;
+		ComPtr<ID3D12Resource> bindNormals; // nullptr if the primitive has no normals
+		ComPtr<ID3D12Resource> joints; // uint4 per vertex
+		ComPtr<ID3D12Resource> weights; // float4 per vertex
+		ComPtr<ID3D12Resource> positions;
+		ComPtr<ID3D12Resource> normals;
+		UINT vertexCount = 0;
+		UINT skin = 0; // Index in SkinnedModel::skins
+	};
+	// Skinning data of a loaded model, all instances of the model share the pose
+	struct SkinnedModel
+	{
+		std::string modelName;
+		size_t blasRecord = 0; // Index in m_BlasRecords, refitted after every skinning pass
+		skin::NodeHierarchy hierarchy;
+		std::vector<skin::Skin> skins;
+		std::vector<int> skinSources; // glTF skin of every entry in skins
+		std::vector<std::vector<glm::mat4>> jointMatrices; // Last uploaded matrices of every skin
+		std::vector<ComPtr<ID3D12Resource>> jointMatrixBuffers; // Upload heap, persistently mapped, FrameCount per skin
+		std::vector<glm::mat4*> mappedJointMatrices;
+		std::vector<SkinnedPrimitive> primitives;
+		std::vector<ComPtr<ID3D12Resource>> blasInputs; // Vertex, index and transform buffers of every BLAS geometry
+		bool dirty = true; // The pose changed since the last skinning pass
+	};
+	std::vector<SkinnedModel> m_SkinnedModels;
+	// Primitive of a model with a single BLAS, the generated levels of detail share its vertex streams
+	struct LodPrimitive
+	{
+		std::vector<glm::vec3> positions;
+		std::vector<uint32_t> indices;
+		std::pair<ComPtr<ID3D12Resource>, uint32_t> vertexBuffer;
+		ComPtr<ID3D12Resource> transform;
+		bool opaque = true;
+		// Buffers of the heap views in front of the indexes with their stride, the material first
+		std::vector<std::pair<ComPtr<ID3D12Resource>, UINT>> views;
+		// The triangle lods after the indexes are built again for the simplified triangles
+		glm::mat4 modelTransform = glm::mat4(1.f);
+		std::vector<std::vector<glm::vec2>> texcoords;
+	};
+	std::vector<LodPrimitive> m_LodPrimitives; // Filled by LoadModelRecursive, consumed by LoadModelLods
+	// Light list of next event estimation. Every model with emissive primitives gets its triangles in model
+	// space once, the TLAS instances of the whole model reference them
+	std::vector<std::vector<lights::Triangle>> m_LightGeometries; // Per BLAS geometry of the model being loaded
+	std::unordered_map<std::string, lights::MeshLights> m_ModelLights; // By model name
+	ComPtr<ID3D12Resource> m_LightTriangleBuffer;
+	ComPtr<ID3D12Resource> m_LightGeometryBuffer;
+	uint32_t m_LightTrianglesHeapIndex;
+	uint32_t m_LightGeometriesHeapIndex;
+	// The instance table follows the transforms, so every frame slot has its own mapped copy
+	ComPtr<ID3D12Resource> m_LightInstanceBuffers[FrameCount];
+	lights::GpuInstance* m_MappedLightInstances[FrameCount] = {};
+	uint32_t m_LightInstancesHeapIndices[FrameCount];
+	std::vector<lights::InstanceLights> m_InstanceLights; // Per TLAS instance, filled by UploadScene
+	std::vector<glm::mat4> m_LightTransforms;
+	std::vector<lights::GpuInstance> m_LightInstanceTable;
+	uint32_t m_LightInstanceCount = 0; // RenderConstants::lightInstances
+	// Reserves the descriptors of the light buffers, UploadScene points them at the buffers of the scene
+	void CreateLightDescriptors();
+	// Rebuilds the instance table of the frame slot, levels of detail other than 0 have no lights
+	void UpdateLights();
+	simplify::Settings m_LodChainSettings;
+	// glTF animations of a loaded model, all instances of the model share the pose
+	struct AnimatedModel
+	{
+		std::string modelName;
+		skin::NodeHierarchy hierarchy;
+		std::vector<anim::Clip> clips;
+		size_t activeClip = 0;
+		anim::Instance instance;
+		int skinnedModel = -1; // Index in m_SkinnedModels which gets the animated local transforms
+		// The BLAS holds the rest pose, a single root node moves the TLAS instances instead
+		int rootNode = -1;
+		glm::mat4 inverseRestRootGlobal = glm::mat4(1.f);
+	};
+	std::vector<AnimatedModel> m_AnimatedModels;
+	std::chrono::high_resolution_clock::time_point m_lastAnimationTime;
+	// Prints every BLAS with its policy, size and build time
+	void ReportAccelerationStructures();
+	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS GetASBuildFlags(ASBuildPolicy policy);
 
+	// Records the build on m_commandList and appends record to m_BlasRecords, which keeps the BLAS alive.
+	// Nothing is submitted until FlushBottomLevelAS, which also replaces compacted results
 	AccelerationStructureBuffers
 		CreateBottomLevelAS(std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>> vVertexBuffers,
 							std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>> vIndexBuffers = {},
-	std::vector<ComPtr<ID3D12Resource>> vTransformBuffers = {});
+	std::vector<ComPtr<ID3D12Resource>> vTransformBuffers = {}, std::vector<bool> vOpaque = {}, ASBuildPolicy policy = ASBuildPolicy::Static, BlasRecord* record = nullptr);
+	// Submits the pending builds with their size and timestamp queries and the pending mip generation,
+	// then the copies into compacted buffers, and points the records and model at the compacted BLASes
+	void FlushBottomLevelAS(Model* model = nullptr);
 	// ---------     TLAS   ----------------------------------------
 	/// Create the main acceleration structure that holds all instances of the scene
-	/// param instances : tuple of BLAS, transform in world and hit group number
-	void CreateTopLevelAS(const std::vector<std::tuple<ComPtr<ID3D12Resource>, DirectX::XMMATRIX, UINT>>& instances, bool updateOnly = false);
+	/// param instances : BLAS, transform in world, hit group number, mask, flags and user ID of each instance
+	void CreateTopLevelAS(const std::vector<SceneInstance>& instances, bool updateOnly = false);
 	void ReCreateAccelerationStructures();
 	nv_helpers_dx12::TopLevelASGenerator m_topLevelASGenerator; // Helper to create TLAS
 	AccelerationStructureBuffers m_topLevelASBuffers;
+	// The CPU rewrites the instance descriptors of every TLAS update, so each frame slot has its own
+	ComPtr<ID3D12Resource> m_TlasInstanceDescs[FrameCount];
+	// Always allows updates for animated instances, trace/build preference depends on the scene content
+	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS m_TlasBuildFlags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE;
 	uint32_t m_TlasHeapIndex;
 	bool m_TlasFirstBuild = true;
 	//--------------------------------------------------------------
@@ -182,20 +354,22 @@ private:
 	//-------------------
 	void CreateRaytracingPipeline(); // PSO creation
 	// Shader representation for #RTX
-	ComPtr<IDxcBlob> m_rayGenLibrary;
-	ComPtr<IDxcBlob> m_hitLibrary;
-	ComPtr<IDxcBlob> m_missLibrary;
+	ComPtr<IDxcBlob> m_rayGenLibraries[2]; // By SURFACE_PAYLOAD, the color only payload of the debug modes or the full one
+	std::vector<ComPtr<IDxcBlob>> m_hitLibraries; // Closest hit permutation of every render mode
+	std::vector<std::wstring> m_modeHitGroups; // Hit group of every render mode
+	ComPtr<IDxcBlob> m_missLibraries[2]; // By SURFACE_PAYLOAD
 	// ------------------ Local RS
 	ComPtr<ID3D12RootSignature> m_rayGenSignature;
 	ComPtr<ID3D12RootSignature> m_hitSignature;
 	ComPtr<ID3D12RootSignature> m_missSignature;
 	// ------------------ Global RS
 	ComPtr<ID3D12RootSignature> m_globalSignature;
-	// Ray tracing pipeline state
-	ComPtr<ID3D12StateObject> m_rtStateObject;
+	// Ray tracing pipeline states, one per group of render modes with the same needs
+	std::vector<ComPtr<ID3D12StateObject>> m_rtStateObjects;
 	// Ray tracing pipeline state properties, retaining the shader identifiers
 	// to use in the Shader Binding Table
-	ComPtr<ID3D12StateObjectProperties> m_rtStateObjectProps;
+	std::vector<ComPtr<ID3D12StateObjectProperties>> m_rtStateObjectProps;
+	std::vector<uint32_t> m_modePipelines; // Pipeline of every render mode
 	//-----------------------------------------------------------------
 	ComPtr<ID3D12DescriptorHeap> m_CbvSrvUavHeap;
 	D3D12_CPU_DESCRIPTOR_HANDLE m_CbvSrvUavHandle;
@@ -213,18 +387,35 @@ private:
 	void CreateRaytracingOutputBuffer();
 	ComPtr<ID3D12Resource> m_outputResource; // similar to rtv in #RTX. Shaders write to this buffer
 	uint32_t m_RTOutputHeapIndex;
+	// Running average of the path tracing mode, float so long accumulations don't band
+	ComPtr<ID3D12Resource> m_accumulationResource;
+	uint32_t m_AccumulationHeapIndex;
+	// Restarts the accumulation when the camera, the instances, the animations or the settings changed
+	// and shows the samples per pixel in the window title
+	void UpdateAccumulation();
+	accum::Controller m_Accumulation;
+	accum::State m_AccumulationState;
+	accum::Frame m_AccumulationFrame;
+	bool m_pauseAnimation = false; // P, lets the path tracer converge in animated scenes
 	// ---------SBT for connectring Shaders and resources together-----
 	// SBT is the CORE of the DXR, uniting the whole setup
 	void ReCreateShaderBindingTable(Scene* scene);
+	// Hit group lists of the models in the scene, each gets one set of records in the SBT. The shaders find
+	// the instance data with InstanceIndex(), so every instance of a list shares its records
+	std::vector<std::vector<std::string>> m_HitGroupSets;
+	// Record of the first hit group of the list, which is added to m_HitGroupSets if it is new
+	UINT GetHitGroupOffset(const std::vector<std::string>& hitGroups);
 	nv_helpers_dx12::ShaderBindingTableGenerator m_sbtHelper;
-	ComPtr<ID3D12Resource> m_sbtStorage;
+	std::vector<ComPtr<ID3D12Resource>> m_sbtStorage; // Per render mode
 	//---------------------------------------------------------------------
 	// CAMERA SETUP - can be replaced for Perry cam later
-	void CreateCameraBuffer();
 	void UpdateCameraBuffer();
-	ComPtr< ID3D12Resource > m_cameraBuffer;
-	uint32_t m_camHeapIndex;
-	uint32_t m_cameraBufferSize = 0;
+	uint32_t m_camHeapIndices[FrameCount];
+	// Camera, frame index and other per frame constants, written through a persistent mapping
+	FrameConstants m_FrameConstants;
+	static const uint64_t kFrameConstantsSliceSize = 64 * 1024;
+	// Reserves the per slot descriptors of the frame constants, they are rewritten when the slot is recorded
+	void CreateFrameConstants();
 	// CAMERA CONTROLS
 	void OnButtonDown(UINT32 lParam); 
 	void OnMouseMove(UINT8 wParam, UINT32 lParam);
@@ -236,21 +427,104 @@ private:
 	// MODEL LOADING
 	void BuildModelRecursive(tinygltf::Model& model, Model* modelData, uint64_t nodeIndex, XMMATRIX parentMat, std::vector <ComPtr<ID3D12Resource >>& transforms,
 		std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>& modelVertexAndNum, std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>& modelIndexAndNum,
-		std::vector<uint32_t>& primitiveIndexes, std::vector<uint32_t>& imageHeapIds);
+		std::vector<bool>& opaqueGeometry, omm::BakeStats& ommStats, SkinnedModel& skinnedModel, std::vector<uint32_t>& primitiveIndexes, std::vector<uint32_t>& imageHeapIds,
+		std::vector<LodPrimitive>* lodPrimitives);
+	// Buffers, heap views and BLAS geometries of the primitives of a mesh placed with transform. skinNode is the node
+	// whose skin deforms the mesh, -1 for none
+	void BuildMeshPrimitives(tinygltf::Model& model, int meshIndex, XMMATRIX transform, int skinNode, std::vector<ComPtr<ID3D12Resource>>& transforms,
+		std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>& modelVertexAndNum, std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>& modelIndexAndNum,
+		std::vector<bool>& opaqueGeometry, omm::BakeStats& ommStats, SkinnedModel& skinnedModel, std::vector<uint32_t>& primitiveIndexes, std::vector<uint32_t>& imageHeapIds,
+		std::vector<LodPrimitive>* lodPrimitives);
+	// Builds a BLAS per unique mesh of the default scene and fills Model::m_nodeInstances
+	void BuildMeshAccelerationStructures(tinygltf::Model& model, Model* modelData, const std::string& name, const skin::NodeHierarchy& hierarchy, std::vector<uint32_t>& imageHeapIds);
+	// Parses the glTF animations into m_AnimatedModels
+	void LoadAnimations(const tinygltf::Model& model, const std::string& name, const skin::NodeHierarchy& hierarchy, int skinnedModel);
 	XMMATRIX GlmToXM_mat4(glm::mat4 gmat);
 	// Bindless
 	std::vector<uint32_t> m_AllHeapIndices;
-	ComPtr<ID3D12Resource> m_HeapIndexBuffer;
+	// Upload heap, persistently mapped. Every frame slot has a copy pointing at its own camera and frame index,
+	// it is refreshed from m_AllHeapIndices before recording the frame so LOD switches reach all slots
+	ComPtr<ID3D12Resource> m_HeapIndexBuffers[FrameCount];
+	uint32_t* m_MappedHeapIndices[FrameCount] = {};
+	void UpdateHeapIndexBuffer();
+	static const uint32_t kCommonHeapIndexCount = 8; // COMMON_RESOURCE_OFFSET in Common.hlsl
 	// Mip maps
 	ComPtr<ID3D12RootSignature> m_MipMapRootSignature;
 	ComPtr<ID3D12PipelineState> m_MipMapPSO;
 	ComPtr<ID3D12RootSignature> CreateMipMapSignature();
 	void CreateMipMapPSO();
-	void GenerateMips(ComPtr<ID3D12Resource> texture);
+	// Records the mips of a texture uploaded in the COMMON state, the returned UAV heap has to live until the command list executed
+	ComPtr<ID3D12DescriptorHeap> GenerateMips(ComPtr<ID3D12Resource> texture);
+	// Skinning
+	ComPtr<ID3D12RootSignature> m_SkinningRootSignature;
+	ComPtr<ID3D12PipelineState> m_SkinningPSO;
+	ComPtr<ID3D12RootSignature> CreateSkinningSignature();
+	void CreateSkinningPSO();
+	// Advances and evaluates all animated models on worker threads, then moves their TLAS instances
+	void UpdateAnimations();
+	// Evaluates the joint matrices of all skinned models on worker threads and uploads the changed ones
+	void UpdateSkinning();
+	// Records the skinning pass and the BLAS refit of every model whose pose changed
+	void RecordSkinning();
+	// Picks the level of detail of every instance from its projected size and the triangle budget,
+	// then swaps the BLAS of the TLAS instance and its primitive indexes
+	void UpdateLods();
+	// Loads the authored levels of detail <name>_lod1.gltf, <name>_lod2.gltf, ... next to the model,
+	// without them the levels are generated by simplifying the primitives of the model
+	void LoadModelLods(Model* model);
+	// Builds a BLAS per simplified level, the index buffers of a level view the original vertex streams
+	void GenerateLods(Model* model, const std::vector<LodPrimitive>& primitives);
+	// Heap view after the indexes of a primitive: the texel density of every triangle and texcoord set, which
+	// the ray cones of Hit.hlsl pick the texture levels with. Positions are in mesh space, transform is the node's
+	void CreateTriangleLodView(const std::vector<glm::vec3>& positions, const glm::mat4& transform, const std::vector<uint32_t>& indices,
+		const std::vector<std::vector<glm::vec2>>& texcoords);
+	std::vector<lod::Candidate> m_LodCandidates;
+	std::vector<uint64_t> m_LodLevelTriangles;
+	lod::Result m_LodResult;
+	// The LOD line is printed at most once a second, for the switches since the last one
+	std::chrono::high_resolution_clock::time_point m_LodLastReport;
+	uint32_t m_LodUnreportedSwitches = 0;
+	// CPU copy of the TLAS and BLASes for ray queries from gameplay code, enabled with -cpurays.
+	// One instance per game object, the BLASes hold the rest pose of the whole model
+	void BuildCpuScene(Scene* scene);
+	// Moves the CPU instances to the transforms of their TLAS instances
+	void UpdateCpuScene();
+	std::unordered_map<std::string, bvh::Blas> m_CpuBlases; // By model name, built once
+	bvh::Tlas m_CpuTlas;
+	std::vector<bvh::Instance> m_CpuInstances;
+	std::vector<size_t> m_CpuInstanceSources; // First TLAS instance of every game object
+	// Benchmarks of the CPU components, enabled with -benchmark
+	void RunBenchmarks();
+	// Builds the BLASes of a glTF file with both granularities and prints their size and build time
+	void CompareBlasGranularity(const std::string& name);
+	// CPU copy of a scene and the camera for the path tracing reference renders
+	struct PathTracingReference {
+		std::unordered_map<std::string, bvh::Blas> blases; // By model name
+		std::unordered_map<std::string, pt::Surfaces> surfaces;
+		bvh::Tlas tlas;
+		pt::Scene scene;
+		pt::Camera camera;
+	};
+	// One instance per game object like BuildCpuScene, the camera at 1 / resolutionDivisor of the window
+	void BuildPathTracingReference(Scene* scene, uint32_t resolutionDivisor, PathTracingReference& reference);
+	// Renders the reference with the path tracing loop of RayGen.hlsl and with the recursive estimator
+	// it replaced, then prints the mean radiance of both
+	void ComparePathTracingEstimators(const PathTracingReference& reference);
+	// Checks the sampling of the light list, then prints the error of the path tracer with and without
+	// next event estimation against a converged render at increasing sample counts
+	void CompareNextEventEstimation(const PathTracingReference& reference);
+	// Measures variance times time of the path tracer without Russian roulette and with it from several depths
+	void CompareRussianRoulette(const PathTracingReference& reference);
+	// Prints the texture levels of the primary hits from the ray cones, from the hit distance as before and from
+	// the texcoords of the neighbouring pixels, with the texture cache hit rates of each at two cache sizes
+	void CompareTextureLod(const PathTracingReference& reference);
+	// Accumulates one sample per frame through accum::Controller like the GPU and prints the error
+	// against a converged render, then moves the camera to check the reset
+	void TestProgressiveAccumulation(PathTracingReference& reference);
+	// Decodes instanceCount random EXT_mesh_gpu_instancing instances of the cube and builds a TLAS of them
+	void StressTestGpuInstancing(uint32_t instanceCount);
 	// Path Tracing
 	uint32_t m_FrameNumber = 0;
-	uint32_t m_FrameHeapIndex = 0;
-	void CreateFrameIndexBuffer();
 	void UpdateFrameIndexBuffer();
-	ComPtr< ID3D12Resource > m_FrameIndexBuffer;
+	uint32_t m_FrameHeapIndices[FrameCount];
 };
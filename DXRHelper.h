@@ -179,10 +179,15 @@ static const D3D12_HEAP_PROPERTIES kUploadHeapProps = {
 static const D3D12_HEAP_PROPERTIES kDefaultHeapProps = {
     D3D12_HEAP_TYPE_DEFAULT, D3D12_CPU_PAGE_PROPERTY_UNKNOWN, D3D12_MEMORY_POOL_UNKNOWN, 0, 0};
 
+// Specifies a heap used for reading back GPU results, such as the compacted
+// size of an acceleration structure.
+static const D3D12_HEAP_PROPERTIES kReadbackHeapProps = {
+    D3D12_HEAP_TYPE_READBACK, D3D12_CPU_PAGE_PROPERTY_UNKNOWN, D3D12_MEMORY_POOL_UNKNOWN, 0, 0};
+
 //--------------------------------------------------------------------------------------------------
-// Compile a HLSL file into a DXIL library
+// Compile a HLSL file into a DXIL library, defines select a permutation
 //
-IDxcBlob* CompileShaderLibrary(LPCWSTR fileName, LPCWSTR target)
+IDxcBlob* CompileShaderLibrary(LPCWSTR fileName, LPCWSTR target, const std::vector<DxcDefine>& defines = {})
 {
   static IDxcCompiler* pCompiler = nullptr;
   static IDxcLibrary* pLibrary = nullptr;
@@ -214,7 +219,7 @@ IDxcBlob* CompileShaderLibrary(LPCWSTR fileName, LPCWSTR target)
 
   // Compile
   IDxcOperationResult* pResult;
-  ThrowIfFailed(pCompiler->Compile(pTextBlob, fileName, L"", target , nullptr, 0, nullptr, 0,
+  ThrowIfFailed(pCompiler->Compile(pTextBlob, fileName, L"", target , nullptr, 0, defines.data(), static_cast<UINT32>(defines.size()),
                                    dxcIncludeHandler, &pResult));
 
   // Verify the result
@@ -11,6 +11,7 @@
 
 #include "stdafx.h"
 #include "DXSample.h"
+#include "RenderModes.h"
 
 using namespace Microsoft::WRL;
 
@@ -18,7 +19,13 @@ DXSample::DXSample(UINT width, UINT height, std::wstring name) :
 	m_width(width),
 	m_height(height),
 	m_title(name),
-	m_useWarpDevice(false)
+	m_useWarpDevice(false),
+	m_runBenchmarks(false),
+	m_lodTriangleBudget(0),
+	m_lodLevelCount(4),
+	m_cpuRayQueries(false),
+	m_framesInFlight(2),
+	m_pathRouletteDepth(render::kPathRouletteDepth)
 {
 	WCHAR assetsPath[512];
 	GetAssetsPath(assetsPath, _countof(assetsPath));
@@ -87,5 +94,35 @@ void DXSample::ParseCommandLineArgs(WCHAR* argv[], int argc)
 			m_useWarpDevice = true;
 			m_title = m_title + L" (WARP)";
 		}
+		if (_wcsnicmp(argv[i], L"-benchmark", wcslen(argv[i])) == 0 ||
+			_wcsnicmp(argv[i], L"/benchmark", wcslen(argv[i])) == 0)
+		{
+			m_runBenchmarks = true;
+		}
+		if ((_wcsnicmp(argv[i], L"-lodbudget", wcslen(argv[i])) == 0 ||
+			_wcsnicmp(argv[i], L"/lodbudget", wcslen(argv[i])) == 0) && i + 1 < argc)
+		{
+			m_lodTriangleBudget = _wcstoui64(argv[++i], nullptr, 10);
+		}
+		if ((_wcsnicmp(argv[i], L"-lodlevels", wcslen(argv[i])) == 0 ||
+			_wcsnicmp(argv[i], L"/lodlevels", wcslen(argv[i])) == 0) && i + 1 < argc)
+		{
+			m_lodLevelCount = static_cast<UINT>(_wtoi(argv[++i]));
+		}
+		if (_wcsnicmp(argv[i], L"-cpurays", wcslen(argv[i])) == 0 ||
+			_wcsnicmp(argv[i], L"/cpurays", wcslen(argv[i])) == 0)
+		{
+			m_cpuRayQueries = true;
+		}
+		if ((_wcsnicmp(argv[i], L"-framesinflight", wcslen(argv[i])) == 0 ||
+			_wcsnicmp(argv[i], L"/framesinflight", wcslen(argv[i])) == 0) && i + 1 < argc)
+		{
+			m_framesInFlight = static_cast<UINT>(_wtoi(argv[++i]));
+		}
+		if ((_wcsnicmp(argv[i], L"-roulettedepth", wcslen(argv[i])) == 0 ||
+			_wcsnicmp(argv[i], L"/roulettedepth", wcslen(argv[i])) == 0) && i + 1 < argc)
+		{
+			m_pathRouletteDepth = static_cast<UINT>(_wtoi(argv[++i]));
+		}
 	}
 }
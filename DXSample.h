@@ -51,6 +51,18 @@ protected:
 
 	// Adapter info.
 	bool m_useWarpDevice;
+	// Run the CPU benchmarks after loading and print the results
+	bool m_runBenchmarks;
+	// Maximum number of triangles of the selected levels of detail, 0 for no budget
+	UINT64 m_lodTriangleBudget;
+	// Levels of detail generated for models without authored ones, including the original
+	UINT m_lodLevelCount;
+	// Keep a CPU copy of the acceleration structures for ray queries from gameplay code
+	bool m_cpuRayQueries;
+	// Frames the CPU may record ahead of the GPU, 2 or 3
+	UINT m_framesInFlight;
+	// Surfaces of a path before Russian roulette may end it, the bounce limit or more turns it off
+	UINT m_pathRouletteDepth;
 private:
 	// Root assets path.
 	std::wstring m_assetsPath;
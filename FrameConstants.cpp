@@ -0,0 +1,21 @@
+#include "stdafx.h"
+#include "FrameConstants.h"
+#include "DXSampleHelper.h"
+
+FrameConstants::~FrameConstants() {
+	if (m_mapped)
+		m_buffer->Unmap(0, nullptr);
+}
+
+void FrameConstants::Init(ID3D12Device* device, uint64_t sliceSize, uint32_t sliceCount) {
+	m_device = device;
+	// Slices keep the placement alignment of their first constant
+	sliceSize = (sliceSize + D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT - 1) & ~uint64_t(D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT - 1);
+	m_ring.Init(sliceSize, sliceCount);
+	CD3DX12_HEAP_PROPERTIES heapProps(D3D12_HEAP_TYPE_UPLOAD);
+	CD3DX12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Buffer(sliceSize * sliceCount);
+	ThrowIfFailed(m_device->CreateCommittedResource(&heapProps, D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&m_buffer)));
+	// Upload heaps may stay mapped while the GPU reads them, the CPU never reads back
+	CD3DX12_RANGE readRange(0, 0);
+	ThrowIfFailed(m_buffer->Map(0, &readRange, reinterpret_cast<void**>(&m_mapped)));
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <d3d12.h>
+#include <wrl.h>
+#include <stdexcept>
+#include "FrameRing.h"
+// Per frame constants in one persistently mapped upload buffer, sliced per frame in flight. Allocate
+// hands out typed CPU pointers and GPU addresses, instead of a Map and Unmap of a buffer per constant
+class FrameConstants {
+public:
+	template <typename T>
+	struct Constant {
+		T* cpu = nullptr;
+		D3D12_GPU_VIRTUAL_ADDRESS gpu = 0;
+		uint64_t size = 0; // Rounded up to D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT, as constant buffer views need
+	};
+	~FrameConstants();
+	void Init(ID3D12Device* device, uint64_t sliceSize, uint32_t sliceCount);
+	// Recycles the slice of a frame slot, after the GPU finished its previous frame
+	void BeginFrame(uint32_t slot) { m_ring.BeginFrame(slot); }
+	// count values of T in the slice of the current frame, valid until the slot comes around again
+	template <typename T>
+	Constant<T> Allocate(uint32_t count = 1) {
+		Constant<T> constant;
+		constant.size = (sizeof(T) * count + D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT - 1) & ~uint64_t(D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT - 1);
+		uint64_t offset = m_ring.Allocate(constant.size, D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
+		if (offset == frame::kOutOfMemory)
+			throw std::logic_error("Frame constants don't fit in their slice");
+		constant.cpu = reinterpret_cast<T*>(m_mapped + offset);
+		constant.gpu = m_buffer->GetGPUVirtualAddress() + offset;
+		return constant;
+	}
+	// Points a descriptor to a constant, as a constant buffer or as a structured buffer of T
+	template <typename T>
+	void CreateConstantBufferView(const Constant<T>& constant, D3D12_CPU_DESCRIPTOR_HANDLE handle) const {
+		D3D12_CONSTANT_BUFFER_VIEW_DESC cbvDesc = {};
+		cbvDesc.BufferLocation = constant.gpu;
+		cbvDesc.SizeInBytes = static_cast<UINT>(constant.size);
+		m_device->CreateConstantBufferView(&cbvDesc, handle);
+	}
+	template <typename T>
+	void CreateStructuredBufferView(const Constant<T>& constant, uint32_t count, D3D12_CPU_DESCRIPTOR_HANDLE handle) const {
+		D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+		srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
+		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+		srvDesc.Buffer.FirstElement = (constant.gpu - m_buffer->GetGPUVirtualAddress()) / sizeof(T);
+		srvDesc.Buffer.NumElements = count;
+		srvDesc.Buffer.StructureByteStride = sizeof(T);
+		srvDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_NONE;
+		m_device->CreateShaderResourceView(m_buffer.Get(), &srvDesc, handle);
+	}
+	const frame::Ring& GetRing() const { return m_ring; }
+private:
+	Microsoft::WRL::ComPtr<ID3D12Device> m_device;
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_buffer;
+	uint8_t* m_mapped = nullptr;
+	frame::Ring m_ring;
+};
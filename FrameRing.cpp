@@ -0,0 +1,28 @@
+#include "FrameRing.h"
+#include <algorithm>
+
+namespace frame {
+	void Ring::Init(uint64_t sliceSize, uint32_t sliceCount) {
+		m_sliceSize = sliceSize;
+		m_sliceCount = sliceCount;
+		m_sliceStart = 0;
+		m_used = 0;
+		m_peakUsed = 0;
+	}
+
+	void Ring::BeginFrame(uint32_t slice) {
+		m_sliceStart = m_sliceSize * (slice % (std::max)(m_sliceCount, 1u));
+		m_used = 0;
+	}
+
+	uint64_t Ring::Allocate(uint64_t size, uint64_t alignment) {
+		// Slices start at multiples of the slice size, aligning within the slice is enough as long as
+		// the slice size is a multiple of the alignment
+		uint64_t offset = (m_used + alignment - 1) & ~(alignment - 1);
+		if (offset + size > m_sliceSize)
+			return kOutOfMemory;
+		m_used = offset + size;
+		m_peakUsed = (std::max)(m_peakUsed, m_used);
+		return m_sliceStart + offset;
+	}
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+// Linear allocator over a ring with one slice per frame in flight. A slice is reset when its frame slot
+// comes around again, once the fence of the slot was reached, so the CPU never writes memory the GPU
+// still reads and single allocations need no fence. No D3D dependencies
+namespace frame {
+	static const uint64_t kOutOfMemory = ~0ull;
+	class Ring {
+	public:
+		void Init(uint64_t sliceSize, uint32_t sliceCount);
+		// Starts allocating from the slice of a frame slot, the GPU must be done with its previous frame
+		void BeginFrame(uint32_t slice);
+		// Offset in the ring of size bytes, kOutOfMemory when they don't fit in the slice of the frame.
+		// alignment is a power of two
+		uint64_t Allocate(uint64_t size, uint64_t alignment);
+		uint64_t GetSliceSize() const { return m_sliceSize; }
+		uint32_t GetSliceCount() const { return m_sliceCount; }
+		uint64_t GetUsed() const { return m_used; } // In the slice of the current frame
+		uint64_t GetPeakUsed() const { return m_peakUsed; }
+	private:
+		uint64_t m_sliceSize = 0;
+		uint32_t m_sliceCount = 0;
+		uint64_t m_sliceStart = 0;
+		uint64_t m_used = 0;
+		uint64_t m_peakUsed = 0;
+	};
+}
@@ -1,9 +1,26 @@
 #pragma once
 #include "Model.h"
 #include <glm/glm.hpp>
+// Instance visibility masks, must match the INSTANCE_MASK_* defines in Common.hlsl
+enum InstanceMask : uint32_t {
+	INSTANCE_MASK_GEOMETRY = 0x01, // Regular scene geometry, visible to every ray
+	INSTANCE_MASK_LIGHT_PROXY = 0x02, // Emissive stand-ins for lights, skipped by shadow rays
+	INSTANCE_MASK_ALL = 0xFF
+};
+// Per instance traversal flags, same values as D3D12_RAYTRACING_INSTANCE_FLAGS
+enum InstanceFlags : uint32_t {
+	INSTANCE_FLAG_NONE = 0x0,
+	INSTANCE_FLAG_TRIANGLE_CULL_DISABLE = 0x1,
+	INSTANCE_FLAG_TRIANGLE_FRONT_COUNTERCLOCKWISE = 0x2,
+	INSTANCE_FLAG_FORCE_OPAQUE = 0x4, // Skips any-hit shaders for the whole instance
+	INSTANCE_FLAG_FORCE_NON_OPAQUE = 0x8
+};
 class GameObject {
 public:
 
 	glm::mat4 m_transform;
 	Model* m_model;
-};
\ No newline at end of file
+	uint32_t m_instanceMask = INSTANCE_MASK_GEOMETRY;
+	uint32_t m_instanceFlags = INSTANCE_FLAG_NONE;
+	uint32_t m_userID = 0; // Visible in shaders through InstanceID(), 24 bits
+};
@@ -0,0 +1,131 @@
+#include "GpuInstancing.h"
+#include "ParallelFor.h"
+#include <random>
+#include <glm/gtc/quaternion.hpp>
+#if defined(_M_X64) || defined(__SSE2__)
+#include <xmmintrin.h>
+#define INSTANCING_SIMD 1
+#else
+#define INSTANCING_SIMD 0
+#endif
+
+namespace instancing {
+	static const glm::vec4 kNoTranslation(0.f);
+	static const glm::vec4 kNoRotation(0.f, 0.f, 0.f, 1.f);
+	static const glm::vec4 kNoScale(1.f);
+
+	static inline const glm::vec4& Attribute(const std::vector<glm::vec4>& values, uint32_t i, const glm::vec4& fallback) {
+		return values.empty() ? fallback : values[i];
+	}
+
+	void ComposeInstanceTransformsReference(const InstanceAttributes& attributes, const glm::mat4& parent, glm::mat4* out, uint32_t first, uint32_t last) {
+		for (uint32_t i = first; i < last; i++) {
+			glm::vec4 t = Attribute(attributes.translations, i, kNoTranslation);
+			glm::vec4 r = Attribute(attributes.rotations, i, kNoRotation);
+			glm::vec4 s = Attribute(attributes.scales, i, kNoScale);
+			glm::mat4 local = glm::mat4_cast(glm::quat(r.w, r.x, r.y, r.z));
+			local[0] *= s.x;
+			local[1] *= s.y;
+			local[2] *= s.z;
+			local[3] = glm::vec4(t.x, t.y, t.z, 1.f);
+			out[i] = parent * local;
+		}
+	}
+
+#if INSTANCING_SIMD
+	// Loads attribute i of four instances and transposes them, so every register holds one component of all four
+	static inline void LoadSoA(const std::vector<glm::vec4>& values, uint32_t i, const glm::vec4& fallback, __m128& x, __m128& y, __m128& z, __m128& w) {
+		if (values.empty()) {
+			x = _mm_set1_ps(fallback.x);
+			y = _mm_set1_ps(fallback.y);
+			z = _mm_set1_ps(fallback.z);
+			w = _mm_set1_ps(fallback.w);
+			return;
+		}
+		x = _mm_loadu_ps(&values[i].x);
+		y = _mm_loadu_ps(&values[i + 1].x);
+		z = _mm_loadu_ps(&values[i + 2].x);
+		w = _mm_loadu_ps(&values[i + 3].x);
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+	}
+	// out = parent * (x, y, z, w) for four columns given as components of four instances
+	static inline void StoreColumns(const __m128 parent[4], __m128 x, __m128 y, __m128 z, __m128 w, glm::mat4* out, uint32_t column) {
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+		__m128 columns[4] = { x, y, z, w };
+		for (int k = 0; k < 4; k++) {
+			__m128 c = columns[k];
+			__m128 r = _mm_mul_ps(parent[0], _mm_shuffle_ps(c, c, _MM_SHUFFLE(0, 0, 0, 0)));
+			r = _mm_add_ps(r, _mm_mul_ps(parent[1], _mm_shuffle_ps(c, c, _MM_SHUFFLE(1, 1, 1, 1))));
+			r = _mm_add_ps(r, _mm_mul_ps(parent[2], _mm_shuffle_ps(c, c, _MM_SHUFFLE(2, 2, 2, 2))));
+			r = _mm_add_ps(r, _mm_mul_ps(parent[3], _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 3, 3))));
+			_mm_storeu_ps(&out[k][column].x, r);
+		}
+	}
+#endif
+
+	void ComposeInstanceTransforms(const InstanceAttributes& attributes, const glm::mat4& parent, glm::mat4* out, uint32_t first, uint32_t last) {
+#if INSTANCING_SIMD
+		__m128 parentColumns[4];
+		for (int c = 0; c < 4; c++) {
+			parentColumns[c] = _mm_loadu_ps(&parent[c].x);
+		}
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.f);
+		const __m128 two = _mm_set1_ps(2.f);
+		uint32_t i = first;
+		for (; i + 4 <= last; i += 4) {
+			__m128 tx, ty, tz, tw, qx, qy, qz, qw, sx, sy, sz, sw;
+			LoadSoA(attributes.translations, i, kNoTranslation, tx, ty, tz, tw);
+			LoadSoA(attributes.rotations, i, kNoRotation, qx, qy, qz, qw);
+			LoadSoA(attributes.scales, i, kNoScale, sx, sy, sz, sw);
+			__m128 xx = _mm_mul_ps(qx, qx), yy = _mm_mul_ps(qy, qy), zz = _mm_mul_ps(qz, qz);
+			__m128 xy = _mm_mul_ps(qx, qy), xz = _mm_mul_ps(qx, qz), yz = _mm_mul_ps(qy, qz);
+			__m128 wx = _mm_mul_ps(qw, qx), wy = _mm_mul_ps(qw, qy), wz = _mm_mul_ps(qw, qz);
+			// Rotation columns scaled by S, the same terms as anim::ComposeTRS
+			StoreColumns(parentColumns,
+				_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx),
+				_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx),
+				_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx),
+				zero, out + i, 0);
+			StoreColumns(parentColumns,
+				_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy),
+				_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy),
+				_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy),
+				zero, out + i, 1);
+			StoreColumns(parentColumns,
+				_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz),
+				_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz),
+				_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz),
+				zero, out + i, 2);
+			StoreColumns(parentColumns, tx, ty, tz, one, out + i, 3);
+		}
+		// Remaining instances of an incomplete group of four
+		ComposeInstanceTransformsReference(attributes, parent, out, i, last);
+#else
+		ComposeInstanceTransformsReference(attributes, parent, out, first, last);
+#endif
+	}
+	void ComposeInstanceTransformsParallel(const InstanceAttributes& attributes, const glm::mat4& parent, glm::mat4* out, uint32_t threadCount) {
+		// Chunks are multiples of four, so only the last one has a scalar tail
+		ParallelFor(attributes.count, 16384, threadCount, [&](uint32_t first, uint32_t last, uint32_t) {
+			ComposeInstanceTransforms(attributes, parent, out, first, last);
+		});
+	}
+
+	InstanceAttributes MakeRandomInstances(uint32_t count, float extent, uint32_t seed) {
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<float> unit(-1.f, 1.f);
+		InstanceAttributes attributes;
+		attributes.count = count;
+		attributes.translations.resize(count);
+		attributes.rotations.resize(count);
+		attributes.scales.resize(count);
+		for (uint32_t i = 0; i < count; i++) {
+			attributes.translations[i] = glm::vec4(unit(rng), unit(rng), unit(rng), 0.f) * extent;
+			attributes.rotations[i] = glm::normalize(glm::vec4(unit(rng), unit(rng), unit(rng), unit(rng)) + glm::vec4(0.f, 0.f, 0.f, 0.01f));
+			float scale = 0.75f + 0.25f * unit(rng);
+			attributes.scales[i] = glm::vec4(scale, scale, scale, 0.f);
+		}
+		return attributes;
+	}
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+// Decoding of EXT_mesh_gpu_instancing attributes into instance transforms.
+// Four instances are composed at once with SSE where available. No D3D dependencies
+namespace instancing {
+	// Decoded TRANSLATION, ROTATION (quaternion x, y, z, w) and SCALE attributes,
+	// a missing attribute is an empty vector
+	struct InstanceAttributes {
+		std::vector<glm::vec4> translations;
+		std::vector<glm::vec4> rotations;
+		std::vector<glm::vec4> scales;
+		uint32_t count = 0;
+	};
+	// out[i] = parent * T * R * S of instance i, for i in [first, last)
+	void ComposeInstanceTransforms(const InstanceAttributes& attributes, const glm::mat4& parent, glm::mat4* out, uint32_t first, uint32_t last);
+	// Plain glm implementation, the reference for ComposeInstanceTransforms
+	void ComposeInstanceTransformsReference(const InstanceAttributes& attributes, const glm::mat4& parent, glm::mat4* out, uint32_t first, uint32_t last);
+	// Splits the instances over worker threads, threadCount = 0 uses all hardware threads
+	void ComposeInstanceTransformsParallel(const InstanceAttributes& attributes, const glm::mat4& parent, glm::mat4* out, uint32_t threadCount = 0);
+
+	// Random attributes for count instances, used by the stress benchmark
+	InstanceAttributes MakeRandomInstances(uint32_t count, float extent, uint32_t seed = 1234);
+}
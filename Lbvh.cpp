@@ -0,0 +1,436 @@
+#include "Lbvh.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace bvh {
+	typedef std::chrono::high_resolution_clock Clock;
+	static double ElapsedMs(Clock::time_point& start) {
+		Clock::time_point now = Clock::now();
+		double ms = std::chrono::duration<double, std::milli>(now - start).count();
+		start = now;
+		return ms;
+	}
+	static inline int CountLeadingZeros(uint64_t x) {
+#if defined(_MSC_VER)
+		unsigned long index;
+		return _BitScanReverse64(&index, x) ? 63 - static_cast<int>(index) : 64;
+#else
+		return x ? __builtin_clzll(x) : 64;
+#endif
+	}
+	// Inserts two zero bits between the lower 10 bits of v
+	static inline uint32_t ExpandBits(uint32_t v) {
+		v = (v * 0x00010001u) & 0xFF0000FFu;
+		v = (v * 0x00000101u) & 0x0F00F00Fu;
+		v = (v * 0x00000011u) & 0xC30C30C3u;
+		v = (v * 0x00000005u) & 0x49249249u;
+		return v;
+	}
+	uint32_t MortonCode(const glm::vec3& unitPosition) {
+		glm::uvec3 cell = glm::uvec3(glm::clamp(unitPosition * 1024.f, glm::vec3(0.f), glm::vec3(1023.f)));
+		return (ExpandBits(cell.x) << 2) | (ExpandBits(cell.y) << 1) | ExpandBits(cell.z);
+	}
+
+	void RadixSort(std::vector<uint64_t>& keys, uint32_t firstBit, uint32_t bitCount, uint32_t threadCount) {
+		uint32_t count = static_cast<uint32_t>(keys.size());
+		if (count < 2)
+			return;
+		// Fixed blocks, so every block scatters into its own ranges and the sort stays stable
+		uint32_t blockCount = (std::max)(1u, (std::min)(GetWorkerThreadCount(threadCount), count / 16384));
+		uint32_t blockSize = (count + blockCount - 1) / blockCount;
+		std::vector<uint64_t> sorted(count);
+		std::vector<uint32_t> offsets(256 * size_t(blockCount));
+		for (uint32_t shift = firstBit; shift < firstBit + bitCount; shift += 8) {
+			std::fill(offsets.begin(), offsets.end(), 0u);
+			ParallelFor(blockCount, 1, threadCount, [&](uint32_t firstBlock, uint32_t lastBlock, uint32_t) {
+				for (uint32_t block = firstBlock; block < lastBlock; block++) {
+					uint32_t* histogram = &offsets[256 * size_t(block)];
+					uint32_t end = (std::min)(count, (block + 1) * blockSize);
+					for (uint32_t i = block * blockSize; i < end; i++) {
+						histogram[(keys[i] >> shift) & 0xFF]++;
+					}
+				}
+			});
+			// Digit major prefix sum, blocks of the same digit follow each other
+			uint32_t sum = 0;
+			for (uint32_t digit = 0; digit < 256; digit++) {
+				for (uint32_t block = 0; block < blockCount; block++) {
+					uint32_t blockCountOfDigit = offsets[256 * size_t(block) + digit];
+					offsets[256 * size_t(block) + digit] = sum;
+					sum += blockCountOfDigit;
+				}
+			}
+			ParallelFor(blockCount, 1, threadCount, [&](uint32_t firstBlock, uint32_t lastBlock, uint32_t) {
+				for (uint32_t block = firstBlock; block < lastBlock; block++) {
+					uint32_t* offset = &offsets[256 * size_t(block)];
+					uint32_t end = (std::min)(count, (block + 1) * blockSize);
+					for (uint32_t i = block * blockSize; i < end; i++) {
+						sorted[offset[(keys[i] >> shift) & 0xFF]++] = keys[i];
+					}
+				}
+			});
+			keys.swap(sorted);
+		}
+	}
+
+	namespace {
+		// Binary tree of n - 1 inner nodes followed by n leaves in Morton order
+		struct Hierarchy {
+			uint32_t leafCount = 0;
+			std::vector<uint32_t> children; // Two per inner node
+			std::vector<uint32_t> parents;
+			std::vector<Aabb> bounds;
+			std::vector<float> costs; // SAH cost of the subtree, not normalized
+			std::vector<uint32_t> counts; // Primitives of the subtree
+			std::vector<uint32_t> leafPrimitives;
+			bool IsLeaf(uint32_t node) const { return node >= leafCount - 1; }
+		};
+
+		class TreeletOptimizer {
+		public:
+			// With openable set, only the flagged inner nodes can be opened while growing a treelet
+			TreeletOptimizer(Hierarchy& hierarchy, const LbvhSettings& settings, const std::vector<uint8_t>* openable = nullptr)
+				: m_hierarchy(hierarchy), m_settings(settings), m_openable(openable), m_size(glm::clamp(settings.treeletSize, 3u, 10u)) {
+				uint32_t subsetCount = 1u << m_size;
+				m_subsetBounds.resize(subsetCount);
+				m_subsetCosts.resize(subsetCount);
+				m_subsetCounts.resize(subsetCount);
+				m_partitions.resize(subsetCount);
+			}
+			// Children have to be up to date
+			void Update(uint32_t node) {
+				Hierarchy& h = m_hierarchy;
+				uint32_t left = h.children[2 * node], right = h.children[2 * node + 1];
+				h.bounds[node] = h.bounds[left];
+				h.bounds[node].Grow(h.bounds[right]);
+				h.counts[node] = h.counts[left] + h.counts[right];
+				h.costs[node] = m_settings.leaves.traversalCost * h.bounds[node].Area() + h.costs[left] + h.costs[right];
+			}
+			// Replaces the treelet below node by the topology with the lowest SAH cost
+			void Optimize(uint32_t node) {
+				Hierarchy& h = m_hierarchy;
+				Update(node);
+				if (h.counts[node] < m_settings.treeletMinPrimitives)
+					return;
+				// Grow the treelet by opening the leaf with the largest area
+				m_leaves.assign(h.children.begin() + 2 * node, h.children.begin() + 2 * node + 2);
+				m_inner.assign(1, node);
+				while (m_leaves.size() < m_size) {
+					int largest = -1;
+					float largestArea = -1.f;
+					for (size_t i = 0; i < m_leaves.size(); i++) {
+						float area = h.bounds[m_leaves[i]].Area();
+						if (!h.IsLeaf(m_leaves[i]) && (!m_openable || (*m_openable)[m_leaves[i]]) && area > largestArea) {
+							largest = static_cast<int>(i);
+							largestArea = area;
+						}
+					}
+					if (largest < 0)
+						break;
+					uint32_t opened = m_leaves[largest];
+					m_inner.push_back(opened);
+					m_leaves[largest] = h.children[2 * opened];
+					m_leaves.push_back(h.children[2 * opened + 1]);
+				}
+				uint32_t leafCount = static_cast<uint32_t>(m_leaves.size());
+				if (leafCount < 3)
+					return;
+				// Optimal partition of every subset of treelet leaves, singletons keep their subtree
+				uint32_t full = (1u << leafCount) - 1;
+				for (uint32_t subset = 1; subset <= full; subset++) {
+					uint32_t lowest = subset & (0u - subset);
+					uint32_t rest = subset ^ lowest;
+					uint32_t leaf = 0;
+					while ((1u << leaf) != lowest)
+						leaf++;
+					if (rest == 0) {
+						m_subsetBounds[subset] = h.bounds[m_leaves[leaf]];
+						m_subsetCosts[subset] = h.costs[m_leaves[leaf]];
+						m_subsetCounts[subset] = h.counts[m_leaves[leaf]];
+						continue;
+					}
+					m_subsetBounds[subset] = m_subsetBounds[rest];
+					m_subsetBounds[subset].Grow(h.bounds[m_leaves[leaf]]);
+					m_subsetCounts[subset] = m_subsetCounts[rest] + h.counts[m_leaves[leaf]];
+					// Partitions containing the lowest leaf, the others are the same splits mirrored
+					float best = (std::numeric_limits<float>::max)();
+					for (uint32_t part = rest; ; part = (part - 1) & rest) {
+						uint32_t side = part | lowest;
+						if (side != subset) {
+							float cost = m_subsetCosts[side] + m_subsetCosts[subset ^ side];
+							if (cost < best) {
+								best = cost;
+								m_partitions[subset] = side;
+							}
+						}
+						if (part == 0)
+							break;
+					}
+					m_subsetCosts[subset] = m_settings.leaves.traversalCost * m_subsetBounds[subset].Area() + best;
+				}
+				if (m_subsetCosts[full] >= h.costs[node] * 0.9999f)
+					return;
+				m_nextInner = 1;
+				Rebuild(node, full);
+			}
+		private:
+			void Rebuild(uint32_t node, uint32_t subset) {
+				Hierarchy& h = m_hierarchy;
+				uint32_t sides[2] = { m_partitions[subset], subset ^ m_partitions[subset] };
+				for (int k = 0; k < 2; k++) {
+					uint32_t child;
+					if ((sides[k] & (sides[k] - 1)) == 0) {
+						uint32_t leaf = 0;
+						while ((1u << leaf) != sides[k])
+							leaf++;
+						child = m_leaves[leaf];
+					}
+					else {
+						child = m_inner[m_nextInner++];
+						Rebuild(child, sides[k]);
+					}
+					h.children[2 * node + k] = child;
+					h.parents[child] = node;
+				}
+				h.bounds[node] = m_subsetBounds[subset];
+				h.costs[node] = m_subsetCosts[subset];
+				h.counts[node] = m_subsetCounts[subset];
+			}
+
+			Hierarchy& m_hierarchy;
+			const LbvhSettings& m_settings;
+			const std::vector<uint8_t>* m_openable;
+			uint32_t m_size;
+			std::vector<uint32_t> m_leaves;
+			std::vector<uint32_t> m_inner;
+			uint32_t m_nextInner = 0;
+			std::vector<Aabb> m_subsetBounds;
+			std::vector<float> m_subsetCosts;
+			std::vector<uint32_t> m_subsetCounts;
+			std::vector<uint32_t> m_partitions;
+		};
+
+		// Inner nodes of the subtree in post order, so children are optimized before their parent
+		void OptimizeSubtree(TreeletOptimizer& optimizer, const Hierarchy& hierarchy, uint32_t root, std::vector<std::pair<uint32_t, bool>>& stack) {
+			stack.assign(1, { root, false });
+			while (!stack.empty()) {
+				auto entry = stack.back();
+				stack.pop_back();
+				if (hierarchy.IsLeaf(entry.first))
+					continue;
+				if (entry.second) {
+					optimizer.Optimize(entry.first);
+					continue;
+				}
+				stack.push_back({ entry.first, true });
+				stack.push_back({ hierarchy.children[2 * entry.first], false });
+				stack.push_back({ hierarchy.children[2 * entry.first + 1], false });
+			}
+		}
+	}
+
+	void BuildLbvh(const std::vector<Aabb>& primitiveBounds, const LbvhSettings& settings, Bvh& bvh, LbvhTimings* timings) {
+		LbvhTimings localTimings;
+		LbvhTimings& time = timings ? *timings : localTimings;
+		time = LbvhTimings();
+		Clock::time_point buildStart = Clock::now();
+		Clock::time_point start = buildStart;
+		uint32_t count = static_cast<uint32_t>(primitiveBounds.size());
+		uint32_t threadCount = settings.threadCount;
+		bvh.nodes.clear();
+		bvh.primitives.clear();
+		if (count == 0)
+			return;
+
+		// ---------------Morton codes---------------
+		// Primitive index in the lower bits, so keys are unique and sort ties keep the input order
+		std::vector<Aabb> centerBounds(GetWorkerThreadCount(threadCount));
+		uint32_t usedThreads = ParallelFor(count, 16384, threadCount, [&](uint32_t first, uint32_t last, uint32_t thread) {
+			for (uint32_t i = first; i < last; i++) {
+				centerBounds[thread].Grow(primitiveBounds[i].Center());
+			}
+		});
+		Aabb sceneBounds;
+		for (uint32_t i = 0; i < usedThreads; i++) {
+			sceneBounds.Grow(centerBounds[i]);
+		}
+		glm::vec3 scale = 1.f / glm::max(sceneBounds.max - sceneBounds.min, glm::vec3(1e-30f));
+		std::vector<uint64_t> keys(count);
+		ParallelFor(count, 16384, threadCount, [&](uint32_t first, uint32_t last, uint32_t) {
+			for (uint32_t i = first; i < last; i++) {
+				uint64_t code = MortonCode((primitiveBounds[i].Center() - sceneBounds.min) * scale);
+				keys[i] = (code << 32) | i;
+			}
+		});
+		time.mortonMs = ElapsedMs(start);
+		RadixSort(keys, 32, 30, threadCount);
+		time.sortMs = ElapsedMs(start);
+
+		// ---------------Hierarchy---------------
+		Hierarchy h;
+		h.leafCount = count;
+		uint32_t innerCount = count - 1;
+		h.children.resize(2 * size_t(innerCount));
+		h.parents.resize(2 * size_t(count) - 1);
+		h.bounds.resize(2 * size_t(count) - 1);
+		h.costs.resize(2 * size_t(count) - 1);
+		h.counts.resize(2 * size_t(count) - 1);
+		h.leafPrimitives.resize(count);
+		h.parents[0] = 0;
+		auto delta = [&](int64_t i, int64_t j) {
+			if (j < 0 || j >= int64_t(count))
+				return -1;
+			return CountLeadingZeros(keys[i] ^ keys[j]);
+		};
+		ParallelFor(innerCount, 4096, threadCount, [&](uint32_t first, uint32_t last, uint32_t) {
+			for (uint32_t node = first; node < last; node++) {
+				int64_t i = node;
+				// Direction of the range and its other end, found by exponential then binary search
+				int64_t d = delta(i, i + 1) - delta(i, i - 1) >= 0 ? 1 : -1;
+				int deltaMin = delta(i, i - d);
+				int64_t maxLength = 2;
+				while (delta(i, i + maxLength * d) > deltaMin)
+					maxLength *= 2;
+				int64_t length = 0;
+				for (int64_t t = maxLength / 2; t >= 1; t /= 2) {
+					if (delta(i, i + (length + t) * d) > deltaMin)
+						length += t;
+				}
+				int64_t j = i + length * d;
+				// Split where the common prefix of the range ends
+				int deltaNode = delta(i, j);
+				int64_t split = 0;
+				int64_t t = length;
+				do {
+					t = (t + 1) / 2;
+					if (delta(i, i + (split + t) * d) > deltaNode)
+						split += t;
+				} while (t > 1);
+				int64_t gamma = i + split * d + (std::min)(d, int64_t(0));
+				uint32_t left = (std::min)(i, j) == gamma ? innerCount + static_cast<uint32_t>(gamma) : static_cast<uint32_t>(gamma);
+				uint32_t right = (std::max)(i, j) == gamma + 1 ? innerCount + static_cast<uint32_t>(gamma + 1) : static_cast<uint32_t>(gamma + 1);
+				h.children[2 * node] = left;
+				h.children[2 * node + 1] = right;
+				h.parents[left] = node;
+				h.parents[right] = node;
+			}
+		});
+		// Bounds bottom up, the second child to arrive at a node continues to its parent
+		std::unique_ptr<std::atomic<uint32_t>[]> arrivals(new std::atomic<uint32_t>[(std::max)(1u, innerCount)]);
+		for (uint32_t i = 0; i < innerCount; i++) {
+			arrivals[i].store(0, std::memory_order_relaxed);
+		}
+		ParallelFor(count, 4096, threadCount, [&](uint32_t first, uint32_t last, uint32_t) {
+			for (uint32_t leaf = first; leaf < last; leaf++) {
+				uint32_t node = innerCount + leaf;
+				uint32_t primitive = static_cast<uint32_t>(keys[leaf] & 0xFFFFFFFFu);
+				h.leafPrimitives[leaf] = primitive;
+				h.bounds[node] = primitiveBounds[primitive];
+				h.counts[node] = 1;
+				h.costs[node] = settings.leaves.intersectionCost * h.bounds[node].Area();
+				while (node != 0) {
+					node = h.parents[node];
+					if (arrivals[node].fetch_add(1, std::memory_order_acq_rel) == 0)
+						break;
+					uint32_t left = h.children[2 * node], right = h.children[2 * node + 1];
+					h.bounds[node] = h.bounds[left];
+					h.bounds[node].Grow(h.bounds[right]);
+					h.counts[node] = h.counts[left] + h.counts[right];
+					h.costs[node] = settings.leaves.traversalCost * h.bounds[node].Area() + h.costs[left] + h.costs[right];
+				}
+			}
+		});
+		time.hierarchyMs = ElapsedMs(start);
+
+		// ---------------Treelet restructuring---------------
+		if (settings.treeletSize > 0 && innerCount > 0) {
+			// Independent subtrees below a frontier run on worker threads, the few nodes above it afterwards
+			uint32_t subtreeTarget = 16 * GetWorkerThreadCount(threadCount);
+			std::vector<uint8_t> aboveFrontier(innerCount, 0);
+			std::vector<uint32_t> top, frontier;
+			for (uint32_t pass = 0; pass < settings.treeletPasses; pass++) {
+				for (uint32_t node : top) {
+					aboveFrontier[node] = 0;
+				}
+				top.assign(1, 0);
+				aboveFrontier[0] = 1;
+				frontier.clear();
+				for (size_t i = 0; i < top.size(); i++) {
+					for (int k = 0; k < 2; k++) {
+						uint32_t child = h.children[2 * top[i] + k];
+						if (h.IsLeaf(child))
+							continue;
+						if (top.size() < subtreeTarget && h.counts[child] > count / subtreeTarget) {
+							top.push_back(child);
+							aboveFrontier[child] = 1;
+						}
+						else {
+							frontier.push_back(child);
+						}
+					}
+				}
+				ParallelFor(static_cast<uint32_t>(frontier.size()), 1, threadCount, [&](uint32_t first, uint32_t last, uint32_t) {
+					TreeletOptimizer optimizer(h, settings);
+					std::vector<std::pair<uint32_t, bool>> stack;
+					for (uint32_t i = first; i < last; i++) {
+						OptimizeSubtree(optimizer, h, frontier[i], stack);
+					}
+				});
+				// Reverse breadth first order visits children first. Treelets above the frontier
+				// keep the frontier subtrees whole, so the order stays valid while they change
+				TreeletOptimizer optimizer(h, settings, &aboveFrontier);
+				for (size_t i = top.size(); i-- > 0;) {
+					optimizer.Optimize(top[i]);
+				}
+			}
+			time.treeletMs = ElapsedMs(start);
+		}
+
+		// ---------------Layout---------------
+		// Leaves get their primitive slots depth first, so the primitives of every subtree are contiguous.
+		// Nodes are laid out breadth first with siblings next to each other
+		std::vector<uint32_t> leafSlots(count);
+		bvh.primitives.resize(count);
+		uint32_t slot = 0;
+		std::vector<uint32_t> stack = { 0 };
+		while (!stack.empty()) {
+			uint32_t node = stack.back();
+			stack.pop_back();
+			if (h.IsLeaf(node)) {
+				leafSlots[node - innerCount] = slot;
+				bvh.primitives[slot++] = h.leafPrimitives[node - innerCount];
+				continue;
+			}
+			stack.push_back(h.children[2 * node + 1]);
+			stack.push_back(h.children[2 * node]);
+		}
+		bvh.nodes.reserve(2 * size_t(count) - 1);
+		std::vector<uint32_t> source = { 0 };
+		source.reserve(2 * size_t(count) - 1);
+		for (size_t i = 0; i < source.size(); i++) {
+			uint32_t node = source[i];
+			Node out;
+			out.boundsMin = h.bounds[node].min;
+			out.boundsMax = h.bounds[node].max;
+			if (h.IsLeaf(node)) {
+				out.child = leafSlots[node - innerCount];
+				out.count = 1;
+			}
+			else {
+				out.child = static_cast<uint32_t>(source.size());
+				out.count = 0;
+				source.push_back(h.children[2 * node]);
+				source.push_back(h.children[2 * node + 1]);
+			}
+			bvh.nodes.push_back(out);
+		}
+		CollapseLeaves(bvh, settings.leaves);
+		time.totalMs = std::chrono::duration<double, std::milli>(Clock::now() - buildStart).count();
+	}
+}
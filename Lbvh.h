@@ -0,0 +1,27 @@
+#pragma once
+#include "Bvh.h"
+// Linear BVH builder for geometry which is rebuilt every frame. Primitives are sorted along a
+// Morton curve with a parallel radix sort and the hierarchy is emitted from the sorted codes
+// (Karras 2012), every step runs on worker threads. An optional treelet restructuring pass
+// (Karras and Aila 2013) recovers most of the SAH quality of a top down build
+namespace bvh {
+	struct LbvhSettings {
+		uint32_t threadCount = 0; // 0 uses all hardware threads
+		uint32_t treeletSize = 7; // Leaves of a restructured treelet, 0 skips the restructuring
+		uint32_t treeletPasses = 2;
+		uint32_t treeletMinPrimitives = 8; // Smaller subtrees are left as they are
+		BuildSettings leaves; // SAH constants and leaf size of the final leaf collapse
+	};
+	struct LbvhTimings {
+		double mortonMs = 0.0;
+		double sortMs = 0.0;
+		double hierarchyMs = 0.0; // Emission and bounds
+		double treeletMs = 0.0;
+		double totalMs = 0.0; // Including the final layout and leaf collapse
+	};
+	// 30 bit code of a position in [0, 1]^3, 10 bits per axis
+	uint32_t MortonCode(const glm::vec3& unitPosition);
+	// Sorts keys by bits [firstBit, firstBit + bitCount), 8 bits per pass with one histogram per thread
+	void RadixSort(std::vector<uint64_t>& keys, uint32_t firstBit, uint32_t bitCount, uint32_t threadCount = 0);
+	void BuildLbvh(const std::vector<Aabb>& primitiveBounds, const LbvhSettings& settings, Bvh& bvh, LbvhTimings* timings = nullptr);
+}
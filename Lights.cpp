@@ -0,0 +1,154 @@
+#include "Lights.h"
+#include <algorithm>
+#include <cmath>
+
+namespace lights {
+	double BuildAliasTable(const float* weights, uint32_t count, std::vector<AliasEntry>& table) {
+		table.assign(count, AliasEntry());
+		double sum = 0.0;
+		uint32_t heaviest = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			table[i].alias = i;
+			sum += (std::max)(0.f, weights[i]);
+			if (weights[i] > weights[heaviest])
+				heaviest = i;
+		}
+		if (sum <= 0.0)
+			return 0.0;
+		// Entries below the mean give their remainder to one above it
+		std::vector<double> scaled(count);
+		std::vector<uint32_t> small;
+		std::vector<uint32_t> large;
+		for (uint32_t i = 0; i < count; i++) {
+			scaled[i] = (std::max)(0.f, weights[i]) * count / sum;
+			(scaled[i] < 1.0 ? small : large).push_back(i);
+		}
+		while (!small.empty() && !large.empty()) {
+			uint32_t less = small.back();
+			small.pop_back();
+			uint32_t more = large.back();
+			large.pop_back();
+			table[less].probability = static_cast<float>(scaled[less]);
+			table[less].alias = more;
+			scaled[more] = (scaled[more] + scaled[less]) - 1.0;
+			(scaled[more] < 1.0 ? small : large).push_back(more);
+		}
+		// What is left is at the mean up to rounding, except for entries without weight which must never be kept
+		for (uint32_t i : small) {
+			table[i].probability = weights[i] > 0.f ? 1.f : 0.f;
+			table[i].alias = weights[i] > 0.f ? i : heaviest;
+		}
+		for (uint32_t i : large) {
+			table[i].probability = 1.f;
+		}
+		return sum;
+	}
+
+	uint32_t SampleAlias(const AliasEntry* table, uint32_t count, float u0, float u1) {
+		uint32_t entry = (std::min)(static_cast<uint32_t>(u0 * count), count - 1);
+		return u1 < table[entry].probability ? entry : table[entry].alias;
+	}
+
+	float Luminance(const glm::vec3& color) {
+		return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	}
+
+	bool BuildMeshLights(const std::vector<std::vector<Triangle>>& geometries, MeshLights& lights) {
+		lights = MeshLights();
+		std::vector<float> weights;
+		for (const std::vector<Triangle>& geometry : geometries) {
+			if (geometry.empty()) {
+				lights.geometries.push_back(kNoLight);
+				continue;
+			}
+			lights.geometries.push_back(static_cast<uint32_t>(lights.triangles.size()));
+			for (const Triangle& triangle : geometry) {
+				GpuTriangle light = {};
+				light.p0 = triangle.p0;
+				light.edge1 = triangle.p1 - triangle.p0;
+				light.edge2 = triangle.p2 - triangle.p0;
+				lights.triangles.push_back(light);
+				float area = 0.5f * glm::length(glm::cross(light.edge1, light.edge2));
+				weights.push_back(area * (std::max)(0.f, Luminance(triangle.emission)));
+			}
+		}
+		std::vector<AliasEntry> table;
+		lights.power = BuildAliasTable(weights.data(), static_cast<uint32_t>(weights.size()), table);
+		for (size_t i = 0; i < lights.triangles.size(); i++) {
+			lights.triangles[i].probability = table[i].probability;
+			lights.triangles[i].alias = table[i].alias;
+			lights.triangles[i].pdf = lights.power > 0.0 ? static_cast<float>(weights[i] / lights.power) : 0.f;
+		}
+		return lights.power > 0.0;
+	}
+
+	double BuildInstanceTable(const std::vector<InstanceLights>& instances, const std::vector<glm::mat4>& transforms, std::vector<GpuInstance>& table) {
+		std::vector<float> weights(instances.size(), 0.f);
+		for (size_t i = 0; i < instances.size(); i++) {
+			if (instances[i].mesh) {
+				float areaScale = std::pow(std::abs(glm::determinant(glm::mat3(transforms[i]))), 2.f / 3.f);
+				weights[i] = static_cast<float>(instances[i].mesh->power) * areaScale;
+			}
+		}
+		std::vector<AliasEntry> alias;
+		double power = BuildAliasTable(weights.data(), static_cast<uint32_t>(weights.size()), alias);
+		table.resize(instances.size());
+		for (size_t i = 0; i < instances.size(); i++) {
+			GpuInstance& entry = table[i];
+			entry = GpuInstance();
+			for (int row = 0; row < 3; row++) {
+				entry.rows[row] = glm::vec4(transforms[i][0][row], transforms[i][1][row], transforms[i][2][row], transforms[i][3][row]);
+			}
+			const MeshLights* mesh = instances[i].mesh;
+			entry.firstTriangle = instances[i].firstTriangle;
+			entry.triangleCount = mesh ? static_cast<uint32_t>(mesh->triangles.size()) : 0;
+			entry.firstGeometry = mesh ? instances[i].firstGeometry : kNoLight;
+			entry.probability = alias[i].probability;
+			entry.alias = alias[i].alias;
+			entry.pdf = power > 0.0 ? static_cast<float>(weights[i] / power) : 0.f;
+		}
+		return power;
+	}
+
+	glm::vec3 TransformPoint(const GpuInstance& instance, const glm::vec3& p) {
+		glm::vec4 h(p, 1.f);
+		return glm::vec3(glm::dot(instance.rows[0], h), glm::dot(instance.rows[1], h), glm::dot(instance.rows[2], h));
+	}
+
+	glm::vec3 TransformVector(const GpuInstance& instance, const glm::vec3& v) {
+		glm::vec4 h(v, 0.f);
+		return glm::vec3(glm::dot(instance.rows[0], h), glm::dot(instance.rows[1], h), glm::dot(instance.rows[2], h));
+	}
+
+	glm::vec3 WorldCross(const GpuInstance& instance, const GpuTriangle& triangle) {
+		return glm::cross(TransformVector(instance, triangle.edge1), TransformVector(instance, triangle.edge2));
+	}
+
+	float PdfArea(const GpuInstance& instance, const GpuTriangle& triangle) {
+		float area = 0.5f * glm::length(WorldCross(instance, triangle));
+		return area > 0.f ? instance.pdf * triangle.pdf / area : 0.f;
+	}
+
+	Sample SampleLight(const GpuInstance* instances, uint32_t instanceCount, const GpuTriangle* triangles, const float u[6]) {
+		Sample sample;
+		uint32_t entry = (std::min)(static_cast<uint32_t>(u[0] * instanceCount), instanceCount - 1);
+		sample.instance = u[1] < instances[entry].probability ? entry : instances[entry].alias;
+		const GpuInstance& instance = instances[sample.instance];
+		if (instance.triangleCount == 0)
+			return sample;
+		entry = instance.firstTriangle + (std::min)(static_cast<uint32_t>(u[2] * instance.triangleCount), instance.triangleCount - 1);
+		sample.triangle = instance.firstTriangle + (u[3] < triangles[entry].probability ? entry - instance.firstTriangle : triangles[entry].alias);
+		const GpuTriangle& triangle = triangles[sample.triangle];
+		// Uniform on the triangle
+		float su = std::sqrt(u[4]);
+		glm::vec3 p = triangle.p0 + (1.f - su) * triangle.edge1 + u[5] * su * triangle.edge2;
+		sample.position = TransformPoint(instance, p);
+		glm::vec3 cross = WorldCross(instance, triangle);
+		float length = glm::length(cross);
+		if (length <= 0.f)
+			return sample;
+		sample.normal = cross / length;
+		sample.pdfArea = instance.pdf * triangle.pdf / (0.5f * length);
+		return sample;
+	}
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+// Light list of the path tracer's next event estimation. Every triangle of an emissive geometry is a light,
+// picked in proportion to its power by two alias tables: one per model over its triangles, built when the
+// model is loaded, and one over the TLAS instances, rebuilt when they move. No D3D dependencies
+namespace lights {
+	static const uint32_t kNoLight = 0xFFFFFFFF;
+	struct AliasEntry {
+		float probability = 1.f; // Of keeping the entry instead of taking the alias
+		uint32_t alias = 0;
+	};
+	// Vose's alias method. Returns the sum of the weights, with 0 every entry keeps itself
+	double BuildAliasTable(const float* weights, uint32_t count, std::vector<AliasEntry>& table);
+	// Entry for two uniform numbers in [0, 1), SampleAlias in Common.hlsl
+	uint32_t SampleAlias(const AliasEntry* table, uint32_t count, float u0, float u1);
+	float Luminance(const glm::vec3& color);
+
+	// Emissive triangle of a model, in model space
+	struct Triangle {
+		glm::vec3 p0 = glm::vec3(0.f);
+		glm::vec3 p1 = glm::vec3(0.f);
+		glm::vec3 p2 = glm::vec3(0.f);
+		glm::vec3 emission = glm::vec3(0.f); // Estimated mean radiance, triangles without it are never picked
+	};
+	// LightTriangle in Common.hlsl
+	struct GpuTriangle {
+		glm::vec3 p0;
+		float probability; // Alias table over the triangles of the model
+		glm::vec3 edge1; // p1 - p0
+		uint32_t alias; // Triangle of the same model
+		glm::vec3 edge2; // p2 - p0
+		float pdf; // Of picking the triangle among the ones of its model
+	};
+	// LightInstance in Common.hlsl, one per TLAS instance
+	struct GpuInstance {
+		glm::vec4 rows[3]; // Object to world, world.x = dot(rows[0], float4(p, 1))
+		uint32_t firstTriangle; // Light triangles of the model, indexes of all models
+		uint32_t triangleCount; // 0 if the instance isn't picked
+		uint32_t firstGeometry; // Light geometries of the model, kNoLight makes the hits on it report no light
+		float probability; // Alias table over the instances
+		uint32_t alias;
+		float pdf; // Of picking the instance
+		uint32_t padding[2];
+	};
+
+	// The lights of a model, built once
+	struct MeshLights {
+		std::vector<GpuTriangle> triangles;
+		std::vector<uint32_t> geometries; // First triangle of every BLAS geometry, kNoLight for geometries without emission
+		double power = 0.0; // Sum of area times luminance, in model space
+	};
+	// geometries[g] has every triangle of BLAS geometry g in primitive order, or nothing if it doesn't emit.
+	// Returns false if no triangle emits
+	bool BuildMeshLights(const std::vector<std::vector<Triangle>>& geometries, MeshLights& lights);
+
+	// Where the lights of a TLAS instance are in the scene wide arrays, mesh is nullptr if it has none
+	struct InstanceLights {
+		const MeshLights* mesh = nullptr;
+		uint32_t firstTriangle = 0;
+		uint32_t firstGeometry = 0;
+	};
+	// Power of an instance is the one of its model times the area scale of its transform, exact for uniform
+	// scales. Returns the total power, next event estimation is off without any
+	double BuildInstanceTable(const std::vector<InstanceLights>& instances, const std::vector<glm::mat4>& transforms, std::vector<GpuInstance>& table);
+
+	glm::vec3 TransformPoint(const GpuInstance& instance, const glm::vec3& p);
+	glm::vec3 TransformVector(const GpuInstance& instance, const glm::vec3& v);
+	// World space normal of a light triangle, its length is twice the area
+	glm::vec3 WorldCross(const GpuInstance& instance, const GpuTriangle& triangle);
+	// Area density of picking a point on the triangle, for the MIS weight of paths which hit it
+	float PdfArea(const GpuInstance& instance, const GpuTriangle& triangle);
+
+	struct Sample {
+		glm::vec3 position = glm::vec3(0.f);
+		glm::vec3 normal = glm::vec3(0.f); // World space, unit length
+		float pdfArea = 0.f;
+		uint32_t instance = 0;
+		uint32_t triangle = 0; // In the triangles of all models
+	};
+	// SampleLight in Common.hlsl, u picks the instance, the triangle and the point, two numbers each
+	Sample SampleLight(const GpuInstance* instances, uint32_t instanceCount, const GpuTriangle* triangles, const float u[6]);
+}
@@ -0,0 +1,110 @@
+#include "LodSelector.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <random>
+#include <utility>
+
+namespace lod {
+	glm::vec3 GetEyePosition(const glm::mat4& view) {
+		return glm::vec3(glm::inverse(view)[3]);
+	}
+	void TransformBoundingSphere(const glm::mat4& transform, const glm::vec4& sphere, glm::vec3& center, float& radius) {
+		center = glm::vec3(transform * glm::vec4(glm::vec3(sphere), 1.f));
+		float scale = (std::max)(glm::length(glm::vec3(transform[0])), (std::max)(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+		radius = sphere.w * scale;
+	}
+	float ProjectedSize(const glm::vec3& center, float radius, const glm::vec3& eye, const Settings& settings) {
+		float distance = glm::length(center - eye);
+		if (distance <= radius)
+			return std::numeric_limits<float>::infinity();
+		return radius / (distance * std::tan(0.5f * settings.verticalFov)) * settings.viewportHeight;
+	}
+	uint32_t LevelForSize(float projectedSize, uint32_t levelCount, const Settings& settings) {
+		if (levelCount <= 1 || projectedSize >= settings.fullDetailPixels)
+			return 0;
+		if (projectedSize <= 0.f)
+			return levelCount - 1;
+		float level = std::floor(std::log2(settings.fullDetailPixels / projectedSize));
+		return level >= static_cast<float>(levelCount - 1) ? levelCount - 1 : static_cast<uint32_t>(level);
+	}
+
+	void SelectLods(const std::vector<Candidate>& candidates, const std::vector<uint64_t>& levelTriangles, const glm::vec3& eye,
+		const Settings& settings, Result& result) {
+		size_t count = candidates.size();
+		result.levels.resize(count);
+		result.triangles = 0;
+		result.fullDetailTriangles = 0;
+		result.budgetCoarsenings = 0;
+		std::vector<float> sizes(count);
+		for (size_t i = 0; i < count; i++) {
+			const Candidate& candidate = candidates[i];
+			sizes[i] = ProjectedSize(candidate.center, candidate.radius, eye, settings);
+			result.levels[i] = LevelForSize(sizes[i], candidate.levelCount, settings);
+			result.triangles += levelTriangles[candidate.firstLevel + result.levels[i]];
+			result.fullDetailTriangles += levelTriangles[candidate.firstLevel];
+		}
+		if (settings.triangleBudget == 0 || result.triangles <= settings.triangleBudget) {
+			result.withinBudget = true;
+			return;
+		}
+		// Dropping a level of an instance doubles its pixels per level step, the smallest resulting
+		// ratio loses the least detail. Ties go to the lower index to keep the selection stable
+		typedef std::pair<float, uint32_t> Entry;
+		std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+		auto cost = [&](size_t i) {
+			return sizes[i] * std::ldexp(1.f, static_cast<int>(result.levels[i]) + 1) / settings.fullDetailPixels;
+		};
+		for (size_t i = 0; i < count; i++) {
+			if (result.levels[i] + 1 < candidates[i].levelCount)
+				queue.push({ cost(i), static_cast<uint32_t>(i) });
+		}
+		while (result.triangles > settings.triangleBudget && !queue.empty()) {
+			uint32_t i = queue.top().second;
+			queue.pop();
+			const Candidate& candidate = candidates[i];
+			uint64_t current = levelTriangles[candidate.firstLevel + result.levels[i]];
+			uint64_t coarser = levelTriangles[candidate.firstLevel + result.levels[i] + 1];
+			result.levels[i]++;
+			result.triangles = result.triangles - current + coarser;
+			result.budgetCoarsenings++;
+			if (result.levels[i] + 1 < candidate.levelCount)
+				queue.push({ cost(i), i });
+		}
+		result.withinBudget = result.triangles <= settings.triangleBudget;
+	}
+
+	double BenchmarkLodSelection(uint32_t instanceCount, uint32_t levelCount, uint32_t iterations) {
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<float> unit(-1.f, 1.f);
+		std::vector<Candidate> candidates(instanceCount);
+		std::vector<uint64_t> levelTriangles;
+		for (uint32_t i = 0; i < instanceCount; i++) {
+			candidates[i].center = glm::vec3(unit(rng), 0.1f * unit(rng), unit(rng)) * 500.f;
+			candidates[i].radius = 2.f + unit(rng);
+			candidates[i].firstLevel = static_cast<uint32_t>(levelTriangles.size());
+			candidates[i].levelCount = levelCount;
+			// Every level halves the triangles
+			uint64_t triangles = 10000 + rng() % 50000;
+			for (uint32_t level = 0; level < levelCount; level++) {
+				levelTriangles.push_back((std::max)(uint64_t(1), triangles >> level));
+			}
+		}
+		Settings settings;
+		Result result;
+		SelectLods(candidates, levelTriangles, glm::vec3(0.f), settings, result);
+		settings.triangleBudget = result.fullDetailTriangles / 2;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < iterations; i++) {
+			// The camera moves along a line so that every iteration selects different levels
+			glm::vec3 eye(-250.f + 500.f * i / (std::max)(1u, iterations), 1.7f, 0.f);
+			SelectLods(candidates, levelTriangles, eye, settings, result);
+		}
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+		return elapsed.count() / (std::max)(1u, iterations);
+	}
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+// Per frame level of detail selection for TLAS instances. Every instance picks the level
+// matching its projected size, a global triangle budget then coarsens the instances which
+// lose the least detail first. No D3D dependencies, the renderer swaps the BLAS pointers
+namespace lod {
+	struct Settings {
+		float verticalFov = glm::radians(45.f);
+		float viewportHeight = 720.f;
+		// Projected diameter in pixels down to which level 0 is used, every following level halves it
+		float fullDetailPixels = 512.f;
+		// Maximum number of triangles in the TLAS, 0 disables the budget
+		uint64_t triangleBudget = 0;
+	};
+	// World space bounding sphere of an instance and its levels in the shared triangle count array
+	struct Candidate {
+		glm::vec3 center = glm::vec3(0.f);
+		float radius = 0.f;
+		uint32_t firstLevel = 0; // Index of level 0 in the triangle counts
+		uint32_t levelCount = 1;
+	};
+	struct Result {
+		std::vector<uint32_t> levels; // Selected level of every candidate
+		uint64_t triangles = 0; // Triangles of the selected levels
+		uint64_t fullDetailTriangles = 0; // Triangles if every candidate used level 0
+		uint32_t budgetCoarsenings = 0; // Levels dropped to meet the triangle budget
+		bool withinBudget = true;
+	};
+	// Camera position of a view matrix, e.g. nv_helpers_dx12::CameraManip.getMatrix()
+	glm::vec3 GetEyePosition(const glm::mat4& view);
+	// Sphere around the transformed sphere of a model, the radius grows with the largest axis scale
+	void TransformBoundingSphere(const glm::mat4& transform, const glm::vec4& sphere, glm::vec3& center, float& radius);
+	// Projected diameter in pixels, infinite if the eye is inside the sphere
+	float ProjectedSize(const glm::vec3& center, float radius, const glm::vec3& eye, const Settings& settings);
+	// Level for a projected size before the budget is applied
+	uint32_t LevelForSize(float projectedSize, uint32_t levelCount, const Settings& settings);
+	// levelTriangles holds the triangle count of every level of every candidate, level 0 first
+	void SelectLods(const std::vector<Candidate>& candidates, const std::vector<uint64_t>& levelTriangles, const glm::vec3& eye,
+		const Settings& settings, Result& result);
+
+	// Selects the levels of instanceCount random instances with levelCount levels each and half the
+	// full detail triangles as budget, returns the average milliseconds per selection
+	double BenchmarkLodSelection(uint32_t instanceCount, uint32_t levelCount, uint32_t iterations);
+}
@@ -1,16 +1,41 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <glm/glm.hpp>
+#include "ASBuildPolicy.h"
 //class D3D12HelloTriangle;
 class ResourceManager;
+// TLAS instance of a glTF node, used with BlasGranularity::Mesh.
+// Nodes with EXT_mesh_gpu_instancing get one per instance
+struct NodeInstance {
+	uint64_t blasPointer;
+	uint32_t heapPointer; // Primitive indexes of the mesh
+	int node;
+	int mesh; // glTF mesh of the BLAS, the instances of a mesh share its light triangles
+	glm::mat4 transform; // Node transform in model space
+	glm::mat4 instanceTransform; // EXT_mesh_gpu_instancing transform below the node, only kept for animated models
+	uint64_t triangles;
+};
+// One level of detail of a model with a single BLAS
+struct ModelLod {
+	uint64_t blasPointer;
+	uint32_t heapPointer; // Primitive indexes of the level
+	uint64_t triangles;
+};
 class Model {
 public:
 	//Model(D3D12HelloTriangle* app) {
 	//	m_app = app;
 	//}
 	Model() = default;
-	Model* LoadModel(ResourceManager* resManager, const std::string& name, std::vector<std::string>& hitGroups);
+	Model* LoadModel(ResourceManager* resManager, const std::string& name, std::vector<std::string>& hitGroups, ASBuildPolicy policy = ASBuildPolicy::Static,
+		BlasGranularity granularity = BlasGranularity::Model);
 	uint64_t m_BlasPointer;
+	ASBuildPolicy m_buildPolicy = ASBuildPolicy::Static;
+	BlasGranularity m_blasGranularity = BlasGranularity::Model;
+	std::vector<NodeInstance> m_nodeInstances; // Empty unless the model has a BLAS per mesh
+	std::vector<ModelLod> m_lods; // Level 0 is m_BlasPointer, coarser levels follow. Empty with a BLAS per mesh
+	glm::vec4 m_boundingSphere = glm::vec4(0.f); // Model space center and radius
 	uint32_t m_heapPointer;
 	std::string m_name;
 	std::vector<std::string> m_hitGroups;
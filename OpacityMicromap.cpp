@@ -0,0 +1,141 @@
+#include "OpacityMicromap.h"
+#include "ParallelFor.h"
+#include <chrono>
+#include <cmath>
+
+namespace omm {
+	BakeStats& BakeStats::operator+=(const BakeStats& other) {
+		opaque += other.opaque;
+		transparent += other.transparent;
+		unknown += other.unknown;
+		bakeTimeMs += other.bakeTimeMs;
+		return *this;
+	}
+
+	void GetMicroTriangle(uint32_t subdivisionLevel, uint32_t microIndex, glm::vec2& b0, glm::vec2& b1, glm::vec2& b2) {
+		// Row r holds N - r upright and N - r - 1 inverted micro-triangles, interleaved
+		const int32_t n = 1 << subdivisionLevel;
+		int32_t row = 0;
+		int32_t index = static_cast<int32_t>(microIndex);
+		while (index >= 2 * (n - row) - 1) {
+			index -= 2 * (n - row) - 1;
+			row++;
+		}
+		const float step = 1.f / static_cast<float>(n);
+		const int32_t u = index / 2;
+		if (index % 2 == 0) {
+			b0 = glm::vec2(u, row) * step;
+			b1 = glm::vec2(u + 1, row) * step;
+			b2 = glm::vec2(u, row + 1) * step;
+		}
+		else {
+			b0 = glm::vec2(u + 1, row) * step;
+			b1 = glm::vec2(u + 1, row + 1) * step;
+			b2 = glm::vec2(u, row + 1) * step;
+		}
+	}
+
+	static inline bool IsTexelOpaque(const AlphaTexture& texture, float alphaFactor, float alphaCutoff, int x, int y) {
+		float alpha = alphaFactor;
+		// Same rule as the any-hit shader - masked if alpha < cutoff
+		if (texture.components == 4 || texture.components == 2) {
+			alpha *= texture.pixels[(static_cast<size_t>(y) * texture.width + x) * texture.components + texture.components - 1] / 255.f;
+		}
+		return alpha >= alphaCutoff;
+	}
+	static inline int Wrap(int coord, int size) {
+		int wrapped = coord % size;
+		return wrapped < 0 ? wrapped + size : wrapped;
+	}
+
+	OpacityState ClassifyTriangle(const AlphaTexture& texture, float alphaFactor, float alphaCutoff,
+		const glm::vec2& uv0, const glm::vec2& uv1, const glm::vec2& uv2) {
+		if (texture.pixels == nullptr || texture.width <= 0 || texture.height <= 0) {
+			return alphaFactor >= alphaCutoff ? OpacityState::Opaque : OpacityState::Transparent;
+		}
+		glm::vec2 uvMin = glm::min(uv0, glm::min(uv1, uv2));
+		glm::vec2 uvMax = glm::max(uv0, glm::max(uv1, uv2));
+		// Texels a bilinear fetch inside the bounding box can read (texel centers are at +0.5), the sampler is assumed to wrap
+		int x0 = static_cast<int>(std::floor(uvMin.x * texture.width - 0.5f));
+		int y0 = static_cast<int>(std::floor(uvMin.y * texture.height - 0.5f));
+		int x1 = static_cast<int>(std::floor(uvMax.x * texture.width - 0.5f)) + 1;
+		int y1 = static_cast<int>(std::floor(uvMax.y * texture.height - 0.5f)) + 1;
+		if (x1 - x0 + 1 >= texture.width) {
+			x0 = 0;
+			x1 = texture.width - 1;
+		}
+		if (y1 - y0 + 1 >= texture.height) {
+			y0 = 0;
+			y1 = texture.height - 1;
+		}
+		bool anyOpaque = false;
+		bool anyTransparent = false;
+		for (int y = y0; y <= y1; y++) {
+			int wy = Wrap(y, texture.height);
+			for (int x = x0; x <= x1; x++) {
+				if (IsTexelOpaque(texture, alphaFactor, alphaCutoff, Wrap(x, texture.width), wy))
+					anyOpaque = true;
+				else
+					anyTransparent = true;
+				if (anyOpaque && anyTransparent) {
+					// Mixed - the any-hit shader decides, the centroid picks the fallback state
+					glm::vec2 centroid = (uv0 + uv1 + uv2) / 3.f;
+					int cx = Wrap(static_cast<int>(std::floor(centroid.x * texture.width)), texture.width);
+					int cy = Wrap(static_cast<int>(std::floor(centroid.y * texture.height)), texture.height);
+					return IsTexelOpaque(texture, alphaFactor, alphaCutoff, cx, cy) ? OpacityState::UnknownOpaque : OpacityState::UnknownTransparent;
+				}
+			}
+		}
+		return anyOpaque ? OpacityState::Opaque : OpacityState::Transparent;
+	}
+
+	BakeResult Bake(const BakeInput& input, uint32_t threadCount) {
+		auto bakeStart = std::chrono::high_resolution_clock::now();
+		BakeResult result;
+		result.subdivisionLevel = input.subdivisionLevel;
+		const uint32_t microCount = MicroTriangleCount(input.subdivisionLevel);
+		result.states.resize(static_cast<size_t>(input.triangleCount) * microCount);
+
+		// Barycentrics of the micro-triangles are the same for every triangle
+		std::vector<glm::vec2> microBary(3 * microCount);
+		for (uint32_t m = 0; m < microCount; m++) {
+			GetMicroTriangle(input.subdivisionLevel, m, microBary[3 * m + 0], microBary[3 * m + 1], microBary[3 * m + 2]);
+		}
+
+		// Triangles are handed out in small chunks, alpha masked geometry varies a lot in cost per triangle
+		std::vector<BakeStats> threadStats(GetWorkerThreadCount(threadCount));
+		ParallelFor(input.triangleCount, 64, threadCount, [&](uint32_t first, uint32_t last, uint32_t threadIndex) {
+			BakeStats& stats = threadStats[threadIndex];
+			for (uint32_t tri = first; tri < last; tri++) {
+				const glm::vec2& uv0 = input.texcoords[input.indices[3 * tri + 0]];
+				const glm::vec2& uv1 = input.texcoords[input.indices[3 * tri + 1]];
+				const glm::vec2& uv2 = input.texcoords[input.indices[3 * tri + 2]];
+				OpacityState* states = &result.states[static_cast<size_t>(tri) * microCount];
+				for (uint32_t m = 0; m < microCount; m++) {
+					glm::vec2 microUV[3];
+					for (int c = 0; c < 3; c++) {
+						const glm::vec2& b = microBary[3 * m + c];
+						microUV[c] = uv0 * (1.f - b.x - b.y) + uv1 * b.x + uv2 * b.y;
+					}
+					states[m] = ClassifyTriangle(input.texture, input.alphaFactor, input.alphaCutoff, microUV[0], microUV[1], microUV[2]);
+					switch (states[m]) {
+					case OpacityState::Opaque:
+						stats.opaque++;
+						break;
+					case OpacityState::Transparent:
+						stats.transparent++;
+						break;
+					default:
+						stats.unknown++;
+						break;
+					}
+				}
+			}
+		});
+		for (auto& stats : threadStats) {
+			result.stats += stats;
+		}
+		result.stats.bakeTimeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - bakeStart).count();
+		return result;
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+// CPU baker for opacity micromaps of alpha masked (glTF MASK) geometry.
+// Every triangle is split into 4^subdivisionLevel micro-triangles and each of them is classified
+// against the base color alpha, so traversal only needs the any-hit alpha test for the unknown ones.
+// No D3D dependencies - the GPU side (OMM arrays in the BLAS) is built on top of the baked states
+namespace omm {
+	// Values match the DXR 4-state encoding, unknown micro-triangles fall back to the any-hit shader
+	enum class OpacityState : uint8_t {
+		Transparent = 0,
+		Opaque = 1,
+		UnknownTransparent = 2,
+		UnknownOpaque = 3
+	};
+	// Texture the alpha is read from, tightly packed 8 bit per component like tinygltf::Image.
+	// Images without an alpha component are treated as alpha = 1
+	struct AlphaTexture {
+		const uint8_t* pixels = nullptr;
+		int width = 0;
+		int height = 0;
+		int components = 4;
+	};
+	struct BakeInput {
+		const glm::vec2* texcoords = nullptr;
+		const uint32_t* indices = nullptr; // 3 per triangle
+		uint32_t triangleCount = 0;
+		AlphaTexture texture;
+		float alphaFactor = 1.f; // material base color alpha
+		float alphaCutoff = 0.5f;
+		uint32_t subdivisionLevel = 4;
+	};
+	struct BakeStats {
+		uint64_t opaque = 0;
+		uint64_t transparent = 0;
+		uint64_t unknown = 0;
+		double bakeTimeMs = 0.0;
+		uint64_t MicroTriangles() const { return opaque + transparent + unknown; }
+		// Part of the micro-triangles that never invoke the any-hit shader
+		double ResolvedFraction() const { return MicroTriangles() > 0 ? double(opaque + transparent) / double(MicroTriangles()) : 1.0; }
+		BakeStats& operator+=(const BakeStats& other);
+	};
+	struct BakeResult {
+		uint32_t subdivisionLevel = 0;
+		// 4^subdivisionLevel states per triangle, micro-triangles are stored row by row
+		// starting at vertex 0 (see GetMicroTriangle), not in the bird curve order of DXR
+		std::vector<OpacityState> states;
+		BakeStats stats;
+	};
+
+	inline uint32_t MicroTriangleCount(uint32_t subdivisionLevel) { return 1u << (2 * subdivisionLevel); }
+	// Barycentric coordinates (of vertex 1 and 2) of the corners of a micro-triangle
+	void GetMicroTriangle(uint32_t subdivisionLevel, uint32_t microIndex, glm::vec2& b0, glm::vec2& b1, glm::vec2& b2);
+	// Classifies a single triangle given in texture space, conservatively over all texels
+	// the bilinear footprint of the triangle can touch
+	OpacityState ClassifyTriangle(const AlphaTexture& texture, float alphaFactor, float alphaCutoff,
+		const glm::vec2& uv0, const glm::vec2& uv1, const glm::vec2& uv2);
+	// Bakes all triangles of the input, threadCount = 0 uses all hardware threads
+	BakeResult Bake(const BakeInput& input, uint32_t threadCount = 0);
+}
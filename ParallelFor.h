@@ -0,0 +1,126 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+// Splits [0, count) into chunks which are handed out to worker threads on demand.
+// fn(begin, end, threadIndex) is called once per chunk, threadIndex < the returned thread count
+// so callers can keep per-thread results without locking. The calling thread works as thread 0
+inline uint32_t GetWorkerThreadCount(uint32_t threadCount) {
+	return threadCount == 0 ? (std::max)(1u, std::thread::hardware_concurrency()) : threadCount;
+}
+// Threads which live as long as the process, so per frame work doesn't start and join threads every call.
+// One job at a time: a ParallelFor nested in a job, or one from another thread while a job runs, gets false
+// from Run and starts its own threads
+class WorkerPool {
+public:
+	static WorkerPool& Get() {
+		static WorkerPool pool;
+		return pool;
+	}
+	~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_start.notify_all();
+		for (auto& thread : m_threads) {
+			thread.join();
+		}
+	}
+	// Calls job(i) for i in [1, threadCount) on pool threads and job(0) on the caller, returns once all are done
+	bool Run(uint32_t threadCount, const std::function<void(uint32_t)>& job) {
+		if (InWorker() || m_busy.exchange(true))
+			return false;
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (m_threads.size() + 1 < threadCount) {
+			uint32_t index = static_cast<uint32_t>(m_threads.size()) + 1;
+			m_threads.emplace_back([this, index] { WorkerLoop(index); });
+		}
+		m_job = &job;
+		m_activeCount = threadCount;
+		m_remaining = threadCount - 1;
+		m_generation++;
+		lock.unlock();
+		m_start.notify_all();
+		InWorker() = true;
+		job(0);
+		InWorker() = false;
+		lock.lock();
+		m_done.wait(lock, [this] { return m_remaining == 0; });
+		m_job = nullptr;
+		lock.unlock();
+		m_busy = false;
+		return true;
+	}
+private:
+	WorkerPool() = default;
+	static bool& InWorker() {
+		static thread_local bool inWorker = false;
+		return inWorker;
+	}
+	void WorkerLoop(uint32_t index) {
+		InWorker() = true;
+		uint64_t seen = 0;
+		std::unique_lock<std::mutex> lock(m_mutex);
+		for (;;) {
+			m_start.wait(lock, [&] { return m_stop || m_generation != seen; });
+			if (m_stop)
+				return;
+			seen = m_generation;
+			// Threads beyond the count of this job sit it out
+			if (index >= m_activeCount)
+				continue;
+			const std::function<void(uint32_t)>* job = m_job;
+			lock.unlock();
+			(*job)(index);
+			lock.lock();
+			if (--m_remaining == 0)
+				m_done.notify_one();
+		}
+	}
+	std::vector<std::thread> m_threads; // Thread i runs job index i + 1
+	std::mutex m_mutex;
+	std::condition_variable m_start;
+	std::condition_variable m_done;
+	std::atomic<bool> m_busy{ false };
+	const std::function<void(uint32_t)>* m_job = nullptr;
+	uint64_t m_generation = 0;
+	uint32_t m_activeCount = 0;
+	uint32_t m_remaining = 0;
+	bool m_stop = false;
+};
+template<typename Fn>
+uint32_t ParallelFor(uint32_t count, uint32_t chunkSize, uint32_t threadCount, Fn fn) {
+	chunkSize = (std::max)(1u, chunkSize);
+	threadCount = (std::max)(1u, (std::min)(GetWorkerThreadCount(threadCount), (count + chunkSize - 1) / chunkSize));
+	std::atomic<uint32_t> next(0);
+	auto worker = [&](uint32_t threadIndex) {
+		for (;;) {
+			uint32_t begin = next.fetch_add(chunkSize);
+			if (begin >= count)
+				break;
+			fn(begin, (std::min)(begin + chunkSize, count), threadIndex);
+		}
+	};
+	// A single chunk runs on the caller
+	if (threadCount == 1) {
+		worker(0);
+		return threadCount;
+	}
+	if (WorkerPool::Get().Run(threadCount, worker))
+		return threadCount;
+	std::vector<std::thread> threads;
+	for (uint32_t i = 1; i < threadCount; i++) {
+		threads.emplace_back(worker, i);
+	}
+	worker(0);
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	return threadCount;
+}
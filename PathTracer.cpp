@@ -0,0 +1,513 @@
+#include "PathTracer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <unordered_map>
+#include "ParallelFor.h"
+
+namespace pt {
+	static const float kPi = 3.141592653589f;
+	static const float kInvPi = 0.318309886183f;
+
+	glm::vec4 Texture::Sample(const glm::vec2& uv) const {
+		if (pixels.empty() || width <= 0 || height <= 0)
+			return glm::vec4(1.f);
+		// Texel centers are at +0.5
+		float x = uv.x * width - 0.5f;
+		float y = uv.y * height - 0.5f;
+		float fx = std::floor(x);
+		float fy = std::floor(y);
+		int x0 = static_cast<int>(fx);
+		int y0 = static_cast<int>(fy);
+		auto texel = [&](int tx, int ty) {
+			tx = (tx % width + width) % width;
+			ty = (ty % height + height) % height;
+			const uint8_t* p = &pixels[(static_cast<size_t>(ty) * width + tx) * components];
+			glm::vec4 c(0.f, 0.f, 0.f, 1.f);
+			for (int i = 0; i < (std::min)(components, 4); i++) {
+				c[i] = p[i] / 255.f;
+			}
+			return c;
+		};
+		float ax = x - fx;
+		float ay = y - fy;
+		return glm::mix(glm::mix(texel(x0, y0), texel(x0 + 1, y0), ax), glm::mix(texel(x0, y0 + 1), texel(x0 + 1, y0 + 1), ax), ay);
+	}
+
+	uint32_t WangHash(uint32_t seed) {
+		seed = (seed ^ 61) ^ (seed >> 16);
+		seed *= 9;
+		seed = seed ^ (seed >> 4);
+		seed *= 0x27d4eb2d;
+		seed = seed ^ (seed >> 15);
+		return seed;
+	}
+
+	float Rand(uint32_t& seed) {
+		seed ^= (seed << 13);
+		seed ^= (seed >> 17);
+		seed ^= (seed << 5);
+		return static_cast<float>(seed) / 4294967296.f;
+	}
+
+	uint32_t PixelSeed(uint32_t pixelID, uint32_t sample) {
+		return WangHash(pixelID * 3 + 1 + sample * 0x9E3779B9u);
+	}
+
+	uint32_t PackNormal(glm::vec3 n) {
+		n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+		glm::vec2 e(n.x, n.y);
+		if (n.z < 0.f)
+			e = (1.f - glm::abs(glm::vec2(n.y, n.x))) * glm::vec2(n.x >= 0.f ? 1.f : -1.f, n.y >= 0.f ? 1.f : -1.f);
+		glm::vec2 q = glm::clamp(e * 0.5f + 0.5f, 0.f, 1.f) * 65535.f;
+		// HLSL round is round to nearest even, like nearbyint in the default rounding mode
+		return static_cast<uint32_t>(std::nearbyint(q.x)) | (static_cast<uint32_t>(std::nearbyint(q.y)) << 16);
+	}
+
+	glm::vec3 UnpackNormal(uint32_t packed) {
+		glm::vec2 e = glm::vec2(static_cast<float>(packed & 0xFFFF), static_cast<float>(packed >> 16)) / 65535.f * 2.f - 1.f;
+		glm::vec3 n(e, 1.f - std::abs(e.x) - std::abs(e.y));
+		if (n.z < 0.f) {
+			glm::vec2 folded = (1.f - glm::abs(glm::vec2(n.y, n.x))) * glm::vec2(n.x >= 0.f ? 1.f : -1.f, n.y >= 0.f ? 1.f : -1.f);
+			n.x = folded.x;
+			n.y = folded.y;
+		}
+		return glm::normalize(n);
+	}
+
+	glm::vec3 GetDiffuseReflected(const glm::vec3& normal, uint32_t& seed) {
+		float r = std::sqrt(Rand(seed));
+		float phi = 2.f * kPi * Rand(seed);
+		glm::vec3 tangent = glm::normalize(glm::cross(std::abs(normal.x) > 0.5f ? glm::vec3(0.f, 1.f, 0.f) : glm::vec3(1.f, 0.f, 0.f), normal));
+		glm::vec3 bitangent = glm::cross(normal, tangent);
+		return glm::normalize(tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + normal * std::sqrt((std::max)(0.f, 1.f - r * r)));
+	}
+
+	float PowerHeuristic(float pdf, float otherPdf) {
+		float squared = pdf * pdf;
+		float sum = squared + otherPdf * otherPdf;
+		return sum > 0.f ? squared / sum : 0.f;
+	}
+
+	float SurvivalProbability(const glm::vec3& throughput) {
+		return (std::min)(1.f, (std::max)(throughput.x, (std::max)(throughput.y, throughput.z)) / render::kPathRouletteThreshold);
+	}
+
+	glm::vec3 Sky(uint32_t x, uint32_t y, const Camera& camera) {
+		float rampy = static_cast<float>(y) / camera.height;
+		float rampx = static_cast<float>(x) / camera.width;
+		return glm::vec3(rampx, rampx * rampy, rampy);
+	}
+
+	bvh::Ray CameraRay(const Camera& camera, uint32_t x, uint32_t y) {
+		glm::vec2 d = ((glm::vec2(static_cast<float>(x), static_cast<float>(y)) + 0.5f) / glm::vec2(static_cast<float>(camera.width), static_cast<float>(camera.height))) * 2.f - 1.f;
+		bvh::Ray ray;
+		ray.origin = glm::vec3(camera.viewInv * glm::vec4(0.f, 0.f, 0.f, 1.f));
+		// Not normalized, like in RayGen.hlsl
+		glm::vec4 target = camera.projectionInv * glm::vec4(d.x, -d.y, 1.f, 1.f);
+		ray.direction = glm::vec3(camera.viewInv * glm::vec4(glm::vec3(target), 0.f));
+		ray.tMin = 0.f;
+		ray.tMax = 100000.f;
+		return ray;
+	}
+
+	glm::vec3 Emission(const Material& material, const std::vector<Texture>& textures, const glm::vec2& uv) {
+		if (material.emissiveTexture < 0)
+			return glm::vec3(0.f);
+		return glm::vec3(textures[material.emissiveTexture].Sample(uv)) * material.emissive;
+	}
+
+	glm::vec3 EstimateEmission(const Material& material, const std::vector<Texture>& textures, const glm::vec2& uv0, const glm::vec2& uv1, const glm::vec2& uv2) {
+		glm::vec3 sum = Emission(material, textures, uv0) + Emission(material, textures, uv1) + Emission(material, textures, uv2);
+		return (sum + Emission(material, textures, (uv0 + uv1 + uv2) / 3.f)) * 0.25f;
+	}
+
+	void BuildSceneLights(Scene& scene) {
+		SceneLights& sceneLights = scene.lights;
+		sceneLights = SceneLights();
+		const std::vector<bvh::Instance>& instances = scene.tlas->GetInstances();
+		// Instances of the same surfaces share their mesh, -1 without emission
+		std::vector<const Surfaces*> knownSurfaces;
+		std::vector<int> knownMeshes;
+		std::vector<int> instanceMeshes(instances.size(), -1);
+		for (size_t i = 0; i < instances.size(); i++) {
+			const Surfaces& surfaces = *scene.surfaces[i];
+			auto known = std::find(knownSurfaces.begin(), knownSurfaces.end(), &surfaces);
+			if (known != knownSurfaces.end()) {
+				instanceMeshes[i] = knownMeshes[known - knownSurfaces.begin()];
+				continue;
+			}
+			knownSurfaces.push_back(&surfaces);
+			knownMeshes.push_back(-1);
+			const bvh::Mesh& mesh = instances[i].blas->mesh;
+			std::vector<std::vector<lights::Triangle>> geometries(1);
+			geometries[0].resize(mesh.triangles.size());
+			bool emissive = false;
+			for (size_t t = 0; t < mesh.triangles.size(); t++) {
+				const glm::uvec3& triangle = mesh.triangles[t];
+				lights::Triangle& light = geometries[0][t];
+				light.p0 = mesh.positions[triangle.x];
+				light.p1 = mesh.positions[triangle.y];
+				light.p2 = mesh.positions[triangle.z];
+				const Material& material = surfaces.materials[surfaces.triangleMaterials[t]];
+				if (material.emissiveTexture < 0 || surfaces.texcoords.empty())
+					continue;
+				light.emission = EstimateEmission(material, surfaces.textures, surfaces.texcoords[triangle.x], surfaces.texcoords[triangle.y], surfaces.texcoords[triangle.z]);
+				emissive = true;
+			}
+			lights::MeshLights meshLights;
+			if (!emissive || !lights::BuildMeshLights(geometries, meshLights))
+				continue;
+			instanceMeshes[i] = knownMeshes.back() = static_cast<int>(sceneLights.meshes.size());
+			sceneLights.meshes.push_back(std::move(meshLights));
+		}
+		// Scene wide indexes like the buffers of UploadScene
+		std::vector<uint32_t> firstTriangles;
+		std::vector<uint32_t> firstGeometries;
+		for (const lights::MeshLights& meshLights : sceneLights.meshes) {
+			firstTriangles.push_back(static_cast<uint32_t>(sceneLights.triangles.size()));
+			firstGeometries.push_back(static_cast<uint32_t>(sceneLights.geometries.size()));
+			for (uint32_t first : meshLights.geometries) {
+				sceneLights.geometries.push_back(first == lights::kNoLight ? first : first + firstTriangles.back());
+			}
+			sceneLights.triangles.insert(sceneLights.triangles.end(), meshLights.triangles.begin(), meshLights.triangles.end());
+		}
+		std::vector<lights::InstanceLights> instanceLights(instances.size());
+		std::vector<glm::mat4> transforms(instances.size());
+		for (size_t i = 0; i < instances.size(); i++) {
+			transforms[i] = instances[i].transform;
+			if (instanceMeshes[i] < 0)
+				continue;
+			instanceLights[i].mesh = &sceneLights.meshes[instanceMeshes[i]];
+			instanceLights[i].firstTriangle = firstTriangles[instanceMeshes[i]];
+			instanceLights[i].firstGeometry = firstGeometries[instanceMeshes[i]];
+		}
+		sceneLights.power = lights::BuildInstanceTable(instanceLights, transforms, sceneLights.instances);
+	}
+
+	bool IntersectSurface(const Scene& scene, const bvh::Ray& ray, SurfaceHit& hit) {
+		bvh::InstanceHit instanceHit;
+		if (!scene.tlas->Intersect(ray, 0xFF, instanceHit))
+			return false;
+		const bvh::Instance& instance = scene.tlas->GetInstances()[instanceHit.instance];
+		const Surfaces& surfaces = *scene.surfaces[instanceHit.instance];
+		const glm::uvec3& triangle = instance.blas->mesh.triangles[instanceHit.hit.primitive];
+		glm::vec3 barycentrics(1.f - instanceHit.hit.u - instanceHit.hit.v, instanceHit.hit.u, instanceHit.hit.v);
+		const Material& material = surfaces.materials[surfaces.triangleMaterials[instanceHit.hit.primitive]];
+		glm::vec2 uv(0.f);
+		if (!surfaces.texcoords.empty()) {
+			uv = surfaces.texcoords[triangle.x] * barycentrics.x + surfaces.texcoords[triangle.y] * barycentrics.y +
+				surfaces.texcoords[triangle.z] * barycentrics.z;
+		}
+		glm::vec3 baseColor(0.f);
+		if (material.baseTexture >= 0)
+			baseColor = glm::vec3(surfaces.textures[material.baseTexture].Sample(uv) * material.baseColor);
+		glm::vec3 emissive = Emission(material, surfaces.textures, uv);
+		hit.t = instanceHit.hit.t;
+		hit.instance = instanceHit.instance;
+		hit.emissive = glm::length(emissive) > 0.f;
+		if (hit.emissive) {
+			hit.color = baseColor + emissive;
+			hit.light = lights::kNoLight;
+			const SceneLights& sceneLights = scene.lights;
+			if (sceneLights.power > 0.0 && sceneLights.instances[hit.instance].firstGeometry != lights::kNoLight) {
+				uint32_t first = sceneLights.geometries[sceneLights.instances[hit.instance].firstGeometry];
+				if (first != lights::kNoLight)
+					hit.light = first + instanceHit.hit.primitive;
+			}
+			return true;
+		}
+		hit.color = baseColor;
+		glm::vec3 normal = surfaces.normals[triangle.x] * barycentrics.x + surfaces.normals[triangle.y] * barycentrics.y +
+			surfaces.normals[triangle.z] * barycentrics.z;
+		// Meshes without normals shade with the face normal
+		if (glm::dot(normal, normal) == 0.f) {
+			const std::vector<glm::vec3>& positions = instance.blas->mesh.positions;
+			normal = glm::cross(positions[triangle.y] - positions[triangle.x], positions[triangle.z] - positions[triangle.x]);
+		}
+		hit.normal = glm::normalize(glm::mat3(instance.transform) * normal);
+		return true;
+	}
+
+	glm::vec3 SampleDirectLight(const Scene& scene, const glm::vec3& position, const glm::vec3& normal, const glm::vec3& albedo, uint32_t& seed) {
+		const SceneLights& sceneLights = scene.lights;
+		float u[6];
+		for (float& number : u) {
+			number = Rand(seed);
+		}
+		lights::Sample light = lights::SampleLight(sceneLights.instances.data(), static_cast<uint32_t>(sceneLights.instances.size()), sceneLights.triangles.data(), u);
+		if (light.pdfArea <= 0.f)
+			return glm::vec3(0.f);
+		glm::vec3 toLight = light.position - position;
+		float distance = glm::length(toLight);
+		glm::vec3 direction = toLight / distance;
+		float cosSurface = glm::dot(normal, direction);
+		float cosLight = std::abs(glm::dot(light.normal, direction));
+		if (cosSurface <= 0.f || cosLight <= 0.f)
+			return glm::vec3(0.f);
+		// Anything but the sampled triangle in between occludes it
+		bvh::Ray shadow;
+		shadow.origin = position;
+		shadow.direction = direction;
+		shadow.tMin = 0.01f;
+		shadow.tMax = distance * 1.01f;
+		SurfaceHit hit;
+		if (!IntersectSurface(scene, shadow, hit) || !hit.emissive || hit.light != light.triangle || hit.instance != light.instance)
+			return glm::vec3(0.f);
+		float lightPdf = light.pdfArea * distance * distance / cosLight;
+		float bsdfPdf = cosSurface * kInvPi;
+		return albedo * kInvPi * cosSurface * hit.color * (PowerHeuristic(lightPdf, bsdfPdf) / lightPdf);
+	}
+
+	glm::vec3 TracePath(const Scene& scene, bvh::Ray ray, uint32_t x, uint32_t y, const Camera& camera, uint32_t& seed, const Settings& settings) {
+		const SceneLights& sceneLights = scene.lights;
+		bool nextEvent = settings.nextEventEstimation && sceneLights.power > 0.0;
+		glm::vec3 radiance(0.f);
+		glm::vec3 throughput(1.f);
+		float bsdfPdf = 0.f; // Of the last bounce, 0 for camera rays which no light sample can reach
+		for (uint32_t bounce = 0; bounce < settings.maxBounces; bounce++) {
+			SurfaceHit hit;
+			if (!IntersectSurface(scene, ray, hit)) {
+				radiance += throughput * Sky(x, y, camera);
+				break;
+			}
+			if (hit.emissive) {
+				float weight = 1.f;
+				if (nextEvent && bsdfPdf > 0.f && hit.light != lights::kNoLight) {
+					const lights::GpuInstance& instance = sceneLights.instances[hit.instance];
+					const lights::GpuTriangle& triangle = sceneLights.triangles[hit.light];
+					float cosLight = std::abs(glm::dot(glm::normalize(lights::WorldCross(instance, triangle)), ray.direction));
+					float lightPdf = cosLight > 0.f ? lights::PdfArea(instance, triangle) * hit.t * hit.t / cosLight : 0.f;
+					weight = PowerHeuristic(bsdfPdf, lightPdf);
+				}
+				radiance += throughput * hit.color * weight;
+				break;
+			}
+			if (bounce + 1 >= settings.maxBounces)
+				break;
+			glm::vec3 normal = UnpackNormal(PackNormal(hit.normal));
+			glm::vec3 position = ray.origin + hit.t * ray.direction;
+			if (nextEvent)
+				radiance += throughput * SampleDirectLight(scene, position, normal, hit.color, seed);
+			glm::vec3 newDir = GetDiffuseReflected(normal, seed);
+			throughput *= hit.color;
+			bsdfPdf = glm::dot(newDir, normal) * kInvPi;
+			if (bounce + 1 >= settings.rouletteDepth) {
+				float survival = SurvivalProbability(throughput);
+				if (Rand(seed) >= survival)
+					break;
+				throughput /= survival;
+			}
+			ray.origin = position;
+			ray.direction = newDir;
+			ray.tMin = 0.01f;
+			ray.tMax = 100000.f;
+		}
+		return radiance;
+	}
+
+	glm::vec3 TracePathRecursive(const Scene& scene, const bvh::Ray& ray, uint32_t x, uint32_t y, const Camera& camera, uint32_t seed, uint32_t depth, const Settings& settings) {
+		SurfaceHit hit;
+		if (!IntersectSurface(scene, ray, hit))
+			return Sky(x, y, camera);
+		if (hit.emissive)
+			return hit.color;
+		glm::vec3 newDir = GetDiffuseReflected(hit.normal, seed);
+		// The surfaces at the last depth get no light
+		if (depth + 1 >= settings.maxBounces)
+			return glm::vec3(0.f);
+		bvh::Ray next;
+		next.origin = ray.origin + hit.t * ray.direction;
+		next.direction = newDir;
+		next.tMin = 0.01f;
+		next.tMax = 100000.f;
+		glm::vec3 incoming = TracePathRecursive(scene, next, x, y, camera, seed, depth + 1, settings);
+		return hit.color * incoming;
+	}
+
+	double Render(const Scene& scene, const Camera& camera, const Settings& settings, Estimator estimator, std::vector<glm::vec3>& image,
+		std::vector<glm::vec3>* meanSquares) {
+		auto start = std::chrono::high_resolution_clock::now();
+		image.assign(static_cast<size_t>(camera.width) * camera.height, glm::vec3(0.f));
+		if (meanSquares)
+			meanSquares->assign(image.size(), glm::vec3(0.f));
+		uint32_t samples = (std::max)(1u, settings.samplesPerPixel);
+		ParallelFor(camera.height, 1, settings.threadCount, [&](uint32_t begin, uint32_t end, uint32_t) {
+			for (uint32_t y = begin; y < end; y++) {
+				for (uint32_t x = 0; x < camera.width; x++) {
+					uint32_t pixelID = camera.width * y + x;
+					glm::vec3 sum(0.f);
+					glm::vec3 squares(0.f);
+					for (uint32_t sample = settings.firstSample; sample < settings.firstSample + samples; sample++) {
+						uint32_t seed = PixelSeed(pixelID, sample);
+						bvh::Ray ray = CameraRay(camera, x, y);
+						glm::vec3 radiance = estimator == Estimator::Loop ? TracePath(scene, ray, x, y, camera, seed, settings) :
+							TracePathRecursive(scene, ray, x, y, camera, seed, 0, settings);
+						sum += radiance;
+						squares += radiance * radiance;
+					}
+					image[pixelID] = sum / static_cast<float>(samples);
+					if (meanSquares)
+						(*meanSquares)[pixelID] = squares / static_cast<float>(samples);
+				}
+			}
+		});
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	double MeanRadiance(const std::vector<glm::vec3>& image) {
+		double sum = 0.0;
+		for (const glm::vec3& pixel : image) {
+			sum += static_cast<double>(pixel.x) + pixel.y + pixel.z;
+		}
+		return image.empty() ? 0.0 : sum / (3.0 * image.size());
+	}
+
+	double Rmse(const std::vector<glm::vec3>& image, const std::vector<glm::vec3>& reference) {
+		double squared = 0.0;
+		for (size_t i = 0; i < image.size(); i++) {
+			glm::vec3 d = image[i] - reference[i];
+			squared += static_cast<double>(glm::dot(d, d));
+		}
+		return image.empty() ? 0.0 : std::sqrt(squared / (3.0 * image.size()));
+	}
+
+	EstimatorComparison CompareEstimators(const Scene& scene, const Camera& camera, const Settings& settings) {
+		EstimatorComparison result;
+		std::vector<glm::vec3> loop;
+		std::vector<glm::vec3> recursive;
+		Settings bounces = settings;
+		bounces.nextEventEstimation = false;
+		bounces.rouletteDepth = settings.maxBounces;
+		result.loopMs = Render(scene, camera, bounces, Estimator::Loop, loop);
+		result.recursiveMs = Render(scene, camera, bounces, Estimator::Recursive, recursive);
+		result.loopMean = MeanRadiance(loop);
+		result.recursiveMean = MeanRadiance(recursive);
+		result.rmsDifference = Rmse(loop, recursive);
+		return result;
+	}
+
+	Efficiency MeasureEfficiency(const Scene& scene, const Camera& camera, const Settings& settings) {
+		Efficiency result;
+		std::vector<glm::vec3> image;
+		std::vector<glm::vec3> meanSquares;
+		uint32_t samples = (std::max)(2u, settings.samplesPerPixel);
+		Settings measured = settings;
+		measured.samplesPerPixel = samples;
+		double ms = Render(scene, camera, measured, Estimator::Loop, image, &meanSquares);
+		// Unbiased sample variance of every pixel and channel
+		double variance = 0.0;
+		for (size_t i = 0; i < image.size(); i++) {
+			glm::vec3 pixel = meanSquares[i] - image[i] * image[i];
+			variance += (static_cast<double>(pixel.x) + pixel.y + pixel.z) * samples / (samples - 1);
+		}
+		result.mean = MeanRadiance(image);
+		result.variance = image.empty() ? 0.0 : variance / (3.0 * image.size());
+		result.msPerSample = ms / samples;
+		return result;
+	}
+
+	// Texcoord where a world space ray crosses the plane of a triangle in the space of its BLAS
+	static bool PlaneTexcoord(const bvh::Ray& ray, const glm::mat4& worldToObject, const glm::vec3 p[3], const glm::vec2 uv[3], glm::vec2& texcoord) {
+		glm::vec3 origin = glm::vec3(worldToObject * glm::vec4(ray.origin, 1.f));
+		glm::vec3 direction = glm::mat3(worldToObject) * ray.direction;
+		glm::vec3 e1 = p[1] - p[0];
+		glm::vec3 e2 = p[2] - p[0];
+		glm::vec3 n = glm::cross(e1, e2);
+		float denominator = glm::dot(n, direction);
+		float lengthSquared = glm::dot(n, n);
+		if (denominator == 0.f || lengthSquared == 0.f)
+			return false;
+		float t = glm::dot(n, p[0] - origin) / denominator;
+		if (t <= 0.f)
+			return false;
+		glm::vec3 q = origin + t * direction - p[0];
+		float b1 = glm::dot(glm::cross(q, e2), n) / lengthSquared;
+		float b2 = glm::dot(glm::cross(e1, q), n) / lengthSquared;
+		texcoord = uv[0] * (1.f - b1 - b2) + uv[1] * b1 + uv[2] * b2;
+		return true;
+	}
+
+	TextureLodReport AnalyzeTextureLod(const Scene& scene, const Camera& camera, const texlod::CacheSettings& cache) {
+		TextureLodReport report;
+		texlod::TextureCache coneCache(cache);
+		texlod::TextureCache distanceCache(cache);
+		texlod::TextureCache finestCache(cache);
+		std::unordered_map<const Texture*, uint32_t> textureIDs;
+		const uint32_t tileSize = 8;
+		// Tile by tile, close to the order the GPU runs the dispatch in
+		for (uint32_t tileY = 0; tileY < camera.height; tileY += tileSize) {
+			for (uint32_t tileX = 0; tileX < camera.width; tileX += tileSize) {
+				for (uint32_t y = tileY; y < (std::min)(tileY + tileSize, camera.height); y++) {
+					for (uint32_t x = tileX; x < (std::min)(tileX + tileSize, camera.width); x++) {
+						bvh::Ray ray = CameraRay(camera, x, y);
+						bvh::InstanceHit instanceHit;
+						if (!scene.tlas->Intersect(ray, 0xFF, instanceHit))
+							continue;
+						const bvh::Instance& instance = scene.tlas->GetInstances()[instanceHit.instance];
+						const Surfaces& surfaces = *scene.surfaces[instanceHit.instance];
+						const Material& material = surfaces.materials[surfaces.triangleMaterials[instanceHit.hit.primitive]];
+						if (material.baseTexture < 0 || surfaces.texcoords.empty())
+							continue;
+						const Texture& texture = surfaces.textures[material.baseTexture];
+						if (texture.width <= 0 || texture.height <= 0)
+							continue;
+						const glm::uvec3& triangle = instance.blas->mesh.triangles[instanceHit.hit.primitive];
+						const std::vector<glm::vec3>& positions = instance.blas->mesh.positions;
+						glm::vec3 p[3] = { positions[triangle.x], positions[triangle.y], positions[triangle.z] };
+						glm::vec2 uv[3] = { surfaces.texcoords[triangle.x], surfaces.texcoords[triangle.y], surfaces.texcoords[triangle.z] };
+						glm::vec2 texcoord = uv[0] * (1.f - instanceHit.hit.u - instanceHit.hit.v) + uv[1] * instanceHit.hit.u + uv[2] * instanceHit.hit.v;
+						uint32_t width = static_cast<uint32_t>(texture.width);
+						uint32_t height = static_cast<uint32_t>(texture.height);
+						float maxLevel = static_cast<float>(texlod::MipCount(width, height) - 1);
+						auto clampLevel = [maxLevel](float lod) { return (std::min)((std::max)(lod, 0.f), maxLevel); };
+
+						// The cone of RayGen.hlsl starts at the camera with the angle to the pixel below, t is in
+						// lengths of the unnormalized direction like RayTCurrent
+						glm::mat4 worldToObject = glm::inverse(instance.transform);
+						float logAreaScale = 2.f / 3.f * std::log2(std::abs(glm::determinant(glm::mat3(instance.transform))));
+						float spread = texlod::SpreadAngle(ray.direction, CameraRay(camera, x, y + 1).direction);
+						float coneWidth = spread * instanceHit.hit.t * glm::length(ray.direction);
+						texlod::TriangleLod triangleLod = texlod::ComputeTriangleLod(p[0], p[1], p[2], uv[0], uv[1], uv[2]);
+						float coneLod = clampLevel(texlod::TextureLod(triangleLod, width, height, coneWidth, glm::mat3(worldToObject) * ray.direction, logAreaScale));
+						float distanceLod = clampLevel(texlod::DistanceLod(instanceHit.hit.t));
+						report.fetches++;
+						report.coneLod += coneLod;
+						report.distanceLod += distanceLod;
+
+						glm::vec2 texcoordX;
+						glm::vec2 texcoordY;
+						if (PlaneTexcoord(CameraRay(camera, x + 1, y), worldToObject, p, uv, texcoordX) &&
+							PlaneTexcoord(CameraRay(camera, x, y + 1), worldToObject, p, uv, texcoordY)) {
+							glm::vec2 size(static_cast<float>(width), static_cast<float>(height));
+							float footprint = (std::max)(glm::length((texcoordX - texcoord) * size), glm::length((texcoordY - texcoord) * size));
+							float referenceLod = clampLevel(footprint > 0.f ? std::log2(footprint) : 0.f);
+							report.referenceFetches++;
+							report.referenceLod += referenceLod;
+							report.coneError += std::abs(coneLod - referenceLod);
+							report.distanceError += std::abs(distanceLod - referenceLod);
+						}
+
+						uint32_t textureID = textureIDs.emplace(&texture, static_cast<uint32_t>(textureIDs.size())).first->second;
+						coneCache.Fetch(textureID, width, height, texcoord, coneLod);
+						distanceCache.Fetch(textureID, width, height, texcoord, distanceLod);
+						finestCache.Fetch(textureID, width, height, texcoord, 0.f);
+					}
+				}
+			}
+		}
+		if (report.fetches > 0) {
+			report.coneLod /= report.fetches;
+			report.distanceLod /= report.fetches;
+		}
+		if (report.referenceFetches > 0) {
+			report.referenceLod /= report.referenceFetches;
+			report.coneError /= report.referenceFetches;
+			report.distanceError /= report.referenceFetches;
+		}
+		report.coneCache = coneCache.GetStats();
+		report.distanceCache = distanceCache.GetStats();
+		report.finestCache = finestCache.GetStats();
+		return report;
+	}
+}
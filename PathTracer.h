@@ -0,0 +1,165 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "TwoLevelBvh.h"
+#include "RenderModes.h"
+#include "Lights.h"
+#include "TextureLod.h"
+// CPU reference of the path tracing render mode. The loop, the random numbers, the payload packing,
+// the light sampling and the miss color are the ones of RayGen.hlsl, so both converge to the same radiance.
+// The recursive estimator the loop replaced is kept to check that it still does. No D3D dependencies
+namespace pt {
+	// Tightly packed 8 bit per component like tinygltf::Image, sampled bilinearly with wrapping.
+	// Always mip 0, the GPU picks a level from the ray cone and AnalyzeTextureLod measures that choice
+	struct Texture {
+		std::vector<uint8_t> pixels;
+		int width = 0;
+		int height = 0;
+		int components = 4;
+		// Missing components read as 0, alpha as 1, like a DXGI format with fewer channels
+		glm::vec4 Sample(const glm::vec2& uv) const;
+	};
+	// The part of a glTF material the path tracer reads. Like Hit.hlsl, a material without a base
+	// color texture is black and one without an emissive texture emits nothing
+	struct Material {
+		glm::vec4 baseColor = glm::vec4(1.f);
+		int baseTexture = -1; // In Surfaces::textures
+		glm::vec3 emissive = glm::vec3(0.f); // Times KHR_materials_emissive_strength
+		int emissiveTexture = -1;
+	};
+	// Shading data of a BLAS, in the vertex and triangle order of its mesh
+	struct Surfaces {
+		std::vector<glm::vec3> normals; // Model space like the positions, zero without normals
+		std::vector<glm::vec2> texcoords; // TEXCOORD_0
+		std::vector<uint32_t> triangleMaterials;
+		std::vector<Material> materials;
+		std::vector<Texture> textures;
+	};
+	// Light list of the scene in the layout UploadScene uploads. The CPU BLAS of a model is a single
+	// geometry, so every model with emission has one light geometry with all its triangles
+	struct SceneLights {
+		std::vector<lights::MeshLights> meshes;
+		std::vector<lights::GpuTriangle> triangles;
+		std::vector<uint32_t> geometries; // First light triangle of the geometry, indexes of all meshes
+		std::vector<lights::GpuInstance> instances; // Of every TLAS instance
+		double power = 0.0; // Next event estimation is off without any
+	};
+	struct Scene {
+		const bvh::Tlas* tlas = nullptr;
+		std::vector<const Surfaces*> surfaces; // Of every TLAS instance
+		SceneLights lights; // BuildSceneLights
+	};
+	// Inverse matrices of the camera constant buffer and the size of the dispatch
+	struct Camera {
+		glm::mat4 viewInv = glm::mat4(1.f);
+		glm::mat4 projectionInv = glm::mat4(1.f);
+		uint32_t width = 1;
+		uint32_t height = 1;
+	};
+	struct Settings {
+		uint32_t maxBounces = render::kPathMaxBounces; // Surfaces along a path, the last one only adds its emission
+		uint32_t samplesPerPixel = 1;
+		uint32_t firstSample = 0; // Seeds samples [firstSample, firstSample + samplesPerPixel)
+		uint32_t threadCount = 0; // 0 uses all hardware threads
+		bool nextEventEstimation = true; // Off only follows the bounces
+		// Surfaces before Russian roulette may end a path, maxBounces or more turns it off. Without both
+		// the loop draws the random numbers of the recursive estimator
+		uint32_t rouletteDepth = render::kPathRouletteDepth;
+	};
+	// What the closest hit shader of the mode returns in HitInfo
+	struct SurfaceHit {
+		float t = 0.f;
+		glm::vec3 color = glm::vec3(0.f); // Albedo, or the emitted radiance of emissive surfaces
+		glm::vec3 normal = glm::vec3(0.f); // World space
+		bool emissive = false;
+		uint32_t instance = 0;
+		uint32_t light = lights::kNoLight; // Light triangle of emissive hits, the index in HitInfo::normal
+	};
+
+	// Random.hlsl
+	uint32_t WangHash(uint32_t seed);
+	float Rand(uint32_t& seed);
+	// Seed of a pixel, RayGen.hlsl passes the frame index as the sample
+	uint32_t PixelSeed(uint32_t pixelID, uint32_t sample);
+	// Common.hlsl
+	uint32_t PackNormal(glm::vec3 n);
+	glm::vec3 UnpackNormal(uint32_t packed);
+	// Cosine weighted, so brdf * cos / pdf of a diffuse surface is its albedo
+	glm::vec3 GetDiffuseReflected(const glm::vec3& normal, uint32_t& seed);
+	float PowerHeuristic(float pdf, float otherPdf);
+	// Russian roulette keeps a path with the largest component of its throughput over render::kPathRouletteThreshold, at most 1
+	float SurvivalProbability(const glm::vec3& throughput);
+	// Miss.hlsl, a gradient over the dispatch
+	glm::vec3 Sky(uint32_t x, uint32_t y, const Camera& camera);
+	bvh::Ray CameraRay(const Camera& camera, uint32_t x, uint32_t y);
+	// Radiance the emissive texture and factor give at uv, black without an emissive texture
+	glm::vec3 Emission(const Material& material, const std::vector<Texture>& textures, const glm::vec2& uv);
+	// Mean of the emission at the corners and the center of a triangle, weights the light of the triangle
+	glm::vec3 EstimateEmission(const Material& material, const std::vector<Texture>& textures, const glm::vec2& uv0, const glm::vec2& uv1, const glm::vec2& uv2);
+	// Light list of the surfaces with emission at the current instance transforms
+	void BuildSceneLights(Scene& scene);
+
+	// Closest hit of the path tracing mode, false on a miss
+	bool IntersectSurface(const Scene& scene, const bvh::Ray& ray, SurfaceHit& hit);
+	// Next event estimation of RayGen.hlsl: a shadow ray towards a point on a light picked by power, which
+	// only counts if it reaches that triangle. Weighted against the bounces with the power heuristic
+	glm::vec3 SampleDirectLight(const Scene& scene, const glm::vec3& position, const glm::vec3& normal, const glm::vec3& albedo, uint32_t& seed);
+	// The loop of RayGen.hlsl, the normal goes through the payload packing like on the GPU
+	glm::vec3 TracePath(const Scene& scene, bvh::Ray ray, uint32_t x, uint32_t y, const Camera& camera, uint32_t& seed, const Settings& settings);
+	// The recursive closest hit shader the loop replaced, depth counts the surfaces so far
+	glm::vec3 TracePathRecursive(const Scene& scene, const bvh::Ray& ray, uint32_t x, uint32_t y, const Camera& camera, uint32_t seed, uint32_t depth, const Settings& settings);
+
+	enum class Estimator {
+		Loop,
+		Recursive
+	};
+	// Mean radiance of every pixel over settings.samplesPerPixel samples, row by row, meanSquares gets the
+	// mean of the squared samples. Returns the time in ms
+	double Render(const Scene& scene, const Camera& camera, const Settings& settings, Estimator estimator, std::vector<glm::vec3>& image,
+		std::vector<glm::vec3>* meanSquares = nullptr);
+	// Mean over the pixels and color channels
+	double MeanRadiance(const std::vector<glm::vec3>& image);
+	// Root mean square error over the pixels and color channels
+	double Rmse(const std::vector<glm::vec3>& image, const std::vector<glm::vec3>& reference);
+
+	struct EstimatorComparison {
+		double loopMean = 0.0;
+		double recursiveMean = 0.0;
+		double rmsDifference = 0.0; // Per pixel and channel
+		double loopMs = 0.0;
+		double recursiveMs = 0.0;
+		double RelativeDifference() const { return recursiveMean > 0.0 ? (loopMean - recursiveMean) / recursiveMean : 0.0; }
+	};
+	// Renders the view with both estimators, without next event estimation and Russian roulette. They draw the
+	// same random numbers, so only the normal packing of the loop tells them apart
+	EstimatorComparison CompareEstimators(const Scene& scene, const Camera& camera, const Settings& settings);
+
+	struct Efficiency {
+		double mean = 0.0;
+		double variance = 0.0; // Of a single sample, per pixel and channel
+		double msPerSample = 0.0; // Of all pixels
+		// Inverse of variance times time, higher converges faster for the same time
+		double Value() const { return variance * msPerSample > 0.0 ? 1.0 / (variance * msPerSample) : 0.0; }
+	};
+	// Variance of the loop estimator from settings.samplesPerPixel samples per pixel, and its cost
+	Efficiency MeasureEfficiency(const Scene& scene, const Camera& camera, const Settings& settings);
+
+	// Base color fetches of the primary hits of render mode 12, with the level from the ray cone of Hit.hlsl,
+	// from the hit distance as before, and from the texcoords of the neighbouring pixels on the plane of the
+	// triangle, what ddx and ddy give a rasterizer. Levels are clamped to the mips of the texture like the sampler
+	struct TextureLodReport {
+		uint32_t fetches = 0;
+		uint32_t referenceFetches = 0; // Fetches whose neighbouring rays cross the plane of the triangle
+		double coneLod = 0.0; // Means over the fetches
+		double distanceLod = 0.0;
+		double referenceLod = 0.0; // Over the reference fetches, like the errors
+		double coneError = 0.0; // Mean absolute difference to the reference level
+		double distanceError = 0.0;
+		// The fetches in 8x8 pixel tiles through one cache each, the finest one always reads mip 0
+		texlod::CacheStats coneCache;
+		texlod::CacheStats distanceCache;
+		texlod::CacheStats finestCache;
+	};
+	TextureLodReport AnalyzeTextureLod(const Scene& scene, const Camera& camera, const texlod::CacheSettings& cache = texlod::CacheSettings());
+}
@@ -0,0 +1,68 @@
+#include "RayQuery.h"
+#include "Lbvh.h"
+#include "ParallelFor.h"
+#include <chrono>
+
+namespace bvh {
+	// Trace order of the rays, the octant of the direction above the Morton code of the origin
+	static void SortRays(const Tlas& tlas, const std::vector<Ray>& rays, const RayBatchSettings& settings, std::vector<uint32_t>& order) {
+		uint32_t count = static_cast<uint32_t>(rays.size());
+		order.resize(count);
+		if (!settings.sortRays || tlas.GetBvh().nodes.empty()) {
+			for (uint32_t i = 0; i < count; i++) {
+				order[i] = i;
+			}
+			return;
+		}
+		Aabb bounds = tlas.GetBvh().nodes[0].Bounds();
+		glm::vec3 scale = 1.f / glm::max(bounds.max - bounds.min, glm::vec3(1e-30f));
+		std::vector<uint64_t> keys(count);
+		ParallelFor(count, 16384, settings.threadCount, [&](uint32_t first, uint32_t last, uint32_t) {
+			for (uint32_t i = first; i < last; i++) {
+				const Ray& ray = rays[i];
+				uint64_t octant = (ray.direction.x < 0.f ? 1 : 0) | (ray.direction.y < 0.f ? 2 : 0) | (ray.direction.z < 0.f ? 4 : 0);
+				// 32 bit code above the ray index, so the Morton code loses its last bit
+				uint64_t code = (octant << 29) | (MortonCode((ray.origin - bounds.min) * scale) >> 1);
+				keys[i] = (code << 32) | i;
+			}
+		});
+		RadixSort(keys, 32, 32, settings.threadCount);
+		for (uint32_t i = 0; i < count; i++) {
+			order[i] = static_cast<uint32_t>(keys[i] & 0xFFFFFFFFu);
+		}
+	}
+
+	template <typename Fn>
+	static RayBatchTiming TraceBatch(const Tlas& tlas, const std::vector<Ray>& rays, const RayBatchSettings& settings, Fn trace) {
+		RayBatchTiming timing;
+		auto start = std::chrono::high_resolution_clock::now();
+		timing.rayCount = static_cast<uint32_t>(rays.size());
+		std::vector<uint32_t> order;
+		SortRays(tlas, rays, settings, order);
+		auto sorted = std::chrono::high_resolution_clock::now();
+		timing.threadCount = ParallelFor(timing.rayCount, settings.streamSize, settings.threadCount, [&](uint32_t first, uint32_t last, uint32_t) {
+			for (uint32_t i = first; i < last; i++) {
+				trace(order[i]);
+			}
+		});
+		auto end = std::chrono::high_resolution_clock::now();
+		timing.sortMs = std::chrono::duration<double, std::milli>(sorted - start).count();
+		timing.traceMs = std::chrono::duration<double, std::milli>(end - sorted).count();
+		timing.totalMs = std::chrono::duration<double, std::milli>(end - start).count();
+		return timing;
+	}
+
+	RayBatchTiming IntersectRays(const Tlas& tlas, const std::vector<Ray>& rays, std::vector<InstanceHit>& hits, const RayBatchSettings& settings) {
+		hits.resize(rays.size());
+		return TraceBatch(tlas, rays, settings, [&](uint32_t ray) {
+			tlas.Intersect(rays[ray], settings.mask, hits[ray]);
+		});
+	}
+
+	RayBatchTiming OccludedRays(const Tlas& tlas, const std::vector<Ray>& rays, std::vector<uint8_t>& occluded, const RayBatchSettings& settings) {
+		occluded.resize(rays.size());
+		return TraceBatch(tlas, rays, settings, [&](uint32_t ray) {
+			occluded[ray] = tlas.Occluded(rays[ray], settings.mask) ? 1 : 0;
+		});
+	}
+}
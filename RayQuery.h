@@ -0,0 +1,26 @@
+#pragma once
+#include "TwoLevelBvh.h"
+// Batched CPU ray queries for gameplay and tools (line of sight, picking, audio occlusion).
+// A batch is sorted into streams of rays with similar origins and directions and the streams
+// are traced on worker threads. Every ray tests all children of a wide BVH node at once with SIMD.
+// No D3D dependencies
+namespace bvh {
+	struct RayBatchSettings {
+		uint32_t threadCount = 0; // 0 uses all hardware threads
+		uint32_t streamSize = 256; // Rays handed to a worker thread at once
+		bool sortRays = true; // By direction octant, then by origin along a Morton curve
+		uint32_t mask = 0xFF; // Instances sharing no bit with it are skipped
+	};
+	struct RayBatchTiming {
+		uint32_t rayCount = 0;
+		uint32_t threadCount = 0;
+		double sortMs = 0.0;
+		double traceMs = 0.0;
+		double totalMs = 0.0;
+		double RaysPerSecond() const { return totalMs > 0.0 ? rayCount / (totalMs * 1e-3) : 0.0; }
+	};
+	// hits[i] is the closest hit of rays[i], instance ~0u for misses
+	RayBatchTiming IntersectRays(const Tlas& tlas, const std::vector<Ray>& rays, std::vector<InstanceHit>& hits, const RayBatchSettings& settings = RayBatchSettings());
+	// occluded[i] is 1 if rays[i] hits anything between tMin and tMax
+	RayBatchTiming OccludedRays(const Tlas& tlas, const std::vector<Ray>& rays, std::vector<uint8_t>& occluded, const RayBatchSettings& settings = RayBatchSettings());
+}
@@ -0,0 +1,24 @@
+#include "RenderModes.h"
+
+namespace render {
+	std::vector<PipelineDesc> GroupModes(const ModeDesc* modes, uint32_t count, std::vector<uint32_t>& modePipelines) {
+		std::vector<PipelineDesc> pipelines;
+		modePipelines.resize(count);
+		for (uint32_t mode = 0; mode < count; mode++) {
+			uint32_t pipeline = 0;
+			while (pipeline < pipelines.size() && (pipelines[pipeline].maxRecursionDepth != modes[mode].maxRecursionDepth ||
+				pipelines[pipeline].maxPayloadSize != modes[mode].maxPayloadSize)) {
+				pipeline++;
+			}
+			if (pipeline == pipelines.size()) {
+				PipelineDesc desc;
+				desc.maxRecursionDepth = modes[mode].maxRecursionDepth;
+				desc.maxPayloadSize = modes[mode].maxPayloadSize;
+				pipelines.push_back(desc);
+			}
+			pipelines[pipeline].modes.push_back(mode);
+			modePipelines[mode] = pipeline;
+		}
+		return pipelines;
+	}
+}
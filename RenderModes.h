@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+// Render modes and what their ray tracing pipeline needs. Modes with the same needs share a state object,
+// so the debug views don't pay for the stack of the modes that recurse. Adding a mode is a line in kModes
+// and a RENDER_MODE case in Hit.hlsl. No D3D dependencies
+namespace render {
+	struct ModeDesc {
+		const char* name;
+		uint32_t maxRecursionDepth; // Nested TraceRay calls, 1 for primary rays only
+		uint32_t maxPayloadSize; // Largest ray payload of the shaders the mode runs, in bytes
+	};
+	static const uint32_t kHitInfoSize = 8 * sizeof(float); // HitInfo in Common.hlsl
+	// HitInfo without the surface record of the path tracer, SURFACE_PAYLOAD 0 in Common.hlsl. The modes which
+	// only return a color use it, their shaders are compiled for it
+	static const uint32_t kColorHitInfoSize = 6 * sizeof(float);
+	static const uint32_t kShadowHitInfoSize = sizeof(uint32_t); // ShadowHitInfo in ShadowRay.hlsl
+	// The path tracer loops in RayGen, so its path length is a constant and not a recursion depth
+	static const uint32_t kPathMaxBounces = 9; // RenderModeStruct::maxBounces in Common.hlsl
+	// Surfaces every path gets before Russian roulette may end it by its throughput, RenderModeStruct::rouletteDepth
+	static const uint32_t kPathRouletteDepth = 3;
+	// Paths with more throughput always survive, ROULETTE_THRESHOLD in Common.hlsl. Ending brighter paths
+	// costs more variance than it saves time, next event estimation still gets light from them
+	static const float kPathRouletteThreshold = 0.25f;
+	static const ModeDesc kModes[] = {
+		{ "vertex colors", 1, kColorHitInfoSize },
+		{ "vertex normals", 1, kColorHitInfoSize },
+		{ "base color", 1, kColorHitInfoSize },
+		{ "metallic", 1, kColorHitInfoSize },
+		{ "roughness", 1, kColorHitInfoSize },
+		{ "metallic roughness", 1, kColorHitInfoSize },
+		{ "occlusion", 1, kColorHitInfoSize },
+		{ "orm", 1, kColorHitInfoSize },
+		{ "normal map", 1, kColorHitInfoSize },
+		{ "world space normals", 1, kColorHitInfoSize },
+		{ "emissive", 1, kColorHitInfoSize },
+		{ "base color + shadows", 2, kColorHitInfoSize },
+		{ "path tracing", 1, kHitInfoSize },
+	};
+	static const uint32_t kModeCount = sizeof(kModes) / sizeof(kModes[0]);
+	static const uint32_t kPathTracingMode = 12; // Accumulates over frames
+
+	struct PipelineDesc {
+		uint32_t maxRecursionDepth = 1;
+		uint32_t maxPayloadSize = 0;
+		std::vector<uint32_t> modes;
+	};
+	// One pipeline per distinct recursion depth and payload size, in the order of their first mode.
+	// modePipelines gets the pipeline of every mode
+	std::vector<PipelineDesc> GroupModes(const ModeDesc* modes, uint32_t count, std::vector<uint32_t>& modePipelines);
+}
@@ -0,0 +1,322 @@
+#include "Sbvh.h"
+#include <algorithm>
+
+namespace bvh {
+	namespace {
+		// Part of a triangle inside a node, bounds are clipped by the spatial splits above it
+		struct Reference {
+			Aabb bounds;
+			uint32_t primitive;
+		};
+		struct Task {
+			uint32_t node;
+			uint32_t depth;
+			std::vector<Reference> references;
+		};
+	}
+	static const uint32_t kMaxDepth = 64;
+
+	static Aabb Intersection(const Aabb& a, const Aabb& b) {
+		Aabb result;
+		result.min = glm::max(a.min, b.min);
+		result.max = glm::min(a.max, b.max);
+		if (glm::any(glm::greaterThan(result.min, result.max)))
+			return Aabb();
+		return result;
+	}
+	// Bounds of the parts of the referenced triangle below and above the plane at position
+	static void SplitReference(const Mesh& mesh, const Reference& reference, int axis, float position, Reference& left, Reference& right) {
+		left.bounds = Aabb();
+		right.bounds = Aabb();
+		left.primitive = right.primitive = reference.primitive;
+		const glm::uvec3& triangle = mesh.triangles[reference.primitive];
+		const glm::vec3 vertices[3] = { mesh.positions[triangle.x], mesh.positions[triangle.y], mesh.positions[triangle.z] };
+		for (int i = 0; i < 3; i++) {
+			const glm::vec3& a = vertices[i];
+			const glm::vec3& b = vertices[(i + 1) % 3];
+			if (a[axis] <= position)
+				left.bounds.Grow(a);
+			if (a[axis] >= position)
+				right.bounds.Grow(a);
+			if ((a[axis] < position && b[axis] > position) || (a[axis] > position && b[axis] < position)) {
+				glm::vec3 p = glm::mix(a, b, (position - a[axis]) / (b[axis] - a[axis]));
+				p[axis] = position;
+				left.bounds.Grow(p);
+				right.bounds.Grow(p);
+			}
+		}
+		left.bounds = Intersection(left.bounds, reference.bounds);
+		right.bounds = Intersection(right.bounds, reference.bounds);
+	}
+	static Node MakeSbvhNode(const std::vector<Reference>& references) {
+		Aabb bounds;
+		for (const Reference& reference : references) {
+			bounds.Grow(reference.bounds);
+		}
+		Node node;
+		node.boundsMin = bounds.min;
+		node.boundsMax = bounds.max;
+		node.child = 0;
+		node.count = 0;
+		return node;
+	}
+
+	void BuildSbvh(const Mesh& mesh, const SbvhSettings& settings, Bvh& bvh, SbvhStats* stats) {
+		SbvhStats localStats;
+		SbvhStats& result = stats ? *stats : localStats;
+		result = SbvhStats();
+		bvh.nodes.clear();
+		bvh.primitives.clear();
+		uint32_t triangleCount = static_cast<uint32_t>(mesh.triangles.size());
+		if (triangleCount == 0)
+			return;
+		const BuildSettings& build = settings.build;
+		Task root = { 0, 1, std::vector<Reference>(triangleCount) };
+		std::vector<Aabb> triangleBounds;
+		mesh.GetTriangleBounds(triangleBounds);
+		for (uint32_t i = 0; i < triangleCount; i++) {
+			root.references[i] = { triangleBounds[i], i };
+		}
+		bvh.nodes.push_back(MakeSbvhNode(root.references));
+		float rootArea = bvh.nodes[0].Bounds().Area();
+		uint32_t maxReferences = triangleCount + static_cast<uint32_t>(triangleCount * (std::max)(0.f, settings.maxReferenceGrowth));
+		uint32_t referenceCount = triangleCount;
+
+		uint32_t binCount = glm::clamp(build.binCount, 2u, 256u);
+		std::vector<Aabb> binBounds(binCount);
+		std::vector<uint32_t> binCounts(binCount);
+		std::vector<Aabb> rightBounds(binCount);
+		uint32_t spatialBinCount = glm::clamp(settings.spatialBinCount, 2u, 256u);
+		std::vector<Aabb> spatialBounds(spatialBinCount);
+		std::vector<uint32_t> entries(spatialBinCount), exits(spatialBinCount);
+		std::vector<Aabb> spatialRightBounds(spatialBinCount);
+		std::vector<uint32_t> spatialRightCounts(spatialBinCount);
+
+		std::vector<Task> stack;
+		stack.push_back(std::move(root));
+		while (!stack.empty()) {
+			Task task = std::move(stack.back());
+			stack.pop_back();
+			std::vector<Reference>& references = task.references;
+			uint32_t count = static_cast<uint32_t>(references.size());
+			Aabb nodeBounds = bvh.nodes[task.node].Bounds();
+			float area = nodeBounds.Area();
+			auto makeLeaf = [&]() {
+				bvh.nodes[task.node].child = static_cast<uint32_t>(bvh.primitives.size());
+				bvh.nodes[task.node].count = count;
+				for (const Reference& reference : references) {
+					bvh.primitives.push_back(reference.primitive);
+				}
+			};
+			if (count <= 1 || task.depth >= kMaxDepth || area <= 0.f) {
+				makeLeaf();
+				continue;
+			}
+
+			// Object split, binned over the centers of the references like BuildBinned
+			Aabb centerBounds;
+			for (const Reference& reference : references) {
+				centerBounds.Grow(reference.bounds.Center());
+			}
+			float objectCost = (std::numeric_limits<float>::max)();
+			int objectAxis = -1;
+			uint32_t objectBin = 0;
+			Aabb objectLeft, objectRight;
+			glm::vec3 centerExtent = centerBounds.max - centerBounds.min;
+			auto objectBinOf = [&](const Reference& reference, int axis) {
+				float scale = binCount / centerExtent[axis];
+				return (std::min)(binCount - 1, static_cast<uint32_t>((reference.bounds.Center()[axis] - centerBounds.min[axis]) * scale));
+			};
+			for (int axis = 0; axis < 3; axis++) {
+				if (centerExtent[axis] <= 0.f)
+					continue;
+				std::fill(binBounds.begin(), binBounds.end(), Aabb());
+				std::fill(binCounts.begin(), binCounts.end(), 0u);
+				for (const Reference& reference : references) {
+					uint32_t bin = objectBinOf(reference, axis);
+					binBounds[bin].Grow(reference.bounds);
+					binCounts[bin]++;
+				}
+				Aabb right;
+				for (uint32_t bin = binCount - 1; bin > 0; bin--) {
+					right.Grow(binBounds[bin]);
+					rightBounds[bin] = right;
+				}
+				Aabb left;
+				uint32_t leftCount = 0;
+				for (uint32_t bin = 0; bin + 1 < binCount; bin++) {
+					left.Grow(binBounds[bin]);
+					leftCount += binCounts[bin];
+					uint32_t rightCount = count - leftCount;
+					if (leftCount == 0 || rightCount == 0)
+						continue;
+					float cost = build.traversalCost + build.intersectionCost * (left.Area() * leftCount + rightBounds[bin + 1].Area() * rightCount) / area;
+					if (cost < objectCost) {
+						objectCost = cost;
+						objectAxis = axis;
+						objectBin = bin + 1;
+						objectLeft = left;
+						objectRight = rightBounds[bin + 1];
+					}
+				}
+			}
+
+			// Spatial split, only where the object split children overlap and references are left
+			float spatialCost = (std::numeric_limits<float>::max)();
+			int spatialAxis = -1;
+			float spatialPosition = 0.f;
+			bool trySpatial = referenceCount < maxReferences &&
+				(objectAxis < 0 || Intersection(objectLeft, objectRight).Area() > settings.overlapThreshold * rootArea);
+			glm::vec3 nodeExtent = nodeBounds.max - nodeBounds.min;
+			for (int axis = 0; trySpatial && axis < 3; axis++) {
+				if (nodeExtent[axis] <= 0.f)
+					continue;
+				float binWidth = nodeExtent[axis] / spatialBinCount;
+				auto spatialBinOf = [&](float position) {
+					return (std::min)(spatialBinCount - 1, static_cast<uint32_t>((std::max)(0.f, (position - nodeBounds.min[axis]) / binWidth)));
+				};
+				std::fill(spatialBounds.begin(), spatialBounds.end(), Aabb());
+				std::fill(entries.begin(), entries.end(), 0u);
+				std::fill(exits.begin(), exits.end(), 0u);
+				for (const Reference& reference : references) {
+					uint32_t first = spatialBinOf(reference.bounds.min[axis]);
+					uint32_t last = (std::max)(first, spatialBinOf(reference.bounds.max[axis]));
+					// Clip the reference into every bin it passes
+					Reference rest = reference;
+					for (uint32_t bin = first; bin < last; bin++) {
+						Reference left, right;
+						SplitReference(mesh, rest, axis, nodeBounds.min[axis] + (bin + 1) * binWidth, left, right);
+						spatialBounds[bin].Grow(left.bounds);
+						rest = right;
+					}
+					spatialBounds[last].Grow(rest.bounds);
+					entries[first]++;
+					exits[last]++;
+				}
+				Aabb right;
+				uint32_t rightCount = 0;
+				for (uint32_t bin = spatialBinCount - 1; bin > 0; bin--) {
+					right.Grow(spatialBounds[bin]);
+					rightCount += exits[bin];
+					spatialRightBounds[bin] = right;
+					spatialRightCounts[bin] = rightCount;
+				}
+				Aabb left;
+				uint32_t leftCount = 0;
+				for (uint32_t bin = 0; bin + 1 < spatialBinCount; bin++) {
+					left.Grow(spatialBounds[bin]);
+					leftCount += entries[bin];
+					uint32_t splitRightCount = spatialRightCounts[bin + 1];
+					if (leftCount == 0 || splitRightCount == 0 || (leftCount == count && splitRightCount == count))
+						continue;
+					if (referenceCount + leftCount + splitRightCount - count > maxReferences)
+						continue;
+					float cost = build.traversalCost + build.intersectionCost * (left.Area() * leftCount + spatialRightBounds[bin + 1].Area() * splitRightCount) / area;
+					if (cost < spatialCost) {
+						spatialCost = cost;
+						spatialAxis = axis;
+						spatialPosition = nodeBounds.min[axis] + (bin + 1) * binWidth;
+					}
+				}
+			}
+
+			float leafCost = build.intersectionCost * count;
+			float bestCost = (std::min)(objectCost, spatialCost);
+			if (count <= build.maxLeafSize && bestCost >= leafCost) {
+				makeLeaf();
+				continue;
+			}
+			std::vector<Reference> left, right;
+			if (spatialAxis >= 0 && spatialCost < objectCost) {
+				// Straddling references are split, unless moving them to one side is cheaper (reference unsplitting)
+				Aabb leftBounds, rightBounds;
+				std::vector<Reference> straddlers;
+				for (const Reference& reference : references) {
+					if (reference.bounds.max[spatialAxis] <= spatialPosition) {
+						left.push_back(reference);
+						leftBounds.Grow(reference.bounds);
+					}
+					else if (reference.bounds.min[spatialAxis] >= spatialPosition) {
+						right.push_back(reference);
+						rightBounds.Grow(reference.bounds);
+					}
+					else {
+						straddlers.push_back(reference);
+					}
+				}
+				std::vector<std::pair<Reference, Reference>> parts(straddlers.size());
+				uint32_t leftCount = static_cast<uint32_t>(left.size()), rightCount = static_cast<uint32_t>(right.size());
+				for (size_t i = 0; i < straddlers.size(); i++) {
+					SplitReference(mesh, straddlers[i], spatialAxis, spatialPosition, parts[i].first, parts[i].second);
+					leftBounds.Grow(parts[i].first.bounds);
+					rightBounds.Grow(parts[i].second.bounds);
+					leftCount += parts[i].first.bounds.Empty() ? 0 : 1;
+					rightCount += parts[i].second.bounds.Empty() ? 0 : 1;
+				}
+				for (size_t i = 0; i < straddlers.size(); i++) {
+					const Reference& straddler = straddlers[i];
+					bool hasLeft = !parts[i].first.bounds.Empty();
+					bool hasRight = !parts[i].second.bounds.Empty();
+					if (hasLeft && hasRight) {
+						Aabb leftWith = leftBounds, rightWith = rightBounds;
+						leftWith.Grow(straddler.bounds);
+						rightWith.Grow(straddler.bounds);
+						float splitCost = leftBounds.Area() * leftCount + rightBounds.Area() * rightCount;
+						float leftCost = leftWith.Area() * leftCount + rightBounds.Area() * (rightCount - 1);
+						float rightCost = leftBounds.Area() * (leftCount - 1) + rightWith.Area() * rightCount;
+						if (leftCost < splitCost && leftCost <= rightCost) {
+							hasRight = false;
+							leftBounds = leftWith;
+							rightCount--;
+						}
+						else if (rightCost < splitCost) {
+							hasLeft = false;
+							rightBounds = rightWith;
+							leftCount--;
+						}
+					}
+					if (hasLeft && hasRight) {
+						left.push_back(parts[i].first);
+						right.push_back(parts[i].second);
+					}
+					else if (hasLeft) {
+						left.push_back(straddler);
+					}
+					else {
+						right.push_back(straddler);
+					}
+				}
+				if (!left.empty() && !right.empty()) {
+					referenceCount += static_cast<uint32_t>(left.size() + right.size()) - count;
+					result.spatialSplits++;
+				}
+			}
+			if (left.empty() || right.empty()) {
+				left.clear();
+				right.clear();
+				if (objectAxis >= 0) {
+					for (const Reference& reference : references) {
+						(objectBinOf(reference, objectAxis) < objectBin ? left : right).push_back(reference);
+					}
+					result.objectSplits++;
+				}
+				else {
+					// All centers coincide, split the list in half
+					left.assign(references.begin(), references.begin() + count / 2);
+					right.assign(references.begin() + count / 2, references.end());
+				}
+			}
+			references.clear();
+			references.shrink_to_fit();
+			uint32_t leftIndex = static_cast<uint32_t>(bvh.nodes.size());
+			bvh.nodes.push_back(MakeSbvhNode(left));
+			bvh.nodes.push_back(MakeSbvhNode(right));
+			bvh.nodes[task.node].child = leftIndex;
+			bvh.nodes[task.node].count = 0;
+			// Left subtree first, so the leaves of every subtree are next to each other
+			stack.push_back({ leftIndex + 1, task.depth + 1, std::move(right) });
+			stack.push_back({ leftIndex, task.depth + 1, std::move(left) });
+		}
+		result.references = static_cast<uint32_t>(bvh.primitives.size());
+	}
+}
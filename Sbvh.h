@@ -0,0 +1,23 @@
+#pragma once
+#include "Bvh.h"
+// Spatial split BVH builder (Stich et al. 2009) for scenes with large overlapping triangles such as
+// walls and floors. Where the children of the best object split overlap, splitting planes that clip
+// triangles into several leaves are binned as well, the extra references are capped.
+// No D3D dependencies
+namespace bvh {
+	struct SbvhSettings {
+		BuildSettings build;
+		uint32_t spatialBinCount = 32;
+		// Spatial splits are tried when the children of the object split overlap by more than this
+		// fraction of the root area, 1e-5 from the paper
+		float overlapThreshold = 1e-5f;
+		float maxReferenceGrowth = 0.3f; // References beyond the triangle count, relative to it
+	};
+	struct SbvhStats {
+		uint32_t references = 0; // Leaf entries, at least the triangle count
+		uint32_t spatialSplits = 0;
+		uint32_t objectSplits = 0;
+	};
+	// Leaves may reference a triangle several times, bvh.primitives holds the duplicates
+	void BuildSbvh(const Mesh& mesh, const SbvhSettings& settings, Bvh& bvh, SbvhStats* stats = nullptr);
+}
@@ -0,0 +1,539 @@
+#include "Simplify.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <queue>
+#include <utility>
+
+namespace simplify {
+	// Upper triangle of a symmetric 4x4 matrix, the error of p is (p, 1)^T Q (p, 1)
+	struct Quadric {
+		double a00 = 0.0, a01 = 0.0, a02 = 0.0, a03 = 0.0;
+		double a11 = 0.0, a12 = 0.0, a13 = 0.0;
+		double a22 = 0.0, a23 = 0.0;
+		double a33 = 0.0;
+		double weight = 0.0; // Sum of the plane weights
+		Quadric& operator+=(const Quadric& q) {
+			a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+			a11 += q.a11; a12 += q.a12; a13 += q.a13;
+			a22 += q.a22; a23 += q.a23;
+			a33 += q.a33;
+			weight += q.weight;
+			return *this;
+		}
+	};
+	// Squared distance to the plane dot(n, p) + d = 0, scaled by weight
+	static Quadric PlaneQuadric(const glm::dvec3& n, double d, double weight) {
+		Quadric q;
+		q.a00 = weight * n.x * n.x; q.a01 = weight * n.x * n.y; q.a02 = weight * n.x * n.z; q.a03 = weight * n.x * d;
+		q.a11 = weight * n.y * n.y; q.a12 = weight * n.y * n.z; q.a13 = weight * n.y * d;
+		q.a22 = weight * n.z * n.z; q.a23 = weight * n.z * d;
+		q.a33 = weight * d * d;
+		q.weight = weight;
+		return q;
+	}
+	// Weighted mean of the squared plane distances, so it compares to the square of a distance
+	static double Evaluate(const Quadric& q, const glm::dvec3& p) {
+		double error = q.a00 * p.x * p.x + 2.0 * q.a01 * p.x * p.y + 2.0 * q.a02 * p.x * p.z + 2.0 * q.a03 * p.x
+			+ q.a11 * p.y * p.y + 2.0 * q.a12 * p.y * p.z + 2.0 * q.a13 * p.y
+			+ q.a22 * p.z * p.z + 2.0 * q.a23 * p.z
+			+ q.a33;
+		return q.weight > 0.0 ? (std::max)(0.0, error) / q.weight : 0.0;
+	}
+
+	enum class VertexKind : uint8_t {
+		Manifold = 0, // Collapses onto any neighbour
+		Border, // Only collapses along the border, onto another border or locked vertex
+		Locked // Never moves
+	};
+	// Border edges keep their shape through planes perpendicular to the adjacent triangle
+	static const double kBorderWeight = 10.0;
+	static const uint32_t kNoVertex = ~0u;
+
+	namespace {
+		struct Collapse {
+			double cost;
+			uint32_t from;
+			uint32_t to;
+			uint32_t stamp;
+			bool operator>(const Collapse& other) const { return cost > other.cost; }
+		};
+
+		class Simplifier {
+		public:
+			Simplifier(const MeshInput& mesh) : m_vertexCount(mesh.vertexCount) {
+				LoadPositions(mesh);
+				m_indices.assign(mesh.indices, mesh.indices + mesh.indexCount - mesh.indexCount % 3);
+				m_triangleAlive.assign(m_indices.size() / 3, true);
+				m_vertexTriangles.resize(m_vertexCount);
+				for (uint32_t t = 0; t < m_triangleAlive.size(); t++) {
+					const uint32_t* tri = &m_indices[3 * t];
+					if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2]) {
+						m_triangleAlive[t] = false;
+						continue;
+					}
+					m_liveTriangles++;
+					for (int k = 0; k < 3; k++) {
+						m_vertexTriangles[tri[k]].push_back(t);
+					}
+				}
+				ClassifyVertices();
+				ComputeQuadrics();
+				m_removed.assign(m_vertexCount, false);
+				m_stamps.assign(m_vertexCount, 0);
+				for (uint32_t v = 0; v < m_vertexCount; v++) {
+					PushCandidate(v);
+				}
+			}
+			uint32_t LiveTriangles() const { return m_liveTriangles; }
+			// Collapses edges until at most targetTriangles are left or the next collapse exceeds maxError
+			void Run(uint32_t targetTriangles, double maxError) {
+				double maxCost = maxError * maxError;
+				while (m_liveTriangles > targetTriangles && !m_queue.empty()) {
+					Collapse collapse = m_queue.top();
+					if (collapse.cost > maxCost)
+						break;
+					m_queue.pop();
+					if (m_removed[collapse.from] || m_removed[collapse.to] || collapse.stamp != m_stamps[collapse.from])
+						continue;
+					if (!PairSiblings(collapse.from, collapse.to, m_pairs) || !CanCollapse(collapse.from, collapse.to))
+						continue;
+					Apply(collapse);
+				}
+			}
+			double Error() const { return std::sqrt(m_maxCost); }
+			void GetIndices(std::vector<uint32_t>& indices) const {
+				indices.clear();
+				indices.reserve(3 * m_liveTriangles);
+				for (uint32_t t = 0; t < m_triangleAlive.size(); t++) {
+					if (m_triangleAlive[t])
+						indices.insert(indices.end(), &m_indices[3 * t], &m_indices[3 * t] + 3);
+				}
+			}
+		private:
+			void LoadPositions(const MeshInput& mesh) {
+				m_positions.resize(m_vertexCount);
+				glm::dvec3 boundsMin(0.0), boundsMax(0.0);
+				for (uint32_t v = 0; v < m_vertexCount; v++) {
+					glm::vec3 p;
+					memcpy(&p, mesh.positions + size_t(v) * mesh.positionStride, sizeof(glm::vec3));
+					m_positions[v] = glm::dvec3(p);
+					boundsMin = v == 0 ? m_positions[v] : glm::min(boundsMin, m_positions[v]);
+					boundsMax = v == 0 ? m_positions[v] : glm::max(boundsMax, m_positions[v]);
+				}
+				// Errors are relative to the bounds
+				double extent = glm::length(boundsMax - boundsMin);
+				double scale = extent > 0.0 ? 1.0 / extent : 1.0;
+				for (auto& p : m_positions) {
+					p = (p - boundsMin) * scale;
+				}
+			}
+			// Live triangles of a that also contain b
+			uint32_t SharedTriangles(uint32_t a, uint32_t b) const {
+				uint32_t count = 0;
+				for (uint32_t t : m_vertexTriangles[a]) {
+					const uint32_t* tri = &m_indices[3 * t];
+					if (m_triangleAlive[t] && (tri[0] == b || tri[1] == b || tri[2] == b))
+						count++;
+				}
+				return count;
+			}
+			void ClassifyVertices() {
+				m_kinds.assign(m_vertexCount, VertexKind::Manifold);
+				// Several referenced vertices at one position differ in their attributes, a seam. They are linked
+				// in a ring and collapse together
+				m_positionIds.assign(m_vertexCount, 0);
+				m_siblings.resize(m_vertexCount);
+				std::vector<uint32_t> order;
+				for (uint32_t v = 0; v < m_vertexCount; v++) {
+					m_siblings[v] = v;
+					if (!m_vertexTriangles[v].empty())
+						order.push_back(v);
+				}
+				auto less = [&](uint32_t a, uint32_t b) {
+					const glm::dvec3& pa = m_positions[a];
+					const glm::dvec3& pb = m_positions[b];
+					return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z;
+				};
+				std::sort(order.begin(), order.end(), less);
+				uint32_t positionId = 0;
+				for (size_t i = 0; i < order.size(); i++) {
+					uint32_t v = order[i];
+					if (i > 0 && m_positions[v] == m_positions[order[i - 1]]) {
+						m_siblings[v] = m_siblings[order[i - 1]];
+						m_siblings[order[i - 1]] = v;
+					}
+					else if (i > 0) {
+						positionId++;
+					}
+					m_positionIds[v] = positionId;
+				}
+				// Edges of a single triangle are borders, edges of more than two are locked
+				for (uint32_t t = 0; t < m_triangleAlive.size(); t++) {
+					if (!m_triangleAlive[t])
+						continue;
+					for (int k = 0; k < 3; k++) {
+						uint32_t a = m_indices[3 * t + k];
+						uint32_t b = m_indices[3 * t + (k + 1) % 3];
+						uint32_t shared = SharedTriangles(a, b);
+						VertexKind kind = shared == 1 ? VertexKind::Border : shared > 2 ? VertexKind::Locked : VertexKind::Manifold;
+						m_kinds[a] = (std::max)(m_kinds[a], kind);
+						m_kinds[b] = (std::max)(m_kinds[b], kind);
+					}
+				}
+			}
+			void ComputeQuadrics() {
+				m_quadrics.assign(m_vertexCount, Quadric());
+				for (uint32_t t = 0; t < m_triangleAlive.size(); t++) {
+					if (!m_triangleAlive[t])
+						continue;
+					const uint32_t* tri = &m_indices[3 * t];
+					glm::dvec3 n = glm::cross(m_positions[tri[1]] - m_positions[tri[0]], m_positions[tri[2]] - m_positions[tri[0]]);
+					double length = glm::length(n);
+					if (length == 0.0)
+						continue;
+					n /= length;
+					// Area weighted, so small triangles don't dominate
+					Quadric q = PlaneQuadric(n, -glm::dot(n, m_positions[tri[0]]), 0.5 * length);
+					for (int k = 0; k < 3; k++) {
+						m_quadrics[tri[k]] += q;
+					}
+					for (int k = 0; k < 3; k++) {
+						uint32_t a = tri[k];
+						uint32_t b = tri[(k + 1) % 3];
+						if (SharedTriangles(a, b) != 1)
+							continue;
+						glm::dvec3 edge = m_positions[b] - m_positions[a];
+						glm::dvec3 m = glm::cross(edge, n);
+						double mLength = glm::length(m);
+						if (mLength == 0.0)
+							continue;
+						m /= mLength;
+						Quadric border = PlaneQuadric(m, -glm::dot(m, m_positions[a]), kBorderWeight * glm::dot(edge, edge));
+						m_quadrics[a] += border;
+						m_quadrics[b] += border;
+					}
+				}
+				// Coincident vertices share the quadric of their position
+				std::vector<bool> done(m_vertexCount, false);
+				for (uint32_t v = 0; v < m_vertexCount; v++) {
+					if (done[v] || m_siblings[v] == v)
+						continue;
+					Quadric sum;
+					for (uint32_t s = v; !done[s]; s = m_siblings[s]) {
+						sum += m_quadrics[s];
+						done[s] = true;
+					}
+					for (uint32_t s = m_siblings[v]; s != v; s = m_siblings[s]) {
+						m_quadrics[s] = sum;
+					}
+					m_quadrics[v] = sum;
+				}
+			}
+			bool CanMoveTo(uint32_t from, uint32_t to) const {
+				switch (m_kinds[from]) {
+				case VertexKind::Manifold:
+					return true;
+				case VertexKind::Border:
+					return m_kinds[to] != VertexKind::Manifold && SharedTriangles(from, to) == 1;
+				default:
+					return false;
+				}
+			}
+			// Queues the cheapest collapse of v onto one of its neighbours
+			void PushCandidate(uint32_t v) {
+				if (m_removed[v] || m_kinds[v] == VertexKind::Locked)
+					return;
+				Collapse best = { 0.0, v, v, m_stamps[v] };
+				for (uint32_t t : m_vertexTriangles[v]) {
+					if (!m_triangleAlive[t])
+						continue;
+					for (int k = 0; k < 3; k++) {
+						uint32_t u = m_indices[3 * t + k];
+						if (u == v || !CanMoveTo(v, u))
+							continue;
+						Quadric q = m_quadrics[v];
+						q += m_quadrics[u];
+						double cost = Evaluate(q, m_positions[u]);
+						if (best.to != v && cost >= best.cost)
+							continue;
+						if (m_siblings[v] != v && !PairSiblings(v, u, m_pairs))
+							continue;
+						best.cost = cost;
+						best.to = u;
+					}
+				}
+				if (best.to != v)
+					m_queue.push(best);
+			}
+			bool HasLiveTriangles(uint32_t v) const {
+				for (uint32_t t : m_vertexTriangles[v]) {
+					if (m_triangleAlive[t])
+						return true;
+				}
+				return false;
+			}
+			// A neighbour of v at the position positionId which v may move onto
+			uint32_t FindNeighbourAt(uint32_t v, uint32_t positionId) const {
+				for (uint32_t t : m_vertexTriangles[v]) {
+					if (!m_triangleAlive[t])
+						continue;
+					for (int k = 0; k < 3; k++) {
+						uint32_t u = m_indices[3 * t + k];
+						if (u != v && m_positionIds[u] == positionId && CanMoveTo(v, u))
+							return u;
+					}
+				}
+				return kNoVertex;
+			}
+			// Pairs from and every other vertex at its position with a neighbour at the position of to, so both
+			// sides of a seam collapse along it. False if one of them has no such neighbour
+			bool PairSiblings(uint32_t from, uint32_t to, std::vector<std::pair<uint32_t, uint32_t>>& pairs) const {
+				pairs.clear();
+				pairs.emplace_back(from, to);
+				for (uint32_t s = m_siblings[from]; s != from; s = m_siblings[s]) {
+					if (m_removed[s] || !HasLiveTriangles(s))
+						continue;
+					uint32_t target = FindNeighbourAt(s, m_positionIds[to]);
+					if (target == kNoVertex)
+						return false;
+					for (const auto& pair : pairs) {
+						if (pair.second == target)
+							return false;
+					}
+					pairs.emplace_back(s, target);
+				}
+				return true;
+			}
+			// Positions of the live triangles around all vertices at the position of v, except that position
+			void GatherLink(uint32_t v, std::vector<uint32_t>& link) const {
+				link.clear();
+				uint32_t s = v;
+				do {
+					for (uint32_t t : m_vertexTriangles[s]) {
+						if (!m_triangleAlive[t])
+							continue;
+						for (int k = 0; k < 3; k++) {
+							uint32_t id = m_positionIds[m_indices[3 * t + k]];
+							if (id != m_positionIds[v])
+								link.push_back(id);
+						}
+					}
+					s = m_siblings[s];
+				} while (s != v);
+				std::sort(link.begin(), link.end());
+				link.erase(std::unique(link.begin(), link.end()), link.end());
+			}
+			// Link condition: the only positions next to both ends of the edge are the third corners of the
+			// triangles on it, otherwise the collapse pinches the surface into a non-manifold edge
+			bool KeepsManifold(uint32_t from, uint32_t to) {
+				uint32_t fromId = m_positionIds[from];
+				uint32_t toId = m_positionIds[to];
+				m_opposite.clear();
+				uint32_t s = from;
+				do {
+					for (uint32_t t : m_vertexTriangles[s]) {
+						const uint32_t* tri = &m_indices[3 * t];
+						if (!m_triangleAlive[t])
+							continue;
+						uint32_t ids[3] = { m_positionIds[tri[0]], m_positionIds[tri[1]], m_positionIds[tri[2]] };
+						if (ids[0] != toId && ids[1] != toId && ids[2] != toId)
+							continue;
+						for (int k = 0; k < 3; k++) {
+							if (ids[k] != fromId && ids[k] != toId)
+								m_opposite.push_back(ids[k]);
+						}
+					}
+					s = m_siblings[s];
+				} while (s != from);
+				std::sort(m_opposite.begin(), m_opposite.end());
+				m_opposite.erase(std::unique(m_opposite.begin(), m_opposite.end()), m_opposite.end());
+				GatherLink(from, m_fromLink);
+				GatherLink(to, m_toLink);
+				m_sharedLink.clear();
+				std::set_intersection(m_fromLink.begin(), m_fromLink.end(), m_toLink.begin(), m_toLink.end(), std::back_inserter(m_sharedLink));
+				return m_sharedLink.size() <= m_opposite.size();
+			}
+			// Rejects collapses which break the link condition, or flip or degenerate a remaining triangle
+			// for any of the pairs of the collapse
+			bool CanCollapse(uint32_t from, uint32_t to) {
+				if (!KeepsManifold(from, to))
+					return false;
+				for (const auto& pair : m_pairs) {
+					if (!KeepsOrientation(pair.first, pair.second))
+						return false;
+				}
+				return true;
+			}
+			bool KeepsOrientation(uint32_t from, uint32_t to) const {
+				for (uint32_t t : m_vertexTriangles[from]) {
+					const uint32_t* tri = &m_indices[3 * t];
+					if (!m_triangleAlive[t] || tri[0] == to || tri[1] == to || tri[2] == to)
+						continue;
+					glm::dvec3 p[3], moved[3];
+					for (int k = 0; k < 3; k++) {
+						p[k] = m_positions[tri[k]];
+						moved[k] = tri[k] == from ? m_positions[to] : p[k];
+					}
+					glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+					glm::dvec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+					double afterLength = glm::length(after);
+					if (afterLength < 1e-12 || glm::dot(before, after) < 0.25 * glm::length(before) * afterLength)
+						return false;
+				}
+				return true;
+			}
+			// Moves every pair of the collapse, m_pairs from PairSiblings
+			void Apply(const Collapse& collapse) {
+				m_maxCost = (std::max)(m_maxCost, collapse.cost);
+				// Coincident vertices keep sharing one quadric
+				Quadric merged = m_quadrics[collapse.from];
+				merged += m_quadrics[collapse.to];
+				uint32_t s = collapse.to;
+				do {
+					m_quadrics[s] = merged;
+					s = m_siblings[s];
+				} while (s != collapse.to);
+				for (const auto& pair : m_pairs) {
+					Move(pair.first, pair.second);
+				}
+				// The quadric of to changed, so did the collapses of all its neighbours and the vertices at their positions
+				m_neighbours.clear();
+				for (const auto& pair : m_pairs) {
+					for (uint32_t t : m_vertexTriangles[pair.second]) {
+						for (int k = 0; k < 3; k++) {
+							uint32_t v = m_indices[3 * t + k];
+							uint32_t sibling = v;
+							do {
+								m_neighbours.push_back(sibling);
+								sibling = m_siblings[sibling];
+							} while (sibling != v);
+						}
+					}
+				}
+				std::sort(m_neighbours.begin(), m_neighbours.end());
+				m_neighbours.erase(std::unique(m_neighbours.begin(), m_neighbours.end()), m_neighbours.end());
+				for (uint32_t v : m_neighbours) {
+					m_stamps[v]++;
+					PushCandidate(v);
+				}
+			}
+			void Move(uint32_t from, uint32_t to) {
+				m_removed[from] = true;
+				for (uint32_t t : m_vertexTriangles[from]) {
+					if (!m_triangleAlive[t])
+						continue;
+					uint32_t* tri = &m_indices[3 * t];
+					if (tri[0] == to || tri[1] == to || tri[2] == to) {
+						m_triangleAlive[t] = false;
+						m_liveTriangles--;
+						continue;
+					}
+					for (int k = 0; k < 3; k++) {
+						if (tri[k] == from)
+							tri[k] = to;
+					}
+					m_vertexTriangles[to].push_back(t);
+				}
+				m_vertexTriangles[from].clear();
+				std::vector<uint32_t>& toTriangles = m_vertexTriangles[to];
+				toTriangles.erase(std::remove_if(toTriangles.begin(), toTriangles.end(), [&](uint32_t t) { return !m_triangleAlive[t]; }), toTriangles.end());
+			}
+
+			uint32_t m_vertexCount;
+			std::vector<glm::dvec3> m_positions;
+			std::vector<uint32_t> m_indices;
+			std::vector<bool> m_triangleAlive;
+			uint32_t m_liveTriangles = 0;
+			std::vector<std::vector<uint32_t>> m_vertexTriangles;
+			std::vector<VertexKind> m_kinds;
+			std::vector<uint32_t> m_positionIds; // Equal for coincident vertices
+			std::vector<uint32_t> m_siblings; // Next vertex at the same position, a ring
+			std::vector<Quadric> m_quadrics;
+			std::vector<bool> m_removed;
+			std::vector<uint32_t> m_stamps;
+			std::vector<uint32_t> m_neighbours;
+			std::vector<std::pair<uint32_t, uint32_t>> m_pairs; // from, to of every vertex moved by a collapse
+			std::vector<uint32_t> m_opposite;
+			std::vector<uint32_t> m_fromLink;
+			std::vector<uint32_t> m_toLink;
+			std::vector<uint32_t> m_sharedLink;
+			std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> m_queue;
+			double m_maxCost = 0.0;
+		};
+	}
+
+	void BuildLodChain(const MeshInput& mesh, const Settings& settings, std::vector<Level>& levels) {
+		levels.clear();
+		if (settings.levelCount < 2 || mesh.indexCount < 3 || mesh.vertexCount == 0)
+			return;
+		auto start = std::chrono::high_resolution_clock::now();
+		Simplifier simplifier(mesh);
+		double target = simplifier.LiveTriangles();
+		uint32_t previousTriangles = simplifier.LiveTriangles();
+		for (uint32_t level = 1; level < settings.levelCount; level++) {
+			target *= settings.reduction;
+			simplifier.Run(static_cast<uint32_t>(target), settings.maxError);
+			// Stopped by the error limit without a noticeable reduction, the chain ends here
+			if (simplifier.LiveTriangles() == 0 || simplifier.LiveTriangles() > 0.9 * previousTriangles)
+				break;
+			previousTriangles = simplifier.LiveTriangles();
+			Level result;
+			simplifier.GetIndices(result.indices);
+			result.error = static_cast<float>(simplifier.Error());
+			auto now = std::chrono::high_resolution_clock::now();
+			result.timeMs = std::chrono::duration<double, std::milli>(now - start).count();
+			start = now;
+			levels.push_back(std::move(result));
+		}
+	}
+	void BuildLodChains(const std::vector<MeshInput>& meshes, const Settings& settings, std::vector<std::vector<Level>>& chains, uint32_t threadCount) {
+		chains.resize(meshes.size());
+		ParallelFor(static_cast<uint32_t>(meshes.size()), 1, threadCount, [&](uint32_t first, uint32_t last, uint32_t) {
+			for (uint32_t i = first; i < last; i++) {
+				BuildLodChain(meshes[i], settings, chains[i]);
+			}
+		});
+	}
+
+	double BenchmarkSimplification(uint32_t triangleCount, uint32_t meshCount, const Settings& settings, std::vector<Level>& firstChain, uint32_t threadCount) {
+		// Rings of 2 * stacks slices, the first and last column share positions but not texture coordinates
+		uint32_t stacks = (std::max)(2u, static_cast<uint32_t>(std::sqrt(triangleCount / 4.0)));
+		uint32_t slices = 2 * stacks;
+		std::vector<glm::vec3> positions;
+		std::vector<uint32_t> indices;
+		for (uint32_t i = 0; i <= stacks; i++) {
+			float theta = 3.14159265f * i / stacks;
+			for (uint32_t j = 0; j <= slices; j++) {
+				float phi = 2.f * 3.14159265f * (j % slices) / slices;
+				positions.push_back(glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)));
+			}
+		}
+		for (uint32_t i = 0; i < stacks; i++) {
+			for (uint32_t j = 0; j < slices; j++) {
+				uint32_t a = i * (slices + 1) + j;
+				uint32_t b = a + slices + 1;
+				if (i > 0)
+					indices.insert(indices.end(), { a, a + 1, b });
+				if (i + 1 < stacks)
+					indices.insert(indices.end(), { a + 1, b + 1, b });
+			}
+		}
+		MeshInput mesh;
+		mesh.positions = reinterpret_cast<const uint8_t*>(positions.data());
+		mesh.vertexCount = static_cast<uint32_t>(positions.size());
+		mesh.indices = indices.data();
+		mesh.indexCount = static_cast<uint32_t>(indices.size());
+		std::vector<MeshInput> meshes(meshCount, mesh);
+		std::vector<std::vector<Level>> chains;
+		auto start = std::chrono::high_resolution_clock::now();
+		BuildLodChains(meshes, settings, chains, threadCount);
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+		if (!chains.empty())
+			firstChain = chains[0];
+		return elapsed.count();
+	}
+}
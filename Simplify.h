@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+// Quadric error metric simplification for generated levels of detail.
+// Edges are collapsed onto one of their vertices, so every level is an index buffer into the
+// original vertex streams. Vertices at one position (UV seams, normal creases) collapse together
+// along the seam and primitive borders (material boundaries) only collapse along themselves.
+// No D3D dependencies, primitives are simplified in parallel on worker threads
+namespace simplify {
+	struct Settings {
+		uint32_t levelCount = 4; // Including the original level 0
+		float reduction = 0.5f; // Triangles of a level relative to the previous one
+		float maxError = 0.02f; // Stops the chain, relative to the size of the mesh bounds
+	};
+	struct MeshInput {
+		const uint8_t* positions = nullptr; // float3 per vertex
+		uint32_t positionStride = 12; // in bytes
+		uint32_t vertexCount = 0;
+		const uint32_t* indices = nullptr; // 3 per triangle
+		uint32_t indexCount = 0;
+	};
+	struct Level {
+		std::vector<uint32_t> indices; // Triangles into the original vertices
+		float error = 0.f; // Largest collapse error so far, relative to the size of the mesh bounds
+		double timeMs = 0.0; // Time since the previous level
+	};
+	// Levels 1 to levelCount - 1 of the chain, fewer if the error limit is reached first
+	void BuildLodChain(const MeshInput& mesh, const Settings& settings, std::vector<Level>& levels);
+	// One chain per mesh, threadCount = 0 uses all hardware threads
+	void BuildLodChains(const std::vector<MeshInput>& meshes, const Settings& settings, std::vector<std::vector<Level>>& chains, uint32_t threadCount = 0);
+
+	// Simplifies meshCount UV spheres of about triangleCount triangles with a texture seam,
+	// returns the total milliseconds and the chain of the first sphere
+	double BenchmarkSimplification(uint32_t triangleCount, uint32_t meshCount, const Settings& settings, std::vector<Level>& firstChain, uint32_t threadCount = 0);
+}
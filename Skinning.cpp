@@ -0,0 +1,104 @@
+#include "Skinning.h"
+#include "ParallelFor.h"
+#include <chrono>
+#include <random>
+#include <stdexcept>
+
+namespace skin {
+	void NodeHierarchy::Finalize() {
+		order.clear();
+		order.reserve(parents.size());
+		// 0 - not visited, 1 - on the current path, 2 - done
+		std::vector<uint8_t> state(parents.size(), 0);
+		std::vector<int> path;
+		for (size_t i = 0; i < parents.size(); i++) {
+			// Walk up to the first node which is already ordered, then add the path top down
+			int node = static_cast<int>(i);
+			while (node >= 0 && state[node] == 0) {
+				state[node] = 1;
+				path.push_back(node);
+				node = parents[node];
+			}
+			if (node >= 0 && state[node] == 1) {
+				throw std::logic_error("Node hierarchy contains a cycle");
+			}
+			for (auto it = path.rbegin(); it != path.rend(); ++it) {
+				state[*it] = 2;
+				order.push_back(*it);
+			}
+			path.clear();
+		}
+	}
+	void NodeHierarchy::ComputeGlobalTransforms(std::vector<glm::mat4>& globals) const {
+		globals.resize(localTransforms.size());
+		for (int node : order) {
+			globals[node] = parents[node] >= 0 ? globals[parents[node]] * localTransforms[node] : localTransforms[node];
+		}
+	}
+
+	void ComputeJointMatrices(const Skin& skin, const std::vector<glm::mat4>& globals, glm::mat4* jointMatrices) {
+		glm::mat4 meshGlobalInverse = skin.meshNode >= 0 ? glm::inverse(globals[skin.meshNode]) : glm::mat4(1.f);
+		for (size_t j = 0; j < skin.jointNodes.size(); j++) {
+			glm::mat4 inverseBind = j < skin.inverseBindMatrices.size() ? skin.inverseBindMatrices[j] : glm::mat4(1.f);
+			jointMatrices[j] = meshGlobalInverse * globals[skin.jointNodes[j]] * inverseBind;
+		}
+	}
+
+	void SkinVertices(const SkinningInput& input, const glm::mat4* jointMatrices, glm::vec3* outPositions, glm::vec3* outNormals,
+		uint32_t first, uint32_t last) {
+		for (uint32_t v = first; v < last; v++) {
+			const glm::uvec4& joints = input.joints[v];
+			const glm::vec4& weights = input.weights[v];
+			glm::mat4 skinMatrix = weights.x * jointMatrices[joints.x] + weights.y * jointMatrices[joints.y] +
+				weights.z * jointMatrices[joints.z] + weights.w * jointMatrices[joints.w];
+			outPositions[v] = glm::vec3(skinMatrix * glm::vec4(input.positions[v], 1.f));
+			if (input.normals && outNormals) {
+				// No inverse transpose, joints are expected to scale uniformly
+				outNormals[v] = glm::normalize(glm::mat3(skinMatrix) * input.normals[v]);
+			}
+		}
+	}
+	void SkinVerticesParallel(const SkinningInput& input, const glm::mat4* jointMatrices, glm::vec3* outPositions, glm::vec3* outNormals,
+		uint32_t threadCount) {
+		ParallelFor(input.vertexCount, 4096, threadCount, [&](uint32_t first, uint32_t last, uint32_t) {
+			SkinVertices(input, jointMatrices, outPositions, outNormals, first, last);
+		});
+	}
+
+	double BenchmarkSkinning(uint32_t vertexCount, uint32_t jointCount, uint32_t iterations, uint32_t threadCount) {
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<float> unit(0.f, 1.f);
+		std::uniform_int_distribution<uint32_t> joint(0, jointCount - 1);
+		std::vector<glm::vec3> positions(vertexCount);
+		std::vector<glm::vec3> normals(vertexCount);
+		std::vector<glm::uvec4> joints(vertexCount);
+		std::vector<glm::vec4> weights(vertexCount);
+		for (uint32_t v = 0; v < vertexCount; v++) {
+			positions[v] = glm::vec3(unit(rng), unit(rng), unit(rng));
+			normals[v] = glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) + 0.1f);
+			joints[v] = glm::uvec4(joint(rng), joint(rng), joint(rng), joint(rng));
+			glm::vec4 w(unit(rng), unit(rng), unit(rng), unit(rng));
+			weights[v] = w / (w.x + w.y + w.z + w.w);
+		}
+		std::vector<glm::mat4> jointMatrices(jointCount);
+		for (uint32_t j = 0; j < jointCount; j++) {
+			jointMatrices[j] = glm::mat4(1.f);
+			jointMatrices[j][3] = glm::vec4(unit(rng), unit(rng), unit(rng), 1.f);
+		}
+		SkinningInput input;
+		input.positions = positions.data();
+		input.normals = normals.data();
+		input.joints = joints.data();
+		input.weights = weights.data();
+		input.vertexCount = vertexCount;
+		std::vector<glm::vec3> outPositions(vertexCount);
+		std::vector<glm::vec3> outNormals(vertexCount);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < iterations; i++) {
+			SkinVerticesParallel(input, jointMatrices.data(), outPositions.data(), outNormals.data(), threadCount);
+		}
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		return ms > 0.0 ? double(vertexCount) * iterations / ms : 0.0;
+	}
+}
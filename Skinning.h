@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+// CPU side of glTF skinning: node hierarchy evaluation, joint matrices and a reference
+// implementation of the skinning compute pass (Assets/ComputeShaders/Skinning.hlsl).
+// No D3D dependencies, the renderer uploads the joint matrices and dispatches the GPU pass
+namespace skin {
+	// glTF nodes in a flat array, parents[i] < 0 for root nodes
+	struct NodeHierarchy {
+		std::vector<int> parents;
+		std::vector<glm::mat4> localTransforms;
+		// Nodes sorted so that every parent comes before its children, filled by Finalize
+		std::vector<int> order;
+		// Has to be called after parents are set, glTF doesn't order nodes parent first
+		void Finalize();
+		void ComputeGlobalTransforms(std::vector<glm::mat4>& globals) const;
+	};
+	// One glTF skin bound to the node of a skinned mesh
+	struct Skin {
+		std::vector<int> jointNodes;
+		std::vector<glm::mat4> inverseBindMatrices;
+		int meshNode = -1;
+	};
+	// The positions are transformed into the space of the mesh node, as the node transform is still
+	// applied on top (BLAS geometry transform): inverse(meshGlobal) * jointGlobal * inverseBind
+	void ComputeJointMatrices(const Skin& skin, const std::vector<glm::mat4>& globals, glm::mat4* jointMatrices);
+
+	struct SkinningInput {
+		const glm::vec3* positions = nullptr;
+		const glm::vec3* normals = nullptr; // optional
+		const glm::uvec4* joints = nullptr; // JOINTS_0
+		const glm::vec4* weights = nullptr; // WEIGHTS_0
+		uint32_t vertexCount = 0;
+	};
+	// Skins vertices [first, last), the same math as the compute shader
+	void SkinVertices(const SkinningInput& input, const glm::mat4* jointMatrices, glm::vec3* outPositions, glm::vec3* outNormals,
+		uint32_t first, uint32_t last);
+	// Skins all vertices on worker threads, threadCount = 0 uses all hardware threads
+	void SkinVerticesParallel(const SkinningInput& input, const glm::mat4* jointMatrices, glm::vec3* outPositions, glm::vec3* outNormals,
+		uint32_t threadCount = 0);
+	// Skins a synthetic mesh with random joints and weights, returns vertices per millisecond
+	double BenchmarkSkinning(uint32_t vertexCount, uint32_t jointCount, uint32_t iterations, uint32_t threadCount = 0);
+}
@@ -0,0 +1,172 @@
+#include "Animation.h"
+#include "GpuInstancing.h"
+#include "Check.h"
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtx/transform.hpp>
+#include <random>
+
+namespace {
+	float MaxDifference(const glm::mat4& a, const glm::mat4& b) {
+		float difference = 0.f;
+		for (int c = 0; c < 4; c++) {
+			for (int r = 0; r < 4; r++) {
+				difference = (std::max)(difference, std::abs(a[c][r] - b[c][r]));
+			}
+		}
+		return difference;
+	}
+	glm::mat4 ReferenceTRS(const anim::NodeTRS& trs) {
+		glm::quat q(trs.rotation.w, trs.rotation.x, trs.rotation.y, trs.rotation.z);
+		return glm::translate(glm::vec3(trs.translation)) * glm::mat4_cast(q) * glm::scale(glm::vec3(trs.scale));
+	}
+
+	void TestSampling() {
+		std::mt19937 random(11);
+		std::uniform_real_distribution<float> unit(-1.f, 1.f);
+		for (uint32_t interpolation = 0; interpolation < 3; interpolation++) {
+			for (uint32_t path = 0; path < 3; path++) {
+				anim::Sampler sampler;
+				sampler.interpolation = static_cast<anim::Interpolation>(interpolation);
+				uint32_t valuesPerKey = sampler.interpolation == anim::Interpolation::CubicSpline ? 3 : 1;
+				for (uint32_t k = 0; k < 8; k++) {
+					sampler.times.push_back(0.25f * k);
+					for (uint32_t v = 0; v < valuesPerKey; v++) {
+						glm::vec4 value(unit(random), unit(random), unit(random), unit(random));
+						sampler.values.push_back(static_cast<anim::Path>(path) == anim::Path::Rotation ? glm::normalize(value) : value);
+					}
+				}
+				float maxDifference = 0.f;
+				for (float time = -0.5f; time < 2.5f; time += 0.01f) {
+					glm::vec4 a = anim::Sample(sampler, static_cast<anim::Path>(path), time);
+					glm::vec4 b = anim::SampleReference(sampler, static_cast<anim::Path>(path), time);
+					// q and -q are the same rotation
+					if (static_cast<anim::Path>(path) == anim::Path::Rotation && glm::dot(a, b) < 0.f)
+						a = -a;
+					maxDifference = (std::max)(maxDifference, glm::length(a - b));
+				}
+				CHECK(maxDifference < 1e-4f);
+				// Clamped at both ends, the keys themselves are hit exactly
+				uint32_t last = valuesPerKey * 7 + (valuesPerKey == 3 ? 1 : 0);
+				uint32_t first = valuesPerKey == 3 ? 1 : 0;
+				CHECK(glm::length(anim::SampleReference(sampler, static_cast<anim::Path>(path), -1.f) - sampler.values[first]) < 1e-6f);
+				CHECK(glm::length(anim::SampleReference(sampler, static_cast<anim::Path>(path), 5.f) - sampler.values[last]) < 1e-6f);
+				if (sampler.interpolation != anim::Interpolation::CubicSpline) {
+					glm::vec4 key = anim::Sample(sampler, static_cast<anim::Path>(path), 0.5f);
+					CHECK(std::abs(std::abs(glm::dot(key, sampler.values[2])) - glm::dot(sampler.values[2], sampler.values[2])) < 1e-4f);
+				}
+			}
+		}
+		anim::NodeTRS trs;
+		trs.translation = glm::vec4(1.f, -2.f, 3.f, 0.f);
+		trs.rotation = glm::normalize(glm::vec4(0.3f, -0.2f, 0.5f, 0.7f));
+		trs.scale = glm::vec4(2.f, 0.5f, 1.5f, 0.f);
+		CHECK(MaxDifference(anim::ComposeTRS(trs), ReferenceTRS(trs)) < 1e-5f);
+	}
+
+	void TestEvaluate() {
+		std::mt19937 random(13);
+		std::uniform_real_distribution<float> unit(-1.f, 1.f);
+		const uint32_t nodeCount = 40;
+		skin::NodeHierarchy hierarchy;
+		// Children before their parents, Finalize has to order them
+		hierarchy.parents.resize(nodeCount);
+		for (uint32_t i = 0; i < nodeCount; i++) {
+			hierarchy.parents[i] = i + 1 < nodeCount ? static_cast<int>(i + 1 + random() % (nodeCount - i - 1)) : -1;
+			hierarchy.localTransforms.push_back(glm::translate(glm::vec3(unit(random), unit(random), unit(random))));
+		}
+		hierarchy.Finalize();
+		CHECK(hierarchy.order.size() == nodeCount);
+		std::vector<int> position(nodeCount);
+		for (uint32_t i = 0; i < hierarchy.order.size(); i++) {
+			position[hierarchy.order[i]] = i;
+		}
+		for (uint32_t i = 0; i < nodeCount; i++) {
+			CHECK(hierarchy.parents[i] < 0 || position[hierarchy.parents[i]] < position[i]);
+		}
+
+		// Every other node animated
+		anim::Clip clip;
+		for (uint32_t node = 0; node < nodeCount; node += 2) {
+			for (uint32_t path = 0; path < 3; path++) {
+				anim::Sampler sampler;
+				for (uint32_t k = 0; k < 4; k++) {
+					sampler.times.push_back(0.5f * k);
+					glm::vec4 value(unit(random), unit(random), unit(random), unit(random));
+					sampler.values.push_back(path == 1 ? glm::normalize(value) : path == 2 ? glm::abs(value) + 0.5f : value);
+				}
+				clip.channels.push_back({ static_cast<uint32_t>(clip.samplers.size()), node, static_cast<anim::Path>(path) });
+				clip.samplers.push_back(sampler);
+			}
+		}
+		clip.Finalize();
+		CHECK(clip.duration == 1.5f);
+		CHECK(clip.animatedNodes.size() == nodeCount / 2);
+
+		std::vector<anim::Instance> instances(16);
+		std::vector<anim::Instance*> pointers;
+		for (uint32_t i = 0; i < instances.size(); i++) {
+			instances[i].clip = &clip;
+			instances[i].hierarchy = &hierarchy;
+			instances[i].restPose.resize(nodeCount);
+			instances[i].time = 0.37f * i;
+			pointers.push_back(&instances[i]);
+		}
+		anim::EvaluateBatch(pointers.data(), pointers.size(), 4);
+		for (const anim::Instance& instance : instances) {
+			// The reference: sampled TRS into the hierarchy, globals from skin::NodeHierarchy
+			skin::NodeHierarchy posed = hierarchy;
+			float time = std::fmod(instance.time, clip.duration);
+			for (const anim::Channel& channel : clip.channels) {
+				anim::NodeTRS trs = instance.pose[channel.node];
+				CHECK(glm::length(anim::SampleReference(clip.samplers[channel.sampler], channel.path, time)
+					- (channel.path == anim::Path::Translation ? trs.translation : channel.path == anim::Path::Rotation ? trs.rotation : trs.scale)) < 1e-3f
+					|| (channel.path == anim::Path::Rotation && glm::length(anim::SampleReference(clip.samplers[channel.sampler], channel.path, time) + trs.rotation) < 1e-3f));
+			}
+			for (uint32_t node : clip.animatedNodes) {
+				posed.localTransforms[node] = ReferenceTRS(instance.pose[node]);
+			}
+			std::vector<glm::mat4> globals;
+			posed.ComputeGlobalTransforms(globals);
+			float maxDifference = 0.f;
+			for (uint32_t node = 0; node < nodeCount; node++) {
+				maxDifference = (std::max)(maxDifference, MaxDifference(globals[node], instance.globals[node]));
+			}
+			CHECK(maxDifference < 1e-3f);
+		}
+	}
+
+	void TestInstancing() {
+		instancing::InstanceAttributes attributes = instancing::MakeRandomInstances(1003, 50.f);
+		CHECK(attributes.count == 1003);
+		glm::mat4 parent = glm::translate(glm::vec3(1.f, 2.f, 3.f)) * glm::rotate(0.7f, glm::vec3(0.f, 0.f, 1.f));
+		std::vector<glm::mat4> reference(attributes.count), simd(attributes.count), parallel(attributes.count);
+		instancing::ComposeInstanceTransformsReference(attributes, parent, reference.data(), 0, attributes.count);
+		instancing::ComposeInstanceTransforms(attributes, parent, simd.data(), 0, attributes.count);
+		instancing::ComposeInstanceTransformsParallel(attributes, parent, parallel.data(), 4);
+		float maxDifference = 0.f;
+		for (uint32_t i = 0; i < attributes.count; i++) {
+			anim::NodeTRS trs;
+			trs.translation = attributes.translations[i];
+			trs.rotation = attributes.rotations[i];
+			trs.scale = attributes.scales[i];
+			CHECK(MaxDifference(reference[i], parent * ReferenceTRS(trs)) < 1e-3f);
+			maxDifference = (std::max)(maxDifference, (std::max)(MaxDifference(reference[i], simd[i]), MaxDifference(reference[i], parallel[i])));
+		}
+		CHECK(maxDifference < 1e-3f);
+		// Missing attributes are the identity
+		instancing::InstanceAttributes translationsOnly;
+		translationsOnly.translations = attributes.translations;
+		translationsOnly.count = attributes.count;
+		instancing::ComposeInstanceTransforms(translationsOnly, glm::mat4(1.f), simd.data(), 0, translationsOnly.count);
+		for (uint32_t i = 0; i < translationsOnly.count; i++) {
+			CHECK(MaxDifference(simd[i], glm::translate(glm::vec3(attributes.translations[i]))) < 1e-5f);
+		}
+	}
+}
+
+int main() {
+	TestSampling();
+	TestEvaluate();
+	TestInstancing();
+	return test::Result();
+}
@@ -0,0 +1,140 @@
+#include "Bvh.h"
+#include "Lbvh.h"
+#include "Sbvh.h"
+#include "WideBvh.h"
+#include "Check.h"
+#include <algorithm>
+#include <random>
+
+namespace {
+	// Closest hit over every triangle, what all hierarchies have to return
+	bool BruteForce(const bvh::Mesh& mesh, const bvh::Ray& ray, bvh::Hit& hit) {
+		hit = bvh::Hit();
+		for (uint32_t i = 0; i < mesh.triangles.size(); i++) {
+			const glm::uvec3& tri = mesh.triangles[i];
+			float t, u, v;
+			if (bvh::IntersectTriangle(ray, mesh.positions[tri.x], mesh.positions[tri.y], mesh.positions[tri.z], (std::min)(hit.t, ray.tMax), t, u, v)) {
+				hit.t = t;
+				hit.primitive = i;
+			}
+		}
+		return hit.primitive != ~0u;
+	}
+	template <typename Intersect, typename Occluded>
+	void CheckQueries(const bvh::Mesh& mesh, const std::vector<bvh::Ray>& rays, Intersect intersect, Occluded occluded) {
+		uint32_t mismatches = 0;
+		uint32_t hits = 0;
+		for (const bvh::Ray& ray : rays) {
+			bvh::Hit expected, hit;
+			bool expectedHit = BruteForce(mesh, ray, expected);
+			bool found = intersect(ray, hit);
+			hits += expectedHit;
+			// Equal t, the primitive may differ where triangles touch
+			if (found != expectedHit || (found && std::abs(hit.t - expected.t) > 1e-4f * expected.t))
+				mismatches++;
+			if (occluded(ray) != expectedHit)
+				mismatches++;
+		}
+		CHECK(hits > rays.size() / 4);
+		CHECK(mismatches == 0);
+	}
+
+	void TestBuilders() {
+		bvh::Mesh mesh;
+		bvh::MakeRandomTriangles(3000, 10.f, 0.8f, mesh);
+		std::vector<bvh::Aabb> bounds;
+		mesh.GetTriangleBounds(bounds);
+		bvh::Aabb sceneBounds;
+		for (const auto& b : bounds) {
+			sceneBounds.Grow(b);
+		}
+		std::vector<bvh::Ray> rays;
+		bvh::MakeRandomRays(sceneBounds, 1000, rays);
+		bvh::BuildSettings settings;
+		std::string error;
+
+		bvh::Bvh binned;
+		bvh::BuildBinned(bounds, settings, binned);
+		CHECK(bvh::Validate(binned, bounds, &error));
+		CheckQueries(mesh, rays, [&](const bvh::Ray& ray, bvh::Hit& hit) { return bvh::Intersect(binned, mesh, ray, hit); },
+			[&](const bvh::Ray& ray) { return bvh::Occluded(binned, mesh, ray); });
+
+		bvh::Bvh lbvh;
+		bvh::LbvhSettings lbvhSettings;
+		lbvhSettings.threadCount = 4;
+		bvh::BuildLbvh(bounds, lbvhSettings, lbvh);
+		CHECK(bvh::Validate(lbvh, bounds, &error));
+		CheckQueries(mesh, rays, [&](const bvh::Ray& ray, bvh::Hit& hit) { return bvh::Intersect(lbvh, mesh, ray, hit); },
+			[&](const bvh::Ray& ray) { return bvh::Occluded(lbvh, mesh, ray); });
+		// Treelet restructuring only lowers the cost
+		bvh::Bvh plainLbvh;
+		lbvhSettings.treeletSize = 0;
+		bvh::BuildLbvh(bounds, lbvhSettings, plainLbvh);
+		CHECK(bvh::Validate(plainLbvh, bounds, &error));
+		CHECK(bvh::SahCost(lbvh, settings) <= bvh::SahCost(plainLbvh, settings));
+
+		bvh::Bvh sbvh;
+		bvh::SbvhSettings sbvhSettings;
+		bvh::SbvhStats stats;
+		bvh::BuildSbvh(mesh, sbvhSettings, sbvh, &stats);
+		CHECK(stats.references >= mesh.triangles.size());
+		CHECK(stats.references <= mesh.triangles.size() * (1.f + sbvhSettings.maxReferenceGrowth) + 1);
+		CHECK(sbvh.primitives.size() == stats.references);
+		CHECK(bvh::SahCost(sbvh, settings) <= bvh::SahCost(binned, settings) * 1.01f);
+		CheckQueries(mesh, rays, [&](const bvh::Ray& ray, bvh::Hit& hit) { return bvh::Intersect(sbvh, mesh, ray, hit); },
+			[&](const bvh::Ray& ray) { return bvh::Occluded(sbvh, mesh, ray); });
+
+		bvh::Bvh4 bvh4;
+		bvh::CollapseToWide(binned, bvh4);
+		CheckQueries(mesh, rays, [&](const bvh::Ray& ray, bvh::Hit& hit) { return bvh::Intersect(bvh4, mesh, ray, hit); },
+			[&](const bvh::Ray& ray) { return bvh::Occluded(bvh4, mesh, ray); });
+		bvh::Bvh8 bvh8;
+		bvh::CollapseToWide(binned, bvh8);
+		CHECK(bvh8.nodes.size() < bvh4.nodes.size());
+		CheckQueries(mesh, rays, [&](const bvh::Ray& ray, bvh::Hit& hit) { return bvh::Intersect(bvh8, mesh, ray, hit); },
+			[&](const bvh::Ray& ray) { return bvh::Occluded(bvh8, mesh, ray); });
+
+		// Moved triangles keep a valid hierarchy after the refit
+		for (auto& p : mesh.positions) {
+			p += glm::vec3(0.5f * std::sin(p.y), 0.f, 0.25f * std::cos(p.x));
+		}
+		mesh.GetTriangleBounds(bounds);
+		bvh::Refit(binned, bounds);
+		CHECK(bvh::Validate(binned, bounds, &error));
+		CheckQueries(mesh, rays, [&](const bvh::Ray& ray, bvh::Hit& hit) { return bvh::Intersect(binned, mesh, ray, hit); },
+			[&](const bvh::Ray& ray) { return bvh::Occluded(binned, mesh, ray); });
+	}
+
+	void TestMorton() {
+		CHECK(bvh::MortonCode(glm::vec3(0.f)) == 0);
+		CHECK(bvh::MortonCode(glm::vec3(1.f)) == (1u << 30) - 1);
+		// x is the most significant bit of every triple
+		CHECK(bvh::MortonCode(glm::vec3(1.f, 0.f, 0.f)) == 0x24924924u);
+		CHECK(bvh::MortonCode(glm::vec3(0.f, 0.f, 1.f)) == 0x09249249u);
+
+		std::mt19937_64 random(7);
+		std::vector<uint64_t> keys(100000);
+		for (auto& key : keys) {
+			key = random();
+		}
+		std::vector<uint64_t> sorted = keys;
+		bvh::RadixSort(sorted, 16, 32, 4);
+		std::vector<uint64_t> expected = keys;
+		std::sort(expected.begin(), expected.end());
+		std::vector<uint64_t> result = sorted;
+		std::sort(result.begin(), result.end());
+		CHECK(result == expected);
+		auto bits = [](uint64_t key) { return (key >> 16) & 0xFFFFFFFFull; };
+		bool ordered = true;
+		for (size_t i = 1; i < sorted.size(); i++) {
+			ordered &= bits(sorted[i - 1]) <= bits(sorted[i]);
+		}
+		CHECK(ordered);
+	}
+}
+
+int main() {
+	TestBuilders();
+	TestMorton();
+	return test::Result();
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cmath>
+#include <cstdio>
+// Assertions of the CPU module tests. A failed check prints its location and the test returns 1 from main
+namespace test {
+	inline int& Failures() {
+		static int failures = 0;
+		return failures;
+	}
+	inline int Result() {
+		if (Failures() > 0)
+			std::printf("%d checks failed\n", Failures());
+		return Failures() > 0 ? 1 : 0;
+	}
+}
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			test::Failures()++; \
+		} \
+	} while (0)
+#define CHECK_NEAR(a, b, tolerance) \
+	do { \
+		double a_ = (a), b_ = (b); \
+		if (!(std::abs(a_ - b_) <= (tolerance))) { \
+			std::printf("%s:%d: CHECK_NEAR(%s, %s) failed, %g and %g\n", __FILE__, __LINE__, #a, #b, a_, b_); \
+			test::Failures()++; \
+		} \
+	} while (0)
@@ -0,0 +1,88 @@
+#include "FrameRing.h"
+#include "Accumulation.h"
+#include "Check.h"
+#include <glm/glm.hpp>
+#include <random>
+#include <vector>
+
+namespace {
+	void TestRing() {
+		const uint64_t sliceSize = 64 << 10;
+		const uint32_t sliceCount = 3;
+		frame::Ring ring;
+		ring.Init(sliceSize, sliceCount);
+		std::mt19937 random(1);
+		for (uint32_t frameIndex = 0; frameIndex < 12; frameIndex++) {
+			uint32_t slice = frameIndex % sliceCount;
+			ring.BeginFrame(slice);
+			CHECK(ring.GetUsed() == 0);
+			uint64_t end = sliceSize * slice;
+			for (;;) {
+				uint64_t size = 1 + random() % 3000;
+				uint64_t alignment = 256;
+				uint64_t offset = ring.Allocate(size, alignment);
+				if (offset == frame::kOutOfMemory) {
+					// Only once the slice is really full
+					CHECK(((end + alignment - 1) & ~(alignment - 1)) + size > sliceSize * (slice + 1));
+					break;
+				}
+				// In the slice of the frame, aligned and after the previous allocation
+				CHECK(offset % alignment == 0);
+				CHECK(offset >= end && offset + size <= sliceSize * (slice + 1));
+				end = offset + size;
+			}
+			CHECK(ring.GetUsed() == end - sliceSize * slice);
+		}
+		CHECK(ring.GetPeakUsed() <= sliceSize);
+		CHECK(ring.Allocate(sliceSize + 1, 4) == frame::kOutOfMemory);
+	}
+
+	accum::State MakeState(const glm::mat4& view, uint32_t mode) {
+		accum::State state;
+		state.Add(view);
+		state.Add(mode);
+		return state;
+	}
+
+	void TestAccumulation() {
+		accum::Controller controller;
+		glm::mat4 view(1.f);
+		// The first frame starts the average without counting as a reset
+		accum::Frame frame = controller.Advance(MakeState(view, 12));
+		CHECK(frame.sampleIndex == 0 && !frame.reset);
+		for (uint32_t i = 1; i < 5; i++) {
+			frame = controller.Advance(MakeState(view, 12));
+			CHECK(frame.sampleIndex == i && !frame.reset);
+		}
+		CHECK(controller.GetSampleCount() == 5);
+		view[3].x = 1.f;
+		frame = controller.Advance(MakeState(view, 12));
+		CHECK(frame.sampleIndex == 0 && frame.reset);
+		frame = controller.Advance(MakeState(view, 12));
+		CHECK(frame.sampleIndex == 1 && !frame.reset);
+		frame = controller.Advance(MakeState(view, 11));
+		CHECK(frame.sampleIndex == 0 && frame.reset);
+		controller.Reset();
+		frame = controller.Advance(MakeState(view, 11));
+		CHECK(frame.sampleIndex == 0 && frame.reset);
+		CHECK(controller.GetResetCount() == 3);
+
+		// Blending sample by sample gives the mean
+		std::mt19937 random(2);
+		std::uniform_real_distribution<float> unit(0.f, 1.f);
+		glm::vec3 average(0.f), sum(0.f);
+		const uint32_t count = 1000;
+		for (uint32_t i = 0; i < count; i++) {
+			glm::vec3 sample(unit(random), unit(random), 10.f * unit(random));
+			average = accum::Blend(average, sample, i);
+			sum += sample;
+		}
+		CHECK(glm::length(average - sum / float(count)) < 1e-3f);
+	}
+}
+
+int main() {
+	TestRing();
+	TestAccumulation();
+	return test::Result();
+}
@@ -0,0 +1,133 @@
+#include "Lights.h"
+#include "Check.h"
+#include <glm/gtx/transform.hpp>
+#include <random>
+
+namespace {
+	// Exact probability of every entry: kept from its own column plus what the columns aliasing it give away
+	std::vector<double> AliasProbabilities(const std::vector<lights::AliasEntry>& table) {
+		std::vector<double> probabilities(table.size(), 0.0);
+		for (size_t i = 0; i < table.size(); i++) {
+			probabilities[i] += table[i].probability / double(table.size());
+			probabilities[table[i].alias] += (1.0 - table[i].probability) / double(table.size());
+		}
+		return probabilities;
+	}
+
+	void TestAliasTable() {
+		std::mt19937 random(19);
+		std::uniform_real_distribution<float> unit(0.f, 1.f);
+		for (uint32_t count : { 1u, 2u, 7u, 100u, 1000u }) {
+			std::vector<float> weights(count);
+			for (uint32_t i = 0; i < count; i++) {
+				// Some entries without weight, and a few very heavy ones
+				weights[i] = i % 5 == 3 ? 0.f : i % 17 == 0 ? 100.f * unit(random) : unit(random);
+			}
+			if (count == 1)
+				weights[0] = 2.f;
+			std::vector<lights::AliasEntry> table;
+			double sum = lights::BuildAliasTable(weights.data(), count, table);
+			double expectedSum = 0.0;
+			for (float w : weights) {
+				expectedSum += w;
+			}
+			CHECK_NEAR(sum, expectedSum, 1e-6 * expectedSum);
+			std::vector<double> probabilities = AliasProbabilities(table);
+			for (uint32_t i = 0; i < count; i++) {
+				CHECK_NEAR(probabilities[i], weights[i] / sum, 1e-6);
+				CHECK(table[i].alias < count);
+			}
+			// Entries without weight are never picked, whatever the random numbers
+			for (uint32_t i = 0; i < 10000; i++) {
+				uint32_t entry = lights::SampleAlias(table.data(), count, unit(random), unit(random));
+				CHECK(entry < count && weights[entry] > 0.f);
+			}
+		}
+		std::vector<float> zeros(4, 0.f);
+		std::vector<lights::AliasEntry> table;
+		CHECK(lights::BuildAliasTable(zeros.data(), 4, table) == 0.0);
+		for (uint32_t i = 0; i < 4; i++) {
+			CHECK(table[i].alias == i && table[i].probability == 1.f);
+		}
+	}
+
+	void TestSampling() {
+		// A model with an emissive quad, a non-emissive geometry and a dim triangle
+		std::vector<std::vector<lights::Triangle>> geometries(3);
+		lights::Triangle a, b, c;
+		a.p0 = glm::vec3(0.f); a.p1 = glm::vec3(1.f, 0.f, 0.f); a.p2 = glm::vec3(1.f, 0.f, 1.f); a.emission = glm::vec3(4.f);
+		b.p0 = glm::vec3(0.f); b.p1 = glm::vec3(1.f, 0.f, 1.f); b.p2 = glm::vec3(0.f, 0.f, 1.f); b.emission = glm::vec3(4.f);
+		c.p0 = glm::vec3(0.f, 1.f, 0.f); c.p1 = glm::vec3(2.f, 1.f, 0.f); c.p2 = glm::vec3(0.f, 1.f, 2.f); c.emission = glm::vec3(1.f, 0.f, 0.f);
+		geometries[0] = { a, b };
+		geometries[2] = { c };
+		lights::MeshLights mesh;
+		CHECK(lights::BuildMeshLights(geometries, mesh));
+		CHECK(mesh.triangles.size() == 3);
+		CHECK(mesh.geometries.size() == 3 && mesh.geometries[0] == 0 && mesh.geometries[1] == lights::kNoLight && mesh.geometries[2] == 2);
+		double power = 2 * 0.5 * 4.0 + 2.0 * lights::Luminance(glm::vec3(1.f, 0.f, 0.f));
+		CHECK_NEAR(mesh.power, power, 1e-5);
+		CHECK_NEAR(mesh.triangles[0].pdf + mesh.triangles[1].pdf + mesh.triangles[2].pdf, 1.0, 1e-6);
+		CHECK_NEAR(mesh.triangles[2].pdf, 2.0 * lights::Luminance(glm::vec3(1.f, 0.f, 0.f)) / power, 1e-6);
+		std::vector<std::vector<lights::Triangle>> dark(2);
+		lights::MeshLights none;
+		CHECK(!lights::BuildMeshLights(dark, none));
+
+		// Three instances, one twice the size and one without lights
+		std::vector<lights::InstanceLights> instances(3);
+		instances[0].mesh = &mesh;
+		instances[1].mesh = nullptr;
+		instances[2].mesh = &mesh;
+		std::vector<glm::mat4> transforms = {
+			glm::translate(glm::vec3(5.f, 0.f, 0.f)),
+			glm::mat4(1.f),
+			glm::translate(glm::vec3(-5.f, 2.f, 0.f)) * glm::rotate(0.5f, glm::vec3(0.f, 0.f, 1.f)) * glm::scale(glm::vec3(2.f)),
+		};
+		std::vector<lights::GpuInstance> table;
+		double total = lights::BuildInstanceTable(instances, transforms, table);
+		CHECK_NEAR(total, 5.0 * mesh.power, 1e-4);
+		CHECK_NEAR(table[0].pdf, 0.2, 1e-6);
+		CHECK(table[1].pdf == 0.f && table[1].triangleCount == 0 && table[1].firstGeometry == lights::kNoLight);
+		CHECK_NEAR(table[2].pdf, 0.8, 1e-6);
+
+		// Samples land on the triangles in proportion to their world space power, with the density PdfArea reports
+		std::mt19937 random(23);
+		std::uniform_real_distribution<float> unit(0.f, 1.f);
+		const uint32_t sampleCount = 200000;
+		std::vector<uint32_t> counts(table.size() * mesh.triangles.size(), 0);
+		uint32_t mismatches = 0;
+		for (uint32_t i = 0; i < sampleCount; i++) {
+			float u[6];
+			for (float& value : u) {
+				value = unit(random);
+			}
+			lights::Sample sample = lights::SampleLight(table.data(), static_cast<uint32_t>(table.size()), mesh.triangles.data(), u);
+			counts[sample.instance * mesh.triangles.size() + sample.triangle]++;
+			const lights::GpuInstance& instance = table[sample.instance];
+			const lights::GpuTriangle& triangle = mesh.triangles[sample.triangle];
+			if (std::abs(sample.pdfArea - lights::PdfArea(instance, triangle)) > 1e-5f * sample.pdfArea)
+				mismatches++;
+			// On the plane of the triangle, inside its edges
+			glm::vec3 local = glm::vec3(glm::inverse(transforms[sample.instance]) * glm::vec4(sample.position, 1.f)) - triangle.p0;
+			glm::vec3 n = glm::cross(triangle.edge1, triangle.edge2);
+			float b1 = glm::dot(glm::cross(local, triangle.edge2), n) / glm::dot(n, n);
+			float b2 = glm::dot(glm::cross(triangle.edge1, local), n) / glm::dot(n, n);
+			if (std::abs(glm::dot(local, n)) > 1e-4f || b1 < -1e-4f || b2 < -1e-4f || b1 + b2 > 1.f + 1e-4f)
+				mismatches++;
+			if (std::abs(glm::length(sample.normal) - 1.f) > 1e-5f)
+				mismatches++;
+		}
+		CHECK(mismatches == 0);
+		for (size_t i = 0; i < table.size(); i++) {
+			for (size_t t = 0; t < mesh.triangles.size(); t++) {
+				double expected = double(table[i].pdf) * mesh.triangles[t].pdf;
+				CHECK_NEAR(counts[i * mesh.triangles.size() + t] / double(sampleCount), expected, 0.005);
+			}
+		}
+	}
+}
+
+int main() {
+	TestAliasTable();
+	TestSampling();
+	return test::Result();
+}
@@ -0,0 +1,96 @@
+#include "LodSelector.h"
+#include "Check.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <random>
+
+namespace {
+	void TestProjection() {
+		lod::Settings settings;
+		glm::mat4 view = glm::lookAt(glm::vec3(1.f, 2.f, 3.f), glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f));
+		glm::vec3 eye = lod::GetEyePosition(view);
+		CHECK_NEAR(glm::length(eye - glm::vec3(1.f, 2.f, 3.f)), 0.0, 1e-5);
+
+		glm::vec3 center;
+		float radius;
+		glm::mat4 transform = glm::translate(glm::mat4(1.f), glm::vec3(5.f, 0.f, 0.f)) * glm::scale(glm::mat4(1.f), glm::vec3(1.f, 3.f, 2.f));
+		lod::TransformBoundingSphere(transform, glm::vec4(0.f, 1.f, 0.f, 2.f), center, radius);
+		CHECK_NEAR(glm::length(center - glm::vec3(5.f, 3.f, 0.f)), 0.0, 1e-5);
+		CHECK_NEAR(radius, 6.0, 1e-5);
+
+		// Inside the sphere is full detail, the size halves with twice the distance
+		CHECK(std::isinf(lod::ProjectedSize(glm::vec3(0.f), 2.f, glm::vec3(1.f, 0.f, 0.f), settings)));
+		float near = lod::ProjectedSize(glm::vec3(0.f), 1.f, glm::vec3(10.f, 0.f, 0.f), settings);
+		float far = lod::ProjectedSize(glm::vec3(0.f), 1.f, glm::vec3(20.f, 0.f, 0.f), settings);
+		CHECK_NEAR(near, 2.f * far, 1e-3);
+		CHECK_NEAR(near, settings.viewportHeight / (10.f * std::tan(0.5f * settings.verticalFov)), 1e-3);
+
+		CHECK(lod::LevelForSize(settings.fullDetailPixels, 4, settings) == 0);
+		CHECK(lod::LevelForSize(settings.fullDetailPixels * 0.75f, 4, settings) == 0);
+		CHECK(lod::LevelForSize(settings.fullDetailPixels * 0.5f, 4, settings) == 1);
+		CHECK(lod::LevelForSize(settings.fullDetailPixels * 0.25f, 4, settings) == 2);
+		CHECK(lod::LevelForSize(1.f, 4, settings) == 3);
+		CHECK(lod::LevelForSize(0.f, 4, settings) == 3);
+		CHECK(lod::LevelForSize(1.f, 1, settings) == 0);
+	}
+
+	void TestBudget() {
+		std::mt19937 random(3);
+		std::uniform_real_distribution<float> unit(-1.f, 1.f);
+		const uint32_t levelCount = 4;
+		std::vector<lod::Candidate> candidates(300);
+		std::vector<uint64_t> levelTriangles;
+		for (auto& candidate : candidates) {
+			candidate.center = glm::vec3(unit(random), 0.f, unit(random)) * 20.f;
+			candidate.radius = 2.f + unit(random);
+			candidate.firstLevel = static_cast<uint32_t>(levelTriangles.size());
+			candidate.levelCount = levelCount;
+			uint64_t triangles = 1000 + random() % 5000;
+			for (uint32_t level = 0; level < levelCount; level++) {
+				levelTriangles.push_back(triangles >> level);
+			}
+		}
+		lod::Settings settings;
+		glm::vec3 eye(0.f, 1.7f, 0.f);
+		lod::Result unlimited;
+		lod::SelectLods(candidates, levelTriangles, eye, settings, unlimited);
+		uint64_t triangles = 0;
+		for (size_t i = 0; i < candidates.size(); i++) {
+			float size = lod::ProjectedSize(candidates[i].center, candidates[i].radius, eye, settings);
+			CHECK(unlimited.levels[i] == lod::LevelForSize(size, levelCount, settings));
+			triangles += levelTriangles[candidates[i].firstLevel + unlimited.levels[i]];
+		}
+		CHECK(unlimited.triangles == triangles);
+		CHECK(unlimited.withinBudget && unlimited.budgetCoarsenings == 0);
+		CHECK(unlimited.triangles < unlimited.fullDetailTriangles);
+
+		// The budget only coarsens, and the instance with the most pixels per triangle goes first
+		settings.triangleBudget = unlimited.triangles / 2;
+		lod::Result budget;
+		lod::SelectLods(candidates, levelTriangles, eye, settings, budget);
+		CHECK(budget.withinBudget && budget.triangles <= settings.triangleBudget);
+		CHECK(budget.budgetCoarsenings > 0);
+		triangles = 0;
+		uint32_t coarsenings = 0;
+		for (size_t i = 0; i < candidates.size(); i++) {
+			CHECK(budget.levels[i] >= unlimited.levels[i] && budget.levels[i] < levelCount);
+			coarsenings += budget.levels[i] - unlimited.levels[i];
+			triangles += levelTriangles[candidates[i].firstLevel + budget.levels[i]];
+		}
+		CHECK(budget.triangles == triangles);
+		CHECK(budget.budgetCoarsenings == coarsenings);
+
+		// A budget below the coarsest levels can't be met
+		settings.triangleBudget = 1;
+		lod::SelectLods(candidates, levelTriangles, eye, settings, budget);
+		CHECK(!budget.withinBudget);
+		for (uint32_t level : budget.levels) {
+			CHECK(level == levelCount - 1);
+		}
+	}
+}
+
+int main() {
+	TestProjection();
+	TestBudget();
+	return test::Result();
+}
@@ -0,0 +1,115 @@
+#include "OpacityMicromap.h"
+#include "Check.h"
+#include <random>
+
+namespace {
+	void TestMicroTriangles() {
+		for (uint32_t level = 0; level <= 4; level++) {
+			uint32_t count = omm::MicroTriangleCount(level);
+			CHECK(count == (1u << (2 * level)));
+			double area = 0.0;
+			bool inside = true;
+			bool sameWinding = true;
+			for (uint32_t i = 0; i < count; i++) {
+				glm::vec2 b[3];
+				omm::GetMicroTriangle(level, i, b[0], b[1], b[2]);
+				glm::vec2 e1 = b[1] - b[0], e2 = b[2] - b[0];
+				float cross = e1.x * e2.y - e1.y * e2.x;
+				sameWinding &= cross > 0.f;
+				area += 0.5 * cross;
+				for (const glm::vec2& corner : b) {
+					inside &= corner.x >= 0.f && corner.y >= 0.f && corner.x + corner.y <= 1.f + 1e-6f;
+				}
+			}
+			// They tile the triangle: same winding, the area of the whole and all inside it
+			CHECK(sameWinding && inside);
+			CHECK_NEAR(area, 0.5, 1e-6);
+		}
+	}
+
+	// Micro-triangle containing barycentrics b, ~0u on an edge
+	uint32_t FindMicroTriangle(uint32_t level, const glm::vec2& b) {
+		for (uint32_t i = 0; i < omm::MicroTriangleCount(level); i++) {
+			glm::vec2 c[3];
+			omm::GetMicroTriangle(level, i, c[0], c[1], c[2]);
+			bool in = true;
+			for (int k = 0; k < 3; k++) {
+				glm::vec2 e = c[(k + 1) % 3] - c[k];
+				glm::vec2 d = b - c[k];
+				in &= e.x * d.y - e.y * d.x > 1e-6f;
+			}
+			if (in)
+				return i;
+		}
+		return ~0u;
+	}
+
+	void TestBake() {
+		// Opaque on the left half of the texture, transparent on the right
+		const int size = 64;
+		std::vector<uint8_t> pixels(size * size * 4, 255);
+		for (int y = 0; y < size; y++) {
+			for (int x = size / 2; x < size; x++) {
+				pixels[(y * size + x) * 4 + 3] = 0;
+			}
+		}
+		std::vector<glm::vec2> texcoords = { glm::vec2(0.f), glm::vec2(1.f, 0.f), glm::vec2(1.f), glm::vec2(0.f, 1.f) };
+		std::vector<uint32_t> indices = { 0, 1, 2, 0, 2, 3 };
+		omm::BakeInput input;
+		input.texcoords = texcoords.data();
+		input.indices = indices.data();
+		input.triangleCount = 2;
+		input.texture.pixels = pixels.data();
+		input.texture.width = size;
+		input.texture.height = size;
+		input.subdivisionLevel = 4;
+		omm::BakeResult result = omm::Bake(input, 1);
+		uint32_t microCount = omm::MicroTriangleCount(input.subdivisionLevel);
+		CHECK(result.subdivisionLevel == input.subdivisionLevel);
+		CHECK(result.states.size() == 2 * microCount);
+		CHECK(result.stats.MicroTriangles() == 2 * microCount);
+		CHECK(result.stats.opaque > 0 && result.stats.transparent > 0 && result.stats.unknown > 0);
+		// Unknown along the middle and along u = 0 and 1, where the wrapping footprint reads both halves
+		CHECK(result.stats.ResolvedFraction() > 0.7);
+		CHECK(omm::Bake(input, 4).states == result.states);
+
+		// Resolved micro-triangles only cover texels of their state
+		std::mt19937 random(29);
+		std::uniform_real_distribution<float> unit(0.f, 1.f);
+		uint32_t wrong = 0;
+		for (uint32_t i = 0; i < 20000; i++) {
+			glm::vec2 b(unit(random), unit(random));
+			if (b.x + b.y >= 1.f)
+				b = glm::vec2(1.f) - b;
+			uint32_t triangle = i & 1;
+			uint32_t micro = FindMicroTriangle(input.subdivisionLevel, b);
+			if (micro == ~0u)
+				continue;
+			const uint32_t* tri = &indices[3 * triangle];
+			glm::vec2 uv = texcoords[tri[0]] * (1.f - b.x - b.y) + texcoords[tri[1]] * b.x + texcoords[tri[2]] * b.y;
+			int x = (std::min)(static_cast<int>(uv.x * size), size - 1);
+			bool opaque = x < size / 2;
+			omm::OpacityState state = result.states[triangle * microCount + micro];
+			if ((state == omm::OpacityState::Opaque && !opaque) || (state == omm::OpacityState::Transparent && opaque))
+				wrong++;
+		}
+		CHECK(wrong == 0);
+
+		// Uniform textures and the alpha factor
+		CHECK(omm::ClassifyTriangle(input.texture, 1.f, 0.5f, glm::vec2(0.1f), glm::vec2(0.2f, 0.1f), glm::vec2(0.1f, 0.3f)) == omm::OpacityState::Opaque);
+		CHECK(omm::ClassifyTriangle(input.texture, 1.f, 0.5f, glm::vec2(0.7f), glm::vec2(0.8f, 0.7f), glm::vec2(0.7f, 0.9f)) == omm::OpacityState::Transparent);
+		CHECK(omm::ClassifyTriangle(input.texture, 0.3f, 0.5f, glm::vec2(0.1f), glm::vec2(0.2f, 0.1f), glm::vec2(0.1f, 0.3f)) == omm::OpacityState::Transparent);
+		omm::OpacityState straddling = omm::ClassifyTriangle(input.texture, 1.f, 0.5f, glm::vec2(0.4f), glm::vec2(0.6f, 0.4f), glm::vec2(0.4f, 0.6f));
+		CHECK(straddling == omm::OpacityState::UnknownOpaque || straddling == omm::OpacityState::UnknownTransparent);
+		// Without alpha in the texture only the factor counts
+		omm::AlphaTexture rgb = input.texture;
+		rgb.components = 3;
+		CHECK(omm::ClassifyTriangle(rgb, 1.f, 0.5f, glm::vec2(0.7f), glm::vec2(0.8f, 0.7f), glm::vec2(0.7f, 0.9f)) == omm::OpacityState::Opaque);
+	}
+}
+
+int main() {
+	TestMicroTriangles();
+	TestBake();
+	return test::Result();
+}
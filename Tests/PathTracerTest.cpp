@@ -0,0 +1,191 @@
+#include "PathTracer.h"
+#include "RenderModes.h"
+#include "Check.h"
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace {
+	// Quad p, p + a, p + a + b, p + b with texcoords tiled repeat times
+	void AddQuad(bvh::Mesh& mesh, pt::Surfaces& surfaces, const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, float repeat) {
+		uint32_t first = static_cast<uint32_t>(mesh.positions.size());
+		glm::vec3 normal = glm::normalize(glm::cross(a, b));
+		glm::vec3 corners[4] = { p, p + a, p + a + b, p + b };
+		glm::vec2 texcoords[4] = { glm::vec2(0.f), glm::vec2(repeat, 0.f), glm::vec2(repeat), glm::vec2(0.f, repeat) };
+		for (int i = 0; i < 4; i++) {
+			mesh.positions.push_back(corners[i]);
+			surfaces.normals.push_back(normal);
+			surfaces.texcoords.push_back(texcoords[i]);
+		}
+		mesh.triangles.push_back(glm::uvec3(first, first + 1, first + 2));
+		mesh.triangles.push_back(glm::uvec3(first, first + 2, first + 3));
+		surfaces.triangleMaterials.insert(surfaces.triangleMaterials.end(), 2, 0);
+	}
+	pt::Texture MakeChecker(int size, uint8_t a, uint8_t b) {
+		pt::Texture texture;
+		texture.width = texture.height = size;
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				uint8_t value = ((x / 4 + y / 4) & 1) ? a : b;
+				texture.pixels.insert(texture.pixels.end(), { value, value, value, 255 });
+			}
+		}
+		return texture;
+	}
+
+	// A closed room of 4 x 3 x 4 with a light on the ceiling, the walls face inwards
+	struct Room {
+		bvh::Blas walls;
+		bvh::Blas light;
+		pt::Surfaces wallSurfaces;
+		pt::Surfaces lightSurfaces;
+		bvh::Tlas tlas;
+		pt::Scene scene;
+		pt::Camera camera;
+		Room() {
+			bvh::Mesh wallMesh;
+			glm::vec3 x(4.f, 0.f, 0.f), y(0.f, 3.f, 0.f), z(0.f, 0.f, 4.f);
+			glm::vec3 corner(-2.f, 0.f, -2.f);
+			AddQuad(wallMesh, wallSurfaces, corner, z, x, 4.f); // Floor
+			AddQuad(wallMesh, wallSurfaces, corner + y, x, z, 4.f); // Ceiling
+			AddQuad(wallMesh, wallSurfaces, corner, x, y, 4.f); // Back
+			AddQuad(wallMesh, wallSurfaces, corner + z, y, x, 4.f); // Front
+			AddQuad(wallMesh, wallSurfaces, corner, y, z, 4.f); // Left
+			AddQuad(wallMesh, wallSurfaces, corner + x, z, y, 4.f); // Right
+			pt::Material wall;
+			wall.baseColor = glm::vec4(0.8f, 0.7f, 0.6f, 1.f);
+			wall.baseTexture = 0;
+			wallSurfaces.materials.push_back(wall);
+			wallSurfaces.textures.push_back(MakeChecker(256, 255, 160));
+			bvh::BuildBlas(std::move(wallMesh), bvh::BuildSettings(), walls);
+
+			bvh::Mesh lightMesh;
+			AddQuad(lightMesh, lightSurfaces, glm::vec3(-0.5f, 2.95f, -0.5f), glm::vec3(1.f, 0.f, 0.f), glm::vec3(0.f, 0.f, 1.f), 1.f);
+			pt::Material emitter;
+			emitter.baseTexture = -1;
+			emitter.emissive = glm::vec3(8.f);
+			emitter.emissiveTexture = 0;
+			lightSurfaces.materials.push_back(emitter);
+			lightSurfaces.textures.push_back(MakeChecker(1, 255, 255));
+			bvh::BuildBlas(std::move(lightMesh), bvh::BuildSettings(), light);
+
+			std::vector<bvh::Instance> instances(2);
+			instances[0].blas = &walls;
+			instances[1].blas = &light;
+			tlas.Build(instances);
+			scene.tlas = &tlas;
+			scene.surfaces = { &wallSurfaces, &lightSurfaces };
+			pt::BuildSceneLights(scene);
+
+			camera.width = 32;
+			camera.height = 32;
+			camera.viewInv = glm::inverse(glm::lookAt(glm::vec3(0.f, 1.5f, 1.8f), glm::vec3(0.f, 1.f, -2.f), glm::vec3(0.f, 1.f, 0.f)));
+			camera.projectionInv = glm::inverse(glm::perspective(glm::radians(60.f), 1.f, 0.1f, 1000.f));
+		}
+	};
+
+	void TestHelpers() {
+		uint32_t seed = pt::PixelSeed(17, 3);
+		glm::vec3 normal = glm::normalize(glm::vec3(0.3f, -0.5f, 0.8f));
+		double cosine = 0.0;
+		float maxPackingError = 0.f;
+		bool inRange = true;
+		bool aboveSurface = true;
+		const uint32_t count = 100000;
+		for (uint32_t i = 0; i < count; i++) {
+			float u = pt::Rand(seed);
+			inRange &= u >= 0.f && u < 1.f;
+			glm::vec3 direction = pt::GetDiffuseReflected(normal, seed);
+			aboveSurface &= glm::dot(direction, normal) >= 0.f;
+			cosine += glm::dot(direction, normal);
+			maxPackingError = (std::max)(maxPackingError, glm::length(pt::UnpackNormal(pt::PackNormal(direction)) - direction));
+			maxPackingError = (std::max)(maxPackingError, glm::length(pt::UnpackNormal(pt::PackNormal(-direction)) + direction));
+		}
+		CHECK(inRange && aboveSurface);
+		// The mean cosine of a cosine weighted hemisphere is 2/3
+		CHECK_NEAR(cosine / count, 2.0 / 3.0, 0.01);
+		CHECK(maxPackingError < 1e-4f);
+
+		CHECK_NEAR(pt::PowerHeuristic(1.f, 1.f), 0.5, 1e-6);
+		CHECK_NEAR(pt::PowerHeuristic(2.f, 1.f) + pt::PowerHeuristic(1.f, 2.f), 1.0, 1e-6);
+		CHECK(pt::PowerHeuristic(0.f, 0.f) == 0.f);
+		CHECK(pt::SurvivalProbability(glm::vec3(1.f)) == 1.f);
+		CHECK_NEAR(pt::SurvivalProbability(glm::vec3(0.5f * render::kPathRouletteThreshold, 0.f, 0.f)), 0.5, 1e-6);
+	}
+
+	void TestLights(const Room& room) {
+		const pt::SceneLights& lights = room.scene.lights;
+		CHECK(lights.meshes.size() == 1);
+		CHECK(lights.triangles.size() == 2);
+		CHECK(lights.instances.size() == 2);
+		CHECK(lights.instances[0].triangleCount == 0 && lights.instances[0].firstGeometry == lights::kNoLight);
+		CHECK(lights.instances[1].triangleCount == 2 && lights.instances[1].pdf == 1.f);
+		CHECK_NEAR(lights.power, 8.0, 1e-4);
+		// Hits on the light report its triangle
+		bvh::Ray up;
+		up.origin = glm::vec3(0.1f, 1.f, 0.2f);
+		up.direction = glm::vec3(0.f, 1.f, 0.f);
+		pt::SurfaceHit hit;
+		CHECK(pt::IntersectSurface(room.scene, up, hit));
+		CHECK(hit.emissive && hit.instance == 1 && hit.light < 2);
+		CHECK_NEAR(hit.t, 1.95, 1e-4);
+		bvh::Ray down = up;
+		down.direction = -up.direction;
+		pt::SurfaceHit floor;
+		CHECK(pt::IntersectSurface(room.scene, down, floor));
+		CHECK(!floor.emissive && floor.instance == 0 && floor.light == lights::kNoLight);
+		CHECK(glm::length(floor.normal - glm::vec3(0.f, 1.f, 0.f)) < 1e-5f);
+	}
+
+	void TestEstimators(const Room& room) {
+		pt::Settings settings;
+		settings.maxBounces = 6;
+		settings.samplesPerPixel = 4;
+		// The loop and the recursion only differ by the normal packing
+		pt::EstimatorComparison comparison = pt::CompareEstimators(room.scene, room.camera, settings);
+		CHECK(comparison.loopMean > 0.05);
+		CHECK(std::abs(comparison.RelativeDifference()) < 0.01);
+
+		// Next event estimation and Russian roulette change the variance, not the mean
+		settings.samplesPerPixel = 64;
+		settings.nextEventEstimation = false;
+		settings.rouletteDepth = settings.maxBounces;
+		std::vector<glm::vec3> bounces, nextEvent, roulette;
+		pt::Render(room.scene, room.camera, settings, pt::Estimator::Loop, bounces);
+		settings.nextEventEstimation = true;
+		settings.firstSample = 1000;
+		pt::Render(room.scene, room.camera, settings, pt::Estimator::Loop, nextEvent);
+		settings.rouletteDepth = 1;
+		settings.firstSample = 2000;
+		pt::Render(room.scene, room.camera, settings, pt::Estimator::Loop, roulette);
+		double mean = pt::MeanRadiance(bounces);
+		CHECK_NEAR(pt::MeanRadiance(nextEvent), mean, 0.03 * mean);
+		CHECK_NEAR(pt::MeanRadiance(roulette), mean, 0.03 * mean);
+
+		settings.samplesPerPixel = 16;
+		settings.rouletteDepth = settings.maxBounces;
+		settings.nextEventEstimation = false;
+		pt::Efficiency withoutLights = pt::MeasureEfficiency(room.scene, room.camera, settings);
+		settings.nextEventEstimation = true;
+		pt::Efficiency withLights = pt::MeasureEfficiency(room.scene, room.camera, settings);
+		CHECK(withLights.variance < 0.5 * withoutLights.variance);
+	}
+
+	void TestTextureLod(const Room& room) {
+		pt::TextureLodReport report = pt::AnalyzeTextureLod(room.scene, room.camera);
+		// Every pixel sees a textured wall, apart from the untextured light
+		CHECK(report.fetches > 0.9 * room.camera.width * room.camera.height);
+		CHECK(report.referenceFetches > 0.8 * report.fetches);
+		// The cone follows the texel footprint much closer than the distance, and reads less memory than mip 0
+		CHECK(report.coneError < 0.5 * report.distanceError);
+		CHECK(report.coneError < 1.0);
+		CHECK(report.coneCache.misses < report.finestCache.misses);
+	}
+}
+
+int main() {
+	TestHelpers();
+	Room room;
+	TestLights(room);
+	TestEstimators(room);
+	TestTextureLod(room);
+	return test::Result();
+}
@@ -0,0 +1,30 @@
+#include "RenderModes.h"
+#include "Check.h"
+
+namespace {
+	void TestGrouping() {
+		// Every mode has a pipeline with its recursion depth and payload, the path tracer gets one of its own
+		std::vector<uint32_t> modePipelines;
+		std::vector<render::PipelineDesc> pipelines = render::GroupModes(render::kModes, render::kModeCount, modePipelines);
+		CHECK(modePipelines.size() == render::kModeCount);
+		CHECK(pipelines.size() == 3);
+		uint32_t grouped = 0;
+		for (uint32_t mode = 0; mode < render::kModeCount; mode++) {
+			const render::PipelineDesc& pipeline = pipelines[modePipelines[mode]];
+			CHECK(pipeline.maxRecursionDepth == render::kModes[mode].maxRecursionDepth);
+			CHECK(pipeline.maxPayloadSize == render::kModes[mode].maxPayloadSize);
+		}
+		for (const render::PipelineDesc& pipeline : pipelines) {
+			grouped += static_cast<uint32_t>(pipeline.modes.size());
+		}
+		CHECK(grouped == render::kModeCount);
+		CHECK(pipelines[modePipelines[render::kPathTracingMode]].modes.size() == 1);
+		CHECK(pipelines[modePipelines[render::kPathTracingMode]].maxPayloadSize == render::kHitInfoSize);
+		CHECK(render::kColorHitInfoSize < render::kHitInfoSize);
+	}
+}
+
+int main() {
+	TestGrouping();
+	return test::Result();
+}
@@ -0,0 +1,168 @@
+#include "Simplify.h"
+#include "Check.h"
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+namespace {
+	struct TestMesh {
+		std::vector<glm::vec3> positions;
+		std::vector<uint32_t> indices;
+		simplify::MeshInput Input() const {
+			simplify::MeshInput input;
+			input.positions = reinterpret_cast<const uint8_t*>(positions.data());
+			input.vertexCount = static_cast<uint32_t>(positions.size());
+			input.indices = indices.data();
+			input.indexCount = static_cast<uint32_t>(indices.size());
+			return input;
+		}
+	};
+	// UV sphere whose first and last column are different vertices at the same positions, a texture seam.
+	// The poles are one position each
+	TestMesh MakeSeamSphere(uint32_t stacks) {
+		TestMesh mesh;
+		uint32_t slices = 2 * stacks;
+		for (uint32_t i = 0; i <= stacks; i++) {
+			float theta = 3.14159265f * i / stacks;
+			for (uint32_t j = 0; j <= slices; j++) {
+				float phi = 2.f * 3.14159265f * (j % slices) / slices;
+				glm::vec3 p(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+				if (i == 0 || i == stacks)
+					p = glm::vec3(0.f, i == 0 ? 1.f : -1.f, 0.f);
+				mesh.positions.push_back(p);
+			}
+		}
+		for (uint32_t i = 0; i < stacks; i++) {
+			for (uint32_t j = 0; j < slices; j++) {
+				uint32_t a = i * (slices + 1) + j;
+				uint32_t b = a + slices + 1;
+				if (i > 0)
+					mesh.indices.insert(mesh.indices.end(), { a, a + 1, b });
+				if (i + 1 < stacks)
+					mesh.indices.insert(mesh.indices.end(), { a + 1, b + 1, b });
+			}
+		}
+		return mesh;
+	}
+	// Flat square of size x size quads in the xz plane
+	TestMesh MakeGrid(uint32_t size) {
+		TestMesh mesh;
+		for (uint32_t i = 0; i <= size; i++) {
+			for (uint32_t j = 0; j <= size; j++) {
+				mesh.positions.push_back(glm::vec3(float(j) / size, 0.f, float(i) / size));
+			}
+		}
+		for (uint32_t i = 0; i < size; i++) {
+			for (uint32_t j = 0; j < size; j++) {
+				uint32_t a = i * (size + 1) + j;
+				uint32_t b = a + size + 1;
+				mesh.indices.insert(mesh.indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+			}
+		}
+		return mesh;
+	}
+	// Uses of every edge between positions, the vertices of a seam count as one
+	std::map<std::pair<std::tuple<float, float, float>, std::tuple<float, float, float>>, int> PositionEdges(const TestMesh& mesh, const std::vector<uint32_t>& indices) {
+		std::map<std::pair<std::tuple<float, float, float>, std::tuple<float, float, float>>, int> edges;
+		for (size_t i = 0; i < indices.size(); i += 3) {
+			for (int k = 0; k < 3; k++) {
+				glm::vec3 p = mesh.positions[indices[i + k]];
+				glm::vec3 q = mesh.positions[indices[i + (k + 1) % 3]];
+				auto a = std::make_tuple(p.x, p.y, p.z);
+				auto b = std::make_tuple(q.x, q.y, q.z);
+				edges[std::make_pair((std::min)(a, b), (std::max)(a, b))]++;
+			}
+		}
+		return edges;
+	}
+
+	void TestSphere() {
+		TestMesh mesh = MakeSeamSphere(50);
+		simplify::Settings settings;
+		settings.levelCount = 5;
+		settings.maxError = 0.05f;
+		std::vector<simplify::Level> levels;
+		simplify::BuildLodChain(mesh.Input(), settings, levels);
+		CHECK(levels.size() == 4);
+		size_t previousTriangles = mesh.indices.size() / 3;
+		float previousError = 0.f;
+		for (const auto& level : levels) {
+			size_t triangles = level.indices.size() / 3;
+			CHECK(level.indices.size() % 3 == 0);
+			CHECK(triangles <= previousTriangles * 0.6);
+			CHECK(level.error >= previousError && level.error <= settings.maxError);
+			for (uint32_t index : level.indices) {
+				CHECK(index < mesh.positions.size());
+			}
+			// The seam collapses on both sides together, so the surface stays closed and manifold
+			int open = 0, nonManifold = 0;
+			for (const auto& edge : PositionEdges(mesh, level.indices)) {
+				open += edge.second == 1;
+				nonManifold += edge.second > 2;
+			}
+			CHECK(open == 0);
+			CHECK(nonManifold == 0);
+			// Vertices stay on the sphere, so triangle centers are at most the error inside it.
+			// The error is relative to the bounds diagonal of sqrt(12)
+			for (size_t i = 0; i < level.indices.size(); i += 3) {
+				glm::vec3 center = (mesh.positions[level.indices[i]] + mesh.positions[level.indices[i + 1]] + mesh.positions[level.indices[i + 2]]) / 3.f;
+				CHECK(1.f - glm::length(center) < 0.1f);
+			}
+			previousTriangles = triangles;
+			previousError = level.error;
+		}
+	}
+
+	void TestFlatGrid() {
+		TestMesh mesh = MakeGrid(32);
+		simplify::Settings settings;
+		settings.levelCount = 6;
+		settings.maxError = 0.01f;
+		std::vector<simplify::Level> levels;
+		simplify::BuildLodChain(mesh.Input(), settings, levels);
+		// A plane has no error to collapse, only the border planes keep the outline
+		CHECK(levels.size() == 5);
+		for (const auto& level : levels) {
+			CHECK(level.error < 1e-4f);
+			glm::vec3 boundsMin(1.f), boundsMax(0.f);
+			float area = 0.f;
+			for (size_t i = 0; i < level.indices.size(); i += 3) {
+				glm::vec3 p[3];
+				for (int k = 0; k < 3; k++) {
+					p[k] = mesh.positions[level.indices[i + k]];
+					boundsMin = glm::min(boundsMin, p[k]);
+					boundsMax = glm::max(boundsMax, p[k]);
+				}
+				glm::vec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+				CHECK(n.y > 0.f); // No flipped triangles
+				area += 0.5f * glm::length(n);
+			}
+			CHECK(boundsMin == glm::vec3(0.f) && boundsMax == glm::vec3(1.f, 0.f, 1.f));
+			CHECK_NEAR(area, 1.0, 1e-4);
+		}
+	}
+
+	void TestParallelChains() {
+		TestMesh mesh = MakeSeamSphere(20);
+		simplify::Settings settings;
+		std::vector<simplify::MeshInput> meshes(6, mesh.Input());
+		std::vector<std::vector<simplify::Level>> chains;
+		simplify::BuildLodChains(meshes, settings, chains, 3);
+		std::vector<simplify::Level> single;
+		simplify::BuildLodChain(mesh.Input(), settings, single);
+		CHECK(chains.size() == meshes.size());
+		for (const auto& chain : chains) {
+			CHECK(chain.size() == single.size());
+			for (size_t i = 0; i < chain.size() && i < single.size(); i++) {
+				CHECK(chain[i].indices == single[i].indices);
+			}
+		}
+	}
+}
+
+int main() {
+	TestSphere();
+	TestFlatGrid();
+	TestParallelChains();
+	return test::Result();
+}
@@ -0,0 +1,79 @@
+#include "Skinning.h"
+#include "Check.h"
+#include <glm/gtx/transform.hpp>
+#include <random>
+
+namespace {
+	void TestSkinning() {
+		std::mt19937 random(17);
+		std::uniform_real_distribution<float> unit(0.f, 1.f);
+		const uint32_t vertexCount = 10000;
+		const uint32_t jointCount = 8;
+		std::vector<glm::vec3> positions(vertexCount), normals(vertexCount);
+		std::vector<glm::uvec4> joints(vertexCount);
+		std::vector<glm::vec4> weights(vertexCount);
+		for (uint32_t v = 0; v < vertexCount; v++) {
+			positions[v] = glm::vec3(unit(random), unit(random), unit(random));
+			normals[v] = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + 0.1f);
+			joints[v] = glm::uvec4(random() % jointCount, random() % jointCount, random() % jointCount, random() % jointCount);
+			glm::vec4 w(unit(random), unit(random), unit(random), unit(random));
+			weights[v] = w / (w.x + w.y + w.z + w.w);
+		}
+		skin::SkinningInput input;
+		input.positions = positions.data();
+		input.normals = normals.data();
+		input.joints = joints.data();
+		input.weights = weights.data();
+		input.vertexCount = vertexCount;
+
+		// The bind pose: joints at their bind transforms leave the mesh where it is, in the space of the mesh node
+		skin::NodeHierarchy hierarchy;
+		hierarchy.parents.push_back(-1);
+		hierarchy.localTransforms.push_back(glm::translate(glm::vec3(3.f, 0.f, 0.f)));
+		skin::Skin skin;
+		skin.meshNode = 0;
+		for (uint32_t j = 0; j < jointCount; j++) {
+			hierarchy.parents.push_back(j == 0 ? 0 : static_cast<int>(j));
+			hierarchy.localTransforms.push_back(glm::rotate(0.2f * j, glm::vec3(0.f, 1.f, 0.f)) * glm::translate(glm::vec3(0.f, 0.5f, 0.f)));
+			skin.jointNodes.push_back(static_cast<int>(j + 1));
+		}
+		hierarchy.Finalize();
+		std::vector<glm::mat4> globals;
+		hierarchy.ComputeGlobalTransforms(globals);
+		for (uint32_t j = 0; j < jointCount; j++) {
+			skin.inverseBindMatrices.push_back(glm::inverse(globals[j + 1]) * globals[0]);
+		}
+		std::vector<glm::mat4> jointMatrices(jointCount);
+		skin::ComputeJointMatrices(skin, globals, jointMatrices.data());
+		std::vector<glm::vec3> skinned(vertexCount), skinnedNormals(vertexCount);
+		skin::SkinVerticesParallel(input, jointMatrices.data(), skinned.data(), skinnedNormals.data(), 4);
+		float maxDifference = 0.f;
+		for (uint32_t v = 0; v < vertexCount; v++) {
+			maxDifference = (std::max)(maxDifference, glm::length(skinned[v] - positions[v]) + glm::length(skinnedNormals[v] - normals[v]));
+		}
+		CHECK(maxDifference < 1e-4f);
+
+		// A posed skeleton, the parallel pass matches the single threaded one
+		for (uint32_t j = 0; j < jointCount; j++) {
+			jointMatrices[j] = glm::translate(glm::vec3(unit(random), unit(random), unit(random))) * glm::rotate(unit(random), glm::vec3(1.f, 0.f, 0.f));
+		}
+		std::vector<glm::vec3> serial(vertexCount), serialNormals(vertexCount);
+		skin::SkinVertices(input, jointMatrices.data(), serial.data(), serialNormals.data(), 0, vertexCount);
+		skin::SkinVerticesParallel(input, jointMatrices.data(), skinned.data(), skinnedNormals.data(), 4);
+		CHECK(serial == skinned && serialNormals == skinnedNormals);
+		// Every vertex with all its weight on one joint follows that joint
+		for (uint32_t v = 0; v < 100; v++) {
+			joints[v] = glm::uvec4(v % jointCount, 0, 0, 0);
+			weights[v] = glm::vec4(1.f, 0.f, 0.f, 0.f);
+		}
+		skin::SkinVertices(input, jointMatrices.data(), serial.data(), serialNormals.data(), 0, 100);
+		for (uint32_t v = 0; v < 100; v++) {
+			CHECK(glm::length(serial[v] - glm::vec3(jointMatrices[v % jointCount] * glm::vec4(positions[v], 1.f))) < 1e-5f);
+		}
+	}
+}
+
+int main() {
+	TestSkinning();
+	return test::Result();
+}
@@ -0,0 +1,92 @@
+#include "TextureLod.h"
+#include "Check.h"
+#include <glm/gtx/transform.hpp>
+
+namespace {
+	void TestLevels() {
+		// A 2 x 2 right triangle mapped to half of the texture
+		glm::vec3 p0(0.f), p1(2.f, 0.f, 0.f), p2(0.f, 2.f, 0.f);
+		glm::vec2 uv0(0.f), uv1(1.f, 0.f), uv2(0.f, 1.f);
+		texlod::TriangleLod triangle = texlod::ComputeTriangleLod(p0, p1, p2, uv0, uv1, uv2);
+		CHECK_NEAR(triangle.base, -1.0, 1e-6);
+		CHECK(triangle.normal == glm::vec3(0.f, 0.f, 1.f));
+		// Degenerate triangles have no normal, ones without texture area read the finest level
+		CHECK(texlod::ComputeTriangleLod(p0, p1, p1, uv0, uv1, uv2).normal == glm::vec3(0.f));
+		CHECK(texlod::ComputeTriangleLod(p0, p1, p2, uv0, uv0, uv0).base < -32.f);
+
+		// A cone one texel wide hitting head on reads level 0, every doubling is a level
+		const uint32_t size = 256;
+		float texel = 2.f / size;
+		glm::vec3 down(0.f, 0.f, -1.f);
+		CHECK_NEAR(texlod::TextureLod(triangle, size, size, texel, down), 0.0, 1e-5);
+		CHECK_NEAR(texlod::TextureLod(triangle, size, size, 4.f * texel, down), 2.0, 1e-5);
+		CHECK_NEAR(texlod::TextureLod(triangle, 2 * size, 2 * size, texel, down), 1.0, 1e-5);
+		// At 60 degrees the footprint is twice as long
+		glm::vec3 slanted(std::sin(glm::radians(60.f)), 0.f, -std::cos(glm::radians(60.f)));
+		CHECK_NEAR(texlod::TextureLod(triangle, size, size, texel, slanted), 1.0, 1e-4);
+		// An instance scaling areas by 4 makes the texels twice as large
+		CHECK_NEAR(texlod::TextureLod(triangle, size, size, texel, down, 2.f), -1.0, 1e-5);
+		// Grazing and zero width cones stay finite
+		CHECK(std::isfinite(texlod::TextureLod(triangle, size, size, texel, glm::vec3(1.f, 0.f, 0.f))));
+		CHECK(std::isfinite(texlod::TextureLod(triangle, size, size, 0.f, down)));
+
+		// The transform is baked into the lods, a uniform scale of 2 is one level finer
+		std::vector<glm::vec3> positions = { p0, p1, p2 };
+		std::vector<uint32_t> indices = { 0, 1, 2, 0, 1, 7 };
+		std::vector<std::vector<glm::vec2>> texcoords = { { uv0, uv1, uv2 }, { uv0, 2.f * uv1, 2.f * uv2 } };
+		std::vector<texlod::TriangleLod> lods;
+		texlod::BuildTriangleLods(positions, glm::scale(glm::vec3(2.f)), indices, texcoords, lods);
+		CHECK(lods.size() == 4);
+		CHECK_NEAR(lods[0].base, -2.0, 1e-6);
+		CHECK_NEAR(lods[1].base, -1.0, 1e-6);
+		// Out of range indices leave the default
+		CHECK(lods[2].normal == glm::vec3(0.f) && lods[3].base == 0.f);
+
+		CHECK_NEAR(texlod::SpreadAngle(glm::vec3(0.f, 0.f, 1.f), glm::vec3(1e-4f, 0.f, 1.f)), 1e-4, 1e-8);
+		CHECK(texlod::MipCount(256, 256) == 8);
+		CHECK(texlod::MipCount(300, 20) == 8);
+		CHECK(texlod::MipCount(1, 1) == 1);
+	}
+
+	// Fetches in a row across the texture, step texels apart
+	texlod::CacheStats Sweep(float lod, uint32_t step) {
+		const uint32_t size = 1024;
+		texlod::TextureCache cache;
+		for (uint32_t y = 0; y < size; y += step) {
+			for (uint32_t x = 0; x < size; x += step) {
+				cache.Fetch(0, size, size, glm::vec2((x + 0.5f) / size, (y + 0.5f) / size), lod);
+			}
+		}
+		return cache.GetStats();
+	}
+
+	void TestCache() {
+		// The same footprint twice only misses once
+		texlod::TextureCache cache;
+		cache.Fetch(1, 64, 64, glm::vec2(0.3f, 0.3f), 0.f);
+		uint64_t misses = cache.GetStats().misses;
+		CHECK(misses > 0);
+		cache.Fetch(1, 64, 64, glm::vec2(0.3f, 0.3f), 0.f);
+		CHECK(cache.GetStats().misses == misses);
+		CHECK(cache.GetStats().fetches == 2);
+		// Trilinear fetches touch two levels, levels beyond the last one are clamped
+		texlod::TextureCache trilinear;
+		trilinear.Fetch(1, 64, 64, glm::vec2(0.5f), 0.5f);
+		texlod::TextureCache bilinear;
+		bilinear.Fetch(1, 64, 64, glm::vec2(0.5f), 100.f);
+		CHECK(trilinear.GetStats().lines > bilinear.GetStats().lines);
+
+		// Fetches 4 texels apart read the level where they are one texel apart much more cheaply
+		texlod::CacheStats fine = Sweep(0.f, 4);
+		texlod::CacheStats matched = Sweep(2.f, 4);
+		CHECK(fine.fetches == matched.fetches);
+		CHECK(matched.MissesPerFetch() < 0.5 * fine.MissesPerFetch());
+		CHECK(matched.HitRate() > fine.HitRate());
+	}
+}
+
+int main() {
+	TestLevels();
+	TestCache();
+	return test::Result();
+}
@@ -0,0 +1,146 @@
+#include "TwoLevelBvh.h"
+#include "RayQuery.h"
+#include "Check.h"
+#include <glm/gtx/transform.hpp>
+#include <random>
+
+namespace {
+	// Closest hit over the BLAS of every instance the mask reaches, t along the world space ray
+	bool BruteForce(const std::vector<bvh::Instance>& instances, const bvh::Ray& ray, uint32_t mask, bvh::InstanceHit& hit) {
+		hit = bvh::InstanceHit();
+		for (uint32_t i = 0; i < instances.size(); i++) {
+			const bvh::Instance& instance = instances[i];
+			if ((instance.mask & mask) == 0)
+				continue;
+			glm::mat4 inverse = glm::inverse(instance.transform);
+			bvh::Ray local = ray;
+			local.origin = glm::vec3(inverse * glm::vec4(ray.origin, 1.f));
+			local.direction = glm::vec3(inverse * glm::vec4(ray.direction, 0.f));
+			local.tMax = (std::min)(ray.tMax, hit.hit.t);
+			const bvh::Mesh& mesh = instance.blas->mesh;
+			for (uint32_t p = 0; p < mesh.triangles.size(); p++) {
+				const glm::uvec3& tri = mesh.triangles[p];
+				float t, u, v;
+				if (bvh::IntersectTriangle(local, mesh.positions[tri.x], mesh.positions[tri.y], mesh.positions[tri.z], local.tMax, t, u, v)) {
+					local.tMax = t;
+					hit.hit.t = t;
+					hit.hit.primitive = p;
+					hit.instance = i;
+				}
+			}
+		}
+		return hit.instance != ~0u;
+	}
+	void MakeInstances(const bvh::Blas& blas, uint32_t count, float offset, std::vector<bvh::Instance>& instances) {
+		std::mt19937 random(5);
+		std::uniform_real_distribution<float> position(-20.f, 20.f);
+		std::uniform_real_distribution<float> angle(0.f, 6.2831853f);
+		std::uniform_real_distribution<float> scale(0.5f, 1.5f);
+		instances.resize(count);
+		for (uint32_t i = 0; i < count; i++) {
+			glm::vec3 axis = glm::normalize(glm::vec3(position(random), position(random), position(random)) + glm::vec3(0.1f));
+			instances[i].blas = &blas;
+			instances[i].transform = glm::translate(glm::vec3(position(random) + offset, position(random), position(random)))
+				* glm::rotate(angle(random), axis) * glm::scale(glm::vec3(scale(random)));
+			instances[i].mask = i % 3 == 0 ? 0x1 : 0x2;
+			instances[i].userID = i;
+		}
+	}
+	uint32_t CheckTlas(const bvh::Tlas& tlas, const std::vector<bvh::Ray>& rays, uint32_t mask) {
+		uint32_t mismatches = 0;
+		uint32_t hits = 0;
+		for (const bvh::Ray& ray : rays) {
+			bvh::InstanceHit expected, hit;
+			bool expectedHit = BruteForce(tlas.GetInstances(), ray, mask, expected);
+			bool found = tlas.Intersect(ray, mask, hit);
+			hits += expectedHit;
+			if (found != expectedHit || (found && (hit.instance != expected.instance || std::abs(hit.hit.t - expected.hit.t) > 1e-3f * expected.hit.t)))
+				mismatches++;
+			if (tlas.Occluded(ray, mask) != expectedHit)
+				mismatches++;
+		}
+		CHECK(mismatches == 0);
+		return hits;
+	}
+
+	void TestTlas() {
+		bvh::Mesh mesh;
+		bvh::MakeRandomTriangles(500, 4.f, 0.6f, mesh);
+		bvh::Blas blas;
+		bvh::BuildBlas(std::move(mesh), bvh::BuildSettings(), blas);
+		CHECK(!blas.bvh.nodes.empty());
+		std::vector<bvh::Instance> instances;
+		MakeInstances(blas, 60, 0.f, instances);
+		bvh::Tlas tlas;
+		tlas.Build(instances);
+		std::string error;
+		std::vector<bvh::Aabb> instanceBounds;
+		bvh::Aabb sceneBounds;
+		for (const bvh::Instance& instance : instances) {
+			bvh::Aabb b;
+			for (int corner = 0; corner < 8; corner++) {
+				glm::vec3 p((corner & 1) ? blas.bounds.max.x : blas.bounds.min.x, (corner & 2) ? blas.bounds.max.y : blas.bounds.min.y,
+					(corner & 4) ? blas.bounds.max.z : blas.bounds.min.z);
+				b.Grow(glm::vec3(instance.transform * glm::vec4(p, 1.f)));
+			}
+			instanceBounds.push_back(b);
+			sceneBounds.Grow(b);
+		}
+		CHECK(bvh::Validate(tlas.GetBvh(), instanceBounds, &error));
+		std::vector<bvh::Ray> rays;
+		bvh::MakeRandomRays(sceneBounds, 400, rays);
+		CHECK(CheckTlas(tlas, rays, 0xFF) > rays.size() / 8);
+		CheckTlas(tlas, rays, 0x1);
+		CHECK(CheckTlas(tlas, rays, 0x0) == 0);
+
+		// Small moves refit, the result still matches
+		for (auto& instance : instances) {
+			instance.transform = glm::translate(glm::vec3(0.2f, 0.f, 0.f)) * instance.transform;
+		}
+		bvh::TlasUpdate update = tlas.Update(instances);
+		CHECK(!update.rebuilt);
+		CheckTlas(tlas, rays, 0xFF);
+		// A different instance count rebuilds
+		instances.pop_back();
+		update = tlas.Update(instances);
+		CHECK(update.rebuilt);
+		CheckTlas(tlas, rays, 0xFF);
+		// Scattering the instances makes the refit too slow
+		std::vector<bvh::Instance> scattered;
+		MakeInstances(blas, static_cast<uint32_t>(instances.size()), 0.f, scattered);
+		for (size_t i = 0; i < instances.size(); i++) {
+			instances[i].transform = scattered[(i * 7) % scattered.size()].transform;
+		}
+		update = tlas.Update(instances, 1.01f);
+		CHECK(update.rebuilt);
+		CheckTlas(tlas, rays, 0xFF);
+
+		// Batched queries return what single queries do, with and without sorting
+		for (int sort = 0; sort < 2; sort++) {
+			bvh::RayBatchSettings settings;
+			settings.threadCount = 3;
+			settings.streamSize = 64;
+			settings.sortRays = sort == 1;
+			settings.mask = 0x2;
+			std::vector<bvh::InstanceHit> hits;
+			std::vector<uint8_t> occluded;
+			bvh::RayBatchTiming timing = bvh::IntersectRays(tlas, rays, hits, settings);
+			bvh::OccludedRays(tlas, rays, occluded, settings);
+			CHECK(timing.rayCount == rays.size());
+			CHECK(hits.size() == rays.size() && occluded.size() == rays.size());
+			uint32_t mismatches = 0;
+			for (size_t i = 0; i < rays.size() && i < hits.size() && i < occluded.size(); i++) {
+				bvh::InstanceHit expected;
+				bool expectedHit = tlas.Intersect(rays[i], settings.mask, expected);
+				if (hits[i].instance != expected.instance || (expectedHit && hits[i].hit.t != expected.hit.t) || (occluded[i] != 0) != expectedHit)
+					mismatches++;
+			}
+			CHECK(mismatches == 0);
+		}
+	}
+}
+
+int main() {
+	TestTlas();
+	return test::Result();
+}
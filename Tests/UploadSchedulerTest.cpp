@@ -0,0 +1,114 @@
+#include "UploadScheduler.h"
+#include "Check.h"
+#include <random>
+
+namespace {
+	struct Live {
+		uint64_t offset;
+		uint64_t size;
+		uint64_t fenceValue;
+	};
+
+	// Random uploads against a queue which lags behind, no copy may get staging memory the GPU still reads
+	void TestRing(uint32_t gpuLag) {
+		upload::Settings settings;
+		settings.ringSize = 1 << 20;
+		settings.batchSize = 256 << 10;
+		upload::FakeQueue queue;
+		upload::Scheduler scheduler(queue, settings);
+		std::mt19937 random(gpuLag);
+		std::uniform_int_distribution<uint64_t> size(1, 64 << 10);
+		std::vector<Live> live;
+		std::vector<uint64_t> batchBytes;
+		std::vector<uint32_t> batchUploads;
+		uint32_t overlaps = 0;
+		uint32_t dedicated = 0;
+		uint64_t lastFence = 0;
+		for (uint32_t i = 0; i < 3000; i++) {
+			// Now and then an upload larger than the ring
+			uint64_t bytes = i % 500 == 499 ? settings.ringSize + 1 : size(random);
+			uint64_t alignment = (i & 1) ? 512 : 4;
+			upload::Allocation allocation = scheduler.Allocate(bytes, alignment);
+			CHECK(allocation.fenceValue >= lastFence && allocation.fenceValue == scheduler.GetSubmittedValue() + 1);
+			lastFence = allocation.fenceValue;
+			if (batchBytes.size() < allocation.fenceValue) {
+				batchBytes.resize(allocation.fenceValue, 0);
+				batchUploads.resize(allocation.fenceValue, 0);
+			}
+			batchBytes[allocation.fenceValue - 1] += bytes;
+			batchUploads[allocation.fenceValue - 1]++;
+			if (allocation.offset == upload::kDedicatedStaging) {
+				CHECK(bytes > settings.ringSize);
+				dedicated++;
+			}
+			else {
+				CHECK(allocation.offset % alignment == 0);
+				CHECK(allocation.offset + bytes <= settings.ringSize);
+				uint64_t completed = queue.GetCompletedValue();
+				for (const Live& other : live) {
+					if (other.fenceValue > completed && allocation.offset < other.offset + other.size && other.offset < allocation.offset + bytes)
+						overlaps++;
+				}
+				live.push_back({ allocation.offset, bytes, allocation.fenceValue });
+			}
+			if (gpuLag > 0 && i % gpuLag == gpuLag - 1)
+				queue.Advance(1);
+		}
+		uint64_t fence = scheduler.Flush();
+		CHECK(fence == scheduler.GetSubmittedValue());
+		CHECK(queue.GetSubmissions().size() == fence);
+		for (size_t i = 0; i < queue.GetSubmissions().size(); i++) {
+			CHECK(queue.GetSubmissions()[i] == i + 1);
+		}
+		queue.Wait(fence);
+		CHECK(queue.GetCompletedValue() == fence);
+		CHECK(overlaps == 0);
+		CHECK(dedicated == 6);
+		// Batches stay below their size unless a single upload is larger
+		for (size_t i = 0; i < batchBytes.size(); i++) {
+			CHECK(batchBytes[i] <= settings.batchSize || batchUploads[i] == 1);
+		}
+		const upload::Stats& stats = scheduler.GetStats();
+		CHECK(stats.uploads == 3000);
+		CHECK(stats.submissions == fence);
+		// Batching: far fewer submissions than uploads
+		CHECK(stats.submissions < stats.uploads / 2);
+		// Without GPU progress the CPU has to wait for ring space
+		CHECK(gpuLag == 0 ? stats.ringWaits > 0 : true);
+		CHECK(queue.GetWaitCount() == stats.ringWaits + 1);
+	}
+
+	void TestBatching() {
+		upload::Settings settings;
+		settings.ringSize = 1 << 20;
+		settings.batchSize = 1000;
+		upload::FakeQueue queue;
+		upload::Scheduler scheduler(queue, settings);
+		// Uploads which fit share a batch, the one that doesn't starts the next
+		CHECK(scheduler.Allocate(400, 4).fenceValue == 1);
+		CHECK(scheduler.Allocate(400, 4).fenceValue == 1);
+		CHECK(queue.GetSubmissions().empty());
+		CHECK(scheduler.Allocate(400, 4).fenceValue == 2);
+		CHECK(queue.GetSubmissions().size() == 1);
+		// A single upload beyond the batch size gets a batch of its own
+		CHECK(scheduler.Allocate(5000, 4).fenceValue == 3);
+		CHECK(scheduler.Allocate(10, 4).fenceValue == 4);
+		CHECK(scheduler.Flush() == 4);
+		// Flushing without uploads submits nothing
+		CHECK(scheduler.Flush() == 4);
+		CHECK(queue.GetSubmissions().size() == 4);
+		// Once everything is done the ring starts over
+		queue.Advance(4);
+		upload::Allocation allocation = scheduler.Allocate(100, 256);
+		CHECK(allocation.offset == 0);
+		CHECK(queue.GetWaitCount() == 0);
+	}
+}
+
+int main() {
+	TestRing(0);
+	TestRing(3);
+	TestRing(20);
+	TestBatching();
+	return test::Result();
+}
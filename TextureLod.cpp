@@ -0,0 +1,138 @@
+#include "TextureLod.h"
+#include <algorithm>
+#include <cmath>
+
+namespace texlod {
+	// Smallest cosine and cone width the level is computed for, grazing hits and the camera get a finite level
+	static const float kMinCosine = 1e-3f;
+	static const float kMinWidth = 1e-8f;
+	// Base of triangles without texture area, the fetch lands on the finest level
+	static const float kNoTextureArea = -64.f;
+
+	TriangleLod ComputeTriangleLod(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2,
+		const glm::vec2& uv0, const glm::vec2& uv1, const glm::vec2& uv2) {
+		TriangleLod lod;
+		glm::vec3 cross = glm::cross(p1 - p0, p2 - p0);
+		float area = glm::length(cross);
+		if (!(area > 0.f))
+			return lod;
+		lod.normal = cross / area;
+		glm::vec2 e1 = uv1 - uv0;
+		glm::vec2 e2 = uv2 - uv0;
+		float uvArea = std::abs(e1.x * e2.y - e1.y * e2.x);
+		// Both areas are doubled, the ratio stays
+		lod.base = uvArea > 0.f ? 0.5f * std::log2(uvArea / area) : kNoTextureArea;
+		return lod;
+	}
+
+	void BuildTriangleLods(const std::vector<glm::vec3>& positions, const glm::mat4& transform, const std::vector<uint32_t>& indices,
+		const std::vector<std::vector<glm::vec2>>& texcoordSets, std::vector<TriangleLod>& lods) {
+		size_t triangleCount = indices.size() / 3;
+		lods.assign(triangleCount * texcoordSets.size(), TriangleLod());
+		std::vector<glm::vec3> transformed(positions.size());
+		for (size_t i = 0; i < positions.size(); i++) {
+			transformed[i] = glm::vec3(transform * glm::vec4(positions[i], 1.f));
+		}
+		for (size_t t = 0; t < triangleCount; t++) {
+			uint32_t i0 = indices[3 * t];
+			uint32_t i1 = indices[3 * t + 1];
+			uint32_t i2 = indices[3 * t + 2];
+			if (i0 >= positions.size() || i1 >= positions.size() || i2 >= positions.size())
+				continue;
+			for (size_t set = 0; set < texcoordSets.size(); set++) {
+				const std::vector<glm::vec2>& uvs = texcoordSets[set];
+				if (i0 < uvs.size() && i1 < uvs.size() && i2 < uvs.size())
+					lods[t * texcoordSets.size() + set] = ComputeTriangleLod(transformed[i0], transformed[i1], transformed[i2], uvs[i0], uvs[i1], uvs[i2]);
+			}
+		}
+	}
+
+	float SpreadAngle(const glm::vec3& direction, const glm::vec3& neighbour) {
+		// atan2 keeps the precision of the tiny angles between pixels, acos of the dot product doesn't
+		return std::atan2(glm::length(glm::cross(direction, neighbour)), glm::dot(direction, neighbour));
+	}
+
+	float TextureLod(const TriangleLod& triangle, uint32_t width, uint32_t height, float coneWidth, const glm::vec3& direction, float logAreaScale) {
+		float length = glm::length(direction);
+		float cosine = length > 0.f ? std::abs(glm::dot(triangle.normal, direction)) / length : 0.f;
+		return triangle.base + 0.5f * std::log2(float(width) * float(height)) + std::log2((std::max)(coneWidth, kMinWidth)) -
+			std::log2((std::max)(cosine, kMinCosine)) - 0.5f * logAreaScale;
+	}
+
+	float DistanceLod(float t) {
+		return t / 5.f;
+	}
+
+	uint32_t MipCount(uint32_t width, uint32_t height) {
+		return (std::max)(1, int(std::log2((std::max)(width, height))));
+	}
+
+	TextureCache::TextureCache(const CacheSettings& settings) : m_settings(settings) {
+		m_settings.ways = (std::max)(1u, m_settings.ways);
+		m_settings.blockSize = (std::max)(1u, m_settings.blockSize);
+		m_setCount = (std::max)(1u, m_settings.lineCount / m_settings.ways);
+		m_tags.assign(size_t(m_setCount) * m_settings.ways, ~0ull);
+	}
+
+	void TextureCache::Fetch(uint32_t texture, uint32_t width, uint32_t height, const glm::vec2& uv, float lod) {
+		m_stats.fetches++;
+		uint32_t levels = MipCount(width, height);
+		float level = (std::min)((std::max)(lod, 0.f), float(levels - 1));
+		uint32_t fine = static_cast<uint32_t>(level);
+		FetchLevel(texture, width, height, uv, fine);
+		// The coarser level only counts when the mip filter weights it
+		if (level > float(fine))
+			FetchLevel(texture, width, height, uv, fine + 1);
+	}
+
+	void TextureCache::FetchLevel(uint32_t texture, uint32_t width, uint32_t height, const glm::vec2& uv, uint32_t level) {
+		uint32_t w = (std::max)(1u, width >> level);
+		uint32_t h = (std::max)(1u, height >> level);
+		// Texel centers are at +0.5, like Texture::Sample of the path tracer
+		float x = uv.x * w - 0.5f;
+		float y = uv.y * h - 0.5f;
+		int x0 = static_cast<int>(std::floor(x));
+		int y0 = static_cast<int>(std::floor(y));
+		uint32_t blocks[4][2];
+		uint32_t count = 0;
+		for (int dy = 0; dy < 2; dy++) {
+			for (int dx = 0; dx < 2; dx++) {
+				int tx = ((x0 + dx) % int(w) + int(w)) % int(w);
+				int ty = ((y0 + dy) % int(h) + int(h)) % int(h);
+				uint32_t bx = tx / m_settings.blockSize;
+				uint32_t by = ty / m_settings.blockSize;
+				// A footprint inside one block touches its line once
+				bool seen = false;
+				for (uint32_t i = 0; i < count; i++) {
+					seen = seen || (blocks[i][0] == bx && blocks[i][1] == by);
+				}
+				if (seen)
+					continue;
+				blocks[count][0] = bx;
+				blocks[count][1] = by;
+				count++;
+				Access(texture, level, bx, by);
+			}
+		}
+	}
+
+	void TextureCache::Access(uint32_t texture, uint32_t level, uint32_t blockX, uint32_t blockY) {
+		m_stats.lines++;
+		uint64_t tag = (uint64_t(texture) << 40) ^ (uint64_t(level) << 35) ^ (uint64_t(blockY) << 17) ^ blockX;
+		// Neighbouring blocks go to different sets
+		uint64_t hash = tag * 0x9E3779B97F4A7C15ull;
+		uint64_t* set = &m_tags[size_t((hash >> 32) % m_setCount) * m_settings.ways];
+		uint32_t way = 0;
+		while (way < m_settings.ways && set[way] != tag)
+			way++;
+		if (way == m_settings.ways) {
+			m_stats.misses++;
+			way = m_settings.ways - 1;
+		}
+		// Move to the front, a miss drops the least recently used line
+		for (; way > 0; way--) {
+			set[way] = set[way - 1];
+		}
+		set[0] = tag;
+	}
+}
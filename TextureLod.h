@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+// Texture level of detail from ray cones (Akenine-Moller et al., Improved Shader and Texture Level of Detail
+// Using Ray Cones). The loader stores the texel density of every triangle, Hit.hlsl adds the width of the cone
+// at the hit, its angle to the surface and the size of the texture for every fetch. The texture cache model
+// counts what a choice of level costs in memory traffic. No D3D dependencies
+namespace texlod {
+	// TriangleLod in Hit.hlsl, one per triangle and texcoord set
+	struct TriangleLod {
+		glm::vec3 normal = glm::vec3(0.f); // Unit face normal in the space of the positions, zero if degenerate
+		float base = 0.f; // 0.5 * log2(uv area / area), the level of a 1x1 texture seen by a cone of width 1
+	};
+	TriangleLod ComputeTriangleLod(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2,
+		const glm::vec2& uv0, const glm::vec2& uv1, const glm::vec2& uv2);
+	// lods[triangle * texcoordSets.size() + set]. The positions go through transform first, into the space of
+	// the BLAS, which bakes the node transform in
+	void BuildTriangleLods(const std::vector<glm::vec3>& positions, const glm::mat4& transform, const std::vector<uint32_t>& indices,
+		const std::vector<std::vector<glm::vec2>>& texcoordSets, std::vector<TriangleLod>& lods);
+
+	// Angle between the rays through two neighbouring pixels, the spread of a camera ray cone
+	float SpreadAngle(const glm::vec3& direction, const glm::vec3& neighbour);
+	// Level of a fetch from a width x height texture where a cone of coneWidth hits the triangle along direction,
+	// in the space of the triangle. logAreaScale is log2 of how much the instance transform scales areas
+	float TextureLod(const TriangleLod& triangle, uint32_t width, uint32_t height, float coneWidth, const glm::vec3& direction, float logAreaScale = 0.f);
+	// The level Hit.hlsl used before, from the hit distance only
+	float DistanceLod(float t);
+	// Levels LoadImageData gives a texture, down to 2 texels along the longer side
+	uint32_t MipCount(uint32_t width, uint32_t height);
+
+	struct CacheSettings {
+		uint32_t lineCount = 1024; // 64 KB of RGBA8 with 4x4 blocks
+		uint32_t ways = 8;
+		uint32_t blockSize = 4; // Texels along both sides of a line
+	};
+	struct CacheStats {
+		uint64_t fetches = 0;
+		uint64_t lines = 0; // Lines the fetches touched, several per bilinear footprint
+		uint64_t misses = 0;
+		double HitRate() const { return lines > 0 ? 1.0 - double(misses) / double(lines) : 0.0; }
+		double MissesPerFetch() const { return fetches > 0 ? double(misses) / double(fetches) : 0.0; }
+	};
+	// Set associative with least recently used replacement, lines hold square blocks of texels of one level
+	class TextureCache {
+	public:
+		explicit TextureCache(const CacheSettings& settings = CacheSettings());
+		// A trilinear fetch: the bilinear footprints on the two levels around the clamped lod, wrapping at the edges
+		void Fetch(uint32_t texture, uint32_t width, uint32_t height, const glm::vec2& uv, float lod);
+		const CacheStats& GetStats() const { return m_stats; }
+	private:
+		void Access(uint32_t texture, uint32_t level, uint32_t blockX, uint32_t blockY);
+		void FetchLevel(uint32_t texture, uint32_t width, uint32_t height, const glm::vec2& uv, uint32_t level);
+		CacheSettings m_settings;
+		uint32_t m_setCount = 1;
+		std::vector<uint64_t> m_tags; // ways per set, the most recently used first
+		CacheStats m_stats;
+	};
+}
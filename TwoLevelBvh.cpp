@@ -0,0 +1,205 @@
+#include "TwoLevelBvh.h"
+#include "ParallelFor.h"
+#include <chrono>
+#include <random>
+#include <glm/gtx/transform.hpp>
+
+namespace bvh {
+	void BuildBlas(Mesh&& mesh, const BuildSettings& settings, Blas& blas) {
+		blas.mesh = std::move(mesh);
+		std::vector<Aabb> bounds;
+		blas.mesh.GetTriangleBounds(bounds);
+		blas.bounds = Aabb();
+		for (const Aabb& b : bounds) {
+			blas.bounds.Grow(b);
+		}
+		Bvh binary;
+		BuildBinned(bounds, settings, binary);
+		CollapseLeaves(binary, settings);
+		CollapseToWide(binary, blas.bvh);
+	}
+
+	static Aabb TransformBounds(const Aabb& bounds, const glm::mat4& transform) {
+		Aabb result;
+		if (bounds.Empty())
+			return result;
+		for (int corner = 0; corner < 8; corner++) {
+			glm::vec3 p((corner & 1) ? bounds.max.x : bounds.min.x, (corner & 2) ? bounds.max.y : bounds.min.y, (corner & 4) ? bounds.max.z : bounds.min.z);
+			result.Grow(glm::vec3(transform * glm::vec4(p, 1.f)));
+		}
+		return result;
+	}
+
+	void Tlas::PrepareInstances() {
+		m_inverseTransforms.resize(m_instances.size());
+		m_instanceBounds.resize(m_instances.size());
+		for (size_t i = 0; i < m_instances.size(); i++) {
+			m_inverseTransforms[i] = glm::inverse(m_instances[i].transform);
+			m_instanceBounds[i] = m_instances[i].blas ? TransformBounds(m_instances[i].blas->bounds, m_instances[i].transform) : Aabb();
+		}
+	}
+
+	void Tlas::Build(const std::vector<Instance>& instances) {
+		m_instances = instances;
+		PrepareInstances();
+		BuildBinned(m_instanceBounds, m_settings, m_bvh);
+		CollapseLeaves(m_bvh, m_settings);
+		m_builtSahCost = SahCost(m_bvh, m_settings);
+	}
+
+	TlasUpdate Tlas::Update(const std::vector<Instance>& instances, float rebuildThreshold) {
+		auto start = std::chrono::high_resolution_clock::now();
+		TlasUpdate update;
+		if (instances.size() != m_instances.size()) {
+			Build(instances);
+			update.rebuilt = true;
+		}
+		else {
+			m_instances = instances;
+			PrepareInstances();
+			Refit(m_bvh, m_instanceBounds);
+			update.sahCost = SahCost(m_bvh, m_settings);
+			if (update.sahCost > rebuildThreshold * m_builtSahCost) {
+				Build(instances);
+				update.rebuilt = true;
+			}
+		}
+		if (update.rebuilt)
+			update.sahCost = m_builtSahCost;
+		update.timeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		return update;
+	}
+
+	template <bool AnyHit>
+	bool Tlas::Traverse(const Ray& ray, uint32_t mask, InstanceHit& hit) const {
+		hit = InstanceHit();
+		hit.hit.t = ray.tMax;
+		if (m_bvh.nodes.empty())
+			return false;
+		glm::vec3 inverseDirection = InverseDirection(ray.direction);
+		auto intersectBounds = [&](const Node& node, float& tEntry) {
+			glm::vec3 t0 = (node.boundsMin - ray.origin) * inverseDirection;
+			glm::vec3 t1 = (node.boundsMax - ray.origin) * inverseDirection;
+			glm::vec3 tNear = glm::min(t0, t1);
+			glm::vec3 tFar = glm::max(t0, t1);
+			tEntry = (std::max)((std::max)(tNear.x, tNear.y), (std::max)(tNear.z, ray.tMin));
+			float tExit = (std::min)((std::min)(tFar.x, tFar.y), (std::min)(tFar.z, hit.hit.t));
+			return tEntry <= tExit;
+		};
+		struct Entry {
+			uint32_t node;
+			float t;
+		};
+		Entry stack[256];
+		uint32_t size = 0;
+		float tRoot;
+		if (intersectBounds(m_bvh.nodes[0], tRoot))
+			stack[size++] = { 0, tRoot };
+		while (size > 0) {
+			Entry entry = stack[--size];
+			if (entry.t >= hit.hit.t)
+				continue;
+			const Node& node = m_bvh.nodes[entry.node];
+			if (node.IsLeaf()) {
+				for (uint32_t i = node.child; i < node.child + node.count; i++) {
+					uint32_t index = m_bvh.primitives[i];
+					const Instance& instance = m_instances[index];
+					if ((instance.mask & mask) == 0 || !instance.blas)
+						continue;
+					// The direction is not normalized, so t stays the distance along the world ray
+					Ray local;
+					local.origin = glm::vec3(m_inverseTransforms[index] * glm::vec4(ray.origin, 1.f));
+					local.direction = glm::vec3(m_inverseTransforms[index] * glm::vec4(ray.direction, 0.f));
+					local.tMin = ray.tMin;
+					local.tMax = hit.hit.t;
+					if (AnyHit) {
+						if (bvh::Occluded(instance.blas->bvh, instance.blas->mesh, local)) {
+							hit.instance = index;
+							return true;
+						}
+						continue;
+					}
+					Hit localHit;
+					if (bvh::Intersect(instance.blas->bvh, instance.blas->mesh, local, localHit)) {
+						hit.hit = localHit;
+						hit.instance = index;
+					}
+				}
+				continue;
+			}
+			float tLeft, tRight;
+			bool left = intersectBounds(m_bvh.nodes[node.child], tLeft);
+			bool right = intersectBounds(m_bvh.nodes[node.child + 1], tRight);
+			if (left && right) {
+				bool leftFirst = tLeft <= tRight;
+				stack[size++] = leftFirst ? Entry{ node.child + 1, tRight } : Entry{ node.child, tLeft };
+				stack[size++] = leftFirst ? Entry{ node.child, tLeft } : Entry{ node.child + 1, tRight };
+			}
+			else if (left) {
+				stack[size++] = { node.child, tLeft };
+			}
+			else if (right) {
+				stack[size++] = { node.child + 1, tRight };
+			}
+		}
+		return hit.instance != ~0u;
+	}
+	bool Tlas::Intersect(const Ray& ray, uint32_t mask, InstanceHit& hit) const {
+		return Traverse<false>(ray, mask, hit);
+	}
+	bool Tlas::Occluded(const Ray& ray, uint32_t mask) const {
+		InstanceHit hit;
+		return Traverse<true>(ray, mask, hit);
+	}
+
+	void BenchmarkTlas(const Blas& blas, uint32_t instanceCount, uint32_t rayCount, TlasBenchmark& result, uint32_t threadCount) {
+		result = TlasBenchmark();
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<float> unit(0.f, 1.f);
+		// Constant density, about one instance per cell of twice the BLAS size
+		float size = glm::length(blas.bounds.max - blas.bounds.min);
+		float extent = size * std::cbrt(static_cast<float>(instanceCount));
+		std::vector<Instance> instances(instanceCount);
+		for (Instance& instance : instances) {
+			glm::vec3 axis = glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) - 0.5f + 1e-3f);
+			glm::vec3 position = (glm::vec3(unit(rng), unit(rng), unit(rng)) - 0.5f) * extent;
+			instance.blas = &blas;
+			instance.transform = glm::translate(position) * glm::rotate(6.2831853f * unit(rng), axis) * glm::scale(glm::vec3(0.5f + unit(rng)));
+		}
+		Tlas tlas;
+		auto start = std::chrono::high_resolution_clock::now();
+		tlas.Build(instances);
+		result.buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		for (Instance& instance : instances) {
+			instance.transform = glm::translate(0.1f * size * (glm::vec3(unit(rng), unit(rng), unit(rng)) - 0.5f)) * instance.transform;
+		}
+		TlasUpdate update = tlas.Update(instances);
+		result.refitMs = update.timeMs;
+		result.refitRebuilt = update.rebuilt;
+
+		std::vector<Ray> rays;
+		MakeRandomRays(tlas.GetBvh().nodes[0].Bounds(), rayCount, rays);
+		std::vector<uint32_t> hits(GetWorkerThreadCount(threadCount), 0), occluded(GetWorkerThreadCount(threadCount), 0);
+		start = std::chrono::high_resolution_clock::now();
+		ParallelFor(rayCount, 1024, threadCount, [&](uint32_t first, uint32_t last, uint32_t thread) {
+			InstanceHit hit;
+			for (uint32_t i = first; i < last; i++) {
+				hits[thread] += tlas.Intersect(rays[i], 0xFF, hit) ? 1 : 0;
+			}
+		});
+		double closestMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		start = std::chrono::high_resolution_clock::now();
+		ParallelFor(rayCount, 1024, threadCount, [&](uint32_t first, uint32_t last, uint32_t thread) {
+			for (uint32_t i = first; i < last; i++) {
+				occluded[thread] += tlas.Occluded(rays[i], 0xFF) ? 1 : 0;
+			}
+		});
+		double anyMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		for (size_t i = 0; i < hits.size(); i++) {
+			result.closestHits += hits[i];
+			result.occludedRays += occluded[i];
+		}
+		result.closestHitRaysPerSecond = rayCount / (closestMs * 1e-3);
+		result.anyHitRaysPerSecond = rayCount / (anyMs * 1e-3);
+	}
+}
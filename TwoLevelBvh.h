@@ -0,0 +1,68 @@
+#pragma once
+#include "WideBvh.h"
+// Two level CPU acceleration structure mirroring the DXR TLAS and BLASes. Every model gets a BLAS
+// in model space which is built once, the TLAS over the transformed BLAS bounds of the instances is
+// refitted when they move and rebuilt once the refit made it too slow. Rays are transformed into
+// the space of every instance they reach. No D3D dependencies
+namespace bvh {
+	struct Blas {
+		Mesh mesh; // Model space triangles
+		Bvh8 bvh;
+		Aabb bounds;
+	};
+	// Takes the mesh, the BVH is built with the binned SAH builder and collapsed to 8 wide nodes
+	void BuildBlas(Mesh&& mesh, const BuildSettings& settings, Blas& blas);
+
+	struct Instance {
+		const Blas* blas = nullptr;
+		glm::mat4 transform = glm::mat4(1.f);
+		uint32_t mask = 0xFF; // Skipped by rays whose mask shares no bit with it, like InstanceMask
+		uint32_t userID = 0;
+	};
+	struct InstanceHit {
+		Hit hit; // Primitive of the instance BLAS, t along the world space ray
+		uint32_t instance = ~0u;
+	};
+	struct TlasUpdate {
+		bool rebuilt = false;
+		float sahCost = 0.f; // After the update
+		double timeMs = 0.0;
+	};
+
+	class Tlas {
+	public:
+		void Build(const std::vector<Instance>& instances);
+		// Refits for the new transforms, rebuilds when the instance count changed or the SAH cost
+		// grew beyond rebuildThreshold times the cost of the last build
+		TlasUpdate Update(const std::vector<Instance>& instances, float rebuildThreshold = 1.5f);
+		bool Intersect(const Ray& ray, uint32_t mask, InstanceHit& hit) const;
+		bool Occluded(const Ray& ray, uint32_t mask) const;
+		const std::vector<Instance>& GetInstances() const { return m_instances; }
+		const Bvh& GetBvh() const { return m_bvh; }
+	private:
+		// Inverse transforms and world space bounds of the instances
+		void PrepareInstances();
+		template <bool AnyHit>
+		bool Traverse(const Ray& ray, uint32_t mask, InstanceHit& hit) const;
+
+		std::vector<Instance> m_instances;
+		std::vector<glm::mat4> m_inverseTransforms;
+		std::vector<Aabb> m_instanceBounds;
+		Bvh m_bvh;
+		BuildSettings m_settings;
+		float m_builtSahCost = 0.f;
+	};
+
+	struct TlasBenchmark {
+		double buildMs = 0.0;
+		double refitMs = 0.0; // One update with every instance moved
+		bool refitRebuilt = false;
+		double closestHitRaysPerSecond = 0.0;
+		double anyHitRaysPerSecond = 0.0;
+		uint32_t closestHits = 0;
+		uint32_t occludedRays = 0; // Equal to closestHits
+	};
+	// Scatters instanceCount randomly rotated and scaled instances of blas, then traces rayCount random
+	// rays through them on worker threads
+	void BenchmarkTlas(const Blas& blas, uint32_t instanceCount, uint32_t rayCount, TlasBenchmark& result, uint32_t threadCount = 0);
+}
@@ -0,0 +1,167 @@
+#include "stdafx.h"
+#include "UploadQueue.h"
+#include "DXSampleHelper.h"
+#include <algorithm>
+
+using Microsoft::WRL::ComPtr;
+
+static ComPtr<ID3D12Resource> CreateStagingBuffer(ID3D12Device* device, uint64_t size) {
+	ComPtr<ID3D12Resource> buffer;
+	CD3DX12_HEAP_PROPERTIES heapProps(D3D12_HEAP_TYPE_UPLOAD);
+	CD3DX12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Buffer(size);
+	ThrowIfFailed(device->CreateCommittedResource(&heapProps, D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&buffer)));
+	return buffer;
+}
+
+UploadQueue::~UploadQueue() {
+	if (m_fenceEvent)
+		CloseHandle(m_fenceEvent);
+}
+
+void UploadQueue::Init(ID3D12Device* device, const upload::Settings& settings) {
+	m_device = device;
+	D3D12_COMMAND_QUEUE_DESC queueDesc = {};
+	queueDesc.Type = D3D12_COMMAND_LIST_TYPE_COPY;
+	ThrowIfFailed(m_device->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&m_queue)));
+	ThrowIfFailed(m_device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&m_fence)));
+	m_fenceEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+	if (m_fenceEvent == nullptr)
+		ThrowIfFailed(HRESULT_FROM_WIN32(GetLastError()));
+	ThrowIfFailed(m_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COPY, IID_PPV_ARGS(&m_allocator)));
+	ThrowIfFailed(m_device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COPY, m_allocator.Get(), nullptr, IID_PPV_ARGS(&m_commandList)));
+	ThrowIfFailed(m_commandList->Close());
+	m_allocator.Reset();
+	// The ring stays mapped, the CPU only writes regions the scheduler handed out
+	m_ring = CreateStagingBuffer(m_device.Get(), settings.ringSize);
+	CD3DX12_RANGE readRange(0, 0);
+	ThrowIfFailed(m_ring->Map(0, &readRange, reinterpret_cast<void**>(&m_mappedRing)));
+	m_scheduler.reset(new upload::Scheduler(*this, settings));
+}
+
+void UploadQueue::BeginRecording() {
+	if (m_recording)
+		return;
+	Retire();
+	if (!m_usedAllocators.empty() && m_usedAllocators.front().first <= m_fence->GetCompletedValue()) {
+		m_allocator = m_usedAllocators.front().second;
+		m_usedAllocators.pop_front();
+		ThrowIfFailed(m_allocator->Reset());
+	}
+	else {
+		ThrowIfFailed(m_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COPY, IID_PPV_ARGS(&m_allocator)));
+	}
+	ThrowIfFailed(m_commandList->Reset(m_allocator.Get(), nullptr));
+	m_recording = true;
+}
+
+void UploadQueue::UploadBuffer(ID3D12Resource* buffer, const void* data, size_t size) {
+	upload::Allocation allocation = m_scheduler->Allocate(size, 4);
+	BeginRecording();
+	// Buffers are promoted from COMMON to COPY_DEST by the copy queue, no barrier needed
+	if (allocation.offset == upload::kDedicatedStaging) {
+		ComPtr<ID3D12Resource> staging = CreateStagingBuffer(m_device.Get(), size);
+		void* mapped;
+		CD3DX12_RANGE readRange(0, 0);
+		ThrowIfFailed(staging->Map(0, &readRange, &mapped));
+		memcpy(mapped, data, size);
+		staging->Unmap(0, nullptr);
+		m_commandList->CopyBufferRegion(buffer, 0, staging.Get(), 0, size);
+		m_dedicatedStaging.push_back({ allocation.fenceValue, staging });
+	}
+	else {
+		memcpy(m_mappedRing + allocation.offset, data, size);
+		m_commandList->CopyBufferRegion(buffer, 0, m_ring.Get(), allocation.offset, size);
+	}
+	m_pendingBuffers.push_back(buffer);
+}
+
+void UploadQueue::UploadTexture(ID3D12Resource* texture, const void* data, size_t sourceRowPitch) {
+	D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint;
+	UINT rowCount;
+	UINT64 rowSize;
+	UINT64 size;
+	m_device->GetCopyableFootprints(&texture->GetDesc(), 0, 1, 0, &footprint, &rowCount, &rowSize, &size);
+	upload::Allocation allocation = m_scheduler->Allocate(size, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT);
+	BeginRecording();
+	ComPtr<ID3D12Resource> staging = m_ring;
+	uint8_t* mapped;
+	if (allocation.offset == upload::kDedicatedStaging) {
+		staging = CreateStagingBuffer(m_device.Get(), size);
+		CD3DX12_RANGE readRange(0, 0);
+		ThrowIfFailed(staging->Map(0, &readRange, reinterpret_cast<void**>(&mapped)));
+		footprint.Offset = 0;
+		m_dedicatedStaging.push_back({ allocation.fenceValue, staging });
+	}
+	else {
+		mapped = m_mappedRing + allocation.offset;
+		footprint.Offset = allocation.offset;
+	}
+	// Staging rows are aligned to D3D12_TEXTURE_DATA_PITCH_ALIGNMENT
+	size_t copySize = (std::min)(sourceRowPitch, static_cast<size_t>(rowSize));
+	for (UINT row = 0; row < rowCount; row++) {
+		memcpy(mapped + footprint.Footprint.RowPitch * row, static_cast<const uint8_t*>(data) + sourceRowPitch * row, copySize);
+	}
+	if (allocation.offset == upload::kDedicatedStaging)
+		staging->Unmap(0, nullptr);
+	CD3DX12_TEXTURE_COPY_LOCATION destination(texture, 0);
+	CD3DX12_TEXTURE_COPY_LOCATION source(staging.Get(), footprint);
+	// Promoted to COPY_DEST like the buffers, it decays back to COMMON after the batch
+	m_commandList->CopyTextureRegion(&destination, 0, 0, 0, &source, nullptr);
+}
+
+void UploadQueue::MakeVisible(ID3D12CommandQueue* directQueue, ID3D12GraphicsCommandList* commandList) {
+	uint64_t fenceValue = m_scheduler->Flush();
+	// GPU side wait, the CPU carries on recording. Only once per batch, however often it is made visible
+	if (fenceValue > m_visibleFenceValue) {
+		ThrowIfFailed(directQueue->Wait(m_fence.Get(), fenceValue));
+		m_visibleFenceValue = fenceValue;
+	}
+	if (m_pendingBuffers.empty())
+		return;
+	// A buffer written by several uploads gets a single transition
+	std::sort(m_pendingBuffers.begin(), m_pendingBuffers.end(),
+		[](const ComPtr<ID3D12Resource>& a, const ComPtr<ID3D12Resource>& b) { return a.Get() < b.Get(); });
+	m_pendingBuffers.erase(std::unique(m_pendingBuffers.begin(), m_pendingBuffers.end(),
+		[](const ComPtr<ID3D12Resource>& a, const ComPtr<ID3D12Resource>& b) { return a.Get() == b.Get(); }), m_pendingBuffers.end());
+	std::vector<CD3DX12_RESOURCE_BARRIER> transitions;
+	for (auto& buffer : m_pendingBuffers) {
+		transitions.push_back(CD3DX12_RESOURCE_BARRIER::Transition(buffer.Get(), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_GENERIC_READ));
+	}
+	commandList->ResourceBarrier(static_cast<UINT>(transitions.size()), transitions.data());
+	m_pendingBuffers.clear();
+}
+
+void UploadQueue::WaitIdle() {
+	if (!m_scheduler)
+		return;
+	Wait(m_scheduler->Flush());
+	Retire();
+}
+
+void UploadQueue::Submit(uint64_t fenceValue) {
+	ThrowIfFailed(m_commandList->Close());
+	ID3D12CommandList* commandLists[] = { m_commandList.Get() };
+	m_queue->ExecuteCommandLists(1, commandLists);
+	ThrowIfFailed(m_queue->Signal(m_fence.Get(), fenceValue));
+	m_usedAllocators.push_back({ fenceValue, m_allocator });
+	m_allocator.Reset();
+	m_recording = false;
+}
+
+uint64_t UploadQueue::GetCompletedValue() {
+	return m_fence->GetCompletedValue();
+}
+
+void UploadQueue::Wait(uint64_t fenceValue) {
+	if (m_fence->GetCompletedValue() >= fenceValue)
+		return;
+	ThrowIfFailed(m_fence->SetEventOnCompletion(fenceValue, m_fenceEvent));
+	WaitForSingleObject(m_fenceEvent, INFINITE);
+}
+
+void UploadQueue::Retire() {
+	uint64_t completed = m_fence->GetCompletedValue();
+	while (!m_dedicatedStaging.empty() && m_dedicatedStaging.front().first <= completed) {
+		m_dedicatedStaging.pop_front();
+	}
+}
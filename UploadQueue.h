@@ -0,0 +1,51 @@
+#pragma once
+#include <d3d12.h>
+#include <wrl.h>
+#include <deque>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "UploadScheduler.h"
+// D3D12 side of the upload scheduler: a copy queue with its own fence, a persistently mapped staging
+// ring and the recording of the buffer and texture copies. Loading code records its uploads here and
+// calls MakeVisible before the direct queue uses them, instead of flushing the direct queue per copy
+class UploadQueue : public upload::Queue {
+public:
+	~UploadQueue();
+	void Init(ID3D12Device* device, const upload::Settings& settings = upload::Settings());
+	// Copies size bytes to the start of buffer, which is in the COMMON state
+	void UploadBuffer(ID3D12Resource* buffer, const void* data, size_t size);
+	// Copies the rows of mip 0 of texture, which is in the COMMON state, from data with sourceRowPitch bytes per row
+	void UploadTexture(ID3D12Resource* texture, const void* data, size_t sourceRowPitch);
+	// Submits the open batch and makes directQueue wait for all uploads so far. The uploaded buffers are
+	// transitioned to GENERIC_READ on commandList, textures are left in the COMMON state the copy queue decays them to
+	void MakeVisible(ID3D12CommandQueue* directQueue, ID3D12GraphicsCommandList* commandList);
+	// Blocks until all submitted uploads are done
+	void WaitIdle();
+	const upload::Stats& GetStats() const { return m_scheduler->GetStats(); }
+
+	// upload::Queue
+	void Submit(uint64_t fenceValue) override;
+	uint64_t GetCompletedValue() override;
+	void Wait(uint64_t fenceValue) override;
+private:
+	// Opens the command list of the batch on a free allocator
+	void BeginRecording();
+	// Releases the staging buffers and allocators of the completed batches
+	void Retire();
+
+	Microsoft::WRL::ComPtr<ID3D12Device> m_device;
+	Microsoft::WRL::ComPtr<ID3D12CommandQueue> m_queue;
+	Microsoft::WRL::ComPtr<ID3D12Fence> m_fence;
+	HANDLE m_fenceEvent = nullptr;
+	Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> m_commandList;
+	Microsoft::WRL::ComPtr<ID3D12CommandAllocator> m_allocator; // Of the open batch
+	std::deque<std::pair<uint64_t, Microsoft::WRL::ComPtr<ID3D12CommandAllocator>>> m_usedAllocators; // By fence value
+	bool m_recording = false;
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_ring;
+	uint8_t* m_mappedRing = nullptr;
+	std::deque<std::pair<uint64_t, Microsoft::WRL::ComPtr<ID3D12Resource>>> m_dedicatedStaging; // Uploads larger than the ring, by fence value
+	std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> m_pendingBuffers; // Uploaded since the last MakeVisible
+	uint64_t m_visibleFenceValue = 0; // Last batch a direct queue was made to wait for
+	std::unique_ptr<upload::Scheduler> m_scheduler;
+};
@@ -0,0 +1,114 @@
+#include "UploadScheduler.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+namespace upload {
+	static uint64_t RoundUp(uint64_t value, uint64_t alignment) {
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	Scheduler::Scheduler(Queue& queue, const Settings& settings) : m_queue(queue), m_settings(settings) {
+	}
+
+	Allocation Scheduler::Allocate(uint64_t size, uint64_t alignment) {
+		m_stats.uploads++;
+		m_stats.bytes += size;
+		if (m_openBytes > 0 && m_openBytes + size > m_settings.batchSize)
+			Submit();
+		Allocation allocation;
+		if (size > m_settings.ringSize) {
+			allocation.offset = kDedicatedStaging;
+		}
+		else {
+			uint64_t ringSize = m_settings.ringSize;
+			for (;;) {
+				Retire();
+				// Nothing lives in the ring, so the copy starts at its beginning
+				if (m_inFlight.empty() && m_head == m_openRingStart)
+					m_head = m_tail = m_openRingStart = RoundUp(m_head, ringSize);
+				uint64_t offset = RoundUp(m_head, (std::max)(alignment, uint64_t(1)));
+				// A copy never wraps around the end of the ring
+				if (offset % ringSize + size > ringSize)
+					offset = RoundUp(offset, ringSize);
+				if (offset + size - m_tail <= ringSize) {
+					m_head = offset + size;
+					allocation.offset = offset % ringSize;
+					break;
+				}
+				// Wait for the oldest batch, the open one is submitted once it is the only one left
+				if (m_inFlight.empty())
+					Submit();
+				m_stats.ringWaits++;
+				m_queue.Wait(m_inFlight.front().fenceValue);
+			}
+		}
+		m_openBytes += size;
+		m_openUploads++;
+		allocation.fenceValue = m_submitted + 1;
+		return allocation;
+	}
+
+	uint64_t Scheduler::Flush() {
+		Submit();
+		return m_submitted;
+	}
+
+	void Scheduler::Submit() {
+		if (m_openUploads == 0)
+			return;
+		m_submitted++;
+		m_queue.Submit(m_submitted);
+		m_inFlight.push_back({ m_submitted, m_head });
+		m_openRingStart = m_head;
+		m_openBytes = 0;
+		m_openUploads = 0;
+		m_stats.submissions++;
+	}
+
+	void Scheduler::Retire() {
+		if (m_inFlight.empty())
+			return;
+		uint64_t completed = m_queue.GetCompletedValue();
+		while (!m_inFlight.empty() && m_inFlight.front().fenceValue <= completed) {
+			m_tail = m_inFlight.front().ringEnd;
+			m_inFlight.pop_front();
+		}
+	}
+
+	void FakeQueue::Wait(uint64_t fenceValue) {
+		m_waits++;
+		while (m_completed < fenceValue && m_nextPending < m_submissions.size()) {
+			Advance(1);
+		}
+	}
+
+	void FakeQueue::Advance(uint32_t count) {
+		for (uint32_t i = 0; i < count && m_nextPending < m_submissions.size(); i++) {
+			m_completed = m_submissions[m_nextPending++];
+		}
+	}
+
+	void BenchmarkScheduling(uint32_t uploadCount, uint64_t maxSize, uint32_t gpuLag, const Settings& settings, SchedulingBenchmark& result) {
+		result = SchedulingBenchmark();
+		std::mt19937 rng(1234);
+		std::uniform_int_distribution<uint64_t> size(1, maxSize);
+		std::vector<uint64_t> sizes(uploadCount);
+		for (uint64_t& s : sizes) {
+			s = size(rng);
+		}
+		FakeQueue queue;
+		Scheduler scheduler(queue, settings);
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < uploadCount; i++) {
+			// Textures need 512 byte placement, buffers don't care
+			scheduler.Allocate(sizes[i], (i & 1) ? 512 : 4);
+			if (gpuLag > 0 && i % gpuLag == gpuLag - 1)
+				queue.Advance(1);
+		}
+		scheduler.Flush();
+		result.nsPerUpload = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count() / (std::max)(1u, uploadCount);
+		result.stats = scheduler.GetStats();
+		result.queueWaits = queue.GetWaitCount();
+	}
+}
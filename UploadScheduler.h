@@ -0,0 +1,94 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <vector>
+// Scheduling of asynchronous uploads. Copies are batched into large submissions on a copy queue and
+// their staging memory comes from a ring, a region is reused once the GPU finished its batch. The
+// queue is an interface so the batching can run against FakeQueue. No D3D dependencies
+namespace upload {
+	struct Settings {
+		uint64_t ringSize = 64ull << 20; // Staging memory, larger uploads get a staging buffer of their own
+		uint64_t batchSize = 16ull << 20; // The open batch is submitted before it grows beyond this
+	};
+	struct Stats {
+		uint64_t uploads = 0;
+		uint64_t bytes = 0;
+		uint64_t submissions = 0;
+		uint64_t ringWaits = 0; // Times the CPU waited for the GPU to free ring space
+	};
+	// Copy queue as seen by the scheduler
+	class Queue {
+	public:
+		virtual ~Queue() {}
+		// Executes the copies recorded since the last submission, fenceValue is reached once they are done
+		virtual void Submit(uint64_t fenceValue) = 0;
+		virtual uint64_t GetCompletedValue() = 0;
+		// Blocks until fenceValue is reached
+		virtual void Wait(uint64_t fenceValue) = 0;
+	};
+	static const uint64_t kDedicatedStaging = ~0ull;
+	struct Allocation {
+		uint64_t offset = 0; // In the ring, kDedicatedStaging for uploads larger than the ring
+		uint64_t fenceValue = 0; // Reached once the copy is done
+	};
+
+	class Scheduler {
+	public:
+		Scheduler(Queue& queue, const Settings& settings = Settings());
+		// Staging memory for a copy of size bytes, to be recorded right after. Submits the open batch
+		// when the copy doesn't fit in it and waits for the oldest batches while the ring is full.
+		// alignment must divide the ring size
+		Allocation Allocate(uint64_t size, uint64_t alignment);
+		// Submits the open batch, returns the fence value after which all uploads so far are done
+		uint64_t Flush();
+		uint64_t GetSubmittedValue() const { return m_submitted; }
+		const Stats& GetStats() const { return m_stats; }
+		const Settings& GetSettings() const { return m_settings; }
+	private:
+		void Submit();
+		// Frees the ring space of the completed batches
+		void Retire();
+
+		struct Batch {
+			uint64_t fenceValue;
+			uint64_t ringEnd;
+		};
+		Queue& m_queue;
+		Settings m_settings;
+		std::deque<Batch> m_inFlight;
+		// Ring positions only grow, the offset in the ring is the position modulo its size
+		uint64_t m_head = 0;
+		uint64_t m_tail = 0;
+		uint64_t m_openRingStart = 0;
+		uint64_t m_openBytes = 0;
+		uint32_t m_openUploads = 0;
+		uint64_t m_submitted = 0;
+		Stats m_stats;
+	};
+
+	// Queue without a GPU, a submission completes once Advance or Wait reaches it
+	class FakeQueue : public Queue {
+	public:
+		void Submit(uint64_t fenceValue) override { m_submissions.push_back(fenceValue); }
+		uint64_t GetCompletedValue() override { return m_completed; }
+		void Wait(uint64_t fenceValue) override;
+		// Completes the count oldest pending submissions
+		void Advance(uint32_t count);
+		const std::vector<uint64_t>& GetSubmissions() const { return m_submissions; }
+		uint32_t GetWaitCount() const { return m_waits; }
+	private:
+		std::vector<uint64_t> m_submissions;
+		uint64_t m_nextPending = 0;
+		uint64_t m_completed = 0;
+		uint32_t m_waits = 0;
+	};
+
+	struct SchedulingBenchmark {
+		Stats stats;
+		uint32_t queueWaits = 0; // Wait calls on the fake queue
+		double nsPerUpload = 0.0; // CPU cost of the scheduling alone
+	};
+	// Schedules uploadCount uploads of random sizes up to maxSize against FakeQueue, which completes
+	// one submission every gpuLag uploads
+	void BenchmarkScheduling(uint32_t uploadCount, uint64_t maxSize, uint32_t gpuLag, const Settings& settings, SchedulingBenchmark& result);
+}
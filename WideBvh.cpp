@@ -0,0 +1,314 @@
+#include "WideBvh.h"
+#include <algorithm>
+// The 8 wide node test uses AVX intrinsics on every x64 build, it only runs if the CPU supports them.
+// The file itself is compiled for the baseline instruction set, so the rest runs on any x64 CPU
+#if defined(_M_X64) || defined(__x86_64__)
+#include <immintrin.h>
+#define WIDE_BVH_AVX 1
+#else
+#define WIDE_BVH_AVX 0
+#endif
+// MSVC accepts the intrinsics in any function, GCC and clang need the target on the functions using them
+#if WIDE_BVH_AVX && !defined(_MSC_VER)
+#define WIDE_BVH_AVX_TARGET __attribute__((target("avx")))
+#else
+#define WIDE_BVH_AVX_TARGET
+#endif
+#if defined(_M_X64) || defined(__SSE2__)
+#include <xmmintrin.h>
+#define WIDE_BVH_SIMD 1
+#else
+#define WIDE_BVH_SIMD 0
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace bvh {
+	static inline uint32_t CountTrailingZeros(uint32_t mask) {
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return index;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+	// Whether the CPU has AVX and the OS saves the upper halves of the registers
+	static bool DetectAvx() {
+#if WIDE_BVH_AVX && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		const int osxsave = 1 << 27;
+		const int avx = 1 << 28;
+		return (info[2] & (osxsave | avx)) == (osxsave | avx) && (_xgetbv(0) & 6) == 6;
+#elif WIDE_BVH_AVX
+		return __builtin_cpu_supports("avx") != 0;
+#else
+		return false;
+#endif
+	}
+	static bool HasAvx() {
+		static const bool hasAvx = DetectAvx();
+		return hasAvx;
+	}
+
+	template <int Width>
+	void CollapseToWide(const Bvh& bvh, WideBvh<Width>& wide) {
+		wide.nodes.clear();
+		wide.primitives = bvh.primitives;
+		if (bvh.nodes.empty())
+			return;
+		// Wide node i is made from binary node sources[i], a leaf root becomes a root with one lane
+		std::vector<uint32_t> sources = { 0 };
+		wide.nodes.reserve(bvh.nodes.size() / (Width - 1) + 1);
+		for (size_t i = 0; i < sources.size(); i++) {
+			const Node& source = bvh.nodes[sources[i]];
+			uint32_t lanes[Width];
+			int laneCount = 0;
+			if (source.IsLeaf()) {
+				lanes[laneCount++] = sources[i];
+			}
+			else {
+				lanes[laneCount++] = source.child;
+				lanes[laneCount++] = source.child + 1;
+			}
+			while (laneCount < Width) {
+				int largest = -1;
+				float largestArea = -1.f;
+				for (int lane = 0; lane < laneCount; lane++) {
+					const Node& node = bvh.nodes[lanes[lane]];
+					float area = node.Bounds().Area();
+					if (!node.IsLeaf() && area > largestArea) {
+						largest = lane;
+						largestArea = area;
+					}
+				}
+				if (largest < 0)
+					break;
+				uint32_t opened = bvh.nodes[lanes[largest]].child;
+				lanes[largest] = opened;
+				lanes[laneCount++] = opened + 1;
+			}
+			// Unused lanes get empty bounds at infinity, which no ray enters
+			WideNode<Width> node;
+			const float infinity = (std::numeric_limits<float>::infinity)();
+			for (int lane = 0; lane < Width; lane++) {
+				node.minX[lane] = node.minY[lane] = node.minZ[lane] = infinity;
+				node.maxX[lane] = node.maxY[lane] = node.maxZ[lane] = infinity;
+				node.child[lane] = 0;
+				node.count[lane] = kEmptyLane;
+			}
+			for (int lane = 0; lane < laneCount; lane++) {
+				const Node& child = bvh.nodes[lanes[lane]];
+				node.minX[lane] = child.boundsMin.x;
+				node.minY[lane] = child.boundsMin.y;
+				node.minZ[lane] = child.boundsMin.z;
+				node.maxX[lane] = child.boundsMax.x;
+				node.maxY[lane] = child.boundsMax.y;
+				node.maxZ[lane] = child.boundsMax.z;
+				if (child.IsLeaf()) {
+					node.child[lane] = child.child;
+					node.count[lane] = child.count;
+				}
+				else {
+					node.child[lane] = static_cast<uint32_t>(sources.size());
+					node.count[lane] = 0;
+					sources.push_back(lanes[lane]);
+				}
+			}
+			wide.nodes.push_back(node);
+		}
+	}
+
+	struct TraversalRay {
+		glm::vec3 origin;
+		glm::vec3 inverseDirection;
+		float tMin;
+	};
+
+	// Slab test of lanes [first, first + count), returns the mask of the lanes hit and their entry distances
+	template <int Width>
+	static inline uint32_t IntersectLanesScalar(const WideNode<Width>& node, int first, int count, const TraversalRay& ray, float tMax, float* distances) {
+		uint32_t mask = 0;
+		for (int lane = first; lane < first + count; lane++) {
+			float t0x = (node.minX[lane] - ray.origin.x) * ray.inverseDirection.x;
+			float t1x = (node.maxX[lane] - ray.origin.x) * ray.inverseDirection.x;
+			float t0y = (node.minY[lane] - ray.origin.y) * ray.inverseDirection.y;
+			float t1y = (node.maxY[lane] - ray.origin.y) * ray.inverseDirection.y;
+			float t0z = (node.minZ[lane] - ray.origin.z) * ray.inverseDirection.z;
+			float t1z = (node.maxZ[lane] - ray.origin.z) * ray.inverseDirection.z;
+			float tEntry = (std::max)((std::max)((std::min)(t0x, t1x), (std::min)(t0y, t1y)), (std::max)((std::min)(t0z, t1z), ray.tMin));
+			float tExit = (std::min)((std::min)((std::max)(t0x, t1x), (std::max)(t0y, t1y)), (std::min)((std::max)(t0z, t1z), tMax));
+			distances[lane] = tEntry;
+			if (tEntry <= tExit)
+				mask |= 1u << lane;
+		}
+		return mask;
+	}
+
+#if WIDE_BVH_SIMD
+	template <int Width>
+	static inline uint32_t IntersectLanes4(const WideNode<Width>& node, int first, const TraversalRay& ray, float tMax, float* distances) {
+		const __m128 ox = _mm_set1_ps(ray.origin.x), oy = _mm_set1_ps(ray.origin.y), oz = _mm_set1_ps(ray.origin.z);
+		const __m128 ix = _mm_set1_ps(ray.inverseDirection.x), iy = _mm_set1_ps(ray.inverseDirection.y), iz = _mm_set1_ps(ray.inverseDirection.z);
+		__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX + first), ox), ix);
+		__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX + first), ox), ix);
+		__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY + first), oy), iy);
+		__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY + first), oy), iy);
+		__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ + first), oz), iz);
+		__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ + first), oz), iz);
+		__m128 tEntry = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_set1_ps(ray.tMin)));
+		__m128 tExit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(tMax)));
+		_mm_storeu_ps(distances + first, tEntry);
+		return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(tEntry, tExit))) << first;
+	}
+#endif
+
+	static inline uint32_t IntersectChildren(const WideNode<4>& node, const TraversalRay& ray, float tMax, float* distances) {
+#if WIDE_BVH_SIMD
+		return IntersectLanes4(node, 0, ray, tMax, distances);
+#else
+		return IntersectLanesScalar(node, 0, 4, ray, tMax, distances);
+#endif
+	}
+	static inline uint32_t IntersectChildren(const WideNode<8>& node, const TraversalRay& ray, float tMax, float* distances) {
+#if WIDE_BVH_SIMD
+		return IntersectLanes4(node, 0, ray, tMax, distances) | IntersectLanes4(node, 4, ray, tMax, distances);
+#else
+		return IntersectLanesScalar(node, 0, 8, ray, tMax, distances);
+#endif
+	}
+#if WIDE_BVH_AVX
+	static inline WIDE_BVH_AVX_TARGET uint32_t IntersectChildrenAvx(const WideNode<8>& node, const TraversalRay& ray, float tMax, float* distances) {
+		const __m256 ox = _mm256_set1_ps(ray.origin.x), oy = _mm256_set1_ps(ray.origin.y), oz = _mm256_set1_ps(ray.origin.z);
+		const __m256 ix = _mm256_set1_ps(ray.inverseDirection.x), iy = _mm256_set1_ps(ray.inverseDirection.y), iz = _mm256_set1_ps(ray.inverseDirection.z);
+		__m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.minX), ox), ix);
+		__m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.maxX), ox), ix);
+		__m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.minY), oy), iy);
+		__m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.maxY), oy), iy);
+		__m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.minZ), oz), iz);
+		__m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.maxZ), oz), iz);
+		__m256 tEntry = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)), _mm256_max_ps(_mm256_min_ps(t0z, t1z), _mm256_set1_ps(ray.tMin)));
+		__m256 tExit = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)), _mm256_min_ps(_mm256_max_ps(t0z, t1z), _mm256_set1_ps(tMax)));
+		_mm256_storeu_ps(distances, tEntry);
+		uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(tEntry, tExit, _CMP_LE_OQ)));
+		// The rest of the traversal may be SSE code, which is slowed down by dirty upper halves
+		_mm256_zeroupper();
+		return mask;
+	}
+#endif
+	// Node test of a traversal, Avx picks the AVX test of 8 wide nodes
+	template <bool Avx>
+	struct NodeTest {
+		template <int Width>
+		static inline uint32_t IntersectChildren(const WideNode<Width>& node, const TraversalRay& ray, float tMax, float* distances) {
+			return bvh::IntersectChildren(node, ray, tMax, distances);
+		}
+	};
+#if WIDE_BVH_AVX
+	template <>
+	struct NodeTest<true> {
+		static inline WIDE_BVH_AVX_TARGET uint32_t IntersectChildren(const WideNode<8>& node, const TraversalRay& ray, float tMax, float* distances) {
+			return IntersectChildrenAvx(node, ray, tMax, distances);
+		}
+	};
+#endif
+
+	template <int Width, bool AnyHit, bool Avx>
+	static inline bool Traverse(const WideBvh<Width>& bvh, const Mesh& mesh, const Ray& ray, Hit& hit) {
+		hit = Hit();
+		hit.t = ray.tMax;
+		if (bvh.nodes.empty())
+			return false;
+		TraversalRay traversalRay = { ray.origin, InverseDirection(ray.direction), ray.tMin };
+		// Children and leaves are pushed with their entry distance, farthest first
+		struct Entry {
+			uint32_t child;
+			uint32_t count;
+			float t;
+		};
+		Entry stack[64 * Width];
+		uint32_t size = 0;
+		stack[size++] = { 0, 0, ray.tMin };
+		while (size > 0) {
+			Entry entry = stack[--size];
+			if (entry.t >= hit.t)
+				continue;
+			if (entry.count > 0) {
+				for (uint32_t i = entry.child; i < entry.child + entry.count; i++) {
+					uint32_t primitive = bvh.primitives[i];
+					const glm::uvec3& triangle = mesh.triangles[primitive];
+					if (IntersectTriangle(ray, mesh.positions[triangle.x], mesh.positions[triangle.y], mesh.positions[triangle.z], hit.t, hit.t, hit.u, hit.v)) {
+						hit.primitive = primitive;
+						if (AnyHit)
+							return true;
+					}
+				}
+				continue;
+			}
+			const WideNode<Width>& node = bvh.nodes[entry.child];
+			float distances[Width];
+			uint32_t mask = NodeTest<Avx>::IntersectChildren(node, traversalRay, hit.t, distances);
+			// Insertion sort of the lanes hit by descending distance
+			int order[Width];
+			int hitCount = 0;
+			while (mask != 0) {
+				int lane = static_cast<int>(CountTrailingZeros(mask));
+				mask &= mask - 1;
+				int k = hitCount++;
+				while (k > 0 && distances[order[k - 1]] < distances[lane]) {
+					order[k] = order[k - 1];
+					k--;
+				}
+				order[k] = lane;
+			}
+			for (int k = 0; k < hitCount; k++) {
+				int lane = order[k];
+				stack[size++] = { node.child[lane], node.count[lane], distances[lane] };
+			}
+		}
+		return hit.primitive != ~0u;
+	}
+#if WIDE_BVH_AVX
+	// The whole traversal gets the target, so GCC and clang can inline the node test into it
+	template <bool AnyHit>
+	static WIDE_BVH_AVX_TARGET bool TraverseAvx(const Bvh8& bvh, const Mesh& mesh, const Ray& ray, Hit& hit) {
+		return Traverse<8, AnyHit, true>(bvh, mesh, ray, hit);
+	}
+#endif
+	template <bool AnyHit>
+	static bool Query(const Bvh4& bvh, const Mesh& mesh, const Ray& ray, Hit& hit) {
+		return Traverse<4, AnyHit, false>(bvh, mesh, ray, hit);
+	}
+	template <bool AnyHit>
+	static bool Query(const Bvh8& bvh, const Mesh& mesh, const Ray& ray, Hit& hit) {
+#if WIDE_BVH_AVX
+		if (HasAvx())
+			return TraverseAvx<AnyHit>(bvh, mesh, ray, hit);
+#endif
+		return Traverse<8, AnyHit, false>(bvh, mesh, ray, hit);
+	}
+	template <int Width>
+	bool Intersect(const WideBvh<Width>& bvh, const Mesh& mesh, const Ray& ray, Hit& hit) {
+		return Query<false>(bvh, mesh, ray, hit);
+	}
+	template <int Width>
+	bool Occluded(const WideBvh<Width>& bvh, const Mesh& mesh, const Ray& ray) {
+		Hit hit;
+		return Query<true>(bvh, mesh, ray, hit);
+	}
+
+	const char* GetWideKernelName(int width) {
+		if (width == 8 && HasAvx())
+			return "AVX";
+		return WIDE_BVH_SIMD ? "SSE" : "scalar";
+	}
+
+	template void CollapseToWide<4>(const Bvh& bvh, Bvh4& wide);
+	template void CollapseToWide<8>(const Bvh& bvh, Bvh8& wide);
+	template bool Intersect<4>(const Bvh4& bvh, const Mesh& mesh, const Ray& ray, Hit& hit);
+	template bool Intersect<8>(const Bvh8& bvh, const Mesh& mesh, const Ray& ray, Hit& hit);
+	template bool Occluded<4>(const Bvh4& bvh, const Mesh& mesh, const Ray& ray);
+	template bool Occluded<8>(const Bvh8& bvh, const Mesh& mesh, const Ray& ray);
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "Bvh.h"
+// Wide BVH for CPU ray queries. A built binary BVH is collapsed into nodes of 4 or 8 children
+// with their bounds stored as structure of arrays, so one SIMD test covers all children of a node
+// (AVX for 8 wide nodes on CPUs which support it, SSE otherwise). The children hit are visited
+// front to back. No D3D dependencies
+namespace bvh {
+	static const uint32_t kEmptyLane = 0xFFFFFFFF;
+	template <int Width>
+	struct WideNode {
+		float minX[Width];
+		float minY[Width];
+		float minZ[Width];
+		float maxX[Width];
+		float maxY[Width];
+		float maxZ[Width];
+		uint32_t child[Width]; // Node index of inner children, first primitive of leaves
+		uint32_t count[Width]; // 0 for inner children, kEmptyLane for unused lanes
+	};
+	template <int Width>
+	struct WideBvh {
+		std::vector<WideNode<Width>> nodes; // Root first, leaves only exist as lanes of their parent
+		std::vector<uint32_t> primitives;
+	};
+	typedef WideBvh<4> Bvh4;
+	typedef WideBvh<8> Bvh8;
+	// Pulls up the children with the largest surface area until every node has Width children,
+	// the leaves and primitive order of the binary BVH are kept
+	template <int Width>
+	void CollapseToWide(const Bvh& bvh, WideBvh<Width>& wide);
+	template <int Width>
+	bool Intersect(const WideBvh<Width>& bvh, const Mesh& mesh, const Ray& ray, Hit& hit);
+	template <int Width>
+	bool Occluded(const WideBvh<Width>& bvh, const Mesh& mesh, const Ray& ray);
+	// Node test used for the width on this CPU, "AVX", "SSE" or "scalar"
+	const char* GetWideKernelName(int width);
+}
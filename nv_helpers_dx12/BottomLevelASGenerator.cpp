@@ -133,13 +133,32 @@ void BottomLevelASGenerator::ComputeASBufferSizes(
     UINT64 *resultSizeInBytes   // Required GPU memory to store the acceleration
                                 // structure
 ) {
-  // The generated AS can support iterative updates. This may change the final
-  // size of the AS as well as the temporary memory requirements, and hence has
-  // to be set before the actual build
-  m_flags =
+  ComputeASBufferSizes(
+      device,
       allowUpdate
           ? D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE
-          : D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
+          : D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE,
+      scratchSizeInBytes, resultSizeInBytes);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Compute the buffer sizes for an explicit set of build flags. Fast trace/fast
+// build preferences, compaction and memory minimization all change the
+// memory requirements, so they have to be known before the actual build
+void BottomLevelASGenerator::ComputeASBufferSizes(
+    ID3D12Device5 *device, // Device on which the build will be performed
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS
+        buildFlags,             // Flags used for the build
+    UINT64 *scratchSizeInBytes, // Required scratch memory on the GPU to build
+                                // the acceleration structure
+    UINT64 *resultSizeInBytes   // Required GPU memory to store the acceleration
+                                // structure
+) {
+  // PERFORM_UPDATE is decided per build in Generate, it is not a property of
+  // the acceleration structure itself
+  m_flags =
+      buildFlags &
+      ~D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
 
   // Describe the work being requested, in this case the construction of a
   // (possibly dynamic) bottom-level hierarchy, with the given vertex buffers
@@ -187,25 +206,28 @@ void BottomLevelASGenerator::Generate(
         *resultBuffer, // Result buffer storing the acceleration structure
     bool updateOnly,   // If true, simply refit the existing
                        // acceleration structure
-    ID3D12Resource *previousResult // Optional previous acceleration
-                                   // structure, used if an iterative update
-                                   // is requested
+    ID3D12Resource *previousResult, // Optional previous acceleration
+                                    // structure, used if an iterative update
+                                    // is requested
+    D3D12_GPU_VIRTUAL_ADDRESS
+        compactedSizeBuffer // Optional UAV address receiving the compacted
+                            // size of the AS
 ) {
+  const bool allowUpdate =
+      (m_flags &
+       D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE) != 0;
 
   D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS flags = m_flags;
   // The stored flags represent whether the AS has been built for updates or
   // not. If yes and an update is requested, the builder is told to only update
-  // the AS instead of fully rebuilding it
-  if (flags ==
-          D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE &&
-      updateOnly) {
-    flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+  // the AS instead of fully rebuilding it. An update has to use the same flags
+  // as the original build
+  if (allowUpdate && updateOnly) {
+    flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
   }
 
   // Sanity checks
-  if (m_flags !=
-          D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE &&
-      updateOnly) {
+  if (!allowUpdate && updateOnly) {
     throw std::logic_error(
         "Cannot update a bottom-level AS not originally built for updates");
   }
@@ -234,8 +256,21 @@ void BottomLevelASGenerator::Generate(
       previousResult ? previousResult->GetGPUVirtualAddress() : 0;
   buildDesc.Inputs.Flags = flags;
 
+  // The compacted size can only be emitted on a full build of an AS allowing
+  // compaction
+  D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_DESC postbuildDesc = {};
+  postbuildDesc.InfoType =
+      D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE;
+  postbuildDesc.DestBuffer = compactedSizeBuffer;
+  const bool emitCompactedSize =
+      compactedSizeBuffer != 0 && !updateOnly &&
+      (m_flags &
+       D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION) != 0;
+
   // Build the AS
-  commandList->BuildRaytracingAccelerationStructure(&buildDesc, 0, nullptr);
+  commandList->BuildRaytracingAccelerationStructure(
+      &buildDesc, emitCompactedSize ? 1 : 0,
+      emitCompactedSize ? &postbuildDesc : nullptr);
 
   // Wait for the builder to complete by setting a barrier on the resulting
   // buffer. This is particularly important as the construction of the top-level
@@ -140,6 +140,17 @@ public:
                                   /// acceleration structure
   );
 
+  /// Same as above, but with an explicit set of build flags (fast trace/fast build, compaction,
+  /// memory minimization, updates). ALLOW_UPDATE in the flags enables later refits
+  void ComputeASBufferSizes(
+      ID3D12Device5* device, /// Device on which the build will be performed
+      D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags, /// Flags used for the build
+      UINT64* scratchSizeInBytes, /// Required scratch memory on the GPU to
+                                  /// build the acceleration structure
+      UINT64* resultSizeInBytes   /// Required GPU memory to store the
+                                  /// acceleration structure
+  );
+
   /// Enqueue the construction of the acceleration structure on a command list, using
   /// application-provided buffers and possibly a pointer to the previous acceleration structure in
   /// case of iterative updates. Note that the update can be done in place: the result and
@@ -150,10 +161,16 @@ public:
                                      /// store temporary data
       ID3D12Resource* resultBuffer,  /// Result buffer storing the acceleration structure
       bool updateOnly = false,       /// If true, simply refit the existing acceleration structure
-      ID3D12Resource* previousResult = nullptr /// Optional previous acceleration structure, used
-                                               /// if an iterative update is requested
+      ID3D12Resource* previousResult = nullptr, /// Optional previous acceleration structure, used
+                                                /// if an iterative update is requested
+      D3D12_GPU_VIRTUAL_ADDRESS compactedSizeBuffer = 0 /// Optional UAV address receiving the
+                                                        /// compacted size of the AS. Requires
+                                                        /// ALLOW_COMPACTION, ignored on updates
   );
 
+  /// Flags the acceleration structure has been sized for
+  D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS GetBuildFlags() const { return m_flags; }
+
 private:
   /// Vertex buffer descriptors used to generate the AS
   std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> m_vertexBuffers = {};
@@ -166,6 +183,7 @@ private:
 
   /// Flags for the builder, specifying whether to allow iterative updates, or
   /// when to perform an update
-  D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS m_flags;
+  D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS m_flags =
+      D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
 };
 } // namespace nv_helpers_dx12
@@ -70,12 +70,35 @@ void TopLevelASGenerator::AddInstance(
                                         // positions
     UINT instanceID,                    // Instance ID, which can be used in the shaders to
                                         // identify this specific instance
-    UINT hitGroupIndex                  // Hit group index, corresponding the the index of the
+    UINT hitGroupIndex,                 // Hit group index, corresponding the the index of the
                                         // hit group in the Shader Binding Table that will be
                                         // invocated upon hitting the geometry
+    UINT instanceMask /*= 0xFF*/,       // Visibility mask, the instance is only tested by rays
+                                        // whose InstanceInclusionMask shares a bit with it
+    D3D12_RAYTRACING_INSTANCE_FLAGS flags /*= D3D12_RAYTRACING_INSTANCE_FLAG_NONE*/ // Culling,
+                                        // winding and opacity overrides
 )
 {
-  m_instances.emplace_back(Instance(bottomLevelAS, transform, instanceID, hitGroupIndex));
+  // Only the lower 8 bits of the mask and 24 bits of the ID are stored in the descriptor
+  if (instanceMask > 0xFF || instanceID > 0xFFFFFF)
+  {
+    throw std::logic_error("Instance mask or instance ID out of range");
+  }
+  m_instances.emplace_back(
+      Instance(bottomLevelAS, transform, instanceID, hitGroupIndex, instanceMask, flags));
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Replace the bottom-level AS of an instance. Instances only keep a pointer to
+// the bottom-level AS, which is read when the descriptors are written by Generate
+void TopLevelASGenerator::SetInstanceBottomLevelAS(UINT instanceIndex, ID3D12Resource* bottomLevelAS)
+{
+  if (instanceIndex >= m_instances.size())
+  {
+    throw std::logic_error("Instance index out of range");
+  }
+  m_instances[instanceIndex].bottomLevelAS = bottomLevelAS;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -96,11 +119,31 @@ void TopLevelASGenerator::ComputeASBufferSizes(
                                              // indices etc.
 )
 {
-  // The generated AS can support iterative updates. This may change the final
-  // size of the AS as well as the temporary memory requirements, and hence has
-  // to be set before the actual build
-  m_flags = allowUpdate ? D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE
-                        : D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
+  ComputeASBufferSizes(device,
+                       allowUpdate ? D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE
+                                   : D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE,
+                       scratchSizeInBytes, resultSizeInBytes, descriptorsSizeInBytes);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+// Compute the buffer sizes for an explicit set of build flags, which all change
+// the memory requirements and hence have to be known before the actual build
+void TopLevelASGenerator::ComputeASBufferSizes(
+    ID3D12Device5* device, // Device on which the build will be performed
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags, // Flags used for the build
+    UINT64* scratchSizeInBytes,              // Required scratch memory on the GPU to build
+                                             // the acceleration structure
+    UINT64* resultSizeInBytes,               // Required GPU memory to store the acceleration
+                                             // structure
+    UINT64* descriptorsSizeInBytes           // Required GPU memory to store instance
+                                             // descriptors, containing the matrices,
+                                             // indices etc.
+)
+{
+  // PERFORM_UPDATE is decided per build in Generate, it is not a property of
+  // the acceleration structure itself
+  m_flags = buildFlags & ~D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
 
   // Describe the work being requested, in this case the construction of a
   // (possibly dynamic) top-level hierarchy, with the given instance descriptors
@@ -184,18 +227,16 @@ void TopLevelASGenerator::Generate(
     instanceDescs[i].InstanceID = m_instances[i].instanceID;
     // Index of the hit group invoked upon intersection
     instanceDescs[i].InstanceContributionToHitGroupIndex = m_instances[i].hitGroupIndex;
-    // Instance flags, including backface culling, winding, etc - TODO: should
-    // be accessible from outside
-    instanceDescs[i].Flags = D3D12_RAYTRACING_INSTANCE_FLAG_NONE;
+    // Instance flags, including backface culling, winding, forced opacity
+    instanceDescs[i].Flags = m_instances[i].flags;
     // Instance transform matrix
     DirectX::XMMATRIX m = XMMatrixTranspose(
         m_instances[i].transform); // GLM is column major, the INSTANCE_DESC is row major
     memcpy(instanceDescs[i].Transform, &m, sizeof(instanceDescs[i].Transform));
     // Get access to the bottom level
     instanceDescs[i].AccelerationStructure = m_instances[i].bottomLevelAS->GetGPUVirtualAddress();
-    // Visibility mask, always visible here - TODO: should be accessible from
-    // outside
-    instanceDescs[i].InstanceMask = 0xFF;
+    // Visibility mask, allowing rays to skip whole categories of instances
+    instanceDescs[i].InstanceMask = m_instances[i].instanceMask;
   }
 
   descriptorsBuffer->Unmap(0, nullptr);
@@ -203,17 +244,21 @@ void TopLevelASGenerator::Generate(
   // If this in an update operation we need to provide the source buffer
   D3D12_GPU_VIRTUAL_ADDRESS pSourceAS = updateOnly ? previousResult->GetGPUVirtualAddress() : 0;
 
+  const bool allowUpdate =
+      (m_flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE) != 0;
+
   D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS flags = m_flags;
   // The stored flags represent whether the AS has been built for updates or
   // not. If yes and an update is requested, the builder is told to only update
-  // the AS instead of fully rebuilding it
-  if (flags == D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE && updateOnly)
+  // the AS instead of fully rebuilding it. An update has to use the same flags
+  // as the original build
+  if (allowUpdate && updateOnly)
   {
-    flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+    flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
   }
 
   // Sanity checks
-  if (m_flags != D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE && updateOnly)
+  if (!allowUpdate && updateOnly)
   {
     throw std::logic_error("Cannot update a top-level AS not originally built for updates");
   }
@@ -258,8 +303,9 @@ void TopLevelASGenerator::ClearInstances()
 //
 //
 TopLevelASGenerator::Instance::Instance(ID3D12Resource* blAS, const DirectX::XMMATRIX& tr, UINT iID,
-                                        UINT hgId)
-    : bottomLevelAS(blAS), transform(tr), instanceID(iID), hitGroupIndex(hgId)
+                                        UINT hgId, UINT mask, D3D12_RAYTRACING_INSTANCE_FLAGS fl)
+    : bottomLevelAS(blAS), transform(tr), instanceID(iID), hitGroupIndex(hgId), instanceMask(mask),
+      flags(fl)
 {
 }
 } // namespace nv_helpers_dx12
@@ -49,7 +49,8 @@ Example:
 
 TopLevelASGenerator topLevelAS;
 topLevelAS.AddInstance(instances1, matrix1, instanceId1, hitGroupIndex1);
-topLevelAS.AddInstance(instances2, matrix2, instanceId2, hitGroupIndex2);
+topLevelAS.AddInstance(instances2, matrix2, instanceId2, hitGroupIndex2, instanceMask2,
+D3D12_RAYTRACING_INSTANCE_FLAG_FORCE_OPAQUE);
 ...
 UINT64 scratchSize, resultSize, instanceDescsSize;
 topLevelAS.ComputeASBufferSizes(GetRTDevice(), true, &scratchSize, &resultSize,
@@ -93,9 +94,20 @@ public:
                                                   /// at several world-space positions
               UINT instanceID,   /// Instance ID, which can be used in the shaders to
                                  /// identify this specific instance
-              UINT hitGroupIndex /// Hit group index, corresponding the the index of the
-                                 /// hit group in the Shader Binding Table that will be
-                                 /// invocated upon hitting the geometry
+              UINT hitGroupIndex, /// Hit group index, corresponding the the index of the
+                                  /// hit group in the Shader Binding Table that will be
+                                  /// invocated upon hitting the geometry
+              UINT instanceMask = 0xFF, /// Visibility mask, the instance is only tested by rays
+                                        /// whose InstanceInclusionMask shares a bit with it
+              D3D12_RAYTRACING_INSTANCE_FLAGS flags =
+                  D3D12_RAYTRACING_INSTANCE_FLAG_NONE /// Culling, winding and opacity overrides
+  );
+
+  /// Replace the bottom-level AS of an instance, e.g. to switch its level of
+  /// detail. The change is picked up by the next call to Generate, including
+  /// updates
+  void SetInstanceBottomLevelAS(UINT instanceIndex, /// Index of the instance in the order of AddInstance
+                                ID3D12Resource* bottomLevelAS /// New bottom-level AS of the instance
   );
 
   /// Compute the size of the scratch space required to build the acceleration
@@ -114,6 +126,20 @@ public:
                                      /// indices etc.
   );
 
+  /// Same as above, but with an explicit set of build flags. ALLOW_UPDATE in the flags enables
+  /// later refits of the instance transforms
+  void ComputeASBufferSizes(
+      ID3D12Device5* device, /// Device on which the build will be performed
+      D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags, /// Flags used for the build
+      UINT64* scratchSizeInBytes,    /// Required scratch memory on the GPU to
+                                     /// build the acceleration structure
+      UINT64* resultSizeInBytes,     /// Required GPU memory to store the
+                                     /// acceleration structure
+      UINT64* descriptorsSizeInBytes /// Required GPU memory to store instance
+                                     /// descriptors, containing the matrices,
+                                     /// indices etc.
+  );
+
   /// Enqueue the construction of the acceleration structure on a command list,
   /// using application-provided buffers and possibly a pointer to the previous
   /// acceleration structure in case of iterative updates. Note that the update
@@ -135,7 +161,8 @@ private:
   /// Helper struct storing the instance data
   struct Instance
   {
-    Instance(ID3D12Resource* blAS, const DirectX::XMMATRIX& tr, UINT iID, UINT hgId);
+    Instance(ID3D12Resource* blAS, const DirectX::XMMATRIX& tr, UINT iID, UINT hgId, UINT mask,
+             D3D12_RAYTRACING_INSTANCE_FLAGS fl);
     /// Bottom-level AS
     ID3D12Resource* bottomLevelAS;
     /// Transform matrix
@@ -144,10 +171,15 @@ private:
     UINT instanceID;
     /// Hit group index used to fetch the shaders from the SBT
     UINT hitGroupIndex;
+    /// Visibility mask tested against the mask of each ray
+    UINT instanceMask;
+    /// Culling, winding and opacity overrides
+    D3D12_RAYTRACING_INSTANCE_FLAGS flags;
   };
 
   /// Construction flags, indicating whether the AS supports iterative updates
-  D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS m_flags;
+  D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS m_flags =
+      D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
   /// Instances contained in the top-level AS
   std::vector<Instance> m_instances;
 